@@ -0,0 +1,132 @@
+﻿#include "config.hpp"
+
+#include "appcontainer_list.hpp"
+#include "appcontainer_report.hpp"
+
+#include <cwchar>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace jb
+{
+
+void app_container_list::assign(INET_FIREWALL_APP_CONTAINER const * const ptr, DWORD const size)
+{
+    clear();
+
+    size_t capability_total = 0;
+    size_t binary_total = 0;
+    for (DWORD n = 0; n < size; ++n)
+    {
+        capability_total += ptr[n].capabilities.count;
+        binary_total += ptr[n].binaries.count;
+    }
+    if (capability_total >= std::numeric_limits<uint32_t>::max() || binary_total >= std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Too many app container capabilities or binaries");
+    valid_.reserve(size);
+    app_containers_.reserve(size);
+    users_.reserve(size);
+    fields_.reserve(size_t(size) * field_count);
+    first_capabilities_.reserve(size_t(size) + 1);
+    capabilities_.reserve(capability_total);
+    capability_attributes_.reserve(capability_total);
+    first_binaries_.reserve(size_t(size) + 1);
+    binaries_.reserve(binary_total);
+
+    // The keys point into the OS array, which outlives the call.
+    std::unordered_map<std::wstring_view, uint32_t> string_ids;
+    string_ids.emplace(std::wstring_view(), 0);
+    auto const intern_string = [&](LPCWSTR const value)
+        {
+            std::wstring_view const text = value ? std::wstring_view(value) : std::wstring_view();
+            auto const result = string_ids.emplace(text, static_cast<uint32_t>(string_offsets_.size() - 1));
+            if (result.second)
+            {
+                chars_.insert(chars_.end(), text.begin(), text.end());
+                if (chars_.size() >= std::numeric_limits<uint32_t>::max())
+                    throw std::runtime_error("Too many app container strings");
+                string_offsets_.push_back(static_cast<uint32_t>(chars_.size()));
+            }
+            return result.first->second;
+        };
+    std::unordered_map<sid, uint32_t> sid_ids;
+    sid_ids.emplace(sid(), 0);
+    auto const intern_sid = [&](sid const & value)
+        {
+            auto const result = sid_ids.emplace(value, static_cast<uint32_t>(sids_.size()));
+            if (result.second)
+                sids_.push_back(value);
+            return result.first->second;
+        };
+
+    for (DWORD n = 0; n < size; ++n)
+    {
+        auto const & item = ptr[n];
+        sid value;
+        auto const valid = parse_sid(item.appContainerSid, value);
+        valid_.push_back(valid);
+        app_containers_.push_back(value);
+        if (!valid)
+        {
+            users_.push_back(0);
+            fields_.insert(fields_.end(), field_count, 0);
+            first_capabilities_.push_back(first_capabilities_.back());
+            first_binaries_.push_back(first_binaries_.back());
+            continue;
+        }
+
+        sid user;
+        users_.push_back(item.userSid && parse_sid(item.userSid, user) ? intern_sid(user) : 0);
+        fields_.push_back(intern_string(item.appContainerName));
+        fields_.push_back(intern_string(item.displayName));
+        fields_.push_back(intern_string(item.description));
+        fields_.push_back(intern_string(item.packageFullName));
+        fields_.push_back(intern_string(item.workingDirectory));
+        for (DWORD k = 0; k < item.capabilities.count; ++k)
+        {
+            sid capability;
+            if (parse_sid(item.capabilities.capabilities[k].Sid, capability))
+            {
+                capabilities_.push_back(intern_sid(capability));
+                capability_attributes_.push_back(item.capabilities.capabilities[k].Attributes);
+            }
+        }
+        first_capabilities_.push_back(static_cast<uint32_t>(capabilities_.size()));
+        for (DWORD k = 0; k < item.binaries.count; ++k)
+            binaries_.push_back(intern_string(item.binaries.binaries[k]));
+        first_binaries_.push_back(static_cast<uint32_t>(binaries_.size()));
+    }
+    chars_.shrink_to_fit();
+    string_offsets_.shrink_to_fit();
+    sids_.shrink_to_fit();
+}
+
+void app_container_list::clear() noexcept
+{
+    valid_.clear();
+    app_containers_.clear();
+    users_.clear();
+    fields_.clear();
+    first_capabilities_.assign(1, 0);
+    capabilities_.clear();
+    capability_attributes_.clear();
+    first_binaries_.assign(1, 0);
+    binaries_.clear();
+    sids_.assign(1, sid());
+    chars_.clear();
+    string_offsets_.assign(2, 0);
+}
+
+size_t app_container_list::memory_size() const noexcept
+{
+    return
+        valid_.capacity() * sizeof(uint8_t) +
+        app_containers_.capacity() * sizeof(sid) +
+        (users_.capacity() + fields_.capacity() + first_capabilities_.capacity() + capabilities_.capacity() + capability_attributes_.capacity() +
+         first_binaries_.capacity() + binaries_.capacity() + string_offsets_.capacity()) * sizeof(uint32_t) +
+        sids_.capacity() * sizeof(sid) +
+        chars_.capacity() * sizeof(wchar_t);
+}
+
+}
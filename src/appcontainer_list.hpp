@@ -0,0 +1,84 @@
+﻿#pragma once
+
+#include "sid.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <networkisolation.h>
+
+namespace jb {
+
+// The fields of a NetworkIsolationEnumAppContainers result the reports and snapshots use, copied
+// into one array per field so the OS array can be freed right after the call. Strings and the user
+// and capability SIDs are interned, the app container SIDs are kept inline in their order. Arrays
+// other than the string characters are sized by a counting pass, so none of them carries slack.
+class app_container_list final
+{
+public:
+    // Replaces the content with a copy of the entries.
+    void assign(INET_FIREWALL_APP_CONTAINER const * ptr, DWORD size);
+    void clear() noexcept;
+
+    size_t size() const noexcept { return app_containers_.size(); }
+
+    // False when the entry's SID couldn't be parsed, its other fields are all empty then.
+    bool valid(size_t n) const noexcept { return valid_[n] != 0; }
+    sid const & app_container(size_t n) const noexcept { return app_containers_[n]; }
+    // All of them, for sid_index and join_sids. An invalid entry has the empty sid.
+    sid const * app_containers() const noexcept { return app_containers_.data(); }
+    // An empty sid when there is none.
+    sid const & user(size_t n) const noexcept { return sids_[users_[n]]; }
+    std::wstring_view name(size_t n) const noexcept { return string(fields_[n * field_count + name_field]); }
+    std::wstring_view display_name(size_t n) const noexcept { return string(fields_[n * field_count + display_name_field]); }
+    std::wstring_view description(size_t n) const noexcept { return string(fields_[n * field_count + description_field]); }
+    std::wstring_view package_full_name(size_t n) const noexcept { return string(fields_[n * field_count + package_full_name_field]); }
+    std::wstring_view working_directory(size_t n) const noexcept { return string(fields_[n * field_count + working_directory_field]); }
+
+    size_t capability_count(size_t n) const noexcept { return first_capabilities_[n + 1] - first_capabilities_[n]; }
+    sid const & capability(size_t n, size_t k) const noexcept { return sids_[capabilities_[first_capabilities_[n] + k]]; }
+    uint32_t capability_attributes(size_t n, size_t k) const noexcept { return capability_attributes_[first_capabilities_[n] + k]; }
+
+    size_t binary_count(size_t n) const noexcept { return first_binaries_[n + 1] - first_binaries_[n]; }
+    std::wstring_view binary(size_t n, size_t k) const noexcept { return string(binaries_[first_binaries_[n] + k]); }
+
+    size_t string_count() const noexcept { return string_offsets_.size() - 1; }
+    size_t sid_count() const noexcept { return sids_.size(); }
+    // Bytes held by the arrays.
+    size_t memory_size() const noexcept;
+
+private:
+    enum field : size_t
+    {
+        name_field,
+        display_name_field,
+        description_field,
+        package_full_name_field,
+        working_directory_field,
+        field_count,
+    };
+
+    std::wstring_view string(uint32_t id) const noexcept
+    {
+        return std::wstring_view(chars_.data() + string_offsets_[id], string_offsets_[id + 1] - string_offsets_[id]);
+    }
+
+    std::vector<uint8_t> valid_;
+    std::vector<sid> app_containers_;
+    std::vector<uint32_t> users_;
+    std::vector<uint32_t> fields_;
+    std::vector<uint32_t> first_capabilities_ = { 0 };
+    std::vector<uint32_t> capabilities_;
+    std::vector<uint32_t> capability_attributes_;
+    std::vector<uint32_t> first_binaries_ = { 0 };
+    std::vector<uint32_t> binaries_;
+
+    // Id 0 is the empty sid and the empty string.
+    std::vector<sid> sids_ = { sid() };
+    std::vector<wchar_t> chars_;
+    std::vector<uint32_t> string_offsets_ = { 0, 0 };
+};
+
+}
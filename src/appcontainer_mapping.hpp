@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include "registry_schema.hpp"
+
+namespace jb {
+
+// Values of an AppContainer Mappings subkey; the subkey itself is named by the AppContainer SID.
+struct appcontainer_mapping
+{
+    static constexpr wchar_t const path[] = L"SOFTWARE\\Classes\\Local Settings\\Software\\Microsoft\\Windows\\CurrentVersion\\AppContainer\\Mappings";
+
+    #define FIELD(N, V, T) reg_schema_value_t<reg_type::T> N;
+    #include "appcontainer_mapping.inc"
+
+    static constexpr std::wstring_view value_names[] =
+    {
+        #define FIELD(N, V, T) L###V,
+        #include "appcontainer_mapping.inc"
+    };
+
+    static constexpr size_t data_size_hint = 0
+        #define FIELD(N, V, T) + reg_schema_type<reg_type::T>::size_hint
+        #include "appcontainer_mapping.inc"
+        ;
+
+    template<typename Fn>
+    static void visit(appcontainer_mapping & value, Fn && fn)
+    {
+        #define FIELD(N, V, T) fn(std::integral_constant<reg_type, reg_type::T>(), value.N);
+        #include "appcontainer_mapping.inc"
+    }
+};
+
+}
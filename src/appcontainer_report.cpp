@@ -0,0 +1,48 @@
+﻿#include "config.hpp"
+
+#include "appcontainer_report.hpp"
+#include "status.hpp"
+
+#include <unordered_set>
+
+namespace jb {
+
+bool parse_sid(PSID const ptr, sid & value)
+{
+    return sid::parse(ptr, GetLengthSid(ptr), value);
+}
+
+void write_app_containers(std::wostream & out, app_container_list const & list)
+{
+    auto const size = list.size();
+    std::unordered_set<sid> exist_sids;
+    exist_sids.reserve(size);
+    out << dec(size) << L":\n";
+    for (size_t n = 0; n < size; ++n)
+    {
+        out << L"  #" << dec(n) << L": ";
+        if (is_succeeded(out, status::win32(list.valid(n) ? ERROR_SUCCESS : ERROR_INVALID_SID)))
+        {
+            auto const & value = list.app_container(n);
+            auto const exist_sid = exist_sids.insert(value).second;
+            out << (exist_sid ? L"first" : L"duplicate") << L": ";
+            out << value << L": " << list.name(n);
+            output_record(out, L"app_container").number(L"index", n).text(L"sid", value).text(L"name", list.name(n)).flag(L"duplicate", !exist_sid);
+            for (size_t k = 0, count = list.binary_count(n); k < count; ++k)
+            {
+                out << L"    " << list.binary(n, k);
+                output_record(out, L"app_container_binary").text(L"sid", value).text(L"path", list.binary(n, k));
+            }
+        }
+    }
+    out << L"  @" << dec(exist_sids.size()) << L'\n';
+}
+
+void write_app_containers(std::wostream & out, INET_FIREWALL_APP_CONTAINER const * const ptr, DWORD const size)
+{
+    app_container_list list;
+    list.assign(ptr, size);
+    write_app_containers(out, list);
+}
+
+}
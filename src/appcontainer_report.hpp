@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "appcontainer_list.hpp"
+#include "format.hpp"
+#include "output.hpp"
+#include "registry.hpp"
+#include "sid.hpp"
+
+#include <ostream>
+
+#include <networkisolation.h>
+
+namespace jb {
+
+bool parse_sid(PSID ptr, sid & value);
+
+// Prints the result of NetworkIsolationEnumAppContainers, marking repeated SIDs as duplicates. The
+// binaries, present with NETISO_FLAG_FORCE_COMPUTE_BINARIES, are listed under their container.
+// Containers and binaries are app_container and app_container_binary records.
+void write_app_containers(std::wostream & out, app_container_list const & list);
+// Through an app_container_list copy.
+void write_app_containers(std::wostream & out, INET_FIREWALL_APP_CONTAINER const * ptr, DWORD size);
+
+template<typename Backend>
+void check_MappingRegistry(std::wostream & out, basic_reg_key<Backend> const & mapping_key)
+{
+    auto const values = mapping_key.get_subkey_values_SZ(L"Moniker");
+    auto const size = values.size();
+
+    out << mapping_key.path() << L": " << dec(size) << L": \n";
+    for (size_t n = 0; n < size; ++n)
+    {
+        out << L"  #" << dec(n) << L": " << values.name(n) << L": " << values.value(n);
+        output_record(out, L"mapping").number(L"index", n).text(L"sid", values.name(n)).text(L"moniker", values.value(n));
+    }
+}
+
+}
@@ -0,0 +1,738 @@
+﻿#include "config.hpp"
+
+#include "bench.hpp"
+#include "appcontainer_mapping.hpp"
+#include "bench_fixture.hpp"
+#include "change_source.hpp"
+#include "diagnose.hpp"
+#include "firewall_classifier.hpp"
+#include "firewall_profile.hpp"
+#include "firewall_rules.hpp"
+#include "fleet.hpp"
+#include "format.hpp"
+#include "instrument.hpp"
+#include "network_classifier.hpp"
+#include "on_exit.hpp"
+#include "process_survey.hpp"
+#include "sid_join.hpp"
+#include "snapshot.hpp"
+
+#ifdef _WIN32
+#include "appcontainer_list.hpp"
+#include "appcontainer_report.hpp"
+#include "binaries_cache.hpp"
+#include "daemon.hpp"
+#include "output.hpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace jb {
+
+namespace {
+
+uint64_t const seed = 0x4E6574467754657Full;
+double const duplicate_ratio = 0.1;
+
+struct bench_result final
+{
+    char const * name;
+    size_t size;
+    size_t iterations;
+    double items_per_sec;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    double allocations_per_iteration;
+    double bytes_per_iteration;
+};
+
+// Drops everything, so formatting is measured without the cost of a sink. Counts the lines, so the
+// reports can be checked.
+class null_streambuf final : public std::wstreambuf
+{
+public:
+    size_t lines() const noexcept { return lines_; }
+
+protected:
+    std::streamsize xsputn(wchar_t const * const data, std::streamsize const size) override
+    {
+        lines_ += static_cast<size_t>(std::count(data, data + size, L'\n'));
+        return size;
+    }
+
+    int_type overflow(int_type const ch) override
+    {
+        lines_ += ch == L'\n';
+        return traits_type::not_eof(ch);
+    }
+
+private:
+    size_t lines_ = 0;
+};
+
+struct bench_context final
+{
+    bool quick = false;
+    null_streambuf null_buffer;
+    std::wostream null_out{ &null_buffer };
+    std::vector<bench_result> results;
+
+    // Lines fn writes to null_out.
+    template<typename Fn>
+    size_t lines(Fn && fn)
+    {
+        auto const before = null_buffer.lines();
+        fn();
+        return null_buffer.lines() - before;
+    }
+};
+
+// One warm-up run, whose result must pass check, then at least min_iterations runs and until
+// min_time has passed. Returns the warm-up result. Allocations are summed over all threads, so
+// the worker threads of the parallel cases (sid_join, diagnose, fleet) are charged too.
+template<typename Fn, typename Check>
+auto measure(bench_context & context, char const * const name, size_t const size, size_t const items, Fn && fn, Check && check)
+{
+    size_t const min_iterations = 5;
+    size_t const max_iterations = 10000;
+    auto const min_time = std::chrono::milliseconds(500);
+
+    auto const result = fn();
+    if (!check(result))
+        throw std::runtime_error(std::string("Benchmark case ") + name + " computed a wrong result");
+
+    std::vector<uint64_t> samples;
+    auto const allocations_before = process_allocations();
+    auto const start = std::chrono::steady_clock::now();
+    auto now = start;
+    while (samples.size() < min_iterations || (now - start < min_time && samples.size() < max_iterations))
+    {
+        auto const iteration_start = now;
+        fn();
+        now = std::chrono::steady_clock::now();
+        samples.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - iteration_start).count()));
+    }
+    auto const allocations_after = process_allocations();
+
+    auto const iterations = samples.size();
+    auto const total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    std::sort(samples.begin(), samples.end());
+    context.results.push_back(
+    {
+        name,
+        size,
+        iterations,
+        total_ns ? double(items) * iterations * 1e9 / total_ns : 0.0,
+        samples[(iterations - 1) / 2],
+        samples[(iterations - 1) * 99 / 100],
+        double(allocations_after.count - allocations_before.count) / iterations,
+        double(allocations_after.bytes - allocations_before.bytes) / iterations,
+    });
+    return result;
+}
+
+template<typename T>
+auto equals(T const expected)
+{
+    return [expected](auto const & result) { return result == expected; };
+}
+
+auto is_positive()
+{
+    return [](auto const & result) { return result > 0; };
+}
+
+size_t distinct_count(std::vector<sid> const & sids)
+{
+    return std::unordered_set<sid>(sids.begin(), sids.end()).size();
+}
+
+void write_result(std::wostream & out, bench_result const & result, bool const first)
+{
+    char buffer[512];
+    auto const size = std::snprintf(buffer, sizeof buffer,
+        "%s{\"name\":\"%s\",\"size\":%zu,\"iterations\":%zu,\"items_per_sec\":%.1f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"allocations_per_iteration\":%.1f,\"bytes_per_iteration\":%.1f}",
+        first ? "" : ",\n",
+        result.name, result.size, result.iterations, result.items_per_sec,
+        static_cast<unsigned long long>(result.p50_ns), static_cast<unsigned long long>(result.p99_ns),
+        result.allocations_per_iteration, result.bytes_per_iteration);
+    for (auto ptr = buffer; ptr != buffer + size; ++ptr)
+        out.put(static_cast<wchar_t>(*ptr));
+}
+
+void bench_registry(bench_context & context)
+{
+    std::vector<size_t> counts = { 1000, 100000 };
+    if (!context.quick)
+        counts.push_back(1000000);
+    for (auto const count : counts)
+    {
+        auto const containers = make_app_containers(count, 0.0, seed);
+        auto const distinct = distinct_count(containers.sids);
+        reg_memory_hive hive;
+        add_mappings(hive, containers);
+        auto const mapping_key = hive.root().open_key(appcontainer_mapping::path);
+
+        measure(context, "registry_enum_keys", count, count, [&]
+            {
+                size_t names = 0;
+                for (auto const & name : mapping_key.keys())
+                    names += !name.empty();
+                return names;
+            }, equals(distinct));
+
+        if (count > 100000)
+            continue;
+
+        measure(context, "mapping_open_read", count, count, [&]
+            {
+                size_t found = 0;
+                for (auto const & name : mapping_key.keys())
+                    found += mapping_key.open_key(name).try_get_value_SZ(L"Moniker").has_value();
+                return found;
+            }, equals(distinct));
+
+#ifdef _WIN32
+        // A header line, then a line per Moniker.
+        measure(context, "mapping_registry_report", count, count, [&]
+            {
+                return context.lines([&] { check_MappingRegistry(context.null_out, mapping_key); });
+            }, equals(distinct + 1));
+#endif
+
+        measure(context, "missing_value_throw", count, count, [&]
+            {
+                size_t missing = 0;
+                for (size_t n = 0; n < count; ++n)
+                    try
+                    {
+                        mapping_key.get_value_SZ(L"Missing");
+                    }
+                    catch (std::exception const &)
+                    {
+                        ++missing;
+                    }
+                return missing;
+            }, equals(count));
+
+        measure(context, "missing_value_expected", count, count, [&]
+            {
+                size_t missing = 0;
+                for (size_t n = 0; n < count; ++n)
+                    missing += !mapping_key.try_get_value_SZ(L"Missing");
+                return missing;
+            }, equals(count));
+    }
+}
+
+void bench_sid_join(bench_context & context)
+{
+    std::vector<size_t> counts = { 1000, 100000 };
+    if (!context.quick)
+        counts.push_back(500000);
+    for (auto const count : counts)
+    {
+        // The app containers against a loopback exemption list: every other one of them in
+        // reverse order, plus a tenth as many SIDs without an app container.
+        auto const containers = make_app_containers(count, duplicate_ratio, seed);
+        auto const orphans = make_app_containers(count / 10, 0.0, ~seed);
+        std::vector<sid> exempt;
+        for (auto n = containers.sids.size(); n-- > 0; )
+            if (n % 2 == 0)
+                exempt.push_back(containers.sids[n]);
+        exempt.insert(exempt.end(), orphans.sids.begin(), orphans.sids.end());
+
+        // Every position of either side lands in exactly one of the join's lists.
+        measure(context, "sid_join", count, count + exempt.size(), [&]
+            {
+                return join_sids(containers.sids.data(), containers.sids.size(), exempt.data(), exempt.size());
+            }, [&](sid_join const & result)
+            {
+                return
+                    result.matched.size() + result.left_only.size() + result.left_duplicates == containers.sids.size() &&
+                    result.matched.size() + result.right_only.size() + result.right_duplicates == exempt.size() &&
+                    result.right_only.size() == distinct_count(orphans.sids);
+            });
+    }
+}
+
+// The app container dedupe from the binary SIDs as NetworkIsolationEnumAppContainers returns them.
+void bench_sid_dedupe(bench_context & context)
+{
+    std::vector<size_t> counts = { 1000, 100000 };
+    if (!context.quick)
+        counts.push_back(1000000);
+    for (auto const count : counts)
+    {
+        auto const containers = make_app_containers(count, duplicate_ratio, seed);
+        auto const distinct = distinct_count(containers.sids);
+
+        measure(context, "sid_dedupe_inline", count, count, [&]
+            {
+                std::unordered_set<sid> exist_sids;
+                exist_sids.reserve(count);
+                for (auto const & item : containers.sids)
+                {
+                    sid value;
+                    if (sid::parse(item.data(), sid::max_binary_size, value))
+                        exist_sids.insert(value);
+                }
+                return exist_sids.size();
+            }, equals(distinct));
+
+        // The dedupe as it was before the inline SID type: one string per SID.
+        measure(context, "sid_dedupe_string", count, count, [&]
+            {
+                std::unordered_set<std::wstring> exist_sids;
+                for (auto const & value : containers.sids)
+                    exist_sids.insert(value.to_string());
+                return exist_sids.size();
+            }, equals(distinct));
+    }
+}
+
+#ifdef _WIN32
+void bench_app_containers(bench_context & context)
+{
+    for (size_t const count : { 1000, 100000 })
+    {
+        auto const containers = make_app_containers(count, duplicate_ratio, seed);
+
+        // A count line, a line per entry and the distinct count.
+        measure(context, "app_container_report", count, count, [&]
+            {
+                return context.lines([&] { write_app_containers(context.null_out, containers.entries.data(), static_cast<DWORD>(count)); });
+            }, equals(count + 2));
+
+        measure(context, "app_container_ingest", count, count, [&]
+            {
+                app_container_list list;
+                list.assign(containers.entries.data(), static_cast<DWORD>(count));
+                return list.size();
+            }, equals(count));
+
+        app_container_list list;
+        list.assign(containers.entries.data(), static_cast<DWORD>(count));
+        measure(context, "app_container_list_report", count, count, [&]
+            {
+                return context.lines([&] { write_app_containers(context.null_out, list); });
+            }, equals(count + 2));
+    }
+}
+
+void bench_binaries_cache(bench_context & context)
+{
+    for (size_t const count : { 1000, 100000 })
+    {
+        auto const containers = make_app_containers(count, duplicate_ratio, seed);
+        auto const binaries = make_app_container_binaries(containers, seed);
+        auto const cache_path = std::filesystem::temp_directory_path() / L"NetFwTest.bench.binaries";
+        auto && remove_cache = make_on_exit_scope([&cache_path] { std::error_code error; std::filesystem::remove(cache_path, error); });
+        measure(context, "binaries_cache_write", binaries.size(), binaries.size(), [&]
+            {
+                binaries_cache::write(cache_path, binaries, 0);
+                binaries_cache cache;
+                cache.open(cache_path);
+                return cache.size();
+            }, equals(binaries.size()));
+
+        binaries_cache cache;
+        cache.open(cache_path);
+        measure(context, "binaries_cache_lookup", binaries.size(), binaries.size(), [&]
+            {
+                size_t found = 0;
+                for (auto const & entry : binaries)
+                    found += cache.find(entry.app_container, entry.last_write_time) != cache.size();
+                return found;
+            }, equals(binaries.size()));
+    }
+}
+
+#endif
+
+void bench_snapshot(bench_context & context)
+{
+    for (size_t const count : { 1000, 100000 })
+    {
+        auto const containers = make_app_containers(count, duplicate_ratio, seed);
+        auto const distinct = distinct_count(containers.sids);
+        auto const before = make_snapshot(containers, seed, 0);
+        auto const after = make_snapshot(containers, seed, 0.05);
+        auto const before_path = std::filesystem::temp_directory_path() / L"NetFwTest.bench.snapshot";
+        auto after_path = before_path;
+        after_path += L".after";
+        auto && remove_snapshots = make_on_exit_scope([&] { std::error_code error; std::filesystem::remove(before_path, error); std::filesystem::remove(after_path, error); });
+        measure(context, "snapshot_write", before.app_containers.size(), before.app_containers.size(), [&]
+            {
+                write_snapshot(before_path, before);
+                return std::filesystem::file_size(before_path);
+            }, is_positive());
+        write_snapshot(after_path, after);
+
+        measure(context, "snapshot_open", before.app_containers.size(), before.app_containers.size(), [&]
+            {
+                snapshot_view view;
+                view.open(before_path);
+                return view.app_container_count();
+            }, equals(distinct));
+
+        snapshot_view before_view, after_view;
+        before_view.open(before_path);
+        after_view.open(after_path);
+        if (diff_snapshots(before_view, before_view, context.null_out) != 0)
+            throw std::runtime_error("Benchmark case snapshot_diff found differences in a snapshot against itself");
+        measure(context, "snapshot_diff", before.app_containers.size(), before.app_containers.size(), [&]
+            {
+                return diff_snapshots(before_view, after_view, context.null_out);
+            }, is_positive());
+    }
+}
+
+// A package install as the watch sees it: a burst of Mappings changes, coalesced into one reread of
+// the affected parts.
+void bench_watch(bench_context & context)
+{
+    auto const containers = make_app_containers(1000, duplicate_ratio, seed);
+    auto const before = make_snapshot(containers, seed, 0);
+    auto const after = make_snapshot(containers, seed, 0.05);
+    size_t const events = 1000;
+    std::vector<fake_change_source::change> script(events, { std::chrono::milliseconds(0), 1 });
+    std::vector<uint32_t> const parts = { diagnostic_snapshot::has_mappings | diagnostic_snapshot::has_app_containers | diagnostic_snapshot::has_config };
+    auto model = before;
+    auto flip = false;
+    measure(context, "watch_burst", events, events, [&]
+        {
+            fake_change_source source(script);
+            return watch_snapshot(source, parts, model, [&](diagnostic_snapshot & snapshot, uint32_t)
+                {
+                    auto const & next = (flip = !flip) ? after : before;
+                    snapshot.app_containers = next.app_containers;
+                    snapshot.config = next.config;
+                    snapshot.mappings = next.mappings;
+                }, watch_options(), context.null_out);
+        }, equals(size_t(1)));
+}
+
+#ifdef _WIN32
+void bench_daemon(bench_context & context)
+{
+    for (size_t const count : { 1000, 100000 })
+    {
+        auto const containers = make_app_containers(count, duplicate_ratio, seed);
+        auto const snapshot = make_snapshot(containers, seed, 0);
+
+        daemon_model served_model;
+        measure(context, "daemon_publish", snapshot.app_containers.size(), snapshot.app_containers.size(), [&]
+            {
+                return served_model.publish(snapshot);
+            }, is_positive());
+
+        // What a daemon connection does per request, without the pipe.
+        std::vector<std::vector<uint8_t>> requests;
+        for (auto const & item : snapshot.app_containers)
+        {
+            auto const text = item.app_container.to_string();
+            std::vector<uint8_t> request(1, static_cast<uint8_t>(daemon_op::app_container));
+            request.insert(request.end(), reinterpret_cast<uint8_t const *>(text.data()), reinterpret_cast<uint8_t const *>(text.data() + text.size()));
+            requests.push_back(std::move(request));
+        }
+        measure(context, "daemon_query", requests.size(), requests.size(), [&]
+            {
+                size_t found = 0;
+                for (auto const & request : requests)
+                    found += served_model.handle(request.data(), request.size()).size() > sizeof(uint32_t);
+                return found;
+            }, equals(requests.size()));
+
+        // The same requests through a served pipe, over one connection kept open. A pipe of its own,
+        // so a running daemon doesn't get in the way.
+        auto const pipe_name = L"\\\\.\\pipe\\NetFwTest.bench." + std::to_wstring(GetCurrentProcessId());
+        daemon_server server(served_model, 1, pipe_name);
+        daemon_client client;
+        client.open(5000, pipe_name);
+        auto const pipe_requests = std::min<size_t>(requests.size(), 10000);
+        std::vector<uint8_t> result;
+        measure(context, "daemon_pipe_query", pipe_requests, pipe_requests, [&]
+            {
+                size_t found = 0;
+                for (size_t n = 0; n < pipe_requests; ++n)
+                {
+                    auto const & request = requests[n];
+                    found += !!client.request(static_cast<daemon_op>(request[0]), request.data() + 1, request.size() - 1, result);
+                }
+                return found;
+            }, equals(pipe_requests));
+    }
+}
+
+// A type line, four switches and two default actions a profile.
+void bench_firewall_profile(bench_context & context)
+{
+    size_t const rounds = 1000;
+    fake_firewall_policy policy;
+    measure(context, "firewall_profile", rounds, 3 * rounds, [&]
+        {
+            return context.lines([&]
+                {
+                    for (size_t n = 0; n < rounds; ++n)
+                    {
+                        check_profile(context.null_out, &policy, NET_FW_PROFILE2_PRIVATE);
+                        check_profile(context.null_out, &policy, NET_FW_PROFILE2_DOMAIN );
+                        check_profile(context.null_out, &policy, NET_FW_PROFILE2_PUBLIC );
+                    }
+                });
+        }, equals(3 * rounds * 7));
+}
+
+#endif
+
+void bench_firewall_rules(bench_context & context)
+{
+    size_t const count = 20000;
+    size_t const queries = 1000;
+    auto const containers = make_app_containers(1000, 0.0, seed);
+    auto const rules = make_firewall_rules(count, containers, seed);
+    firewall_rule_snapshot snapshot;
+    for (auto const & rule : rules)
+    {
+        firewall_rule record;
+        record.name = rule.name;
+        record.application = rule.application;
+        record.local_ports = rule.local_ports;
+        record.remote_addresses = rule.remote_addresses;
+        record.protocol = rule.protocol;
+        record.direction = rule.direction;
+        record.action = rule.action;
+        record.profiles = rule.profiles;
+        record.enabled = rule.enabled;
+        snapshot.add(record);
+    }
+    snapshot.freeze();
+
+    firewall_rule_query query;
+    query.local_port = 443;
+    query.protocol = NET_FW_IP_PROTOCOL_TCP;
+    query.direction = NET_FW_RULE_DIR_IN;
+    measure(context, "firewall_rule_query", count, queries, [&]
+        {
+            size_t matches = 0;
+            for (size_t n = 0; n < queries; ++n)
+            {
+                query.application = rules[n % count].application;
+                matches += snapshot.find(query).size();
+            }
+            return matches;
+        }, is_positive());
+
+    firewall_defaults defaults;
+    firewall_classifier const classifier(snapshot, defaults);
+    size_t const packet_count = 1 << 20;
+    auto const packets = make_packets(packet_count, classifier, containers, seed);
+    std::vector<firewall_decision> decisions(packet_count);
+    auto const blocked = [&]
+        {
+            return static_cast<size_t>(std::count_if(decisions.begin(), decisions.end(), [](firewall_decision const & decision) { return decision.action == NET_FW_ACTION_BLOCK; }));
+        };
+    auto const serial_blocked = measure(context, "firewall_classify", count, packet_count, [&]
+        {
+            classifier.classify(packets.data(), packet_count, decisions.data(), 1);
+            return blocked();
+        }, is_positive());
+    measure(context, "firewall_classify_parallel", count, packet_count, [&]
+        {
+            classifier.classify(packets.data(), packet_count, decisions.data());
+            return blocked();
+        }, equals(serial_blocked));
+}
+
+void bench_network(bench_context & context)
+{
+    size_t const count = 1 << 20;
+    auto const texts = make_addresses(count, seed);
+    std::vector<ip_address> addresses(count);
+    measure(context, "ip_parse", count, count, [&]
+        {
+            size_t parsed = 0;
+            for (size_t n = 0; n < count; ++n)
+                parsed += ip_address::parse(texts[n], addresses[n]);
+            return parsed;
+        }, equals(count));
+
+    network_classifier classifier;
+    classifier.add_private_subnets(L"203.0.113.0/24,2001:db8::/32");
+    size_t private_count = 0;
+    for (auto const & address : addresses)
+        private_count += classifier.classify(address) == network_category::private_network;
+    std::vector<network_category> categories(count);
+    measure(context, "network_classify", count, count, [&]
+        {
+            classifier.classify(addresses.data(), count, categories.data());
+            return static_cast<size_t>(std::count(categories.begin(), categories.end(), network_category::private_network));
+        }, equals(private_count));
+}
+
+void bench_diagnose(bench_context & context)
+{
+    size_t const count = 10000;
+    auto const text = make_host_list(count, duplicate_ratio, seed);
+    std::wistringstream in(text);
+    auto const list = read_hosts(in);
+    measure(context, "host_list_read", count, count, [&]
+        {
+            std::wistringstream in(text);
+            auto const result = read_hosts(in);
+            return result.hosts.size() + result.duplicates + result.invalid;
+        }, equals(count));
+
+    fake_diagnose_source source;
+    measure(context, "diagnose_cold", list.hosts.size(), list.hosts.size(), [&]
+        {
+            diagnose_cache cache(std::chrono::hours(1));
+            return diagnose_hosts(source, list.hosts, &cache).size();
+        }, equals(list.hosts.size()));
+
+    network_classifier const prescreen;
+    measure(context, "diagnose_prescreened", list.hosts.size(), list.hosts.size(), [&]
+        {
+            diagnose_cache cache(std::chrono::hours(1));
+            return diagnose_hosts(source, list.hosts, &cache, &prescreen).size();
+        }, equals(list.hosts.size()));
+
+    diagnose_cache cache(std::chrono::hours(1));
+    diagnose_hosts(source, list.hosts, &cache);
+    measure(context, "diagnose_cached", list.hosts.size(), list.hosts.size(), [&]
+        {
+            return diagnose_hosts(source, list.hosts, &cache).size();
+        }, equals(list.hosts.size()));
+}
+
+void bench_process_survey(bench_context & context)
+{
+    size_t const count = 2000;
+    auto const containers = make_app_containers(1000, 0.0, seed);
+    fake_process_source source(count, containers, seed);
+    std::vector<process_entry> processes;
+    source.processes(processes);
+    measure(context, "process_survey_serial", count, count, [&]
+        {
+            return survey_processes(source, processes, 1).size();
+        }, equals(count));
+    measure(context, "process_survey", count, count, [&]
+        {
+            return survey_processes(source, processes).size();
+        }, equals(count));
+}
+
+// The aggregator over a fleet of host files with most of their containers in common.
+void bench_fleet(bench_context & context)
+{
+    size_t const hosts = context.quick ? 100 : 1000;
+    auto const containers = make_app_containers(1000, 0.0, seed);
+    auto const directory = std::filesystem::temp_directory_path() / L"NetFwTest.bench.fleet";
+    auto && remove_fleet = make_on_exit_scope([&directory] { std::error_code error; std::filesystem::remove_all(directory, error); });
+    write_fleet(directory, hosts, containers, seed);
+
+    fleet loaded;
+    measure(context, "fleet_load", hosts, hosts, [&]
+        {
+            loaded.load(directory);
+            return loaded.host_count();
+        }, equals(hosts));
+
+    measure(context, "fleet_query", containers.names.size(), containers.names.size(), [&]
+        {
+            size_t found = 0;
+            for (auto const & name : containers.names)
+                found += loaded.query(context.null_out, L"container=" + name);
+            return found;
+        }, equals(containers.names.size()));
+}
+
+#ifdef _WIN32
+// The sinks write to NUL, so what is measured is the formatting and encoding.
+void bench_output(bench_context & context)
+{
+    size_t const count = 100000;
+    auto const containers = make_app_containers(1000, 0.0, seed);
+    auto const rules = make_firewall_rules(count, containers, seed);
+    auto const null_handle = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (null_handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Can't open the null device");
+    auto && close_null_handle = make_on_exit_scope([null_handle] { CloseHandle(null_handle); });
+
+    static char const * const formats[][2] = { { "text", "output_text" }, { "jsonl", "output_jsonl" }, { "binary", "output_binary" } };
+    for (auto const & format : formats)
+    {
+        auto const sink = make_output_sink(format[0], null_handle);
+        std::wostream sink_out(sink.get());
+        measure(context, format[1], count, count, [&]
+            {
+                for (auto const & rule : rules)
+                    sink_out << rule.name << L": " <<
+                        (rule.direction == NET_FW_RULE_DIR_IN ? L"in" : L"out") << L' ' <<
+                        (rule.action == NET_FW_ACTION_ALLOW ? L"allow" : L"block") << L' ' <<
+                        dec(static_cast<int>(rule.protocol)) << L' ' << rule.local_ports << L' ' << rule.remote_addresses << L' ' <<
+                        hex(rule.profiles) << L' ' << rule.application << L'\n';
+                sink->flush_output();
+                return sink_out.good();
+            }, equals(true));
+    }
+}
+
+#endif
+
+struct bench_case final
+{
+    char const * name;
+    void (* run)(bench_context & context);
+};
+
+bench_case const cases[] =
+{
+    { "registry"        , bench_registry         },
+    { "sid_join"        , bench_sid_join         },
+    { "sid_dedupe"      , bench_sid_dedupe       },
+#ifdef _WIN32
+    { "app_containers"  , bench_app_containers   },
+    { "binaries_cache"  , bench_binaries_cache   },
+#endif
+    { "snapshot"        , bench_snapshot         },
+    { "watch"           , bench_watch            },
+#ifdef _WIN32
+    { "daemon"          , bench_daemon           },
+    { "firewall_profile", bench_firewall_profile },
+#endif
+    { "firewall_rules"  , bench_firewall_rules   },
+    { "network"         , bench_network          },
+    { "diagnose"        , bench_diagnose         },
+    { "process_survey"  , bench_process_survey   },
+    { "fleet"           , bench_fleet            },
+#ifdef _WIN32
+    { "output"          , bench_output           },
+#endif
+};
+
+}
+
+void run_bench(std::wostream & out, bool const quick)
+{
+    bench_context context;
+    context.quick = quick;
+    for (auto const & item : cases)
+        item.run(context);
+
+    out << L"{\"schema\":1,\"cases\":[\n";
+    for (size_t n = 0; n < context.results.size(); ++n)
+        write_result(out, context.results[n], n == 0);
+    out << L"\n]}\n";
+}
+
+}
@@ -0,0 +1,13 @@
+﻿#pragma once
+
+#include <ostream>
+
+namespace jb {
+
+// Runs every benchmark case against generated fixtures and writes one JSON document to out:
+// {"schema":1,"cases":[{"name","size","iterations","items_per_sec","p50_ns","p99_ns",
+// "allocations_per_iteration","bytes_per_iteration"},...]}. Quick mode skips the largest sizes.
+// Outside Windows the cases over Windows structures, the pipe and the sinks are left out.
+void run_bench(std::wostream & out, bool quick);
+
+}
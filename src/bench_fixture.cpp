@@ -0,0 +1,568 @@
+﻿#include "config.hpp"
+
+#include "bench_fixture.hpp"
+#include "appcontainer_mapping.hpp"
+#include "ip_address.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <unordered_set>
+
+#ifndef _WIN32
+
+// The winerror.h and winnt.h values the fixtures use.
+#define ERROR_ACCESS_DENIED     5L
+#define ERROR_INVALID_PARAMETER 87L
+#define SE_GROUP_ENABLED        0x00000004L
+#define SE_GROUP_INTEGRITY      0x00000020L
+
+#endif
+
+namespace jb {
+
+namespace {
+
+wchar_t const * const vendors[] = { L"microsoft", L"contoso", L"fabrikam", L"adatum", L"litware", L"tailspin", L"wingtip", L"northwind" };
+wchar_t const * const products[] = { L"windowscalculator", L"photos", L"zunemusic", L"bingweather", L"windowsstore", L"xboxapp", L"messaging", L"people", L"todos", L"mailcalendar" };
+wchar_t const publisher_chars[] = L"0123456789abcdefghjkmnpqrstvwxyz";
+
+sid make_app_container_sid(std::mt19937_64 & random)
+{
+    uint8_t binary[sid::header_size + 8 * sizeof(uint32_t)] = { 1, 8, 0, 0, 0, 0, 0, 15 };
+    auto ptr = binary + sid::header_size;
+    for (size_t n = 0; n < 8; ++n)
+    {
+        auto const value = n ? static_cast<uint32_t>(random()) : 2u;
+        *ptr++ = static_cast<uint8_t>(value);
+        *ptr++ = static_cast<uint8_t>(value >> 8);
+        *ptr++ = static_cast<uint8_t>(value >> 16);
+        *ptr++ = static_cast<uint8_t>(value >> 24);
+    }
+    return sid::from_binary(binary, sizeof binary);
+}
+
+std::wstring make_package_name(std::mt19937_64 & random, size_t const index)
+{
+    std::wstring result = vendors[random() % std::size(vendors)];
+    result += L'.';
+    result += products[random() % std::size(products)];
+    result += std::to_wstring(index);
+    result += L'_';
+    for (size_t n = 0; n < 13; ++n)
+        result += publisher_chars[random() % (std::size(publisher_chars) - 1)];
+    return result;
+}
+
+// Last write time and executables of the next distinct SID, drawn the same way for
+// make_app_container_binaries and make_snapshot.
+std::vector<std::wstring> draw_binaries(std::mt19937_64 & random, std::wstring const & name, uint64_t & last_write_time)
+{
+    static wchar_t const * const executables[] = { L"app.exe", L"helper.exe", L"updater.exe", L"broker.exe" };
+
+    last_write_time = 0x01D0000000000000ull + random() % 0x0010000000000000ull;
+    std::vector<std::wstring> result;
+    for (size_t k = 0, count = 1 + random() % std::size(executables); k < count; ++k)
+        result.push_back(L"C:\\Program Files\\WindowsApps\\" + name + L"\\" + executables[k]);
+    return result;
+}
+
+#ifdef _WIN32
+HRESULT get_flag(long const flags, NET_FW_PROFILE_TYPE2 const profile, VARIANT_BOOL * const value)
+{
+    *value = flags & profile ? VARIANT_TRUE : VARIANT_FALSE;
+    return S_OK;
+}
+
+HRESULT get_action(long const flags, NET_FW_PROFILE_TYPE2 const profile, NET_FW_ACTION * const value)
+{
+    *value = flags & profile ? NET_FW_ACTION_ALLOW : NET_FW_ACTION_BLOCK;
+    return S_OK;
+}
+#endif
+
+}
+
+app_container_fixture make_app_containers(size_t const count, double const duplicate_ratio, uint64_t const seed)
+{
+    std::mt19937_64 random(seed);
+    std::bernoulli_distribution duplicate(duplicate_ratio);
+
+    app_container_fixture result;
+    result.sids.reserve(count);
+    result.names.reserve(count);
+    for (size_t n = 0; n < count; ++n)
+    {
+        if (n && duplicate(random))
+        {
+            auto const original = random() % n;
+            result.sids.push_back(result.sids[original]);
+            result.names.push_back(result.names[original]);
+        }
+        else
+        {
+            result.sids.push_back(make_app_container_sid(random));
+            result.names.push_back(make_package_name(random, n));
+        }
+    }
+
+#ifdef _WIN32
+    result.entries.resize(count);
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto & entry = result.entries[n];
+        entry = INET_FIREWALL_APP_CONTAINER();
+        entry.appContainerSid = const_cast<uint8_t *>(result.sids[n].data());
+        entry.appContainerName = result.names[n].data();
+        entry.displayName = result.names[n].data();
+    }
+#endif
+    return result;
+}
+
+void add_mappings(reg_memory_hive & hive, app_container_fixture const & containers)
+{
+    std::wstring const root = appcontainer_mapping::path;
+    for (size_t n = 0, count = containers.sids.size(); n < count; ++n)
+    {
+        auto const key = hive.add_key(root + L'\\' + containers.sids[n].to_string());
+        auto const & name = containers.names[n];
+        hive.add_value_SZ(key, L"DisplayName", name.substr(0, name.find(L'_')));
+        hive.add_value_SZ(key, L"Description", L"@{" + name + L"?ms-resource://Description}");
+        hive.add_value_SZ(key, L"Moniker", name);
+    }
+    hive.freeze();
+}
+
+#ifdef _WIN32
+std::vector<app_container_binaries> make_app_container_binaries(app_container_fixture const & containers, uint64_t const seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<app_container_binaries> result;
+    std::unordered_set<sid> seen;
+    for (size_t n = 0; n < containers.sids.size(); ++n)
+    {
+        if (!seen.insert(containers.sids[n]).second)
+            continue;
+        app_container_binaries entry;
+        entry.app_container = containers.sids[n];
+        entry.binaries = draw_binaries(random, containers.names[n], entry.last_write_time);
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+#endif
+
+diagnostic_snapshot make_snapshot(app_container_fixture const & containers, uint64_t const seed, double const change_ratio)
+{
+    std::mt19937_64 random(seed);
+    // Drawn separately, so the unchanged part doesn't depend on change_ratio.
+    std::mt19937_64 change_random(~seed);
+    std::bernoulli_distribution change(change_ratio);
+
+    diagnostic_snapshot result;
+    result.present = diagnostic_snapshot::has_elevation_flags | diagnostic_snapshot::has_token_elevation_type | diagnostic_snapshot::has_firewall |
+        diagnostic_snapshot::has_app_containers | diagnostic_snapshot::has_config | diagnostic_snapshot::has_mappings;
+    result.elevation_flags = 1;
+    result.token_elevation_type = TokenElevationTypeLimited;
+    for (auto & profile : result.firewall)
+        profile.enabled = true;
+
+    sid user;
+    sid::parse(std::wstring_view(L"S-1-5-21-1004336348-1177238915-682003330-1001"), user);
+    // The binaries make_app_container_binaries gives the same containers and seed.
+    std::mt19937_64 binaries_random(seed);
+    std::unordered_set<sid> seen;
+    for (size_t n = 0, b = 0; n < containers.sids.size(); ++n)
+    {
+        if (!seen.insert(containers.sids[n]).second)
+            continue;
+        ++b;
+        auto const & name = containers.names[n];
+        uint64_t last_write_time;
+        auto binaries = draw_binaries(binaries_random, name, last_write_time);
+        auto const capability_count = static_cast<uint32_t>(1 + random() % 4);
+        auto const changed = change(change_random);
+        auto const kind = change_random() % 3;
+        if (changed && kind == 0)
+            continue;
+
+        snapshot_app_container item;
+        item.app_container = containers.sids[n];
+        item.user = user;
+        item.name = name;
+        item.display_name = name.substr(0, name.find(L'_'));
+        if (changed && kind == 1)
+            item.display_name += L" (renamed)";
+        item.description = L"@{" + name + L"?ms-resource://Description}";
+        item.package_full_name = name;
+        item.working_directory = L"C:\\Program Files\\WindowsApps\\" + name;
+        for (uint32_t k = 0; k < capability_count + (changed && kind == 2); ++k)
+        {
+            snapshot_capability capability;
+            sid::parse(std::wstring_view(L"S-1-15-3-" + std::to_wstring(1 + k)), capability.value);
+            capability.attributes = SE_GROUP_ENABLED;
+            item.capabilities.push_back(capability);
+        }
+        item.binaries = std::move(binaries);
+
+        if (b % 2)
+            result.config.push_back({ item.app_container, SE_GROUP_ENABLED });
+        result.mappings.push_back({ item.app_container, item.display_name, item.description, name });
+        result.app_containers.push_back(std::move(item));
+    }
+    return result;
+}
+
+void write_fleet(std::filesystem::path const & directory, size_t const hosts, app_container_fixture const & containers, uint64_t const seed)
+{
+    std::filesystem::create_directories(directory);
+    for (size_t n = 0; n < hosts; ++n)
+    {
+        auto snapshot = make_snapshot(containers, seed + n, 0.2);
+        if (n % 97 == 96)
+            snapshot.elevation_flags = 0;
+        if (n % 13 == 12)
+            snapshot.firewall[1].inbound = NET_FW_ACTION_ALLOW;
+        write_snapshot(directory / (L"host" + std::to_wstring(n) + L".snapshot"), snapshot);
+    }
+}
+
+std::vector<firewall_rule_fixture> make_firewall_rules(size_t const count, app_container_fixture const & containers, uint64_t const seed)
+{
+    static wchar_t const * const ports[] = { L"*", L"80", L"443", L"80,443", L"5353", L"49152-65535", L"135", L"3389" };
+    static wchar_t const * const addresses[] = { L"*", L"LocalSubnet", L"10.0.0.0/255.0.0.0", L"192.168.0.0/255.255.0.0", L"fe80::/10", L"Internet" };
+
+    std::mt19937_64 random(seed);
+    std::vector<firewall_rule_fixture> result(count);
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto & rule = result[n];
+        auto const & package = containers.names.empty() ? std::wstring(L"app") : containers.names[random() % containers.names.size()];
+        rule.name = package.substr(0, package.find(L'_')) + L" rule " + std::to_wstring(n);
+        rule.application = L"C:\\Program Files\\WindowsApps\\" + package + L"\\app.exe";
+        rule.local_ports = ports[random() % std::size(ports)];
+        rule.remote_addresses = addresses[random() % std::size(addresses)];
+        rule.direction = random() % 3 ? NET_FW_RULE_DIR_OUT : NET_FW_RULE_DIR_IN;
+        rule.action = random() % 5 ? NET_FW_ACTION_ALLOW : NET_FW_ACTION_BLOCK;
+        rule.protocol = random() % 4 ? NET_FW_IP_PROTOCOL_TCP : random() % 2 ? NET_FW_IP_PROTOCOL_UDP : NET_FW_IP_PROTOCOL_ANY;
+        rule.profiles = static_cast<long>(random() % 7 + 1);
+        rule.enabled = random() % 10 != 0;
+    }
+    return result;
+}
+
+std::vector<firewall_packet> make_packets(size_t const count, firewall_classifier const & classifier, app_container_fixture const & containers, uint64_t const seed)
+{
+    static uint16_t const ports[] = { 80, 443, 5353, 135, 3389, 53, 8080, 50000 };
+    static NET_FW_PROFILE_TYPE2 const profiles[] = { NET_FW_PROFILE2_DOMAIN, NET_FW_PROFILE2_PRIVATE, NET_FW_PROFILE2_PUBLIC };
+
+    std::vector<uint32_t> applications;
+    for (auto const & package : containers.names)
+        applications.push_back(classifier.application_id(L"C:\\Program Files\\WindowsApps\\" + package + L"\\app.exe"));
+    applications.push_back(uint32_t(firewall_packet::no_application));
+
+    std::mt19937_64 random(seed);
+    std::vector<firewall_packet> result(count);
+    for (auto & packet : result)
+    {
+        packet.direction = random() % 2 ? NET_FW_RULE_DIR_OUT : NET_FW_RULE_DIR_IN;
+        packet.profile = profiles[random() % std::size(profiles)];
+        packet.protocol = static_cast<uint16_t>(random() % 4 ? NET_FW_IP_PROTOCOL_TCP : NET_FW_IP_PROTOCOL_UDP);
+        packet.local_address = ip_address::from_ipv4(0xC0A80000u | static_cast<uint32_t>(random() % 0x10000));
+        switch (random() % 4)
+        {
+        case 0:
+            packet.remote_address = ip_address::from_ipv4(0x0A000000u | static_cast<uint32_t>(random() % 0x1000000));
+            break;
+        case 1:
+            packet.remote_address = ip_address{ 0xFE80000000000000ull, random() };
+            break;
+        default:
+            packet.remote_address = ip_address::from_ipv4(static_cast<uint32_t>(random()));
+            break;
+        }
+        packet.local_port = random() % 2 ? ports[random() % std::size(ports)] : static_cast<uint16_t>(random());
+        packet.remote_port = static_cast<uint16_t>(49152 + random() % 16384);
+        packet.application = applications[random() % applications.size()];
+    }
+    return result;
+}
+
+#ifdef _WIN32
+HRESULT fake_firewall_policy::get_FirewallEnabled(NET_FW_PROFILE_TYPE2 const profile, VARIANT_BOOL * const value) const
+{
+    return get_flag(firewall_enabled, profile, value);
+}
+
+HRESULT fake_firewall_policy::get_BlockAllInboundTraffic(NET_FW_PROFILE_TYPE2 const profile, VARIANT_BOOL * const value) const
+{
+    return get_flag(block_all_inbound, profile, value);
+}
+
+HRESULT fake_firewall_policy::get_NotificationsDisabled(NET_FW_PROFILE_TYPE2 const profile, VARIANT_BOOL * const value) const
+{
+    return get_flag(notifications_disabled, profile, value);
+}
+
+HRESULT fake_firewall_policy::get_UnicastResponsesToMulticastBroadcastDisabled(NET_FW_PROFILE_TYPE2 const profile, VARIANT_BOOL * const value) const
+{
+    return get_flag(unicast_responses_disabled, profile, value);
+}
+
+HRESULT fake_firewall_policy::get_DefaultInboundAction(NET_FW_PROFILE_TYPE2 const profile, NET_FW_ACTION * const value) const
+{
+    return get_action(inbound_allow, profile, value);
+}
+
+HRESULT fake_firewall_policy::get_DefaultOutboundAction(NET_FW_PROFILE_TYPE2 const profile, NET_FW_ACTION * const value) const
+{
+    return get_action(outbound_allow, profile, value);
+}
+#endif
+
+std::vector<std::wstring> make_addresses(size_t const count, uint64_t const seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<std::wstring> result(count);
+    for (auto & text : result)
+    {
+        auto const bits = random();
+        switch (bits % 8)
+        {
+        case 0: text = ip_address::from_ipv4(0x0A000000u | static_cast<uint32_t>(bits >> 8 & 0xFFFFFF)).to_string(); break;
+        case 1: text = ip_address::from_ipv4(0xC0A80000u | static_cast<uint32_t>(bits >> 8 & 0xFFFF)).to_string(); break;
+        case 2: text = ip_address::from_ipv4(0x7F000001u).to_string(); break;
+        case 3: text = ip_address{ 0xFE80000000000000ull, random() }.to_string(); break;
+        case 4: text = ip_address{ 0xFD00000000000000ull | (bits >> 8), random() }.to_string(); break;
+        case 5: text = ip_address{ 0xFF02000000000000ull, bits >> 8 & 0xFFFF }.to_string(); break;
+        case 6: text = ip_address{ 0x2001000000000000ull | (bits >> 16), random() }.to_string(); break;
+        default: text = ip_address::from_ipv4(static_cast<uint32_t>(bits >> 32)).to_string(); break;
+        }
+    }
+    return result;
+}
+
+std::wstring make_host_list(size_t const count, double const duplicate_ratio, uint64_t const seed)
+{
+    static wchar_t const * const tlds[] = { L"com", L"net", L"org", L"io", L"corp.contoso.com" };
+
+    std::mt19937_64 random(seed);
+    std::vector<std::wstring> hosts;
+    std::wstring result;
+    for (size_t n = 0; n < count; ++n)
+    {
+        if (!hosts.empty() && random() % 1000 < duplicate_ratio * 1000)
+        {
+            auto host = hosts[random() % hosts.size()];
+            if (random() % 2)
+                for (auto & ch : host)
+                    if (ch >= L'a' && ch <= L'z')
+                        ch = static_cast<wchar_t>(ch - L'a' + L'A');
+            if (host.find(L':') != std::wstring::npos)
+                host = L"[" + host + L"]";
+            result += L"https://" + host + L":443/api\n";
+            continue;
+        }
+        std::wstring host;
+        switch (random() % 4)
+        {
+        case 0:
+            host = ip_address::from_ipv4(static_cast<uint32_t>(random())).to_string();
+            result += host + L":" + std::to_wstring(random() % 65536) + L'\n';
+            break;
+        case 1:
+            host = ip_address{ 0x20010DB800000000ull | (random() & 0xFFFFFFFF), random() }.to_string();
+            result += L"[" + host + L"]\n";
+            break;
+        default:
+            host = std::wstring(products[random() % std::size(products)]) + L'-' + std::to_wstring(n) + L'.' + vendors[random() % std::size(vendors)] + L'.' + tlds[random() % std::size(tlds)];
+            result += host + L'\n';
+            break;
+        }
+        hosts.push_back(std::move(host));
+    }
+    return result;
+}
+
+status fake_diagnose_source::diagnose(wchar_t const * const host, NETISO_ERROR_TYPE & type)
+{
+    ++calls_;
+    if (latency_.count())
+        std::this_thread::sleep_for(latency_);
+    std::wstring_view const name(host);
+    if (name.compare(0, 4, L"fail") == 0)
+        return status::win32(ERROR_INVALID_PARAMETER);
+    type = static_cast<NETISO_ERROR_TYPE>(NETISO_ERROR_TYPE_PRIVATE_NETWORK + std::hash<std::wstring_view>()(name) % 3);
+    return status();
+}
+
+fake_process_source::fake_process_source(size_t const count, app_container_fixture const & containers, uint64_t const seed)
+{
+    static wchar_t const * const images[] = { L"svchost.exe", L"explorer.exe", L"RuntimeBroker.exe", L"msedge.exe", L"conhost.exe", L"SearchHost.exe" };
+
+    std::mt19937_64 random(seed);
+    processes_.resize(count);
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto & process = processes_[n];
+        process.entry.pid = static_cast<uint32_t>(4 * (n + 1));
+        process.entry.parent_pid = n ? static_cast<uint32_t>(4 * (1 + random() % n)) : 0;
+        process.denied = random() % 10 == 0;
+        process.elevation_type = TokenElevationTypeLimited;
+        process.elevated = false;
+        auto rid = SECURITY_MANDATORY_MEDIUM_RID;
+        if (!containers.sids.empty() && random() % 3 == 0)
+        {
+            auto const index = random() % containers.sids.size();
+            process.app_container = containers.sids[index];
+            process.entry.image = containers.names[index].substr(0, containers.names[index].find(L'_')) + L".exe";
+            rid = SECURITY_MANDATORY_LOW_RID;
+            for (size_t k = 0, capabilities = 1 + random() % 4; k < capabilities; ++k)
+            {
+                sid capability;
+                sid::parse(std::wstring_view(L"S-1-15-3-" + std::to_wstring(1 + k)), capability);
+                process.capabilities.push_back(capability);
+            }
+        }
+        else
+        {
+            process.entry.image = images[random() % std::size(images)];
+            if (random() % 5 == 0)
+            {
+                process.elevation_type = TokenElevationTypeFull;
+                process.elevated = true;
+                rid = SECURITY_MANDATORY_HIGH_RID;
+            }
+        }
+        sid::parse(std::wstring_view(L"S-1-16-" + std::to_wstring(rid)), process.integrity);
+    }
+}
+
+status fake_process_source::processes(std::vector<process_entry> & result)
+{
+    result.clear();
+    for (auto const & process : processes_)
+        result.push_back(process.entry);
+    return status();
+}
+
+status fake_process_source::open_token(uint32_t const pid, HANDLE & token)
+{
+    auto const index = pid / 4 - 1;
+    if (pid % 4 || index >= processes_.size())
+        return status::win32(ERROR_INVALID_PARAMETER);
+    if (processes_[index].denied)
+        return status::win32(ERROR_ACCESS_DENIED);
+    token = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(index + 1));
+    return status();
+}
+
+status fake_process_source::token_information(HANDLE const token, TOKEN_INFORMATION_CLASS const type, std::vector<uint8_t> & buffer)
+{
+    auto const & process = processes_[reinterpret_cast<uintptr_t>(token) - 1];
+    // A header of header_size, then the SIDs it points to.
+    auto const layout = [&buffer](size_t const header_size, sid const * const * const sids, size_t const count)
+        {
+            auto size = header_size;
+            for (size_t n = 0; n < count; ++n)
+                size += sids[n]->binary_size();
+            buffer.assign(size, 0);
+            std::vector<PSID> result;
+            size = header_size;
+            for (size_t n = 0; n < count; ++n)
+            {
+                std::memcpy(buffer.data() + size, sids[n]->data(), sids[n]->binary_size());
+                result.push_back(buffer.data() + size);
+                size += sids[n]->binary_size();
+            }
+            return result;
+        };
+    auto const put = [&buffer](auto const & value)
+        {
+            buffer.resize(sizeof value);
+            std::memcpy(buffer.data(), &value, sizeof value);
+        };
+
+    switch (type)
+    {
+    case TokenElevationType:
+        put(process.elevation_type);
+        break;
+
+    case TokenElevation:
+        put(TOKEN_ELEVATION{ process.elevated });
+        break;
+
+    case TokenIntegrityLevel:
+    {
+        sid const * const sids[] = { &process.integrity };
+        auto const pointers = layout(sizeof(TOKEN_MANDATORY_LABEL), sids, 1);
+        auto & label = *reinterpret_cast<TOKEN_MANDATORY_LABEL *>(buffer.data());
+        label.Label.Sid = pointers[0];
+        label.Label.Attributes = SE_GROUP_INTEGRITY;
+        break;
+    }
+
+    case TokenIsAppContainer:
+        put(static_cast<DWORD>(process.app_container != sid()));
+        break;
+
+    case TokenAppContainerSid:
+    {
+        sid const * const sids[] = { &process.app_container };
+        auto const in_container = process.app_container != sid();
+        auto const pointers = layout(sizeof(TOKEN_APPCONTAINER_INFORMATION), sids, in_container);
+        reinterpret_cast<TOKEN_APPCONTAINER_INFORMATION *>(buffer.data())->TokenAppContainer = in_container ? pointers[0] : nullptr;
+        break;
+    }
+
+    case TokenCapabilities:
+    {
+        std::vector<sid const *> sids;
+        for (auto const & capability : process.capabilities)
+            sids.push_back(&capability);
+        auto const header_size = std::max(sizeof(TOKEN_GROUPS), offsetof(TOKEN_GROUPS, Groups) + sids.size() * sizeof(SID_AND_ATTRIBUTES));
+        auto const pointers = layout(header_size, sids.data(), sids.size());
+        auto & groups = *reinterpret_cast<TOKEN_GROUPS *>(buffer.data());
+        groups.GroupCount = static_cast<DWORD>(sids.size());
+        for (size_t n = 0; n < sids.size(); ++n)
+        {
+            groups.Groups[n].Sid = pointers[n];
+            groups.Groups[n].Attributes = SE_GROUP_ENABLED;
+        }
+        break;
+    }
+
+    default:
+        return status::win32(ERROR_INVALID_PARAMETER);
+    }
+    return status();
+}
+
+void fake_process_source::close_token(HANDLE) noexcept
+{
+}
+
+bool fake_change_source::wait_once(std::chrono::milliseconds const timeout, uint32_t & changes)
+{
+    ++waits_;
+    if (next_ == script_.size())
+        return false;
+    auto & change = script_[next_];
+    if (change.delay > timeout)
+    {
+        std::this_thread::sleep_for(timeout);
+        change.delay -= timeout;
+        return false;
+    }
+    if (change.delay.count())
+        std::this_thread::sleep_for(change.delay);
+    ++next_;
+    changes = change.bits;
+    return true;
+}
+
+}
@@ -0,0 +1,181 @@
+﻿#pragma once
+
+#include "change_source.hpp"
+#include "diagnose.hpp"
+#include "firewall_classifier.hpp"
+#include "process_survey.hpp"
+#include "registry_memory.hpp"
+#include "sid.hpp"
+#include "snapshot.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include "binaries_cache.hpp"
+
+#include <netfw.h>
+#include <networkisolation.h>
+#endif
+
+namespace jb {
+
+// Deterministic stand-ins for the OS data sources, sized for benchmarks. The same seed always
+// produces the same data. The ones for Windows structures exist only there, the rest are built
+// for the Linux benchmark too.
+
+// What NetworkIsolationEnumAppContainers returns: package-style names and S-1-15-2 SIDs, with the
+// given share of entries repeating an earlier SID. The entries point into the fixture's own storage.
+struct app_container_fixture final
+{
+    std::vector<sid> sids;
+    std::vector<std::wstring> names;
+#ifdef _WIN32
+    std::vector<INET_FIREWALL_APP_CONTAINER> entries;
+#endif
+};
+
+app_container_fixture make_app_containers(size_t count, double duplicate_ratio, uint64_t seed);
+
+// One Mappings subkey per distinct SID with DisplayName, Description and Moniker values. The hive is
+// frozen on return.
+void add_mappings(reg_memory_hive & hive, app_container_fixture const & containers);
+
+#ifdef _WIN32
+// What NETISO_FLAG_FORCE_COMPUTE_BINARIES adds: one to four executables per distinct SID, with
+// random Mappings last write times.
+std::vector<app_container_binaries> make_app_container_binaries(app_container_fixture const & containers, uint64_t seed);
+#endif
+
+// Everything a snapshot holds, built from the containers: capabilities, binaries, a config entry
+// for every other container and a mapping each. With the same containers and seed, about
+// change_ratio of the containers differ from the change_ratio 0 snapshot: renamed, gone or with
+// another capability.
+diagnostic_snapshot make_snapshot(app_container_fixture const & containers, uint64_t seed, double change_ratio);
+
+// A directory of host<n>.snapshot files as the fleet aggregator reads them, each a make_snapshot of
+// the containers with its own seed and a fifth of them changed. One host in 97 has UAC off and one in
+// 13 allows inbound traffic on the private profile.
+void write_fleet(std::filesystem::path const & directory, size_t hosts, app_container_fixture const & containers, uint64_t seed);
+
+struct firewall_rule_fixture final
+{
+    std::wstring name;
+    std::wstring application;
+    std::wstring local_ports;
+    std::wstring remote_addresses;
+    NET_FW_RULE_DIRECTION direction;
+    NET_FW_ACTION action;
+    NET_FW_IP_PROTOCOL protocol;
+    long profiles;
+    bool enabled;
+};
+
+std::vector<firewall_rule_fixture> make_firewall_rules(size_t count, app_container_fixture const & containers, uint64_t seed);
+
+// Traffic over the same address and port pools as make_firewall_rules, with the application of a
+// random container where the classifier knows it.
+std::vector<firewall_packet> make_packets(size_t count, firewall_classifier const & classifier, app_container_fixture const & containers, uint64_t seed);
+
+#ifdef _WIN32
+// Has the profile getters of INetFwPolicy2 that check_profile reads, without COM.
+struct fake_firewall_policy final
+{
+    HRESULT get_FirewallEnabled(NET_FW_PROFILE_TYPE2 profile, VARIANT_BOOL * value) const;
+    HRESULT get_BlockAllInboundTraffic(NET_FW_PROFILE_TYPE2 profile, VARIANT_BOOL * value) const;
+    HRESULT get_NotificationsDisabled(NET_FW_PROFILE_TYPE2 profile, VARIANT_BOOL * value) const;
+    HRESULT get_UnicastResponsesToMulticastBroadcastDisabled(NET_FW_PROFILE_TYPE2 profile, VARIANT_BOOL * value) const;
+    HRESULT get_DefaultInboundAction(NET_FW_PROFILE_TYPE2 profile, NET_FW_ACTION * value) const;
+    HRESULT get_DefaultOutboundAction(NET_FW_PROFILE_TYPE2 profile, NET_FW_ACTION * value) const;
+
+    // Bit per profile, NET_FW_PROFILE2_* values.
+    long firewall_enabled = NET_FW_PROFILE2_DOMAIN | NET_FW_PROFILE2_PRIVATE | NET_FW_PROFILE2_PUBLIC;
+    long block_all_inbound = 0;
+    long notifications_disabled = NET_FW_PROFILE2_DOMAIN;
+    long unicast_responses_disabled = 0;
+    long inbound_allow = 0;
+    long outbound_allow = NET_FW_PROFILE2_DOMAIN | NET_FW_PROFILE2_PRIVATE | NET_FW_PROFILE2_PUBLIC;
+};
+#endif
+
+// IPv4 and IPv6 literals over private, loopback, link-local, multicast and public ranges.
+std::vector<std::wstring> make_addresses(size_t count, uint64_t seed);
+
+// A host list as found in service configs: names, URLs, IP literals with and without ports, with
+// the given share of lines repeating an earlier host in another spelling. One line per host.
+std::wstring make_host_list(size_t count, double duplicate_ratio, uint64_t seed);
+
+// Answers from a hash of the host, after an optional delay standing in for name resolution. Hosts
+// starting with "fail" fail with ERROR_INVALID_PARAMETER.
+class fake_diagnose_source final : public diagnose_source
+{
+public:
+    explicit fake_diagnose_source(std::chrono::microseconds const latency = std::chrono::microseconds(0)) noexcept : latency_(latency) {}
+
+    status diagnose(wchar_t const * host, NETISO_ERROR_TYPE & type) override;
+
+    size_t calls() const noexcept { return calls_.load(); }
+
+private:
+    std::chrono::microseconds const latency_;
+    std::atomic<size_t> calls_{ 0 };
+};
+
+// A process table as the Toolhelp snapshot and the tokens would give it. One process in ten denies
+// access, one in three runs in an app container of the fixture with one to four capabilities and
+// low integrity, the rest are medium integrity with a fifth of them elevated by a full token.
+// Token information is laid out in the buffer the way GetTokenInformation does it.
+class fake_process_source final : public process_source
+{
+public:
+    fake_process_source(size_t count, app_container_fixture const & containers, uint64_t seed);
+
+    status processes(std::vector<process_entry> & result) override;
+    status open_token(uint32_t pid, HANDLE & token) override;
+    status token_information(HANDLE token, TOKEN_INFORMATION_CLASS type, std::vector<uint8_t> & buffer) override;
+    void close_token(HANDLE token) noexcept override;
+
+private:
+    struct fake_process final
+    {
+        process_entry entry;
+        bool denied;
+        TOKEN_ELEVATION_TYPE elevation_type;
+        bool elevated;
+        sid integrity;
+        // Empty when it isn't in an app container.
+        sid app_container;
+        std::vector<sid> capabilities;
+    };
+
+    std::vector<fake_process> processes_;
+};
+
+// Replays a script of changes: each one comes delay after the previous one was returned. Closes
+// when the script ends.
+class fake_change_source final : public change_source
+{
+public:
+    struct change final
+    {
+        std::chrono::milliseconds delay;
+        uint32_t bits;
+    };
+
+    explicit fake_change_source(std::vector<change> script) noexcept : script_(std::move(script)) {}
+
+    size_t waits() const noexcept { return waits_; }
+
+private:
+    bool wait_once(std::chrono::milliseconds timeout, uint32_t & changes) override;
+
+    std::vector<change> script_;
+    size_t next_ = 0;
+    size_t waits_ = 0;
+};
+
+}
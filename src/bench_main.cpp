@@ -0,0 +1,36 @@
+﻿#include "config.hpp"
+
+#include "bench.hpp"
+
+#include <exception>
+#include <iostream>
+#include <string_view>
+
+// The benchmark on its own, for the Linux build: the cases that don't need Windows, with the
+// fixtures standing in for the OS. NetFwTest --bench runs them all.
+int main(int const argc, char const * const argv[])
+{
+    auto quick = false;
+    for (int n = 1; n < argc; ++n)
+    {
+        std::string_view const arg = argv[n];
+        if (arg == "--quick")
+            quick = true;
+        else
+        {
+            std::cerr << "ERROR: Unknown argument: " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    try
+    {
+        jb::run_bench(std::wcout, quick);
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
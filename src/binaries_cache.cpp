@@ -0,0 +1,167 @@
+﻿#include "config.hpp"
+
+#include "binaries_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace jb {
+
+namespace {
+
+size_t align8(size_t const size) noexcept
+{
+    return (size + 7) & ~size_t(7);
+}
+
+}
+
+char const binaries_cache::magic[4] = { 'N', 'F', 'B', 'C' };
+
+void binaries_cache::open(std::filesystem::path const & path)
+{
+    close();
+    file_ = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart < LONGLONG(sizeof(file_header)) ||
+        !(mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr)) ||
+        !(view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) ||
+        !attach(view_, static_cast<size_t>(size.QuadPart)))
+        close();
+}
+
+bool binaries_cache::attach(void const * const data, size_t const size)
+{
+    header_ = nullptr;
+    auto const bytes = static_cast<uint8_t const *>(data);
+    if (size < sizeof(file_header))
+        return false;
+    auto const header = reinterpret_cast<file_header const *>(bytes);
+    if (std::memcmp(header->magic, magic, sizeof magic) != 0 || header->version != version || header->char_size != sizeof(wchar_t))
+        return false;
+
+    auto const entries_offset = sizeof(file_header);
+    auto const binaries_offset = entries_offset + size_t(header->entry_count) * sizeof(file_entry);
+    auto const sids_offset = binaries_offset + size_t(header->binary_count) * sizeof(file_binary);
+    auto const chars_offset = sids_offset + align8(header->sid_size);
+    if (chars_offset > size || (size - chars_offset) / sizeof(wchar_t) < header->char_count)
+        return false;
+
+    auto const entries = reinterpret_cast<file_entry const *>(bytes + entries_offset);
+    auto const binaries = reinterpret_cast<file_binary const *>(bytes + binaries_offset);
+    auto const sids = bytes + sids_offset;
+    auto const chars = reinterpret_cast<wchar_t const *>(bytes + chars_offset);
+    sid previous;
+    for (uint32_t n = 0; n < header->entry_count; ++n)
+    {
+        auto const & entry = entries[n];
+        sid current;
+        if (entry.sid_offset > header->sid_size || header->sid_size - entry.sid_offset < entry.sid_size ||
+            !sid::parse(sids + entry.sid_offset, entry.sid_size, current) || (n && !(previous < current)) ||
+            entry.first_binary > header->binary_count || header->binary_count - entry.first_binary < entry.binary_count)
+            return false;
+        previous = current;
+    }
+    for (uint32_t n = 0; n < header->binary_count; ++n)
+    {
+        auto const & binary = binaries[n];
+        if (binary.offset >= header->char_count || header->char_count - binary.offset <= binary.size || chars[binary.offset + binary.size])
+            return false;
+    }
+
+    header_ = header;
+    entries_ = entries;
+    binaries_ = binaries;
+    sids_ = sids;
+    chars_ = chars;
+    return true;
+}
+
+void binaries_cache::close() noexcept
+{
+    if (view_)
+        UnmapViewOfFile(view_);
+    if (mapping_)
+        CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_);
+    view_ = nullptr;
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+    header_ = nullptr;
+}
+
+size_t binaries_cache::find(sid const & value, uint64_t const last_write_time) const noexcept
+{
+    size_t first = 0, count = size();
+    while (count)
+    {
+        auto const step = count / 2;
+        if (entry_sid(first + step) < value)
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+            count = step;
+    }
+    if (first == size() || entry_sid(first) != value || entries_[first].last_write_time != last_write_time)
+        return size();
+    return first;
+}
+
+void binaries_cache::write(std::filesystem::path const & path, std::vector<app_container_binaries> entries, uint64_t const compute_ns)
+{
+    std::stable_sort(entries.begin(), entries.end(), [](app_container_binaries const & left, app_container_binaries const & right) { return left.app_container < right.app_container; });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](app_container_binaries const & left, app_container_binaries const & right) { return left.app_container == right.app_container; }), entries.end());
+
+    std::vector<file_entry> file_entries;
+    std::vector<file_binary> file_binaries;
+    std::vector<uint8_t> sids;
+    std::vector<wchar_t> chars;
+    file_entries.reserve(entries.size());
+    for (auto const & entry : entries)
+    {
+        file_entries.push_back({ static_cast<uint32_t>(sids.size()), static_cast<uint32_t>(entry.app_container.binary_size()), entry.last_write_time, static_cast<uint32_t>(file_binaries.size()), static_cast<uint32_t>(entry.binaries.size()) });
+        sids.insert(sids.end(), entry.app_container.data(), entry.app_container.data() + entry.app_container.binary_size());
+        for (auto const & binary : entry.binaries)
+        {
+            file_binaries.push_back({ static_cast<uint32_t>(chars.size()), static_cast<uint32_t>(binary.size()) });
+            chars.insert(chars.end(), binary.begin(), binary.end());
+            chars.push_back(L'\0');
+        }
+    }
+    sids.resize(align8(sids.size()));
+
+    file_header header = {};
+    std::memcpy(header.magic, magic, sizeof magic);
+    header.version = version;
+    header.char_size = sizeof(wchar_t);
+    header.entry_count = static_cast<uint32_t>(file_entries.size());
+    header.binary_count = static_cast<uint32_t>(file_binaries.size());
+    header.sid_size = static_cast<uint32_t>(sids.size());
+    header.char_count = static_cast<uint32_t>(chars.size());
+    header.compute_ns = compute_ns;
+
+    auto temp = path;
+    temp += L".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Can't create the binaries cache file");
+        out.write(reinterpret_cast<char const *>(&header), sizeof header);
+        out.write(reinterpret_cast<char const *>(file_entries.data()), file_entries.size() * sizeof(file_entry));
+        out.write(reinterpret_cast<char const *>(file_binaries.data()), file_binaries.size() * sizeof(file_binary));
+        out.write(reinterpret_cast<char const *>(sids.data()), sids.size());
+        out.write(reinterpret_cast<char const *>(chars.data()), chars.size() * sizeof(wchar_t));
+        if (!out.flush())
+            throw std::runtime_error("Can't write the binaries cache file");
+    }
+    std::filesystem::rename(temp, path);
+}
+
+}
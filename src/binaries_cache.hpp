@@ -0,0 +1,109 @@
+﻿#pragma once
+
+#include "sid.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace jb {
+
+struct app_container_binaries final
+{
+    sid app_container;
+    // Of the container's Mappings subkey, FILETIME ticks.
+    uint64_t last_write_time;
+    std::vector<std::wstring> binaries;
+};
+
+// Result of the last NETISO_FLAG_FORCE_COMPUTE_BINARIES enumeration, one entry per AppContainer
+// SID stamped with the last write time of its Mappings subkey. The file is mapped read-only and
+// searched in place: a header, the entries sorted by SID, the binary spans, the SID bytes and the
+// null-terminated paths. Everything is bounds checked when the file is opened.
+class binaries_cache final
+{
+public:
+    binaries_cache() = default;
+
+    binaries_cache(binaries_cache const &) = delete;
+    binaries_cache & operator=(binaries_cache const &) = delete;
+
+    ~binaries_cache()
+    {
+        close();
+    }
+
+    // A missing or malformed file leaves the cache empty. The file stays open with delete sharing,
+    // so another process's write() can replace it meanwhile.
+    void open(std::filesystem::path const & path);
+    // Uses a caller-owned image, which must outlive the cache. Returns false when it is malformed.
+    bool attach(void const * data, size_t size);
+    void close() noexcept;
+
+    size_t size() const noexcept { return header_ ? header_->entry_count : 0; }
+    // How long the enumeration the cache was written from took.
+    uint64_t compute_ns() const noexcept { return header_ ? header_->compute_ns : 0; }
+
+    // Index of the entry for the SID if it was written with the same last write time, size()
+    // otherwise.
+    size_t find(sid const & value, uint64_t last_write_time) const noexcept;
+
+    size_t binary_count(size_t const entry) const noexcept { return entries_[entry].binary_count; }
+    wchar_t const * binary(size_t const entry, size_t const n) const noexcept { return chars_ + binaries_[entries_[entry].first_binary + n].offset; }
+
+    // Replaces the file through a temporary one next to it. A repeated SID keeps its first entry.
+    static void write(std::filesystem::path const & path, std::vector<app_container_binaries> entries, uint64_t compute_ns);
+
+private:
+    struct file_header final
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t char_size;
+        uint32_t entry_count;
+        uint32_t binary_count;
+        uint32_t sid_size;
+        uint32_t char_count;
+        uint32_t reserved;
+        uint64_t compute_ns;
+    };
+
+    struct file_entry final
+    {
+        uint32_t sid_offset;
+        uint32_t sid_size;
+        uint64_t last_write_time;
+        uint32_t first_binary;
+        uint32_t binary_count;
+    };
+
+    struct file_binary final
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    static char const magic[4];
+    static uint32_t const version = 1;
+
+    sid entry_sid(size_t const entry) const noexcept
+    {
+        sid result;
+        sid::parse(sids_ + entries_[entry].sid_offset, entries_[entry].sid_size, result);
+        return result;
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    void const * view_ = nullptr;
+
+    file_header const * header_ = nullptr;
+    file_entry const * entries_ = nullptr;
+    file_binary const * binaries_ = nullptr;
+    uint8_t const * sids_ = nullptr;
+    wchar_t const * chars_ = nullptr;
+};
+
+}
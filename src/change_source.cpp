@@ -0,0 +1,46 @@
+﻿#include "config.hpp"
+
+#include "change_source.hpp"
+
+#include <algorithm>
+
+namespace jb {
+
+uint32_t change_source::wait(std::chrono::milliseconds const timeout)
+{
+    auto const deadline = timeout == infinite ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + timeout;
+    auto left = timeout;
+    while (true)
+    {
+        uint32_t changes = 0;
+        if (!wait_once(left, changes))
+            return 0;
+        if (changes)
+            return changes;
+        if (timeout != infinite)
+        {
+            auto const now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                return 0;
+            left = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+        }
+    }
+}
+
+uint32_t wait_coalesced(change_source & source, std::chrono::milliseconds const timeout, watch_options const & options)
+{
+    auto changes = source.wait(timeout);
+    if (!changes)
+        return 0;
+    auto const deadline = std::chrono::steady_clock::now() + options.max_delay;
+    for (auto now = std::chrono::steady_clock::now(); now < deadline; now = std::chrono::steady_clock::now())
+    {
+        auto const more = source.wait(std::min(options.quiet, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)));
+        if (!more)
+            break;
+        changes |= more;
+    }
+    return changes;
+}
+
+}
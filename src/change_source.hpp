@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include "format.hpp"
+#include "snapshot.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace jb {
+
+// Where change notifications come from, one bit per watched item.
+class change_source
+{
+public:
+    // As a timeout, waits for good.
+    static constexpr std::chrono::milliseconds infinite = std::chrono::milliseconds::max();
+
+    virtual ~change_source() = default;
+
+    // Returns the bits of the items that changed, zero on timeout. Zero from an infinite wait means
+    // no change will ever come. Signals that change no item are waited past.
+    uint32_t wait(std::chrono::milliseconds timeout);
+
+protected:
+    // Waits once: false on timeout or when the source is closed, otherwise true with the bits of
+    // the items that changed, which may be none.
+    virtual bool wait_once(std::chrono::milliseconds timeout, uint32_t & changes) = 0;
+};
+
+struct watch_options final
+{
+    // A burst ends when the source stays quiet this long.
+    std::chrono::milliseconds quiet = std::chrono::milliseconds(200);
+    // and lasts no longer than this, so a steady stream of changes still gets refreshes.
+    std::chrono::milliseconds max_delay = std::chrono::seconds(2);
+};
+
+// Waits up to timeout for a change, then gathers the burst that follows it. A package install
+// touches dozens of keys, this turns it into one refresh. Returns the bits of the whole burst.
+uint32_t wait_coalesced(change_source & source, std::chrono::milliseconds timeout, watch_options const & options);
+
+// Keeps model current until the source closes: after every burst, collect(model, parts) rereads
+// the diagnostic_snapshot::has_* parts that parts maps the changed bits to, and the differences
+// against the state before are printed. Returns the number of refreshes.
+template<typename Collect>
+size_t watch_snapshot(change_source & source, std::vector<uint32_t> const & parts, diagnostic_snapshot & model, Collect && collect, watch_options const & options, std::wostream & out)
+{
+    auto image = build_snapshot(model);
+    size_t refreshes = 0;
+    while (auto const changes = wait_coalesced(source, change_source::infinite, options))
+    {
+        uint32_t stale = 0;
+        for (size_t n = 0; n < parts.size(); ++n)
+            if (changes & (1u << n))
+                stale |= parts[n];
+        if (!stale)
+            continue;
+
+        auto const start = std::chrono::steady_clock::now();
+        collect(model, stale);
+        auto next = build_snapshot(model);
+        snapshot_view before, after;
+        before.attach(image.data(), image.size());
+        after.attach(next.data(), next.size());
+        out << L"Change:";
+        for (uint32_t part = 1; part && part <= stale; part <<= 1)
+            if (stale & part)
+                out << L' ' << snapshot_part_name(part);
+        out << L'\n';
+        auto const differences = diff_snapshots(before, after, out);
+        auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        out << L"Refresh: " << dec(differences) << L" differences in " << dec(static_cast<uint64_t>(elapsed.count())) << L" ms" << std::endl;
+        image = std::move(next);
+        ++refreshes;
+    }
+    return refreshes;
+}
+
+}
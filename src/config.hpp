@@ -1,6 +1,10 @@
-﻿#pragma once
-
-#undef  _WIN32_WINNT
-#define _WIN32_WINNT _WIN32_WINNT_WIN8
-#include <sdkddkver.h>
-#include <Windows.h>
+﻿#pragma once
+
+#ifdef _WIN32
+
+#undef  _WIN32_WINNT
+#define _WIN32_WINNT _WIN32_WINNT_WIN8
+#include <sdkddkver.h>
+#include <Windows.h>
+
+#endif
@@ -0,0 +1,327 @@
+﻿#include "config.hpp"
+
+#include "daemon.hpp"
+#include "appcontainer_report.hpp"
+#include "instrument.hpp"
+#include "on_exit.hpp"
+#include "sid.hpp"
+
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <sddl.h>
+
+namespace jb {
+
+namespace {
+
+template<typename T>
+void append(std::vector<uint8_t> & out, T const & value)
+{
+    auto const bytes = reinterpret_cast<uint8_t const *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof value);
+}
+
+std::vector<uint8_t> make_response(DWORD const error)
+{
+    std::vector<uint8_t> result;
+    append(result, uint32_t(error));
+    return result;
+}
+
+void append_text(std::vector<uint8_t> & out, std::wstring const & text)
+{
+    auto const bytes = reinterpret_cast<uint8_t const *>(text.data());
+    out.insert(out.end(), bytes, bytes + text.size() * sizeof(wchar_t));
+}
+
+// Owned by and open to the daemon's user, plus administrators and SYSTEM. The default DACL of a
+// pipe lets everyone read it, and the answers name the user's app containers.
+std::wstring pipe_security()
+{
+    HANDLE token;
+    if (!trace_call(api_call::OpenProcessToken, [&] { return status::last_error(OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)); }))
+        throw std::runtime_error("Can't open the daemon process token");
+    auto && close_token = make_on_exit_scope([token] { CloseHandle(token); });
+    alignas(TOKEN_USER) uint8_t buffer[sizeof(TOKEN_USER) + sid::max_binary_size];
+    DWORD size;
+    if (!trace_call(api_call::GetTokenInformation, [&] { return status::last_error(GetTokenInformation(token, TokenUser, buffer, sizeof buffer, &size)); }))
+        throw std::runtime_error("Can't read the daemon user");
+    auto const user_sid = reinterpret_cast<TOKEN_USER const *>(buffer)->User.Sid;
+    auto const user = sid::from_binary(user_sid, GetLengthSid(user_sid)).to_string();
+    return L"O:" + user + L"D:P(A;;GA;;;" + user + L")(A;;GA;;;BA)(A;;GA;;;SY)";
+}
+
+// Waits for an overlapped call, cancelling it when stop is signaled. started is what the call
+// returned.
+bool complete_io(HANDLE const pipe, OVERLAPPED & overlapped, BOOL const started, HANDLE const stop, DWORD & bytes, DWORD & error)
+{
+    if (!started && (error = GetLastError()) != ERROR_IO_PENDING)
+        return false;
+    HANDLE const events[] = { overlapped.hEvent, stop };
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0)
+    {
+        CancelIoEx(pipe, &overlapped);
+        GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+        error = ERROR_OPERATION_ABORTED;
+        return false;
+    }
+    if (!GetOverlappedResult(pipe, &overlapped, &bytes, FALSE))
+    {
+        error = GetLastError();
+        return false;
+    }
+    return true;
+}
+
+}
+
+uint64_t daemon_model::publish(diagnostic_snapshot const & snapshot)
+{
+    auto next = std::make_shared<state>();
+    next->image = build_snapshot(snapshot);
+    next->view.attach(next->image.data(), next->image.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    next->generation = state_ ? state_->generation + 1 : 1;
+    state_ = std::move(next);
+    return state_->generation;
+}
+
+uint64_t daemon_model::generation() const
+{
+    auto const model = current();
+    return model ? model->generation : 0;
+}
+
+std::shared_ptr<daemon_model::state const> daemon_model::current() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_;
+}
+
+std::vector<uint8_t> daemon_model::handle(uint8_t const * const request, size_t const size) const
+{
+    if (!size || size > daemon_max_request)
+        return make_response(ERROR_INVALID_PARAMETER);
+    auto const model = current();
+    if (!model)
+        return make_response(ERROR_NOT_READY);
+    auto const & view = model->view;
+    auto const argument = request + 1;
+    auto const argument_size = size - 1;
+
+    auto result = make_response(ERROR_SUCCESS);
+    switch (static_cast<daemon_op>(request[0]))
+    {
+    case daemon_op::ping:
+        break;
+
+    case daemon_op::info:
+        append(result, model->generation);
+        append(result, view.created());
+        append(result, view.present());
+        break;
+
+    case daemon_op::snapshot:
+        result.insert(result.end(), model->image.begin(), model->image.end());
+        break;
+
+    case daemon_op::firewall:
+        for (size_t n = 0; n < std::size(firewall_profiles); ++n)
+        {
+            auto const profile = view.firewall(n);
+            uint8_t const bytes[] = { profile.enabled, profile.block_all_inbound, static_cast<uint8_t>(profile.inbound), static_cast<uint8_t>(profile.outbound) };
+            result.insert(result.end(), bytes, bytes + sizeof bytes);
+        }
+        break;
+
+    case daemon_op::app_container:
+    {
+        // Copied out, the argument is not aligned for wchar_t.
+        std::wstring text(argument_size / sizeof(wchar_t), L'\0');
+        std::memcpy(text.data(), argument, text.size() * sizeof(wchar_t));
+        sid value;
+        if (argument_size % sizeof(wchar_t) || !sid::parse(text, value))
+            return make_response(ERROR_INVALID_SID);
+        auto const n = view.find_app_container(value);
+        if (n == view.app_container_count())
+            return make_response(ERROR_NOT_FOUND);
+        auto const item = view.app_container_at(n);
+        std::wostringstream lines;
+        lines << L"app_container: " << item.app_container << L'\n'
+             << L"user: " << item.user << L'\n'
+             << L"name: " << item.name << L'\n'
+             << L"display_name: " << item.display_name << L'\n'
+             << L"description: " << item.description << L'\n'
+             << L"package_full_name: " << item.package_full_name << L'\n'
+             << L"working_directory: " << item.working_directory << L'\n';
+        for (size_t k = 0; k < item.capability_count; ++k)
+            lines << L"capability: " << view.capability(item.first_capability + k).value << L'\n';
+        for (size_t k = 0; k < item.binary_count; ++k)
+            lines << L"binary: " << view.binary(item.first_binary + k) << L'\n';
+        append_text(result, lines.str());
+        break;
+    }
+
+    default:
+        return make_response(ERROR_INVALID_FUNCTION);
+    }
+    return result;
+}
+
+daemon_server::daemon_server(daemon_model const & model, unsigned const threads, std::wstring name) :
+    model_(model),
+    name_(std::move(name))
+{
+    stop_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!stop_)
+        throw std::runtime_error("Can't create the daemon stop event");
+    try
+    {
+        PSECURITY_DESCRIPTOR descriptor;
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(pipe_security().c_str(), SDDL_REVISION_1, &descriptor, nullptr))
+            throw std::runtime_error("Can't make the daemon pipe security descriptor");
+        auto && free_descriptor = make_on_exit_scope([descriptor] { LocalFree(descriptor); });
+        SECURITY_ATTRIBUTES attributes = { sizeof attributes, descriptor, FALSE };
+
+        for (unsigned n = 0; n < std::max(threads, 1u); ++n)
+        {
+            // Only local clients, and the first instance fails when another daemon runs.
+            auto const pipe = CreateNamedPipeW(name_.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (n ? 0 : FILE_FLAG_FIRST_PIPE_INSTANCE),
+                PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES, 64 * 1024, static_cast<DWORD>(daemon_max_request), 0, &attributes);
+            if (pipe == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("Can't create the daemon pipe");
+            pipes_.push_back(pipe);
+        }
+        for (auto const pipe : pipes_)
+            threads_.emplace_back([this, pipe] { serve(pipe); });
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+}
+
+daemon_server::~daemon_server()
+{
+    stop();
+}
+
+void daemon_server::stop() noexcept
+{
+    SetEvent(stop_);
+    for (auto & thread : threads_)
+        thread.join();
+    threads_.clear();
+    for (auto const pipe : pipes_)
+        CloseHandle(pipe);
+    pipes_.clear();
+    CloseHandle(stop_);
+    stop_ = nullptr;
+}
+
+void daemon_server::serve(HANDLE const pipe)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!overlapped.hEvent)
+        return;
+    std::vector<uint8_t> request(daemon_max_request);
+    DWORD bytes = 0, error = ERROR_SUCCESS;
+    while (true)
+    {
+        auto const connected = ConnectNamedPipe(pipe, &overlapped);
+        if (!connected && GetLastError() != ERROR_PIPE_CONNECTED && !complete_io(pipe, overlapped, connected, stop_, bytes, error))
+        {
+            if (error == ERROR_OPERATION_ABORTED)
+                break;
+            DisconnectNamedPipe(pipe);
+            continue;
+        }
+
+        while (complete_io(pipe, overlapped, ReadFile(pipe, request.data(), static_cast<DWORD>(request.size()), nullptr, &overlapped), stop_, bytes, error))
+        {
+            auto const response = model_.handle(request.data(), bytes);
+            ++requests_;
+            if (!complete_io(pipe, overlapped, WriteFile(pipe, response.data(), static_cast<DWORD>(response.size()), nullptr, &overlapped), stop_, bytes, error))
+                break;
+        }
+        // ERROR_MORE_DATA too: a request over daemon_max_request ends its connection.
+        DisconnectNamedPipe(pipe);
+        if (error == ERROR_OPERATION_ABORTED)
+            break;
+    }
+    CloseHandle(overlapped.hEvent);
+}
+
+void daemon_client::open(DWORD const timeout_ms, std::wstring const & name)
+{
+    close();
+    while (true)
+    {
+        pipe_ = CreateFileW(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe_ != INVALID_HANDLE_VALUE)
+            break;
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(name.c_str(), timeout_ms))
+            throw std::runtime_error("Can't connect to the daemon");
+    }
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    if (!SetNamedPipeHandleState(pipe_, &mode, nullptr, nullptr))
+    {
+        close();
+        throw std::runtime_error("Can't set the daemon pipe mode");
+    }
+}
+
+void daemon_client::close() noexcept
+{
+    if (pipe_ != INVALID_HANDLE_VALUE)
+        CloseHandle(pipe_);
+    pipe_ = INVALID_HANDLE_VALUE;
+}
+
+status daemon_client::request(daemon_op const op, void const * const argument, size_t const argument_size, std::vector<uint8_t> & result)
+{
+    result.clear();
+    if (argument_size + 1 > daemon_max_request)
+        return status::win32(ERROR_INVALID_PARAMETER);
+    uint8_t message[daemon_max_request];
+    message[0] = static_cast<uint8_t>(op);
+    if (argument_size)
+        std::memcpy(message + 1, argument, argument_size);
+
+    if (buffer_.size() < 64 * 1024)
+        buffer_.resize(64 * 1024);
+    DWORD read;
+    size_t size = 0;
+    auto done = TransactNamedPipe(pipe_, message, static_cast<DWORD>(argument_size + 1), buffer_.data(), static_cast<DWORD>(buffer_.size()), &read, nullptr);
+    while (true)
+    {
+        if (done)
+        {
+            size += read;
+            break;
+        }
+        if (GetLastError() != ERROR_MORE_DATA)
+            return status::last_error(FALSE);
+        size += read;
+        buffer_.resize(2 * buffer_.size());
+        done = ReadFile(pipe_, buffer_.data() + size, static_cast<DWORD>(buffer_.size() - size), &read, nullptr);
+    }
+
+    uint32_t error;
+    if (size < sizeof error)
+        return status::win32(ERROR_INVALID_DATA);
+    std::memcpy(&error, buffer_.data(), sizeof error);
+    if (error != ERROR_SUCCESS)
+        return status::win32(error);
+    result.assign(buffer_.begin() + sizeof error, buffer_.begin() + size);
+    return status::win32(ERROR_SUCCESS);
+}
+
+}
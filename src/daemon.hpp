@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#include "snapshot.hpp"
+#include "status.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace jb {
+
+// Local query protocol of the daemon: one message each way over a message-mode named pipe. A
+// request is a daemon_op byte followed by its argument, a response a uint32 Win32 status followed
+// by the result, which is there only on success.
+enum class daemon_op : uint8_t
+{
+    // No argument, no result.
+    ping = 1,
+    // No argument; uint64 generation, int64 created in FILETIME ticks, uint32 present bits.
+    info,
+    // No argument; the whole snapshot as build_snapshot makes it.
+    snapshot,
+    // No argument; enabled, block_all_inbound, inbound and outbound bytes of the domain, private
+    // and public profiles.
+    firewall,
+    // SID in the S-1-... form as UTF-16; the container as UTF-16 "field: value" lines,
+    // ERROR_NOT_FOUND when there is no such container.
+    app_container,
+};
+
+wchar_t const daemon_pipe_name[] = L"\\\\.\\pipe\\NetFwTest";
+size_t const daemon_max_request = 1024;
+
+// What the daemon answers from. publish swaps a new snapshot in; a query keeps the one it started
+// with, so queries never wait for a refresh and never see half of one.
+class daemon_model final
+{
+public:
+    // Returns the new generation.
+    uint64_t publish(diagnostic_snapshot const & snapshot);
+
+    uint64_t generation() const;
+
+    // Answers one request.
+    std::vector<uint8_t> handle(uint8_t const * request, size_t size) const;
+
+private:
+    struct state final
+    {
+        std::vector<uint8_t> image;
+        snapshot_view view;
+        uint64_t generation = 0;
+    };
+
+    std::shared_ptr<state const> current() const;
+
+    mutable std::mutex mutex_;
+    std::shared_ptr<state const> state_;
+};
+
+// Serves a model over a named pipe, one pipe instance per thread. A connection stays with its
+// thread for as many requests as the client sends, so a client that keeps the pipe open pays only
+// for the round trip. Only the daemon's user, administrators and SYSTEM may open the pipe.
+class daemon_server final
+{
+public:
+    // Throws when another daemon has the pipe.
+    daemon_server(daemon_model const & model, unsigned threads, std::wstring name = daemon_pipe_name);
+    ~daemon_server();
+
+    daemon_server(daemon_server const &) = delete;
+    daemon_server & operator=(daemon_server const &) = delete;
+
+    uint64_t requests() const noexcept { return requests_.load(); }
+
+private:
+    void serve(HANDLE pipe);
+    void stop() noexcept;
+
+    daemon_model const & model_;
+    std::wstring const name_;
+    HANDLE stop_ = nullptr;
+    std::vector<HANDLE> pipes_;
+    std::vector<std::thread> threads_;
+    std::atomic<uint64_t> requests_{ 0 };
+};
+
+class daemon_client final
+{
+public:
+    daemon_client() = default;
+
+    daemon_client(daemon_client const &) = delete;
+    daemon_client & operator=(daemon_client const &) = delete;
+
+    ~daemon_client()
+    {
+        close();
+    }
+
+    // Throws when no daemon answers within timeout_ms.
+    void open(DWORD timeout_ms, std::wstring const & name = daemon_pipe_name);
+    void close() noexcept;
+
+    // Sends one request and splits the status off the response; result is empty on failure.
+    status request(daemon_op op, void const * argument, size_t argument_size, std::vector<uint8_t> & result);
+
+private:
+    HANDLE pipe_ = INVALID_HANDLE_VALUE;
+    std::vector<uint8_t> buffer_;
+};
+
+}
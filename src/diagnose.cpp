@@ -0,0 +1,295 @@
+﻿#include "config.hpp"
+
+#include "diagnose.hpp"
+#include "ip_address.hpp"
+#include "network_classifier.hpp"
+
+#ifdef _WIN32
+#include "instrument.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+namespace jb {
+
+namespace {
+
+unsigned const default_threads = 8;
+
+bool is_blank(wchar_t const ch) noexcept
+{
+    return ch == L' ' || ch == L'\t' || ch == L'\r' || ch == L'\n';
+}
+
+std::wstring_view trim(std::wstring_view value) noexcept
+{
+    while (!value.empty() && is_blank(value.front()))
+        value.remove_prefix(1);
+    while (!value.empty() && is_blank(value.back()))
+        value.remove_suffix(1);
+    return value;
+}
+
+bool is_port(std::wstring_view const & text) noexcept
+{
+    if (text.empty() || text.size() > 5)
+        return false;
+    uint32_t value = 0;
+    for (auto const ch : text)
+    {
+        if (ch < L'0' || ch > L'9')
+            return false;
+        value = value * 10 + (ch - L'0');
+    }
+    return value <= 0xFFFF;
+}
+
+host_kind normalize_name(std::wstring_view name, std::wstring & result)
+{
+    if (!name.empty() && name.back() == L'.')
+        name.remove_suffix(1);
+    if (name.empty() || name.size() > 253)
+        return host_kind::invalid;
+
+    result.assign(name);
+    size_t label = 0;
+    for (auto & ch : result)
+    {
+        if (ch >= L'A' && ch <= L'Z')
+            ch = static_cast<wchar_t>(ch - L'A' + L'a');
+        if (ch == L'.')
+        {
+            if (!label)
+                return host_kind::invalid;
+            label = 0;
+        }
+        else if ((ch >= L'a' && ch <= L'z') || (ch >= L'0' && ch <= L'9') || ch == L'-' || ch == L'_')
+        {
+            if (++label > 63)
+                return host_kind::invalid;
+        }
+        else
+            return host_kind::invalid;
+    }
+    return host_kind::name;
+}
+
+}
+
+#ifdef _WIN32
+status netiso_diagnose_source::diagnose(wchar_t const * const host, NETISO_ERROR_TYPE & type)
+{
+    return trace_call(api_call::NetworkIsolationDiagnoseConnectFailureAndGetInfo, [&] { return status::win32(NetworkIsolationDiagnoseConnectFailureAndGetInfo(host, &type)); });
+}
+#endif
+
+wchar_t const * netiso_error_type_name(NETISO_ERROR_TYPE const type) noexcept
+{
+    return
+        type == NETISO_ERROR_TYPE_NONE                   ? L"none"                   :
+        type == NETISO_ERROR_TYPE_PRIVATE_NETWORK        ? L"private"                :
+        type == NETISO_ERROR_TYPE_INTERNET_CLIENT        ? L"internet_client"        :
+        type == NETISO_ERROR_TYPE_INTERNET_CLIENT_SERVER ? L"internet_client_server" : L"???";
+}
+
+host_kind normalize_host(std::wstring_view text, std::wstring & result)
+{
+    text = trim(text);
+    auto const scheme = text.find(L"://");
+    if (scheme != std::wstring_view::npos)
+        text.remove_prefix(scheme + 3);
+    text = text.substr(0, text.find_first_of(L"/?#"));
+    auto const at = text.rfind(L'@');
+    if (at != std::wstring_view::npos)
+        text.remove_prefix(at + 1);
+
+    std::wstring_view address;
+    if (!text.empty() && text.front() == L'[')
+    {
+        auto const close = text.find(L']');
+        if (close == std::wstring_view::npos)
+            return host_kind::invalid;
+        auto const rest = text.substr(close + 1);
+        if (!rest.empty() && (rest.front() != L':' || !is_port(rest.substr(1))))
+            return host_kind::invalid;
+        address = text.substr(1, close - 1);
+    }
+    else
+    {
+        auto const colon = text.find(L':');
+        if (colon != std::wstring_view::npos && text.find(L':', colon + 1) == std::wstring_view::npos)
+        {
+            if (!is_port(text.substr(colon + 1)))
+                return host_kind::invalid;
+            text = text.substr(0, colon);
+        }
+        address = text;
+    }
+
+    ip_address value;
+    if (ip_address::parse(address, value))
+    {
+        result = value.to_string();
+        return value.is_ipv4() ? host_kind::ipv4 : host_kind::ipv6;
+    }
+    if (address.size() != text.size() || address.find(L':') != std::wstring_view::npos)
+        return host_kind::invalid;
+    return normalize_name(address, result);
+}
+
+host_list read_hosts(std::wistream & in)
+{
+    host_list result;
+    std::unordered_set<std::wstring> seen;
+    std::wstring line, host;
+    while (std::getline(in, line))
+    {
+        ++result.lines;
+        auto const text = trim(std::wstring_view(line).substr(0, line.find(L'#')));
+        if (text.empty())
+            continue;
+        auto const kind = normalize_host(text, host);
+        if (kind == host_kind::invalid)
+            ++result.invalid;
+        else if (!seen.insert(host).second)
+            ++result.duplicates;
+        else
+        {
+            result.hosts.push_back(host);
+            result.kinds.push_back(kind);
+        }
+    }
+    return result;
+}
+
+void diagnose_cache::load(std::filesystem::path const & path)
+{
+    std::ifstream in(path);
+    if (!in)
+        return;
+    auto const time_now = now();
+    std::string line, text;
+    std::wstring key, host;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        int type;
+        int64_t time;
+        if (!(fields >> text >> type >> time) || !(fields >> std::ws).eof())
+            continue;
+        if (type < NETISO_ERROR_TYPE_NONE || type > NETISO_ERROR_TYPE_INTERNET_CLIENT_SERVER || time > time_now || time_now - time >= ttl_.count())
+            continue;
+        key.assign(text.begin(), text.end());
+        if (normalize_host(key, host) == host_kind::invalid || host != key)
+            continue;
+        auto & item = entries_[key];
+        if (item.time <= time)
+            item = { static_cast<NETISO_ERROR_TYPE>(type), time };
+    }
+}
+
+void diagnose_cache::save(std::filesystem::path const & path) const
+{
+    auto temp = path;
+    temp += L".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Can't create the diagnose cache file");
+        std::string host;
+        for (auto const & item : entries_)
+        {
+            host.assign(item.first.begin(), item.first.end());
+            out << host << ' ' << static_cast<int>(item.second.type) << ' ' << item.second.time << '\n';
+        }
+        if (!out.flush())
+            throw std::runtime_error("Can't write the diagnose cache file");
+    }
+    std::filesystem::rename(temp, path);
+}
+
+bool diagnose_cache::find(std::wstring const & host, int64_t const now, NETISO_ERROR_TYPE & type) const
+{
+    auto const found = entries_.find(host);
+    if (found == entries_.end() || now < found->second.time || now - found->second.time >= ttl_.count())
+        return false;
+    type = found->second.type;
+    return true;
+}
+
+void diagnose_cache::store(std::wstring const & host, NETISO_ERROR_TYPE const type, int64_t const now)
+{
+    entries_[host] = { type, now };
+}
+
+int64_t diagnose_cache::now() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::vector<diagnose_result> diagnose_hosts(diagnose_source & source, std::vector<std::wstring> const & hosts, diagnose_cache * const cache, network_classifier const * const prescreen, unsigned threads)
+{
+    auto const time_now = diagnose_cache::now();
+    std::vector<diagnose_result> results(hosts.size());
+    std::vector<size_t> misses;
+    ip_address address;
+    for (size_t n = 0; n < hosts.size(); ++n)
+        if (prescreen && ip_address::parse(hosts[n], address) && network_classifier::decides(prescreen->classify(address), results[n].type))
+            results[n].local = true;
+        else if (cache && cache->find(hosts[n], time_now, results[n].type))
+            results[n].cached = true;
+        else
+            misses.push_back(n);
+
+    if (!threads)
+        threads = default_threads;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, misses.size()));
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(threads);
+    auto const worker = [&](unsigned const index)
+        {
+            try
+            {
+                for (size_t n; (n = next.fetch_add(1, std::memory_order_relaxed)) < misses.size(); )
+                {
+                    auto & result = results[misses[n]];
+                    result.result = source.diagnose(hosts[misses[n]].c_str(), result.type);
+                }
+            }
+            catch (...)
+            {
+                errors[index] = std::current_exception();
+            }
+        };
+
+    if (threads)
+    {
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned n = 1; n < threads; ++n)
+            pool.emplace_back(worker, n);
+        worker(0);
+        for (auto & thread : pool)
+            thread.join();
+    }
+
+    for (auto const & error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    if (cache)
+        for (auto const n : misses)
+            if (results[n].result)
+                cache->store(hosts[n], results[n].type, time_now);
+    return results;
+}
+
+}
@@ -0,0 +1,111 @@
+﻿#pragma once
+
+#include "network_classifier.hpp"
+#include "status.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jb {
+
+// Where diagnoses come from. diagnose() is called from several worker threads at once.
+class diagnose_source
+{
+public:
+    virtual ~diagnose_source() = default;
+
+    virtual status diagnose(wchar_t const * host, NETISO_ERROR_TYPE & type) = 0;
+};
+
+#ifdef _WIN32
+
+// NetworkIsolationDiagnoseConnectFailureAndGetInfo.
+class netiso_diagnose_source final : public diagnose_source
+{
+public:
+    status diagnose(wchar_t const * host, NETISO_ERROR_TYPE & type) override;
+};
+
+#endif
+
+wchar_t const * netiso_error_type_name(NETISO_ERROR_TYPE type) noexcept;
+
+enum class host_kind : uint8_t
+{
+    invalid,
+    ipv4,
+    ipv6,
+    name,
+};
+
+// Reduces a config entry to the host alone: drops surrounding blanks, "scheme://", user info,
+// path, port and IPv6 brackets. IP literals get their canonical text form, names are lower-cased
+// without the trailing dot. Non-ASCII names are invalid, they must be given in punycode.
+host_kind normalize_host(std::wstring_view text, std::wstring & result);
+
+// Normalized hosts in first-seen order. Blank lines and '#' comments are skipped.
+struct host_list final
+{
+    std::vector<std::wstring> hosts;
+    std::vector<host_kind> kinds;
+    size_t lines = 0;
+    size_t duplicates = 0;
+    size_t invalid = 0;
+};
+
+host_list read_hosts(std::wistream & in);
+
+// Successful diagnoses by normalized host, each valid for ttl after it was made. The file holds
+// one "<host> <type> <unix time>" line per entry.
+class diagnose_cache final
+{
+public:
+    explicit diagnose_cache(std::chrono::seconds const ttl) noexcept : ttl_(ttl) {}
+
+    // A missing file leaves the cache empty. Malformed lines, hosts not in normalized form and
+    // expired entries are skipped, the rest of the file still loads.
+    void load(std::filesystem::path const & path);
+    // Writes a temporary file next to path and renames it over.
+    void save(std::filesystem::path const & path) const;
+
+    bool find(std::wstring const & host, int64_t now, NETISO_ERROR_TYPE & type) const;
+    void store(std::wstring const & host, NETISO_ERROR_TYPE type, int64_t now);
+
+    size_t size() const noexcept { return entries_.size(); }
+
+    static int64_t now() noexcept;
+
+private:
+    struct entry final
+    {
+        NETISO_ERROR_TYPE type;
+        int64_t time;
+    };
+
+    std::chrono::seconds ttl_;
+    std::unordered_map<std::wstring, entry> entries_;
+};
+
+struct diagnose_result final
+{
+    status result;
+    NETISO_ERROR_TYPE type = NETISO_ERROR_TYPE_NONE;
+    bool cached = false;
+    // Settled by the prescreen classifier without the OS call.
+    bool local = false;
+};
+
+// Diagnoses every host, answering IP literals the prescreen classifier settles locally, then from
+// the cache when it has a fresh entry, storing the new successes into it. The rest is spread over
+// at most threads workers that pull the next host as they finish, since a single diagnosis can
+// wait on name resolution.
+std::vector<diagnose_result> diagnose_hosts(diagnose_source & source, std::vector<std::wstring> const & hosts, diagnose_cache * cache, network_classifier const * prescreen = nullptr, unsigned threads = 0);
+
+}
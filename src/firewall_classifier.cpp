@@ -0,0 +1,357 @@
+﻿#include "config.hpp"
+
+#include "firewall_classifier.hpp"
+#include "firewall_text.hpp"
+
+#include <algorithm>
+#include <cwctype>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace jb {
+
+namespace detail_firewall {
+
+namespace {
+
+uint32_t next_key(uint32_t const key) noexcept { return key + 1; }
+ip_address next_key(ip_address const & key) noexcept { return key.next(); }
+
+template<typename Key>
+Key min_key() noexcept { return Key(); }
+
+}
+
+template<typename Key>
+void interval_dimension<Key>::build(std::vector<range> ranges, size_t const rule_count)
+{
+    words_ = (rule_count + 63) / 64;
+
+    struct event final
+    {
+        Key at;
+        int delta;
+        uint32_t rule;
+    };
+    std::vector<event> events;
+    events.reserve(2 * ranges.size());
+    for (auto const & item : ranges)
+    {
+        events.push_back({ item.first, 1, item.rule });
+        if (next_key(item.last) != item.last)
+            events.push_back({ next_key(item.last), -1, item.rule });
+    }
+    std::sort(events.begin(), events.end(), [](event const & left, event const & right) { return left.at < right.at; });
+
+    std::vector<uint32_t> counts(rule_count);
+    std::vector<uint64_t> current(words_);
+    std::unordered_map<std::string, uint32_t> row_ids;
+    auto const add_interval = [&](Key const & start)
+        {
+            std::string const bytes(reinterpret_cast<char const *>(current.data()), current.size() * sizeof(uint64_t));
+            auto const result = row_ids.emplace(bytes, static_cast<uint32_t>(row_ids.size()));
+            if (result.second)
+                rows_.insert(rows_.end(), current.begin(), current.end());
+            starts_.push_back(start);
+            row_of_.push_back(result.first->second);
+        };
+
+    starts_.clear();
+    row_of_.clear();
+    rows_.clear();
+    if (events.empty() || min_key<Key>() < events.front().at)
+        add_interval(min_key<Key>());
+    for (size_t n = 0; n < events.size(); )
+    {
+        auto const at = events[n].at;
+        for (; n < events.size() && !(at < events[n].at); ++n)
+        {
+            auto const rule = events[n].rule;
+            auto & count = counts[rule];
+            count += events[n].delta;
+            auto const mask = uint64_t(1) << rule % 64;
+            current[rule / 64] = count ? current[rule / 64] | mask : current[rule / 64] & ~mask;
+        }
+        add_interval(at);
+    }
+}
+
+template class interval_dimension<uint32_t>;
+template class interval_dimension<ip_address>;
+
+}
+
+namespace {
+
+using detail_firewall::fold_case;
+using detail_firewall::for_each_item;
+using detail_firewall::interval_dimension;
+using detail_firewall::is_any;
+using detail_firewall::lowest_bit;
+using detail_firewall::parse_port;
+
+// Keywords (RPC, Teredo, ...) match no numeric port.
+void add_ports(std::vector<interval_dimension<uint32_t>::range> & ranges, uint32_t const rule, std::wstring_view const & ports)
+{
+    if (is_any(ports))
+    {
+        ranges.push_back({ 0, 0xFFFF, rule });
+        return;
+    }
+    for_each_item(ports, [&](std::wstring_view const & item)
+        {
+            auto const dash = item.find(L'-');
+            uint16_t first, last;
+            if (dash == std::wstring_view::npos)
+            {
+                if (parse_port(item, first))
+                    ranges.push_back({ first, first, rule });
+            }
+            else if (parse_port(item.substr(0, dash), first) && parse_port(item.substr(dash + 1), last) && first <= last)
+                ranges.push_back({ first, last, rule });
+        });
+}
+
+// Keywords (LocalSubnet, Internet, DNS, ...) need interface state, they match every address.
+void add_addresses(std::vector<interval_dimension<ip_address>::range> & ranges, uint32_t const rule, std::wstring_view const & addresses)
+{
+    auto any = is_any(addresses);
+    if (!any)
+        for_each_item(addresses, [&](std::wstring_view const & item)
+            {
+                ip_range range;
+                if (parse_ip_range(item, range))
+                    ranges.push_back({ range.first, range.last, rule });
+                else if (std::iswalpha(item.front()))
+                    any = true;
+            });
+    if (any)
+        ranges.push_back({ ip_address(), ip_address::max(), rule });
+}
+
+void set(uint64_t * const bits, size_t const n)
+{
+    bits[n / 64] |= uint64_t(1) << n % 64;
+}
+
+// Rules naming the same application or service share an id, whose row gets all of them.
+void add_name(std::unordered_map<std::wstring, uint32_t> & ids, std::vector<std::vector<uint32_t>> & rules, std::wstring_view const & name, uint32_t const rule)
+{
+    auto const result = ids.emplace(fold_case(name), static_cast<uint32_t>(ids.size()));
+    if (result.second)
+        rules.emplace_back();
+    rules[result.first->second].push_back(rule);
+}
+
+size_t profile_index(NET_FW_PROFILE_TYPE2 const profile)
+{
+    for (size_t n = 0; n < std::size(firewall_profiles); ++n)
+        if (profile == firewall_profiles[n])
+            return n;
+    throw std::runtime_error("Packet profile must be exactly one of domain, private or public");
+}
+
+}
+
+firewall_classifier::firewall_classifier(firewall_rule_snapshot const & snapshot, firewall_defaults const & defaults) :
+    defaults_(defaults)
+{
+    if (!snapshot.frozen())
+        throw std::runtime_error("Firewall rule snapshot is not frozen");
+
+    for (uint32_t n = 0, count = static_cast<uint32_t>(snapshot.size()); n < count; ++n)
+        if (snapshot.enabled(n) && snapshot.action(n) == NET_FW_ACTION_BLOCK)
+            rules_.push_back(n);
+    block_count_ = rules_.size();
+    for (uint32_t n = 0, count = static_cast<uint32_t>(snapshot.size()); n < count; ++n)
+        if (snapshot.enabled(n) && snapshot.action(n) != NET_FW_ACTION_BLOCK)
+            rules_.push_back(n);
+    words_ = (rules_.size() + 63) / 64;
+
+    for (auto const rule : rules_)
+    {
+        auto const protocol = snapshot.protocol(rule);
+        if (protocol < long(protocol_count) && !protocol_class_[protocol])
+            protocol_class_[protocol] = static_cast<uint8_t>(protocol_classes_++);
+    }
+    prefilter_.assign(2 * 3 * protocol_classes_ * words_, 0);
+
+    std::vector<interval_dimension<uint32_t>::range> local_ports, remote_ports;
+    std::vector<interval_dimension<ip_address>::range> local_addresses, remote_addresses;
+    std::vector<std::vector<uint32_t>> application_rules, service_rules;
+    std::vector<uint32_t> any_application_rules, any_service_rules, every_service_rules;
+
+    for (uint32_t n = 0; n < rules_.size(); ++n)
+    {
+        auto const rule = rules_[n];
+        auto const protocol = snapshot.protocol(rule);
+        auto const profiles = snapshot.profiles(rule);
+        for (size_t direction = 0; direction < 2; ++direction)
+        {
+            if ((direction == 1) != (snapshot.direction(rule) == NET_FW_RULE_DIR_OUT))
+                continue;
+            for (size_t profile = 0; profile < 3; ++profile)
+            {
+                if (!(profiles & firewall_profiles[profile]))
+                    continue;
+                if (protocol < long(protocol_count))
+                    set(prefilter_.data() + ((direction * 3 + profile) * protocol_classes_ + protocol_class_[protocol]) * words_, n);
+                else
+                    for (size_t protocol_class = 0; protocol_class < protocol_classes_; ++protocol_class)
+                        set(prefilter_.data() + ((direction * 3 + profile) * protocol_classes_ + protocol_class) * words_, n);
+            }
+        }
+
+        auto const application = snapshot.application(rule);
+        if (is_any(application))
+            any_application_rules.push_back(n);
+        else
+            add_name(application_ids_, application_rules, application, n);
+
+        auto const service = snapshot.service(rule);
+        if (service == L"*")
+            every_service_rules.push_back(n);
+        else if (is_any(service))
+            any_service_rules.push_back(n);
+        else
+            add_name(service_ids_, service_rules, service, n);
+
+        add_ports(local_ports, n, snapshot.local_ports(rule));
+        add_ports(remote_ports, n, snapshot.remote_ports(rule));
+        add_addresses(local_addresses, n, snapshot.local_addresses(rule));
+        add_addresses(remote_addresses, n, snapshot.remote_addresses(rule));
+    }
+
+    applications_.assign((application_rules.size() + 1) * words_, 0);
+    for (size_t id = 0; id <= application_rules.size(); ++id)
+    {
+        auto const row = applications_.data() + id * words_;
+        for (auto const n : any_application_rules)
+            set(row, n);
+        if (id < application_rules.size())
+            for (auto const n : application_rules[id])
+                set(row, n);
+    }
+
+    services_.assign((service_rules.size() + 2) * words_, 0);
+    for (size_t id = 0; id <= service_rules.size() + 1; ++id)
+    {
+        auto const row = services_.data() + id * words_;
+        for (auto const n : any_service_rules)
+            set(row, n);
+        if (id <= service_rules.size())
+            for (auto const n : every_service_rules)
+                set(row, n);
+        if (id < service_rules.size())
+            for (auto const n : service_rules[id])
+                set(row, n);
+    }
+
+    local_ports_.build(std::move(local_ports), rules_.size());
+    remote_ports_.build(std::move(remote_ports), rules_.size());
+    local_addresses_.build(std::move(local_addresses), rules_.size());
+    remote_addresses_.build(std::move(remote_addresses), rules_.size());
+}
+
+uint32_t firewall_classifier::application_id(std::wstring_view const & path) const
+{
+    auto const found = application_ids_.find(fold_case(path));
+    return found == application_ids_.end() ? firewall_packet::no_application : found->second;
+}
+
+uint32_t firewall_classifier::service_id(std::wstring_view const & name) const
+{
+    auto const found = service_ids_.find(fold_case(name));
+    return found == service_ids_.end() ? static_cast<uint32_t>(service_ids_.size()) : found->second;
+}
+
+firewall_decision firewall_classifier::classify(firewall_packet const & packet) const
+{
+    auto const profile = profile_index(packet.profile);
+    auto const & defaults = defaults_[profile];
+    if (!defaults.enabled)
+        return { NET_FW_ACTION_ALLOW, firewall_decision::source_type::firewall_disabled, 0 };
+    auto const outbound = packet.direction == NET_FW_RULE_DIR_OUT;
+    if (!outbound && defaults.block_all_inbound)
+        return { NET_FW_ACTION_BLOCK, firewall_decision::source_type::block_all_inbound, 0 };
+
+    auto const application = packet.application < application_ids_.size() ? packet.application : static_cast<uint32_t>(application_ids_.size());
+    auto const service = packet.service <= service_ids_.size() ? packet.service : static_cast<uint32_t>(service_ids_.size() + 1);
+    uint64_t const * const rows[] =
+    {
+        prefilter(outbound ? 1 : 0, profile, packet.protocol < protocol_count ? protocol_class_[packet.protocol] : 0),
+        applications_.data() + size_t(application) * words_,
+        services_.data() + size_t(service) * words_,
+        local_ports_.lookup(packet.local_port),
+        remote_ports_.lookup(packet.remote_port),
+        local_addresses_.lookup(packet.local_address),
+        remote_addresses_.lookup(packet.remote_address),
+    };
+
+    // Four words per step keep the AND loop branch-free and vectorizable.
+    size_t const block = 4;
+    for (size_t first = 0; first < words_; first += block)
+    {
+        auto const last = std::min(first + block, words_);
+        uint64_t candidates[block] = {};
+        uint64_t any = 0;
+        for (auto w = first; w < last; ++w)
+        {
+            auto const word = rows[0][w] & rows[1][w] & rows[2][w] & rows[3][w] & rows[4][w] & rows[5][w] & rows[6][w];
+            candidates[w - first] = word;
+            any |= word;
+        }
+        if (!any)
+            continue;
+        for (auto w = first; w < last; ++w)
+            if (auto const word = candidates[w - first])
+            {
+                auto const n = w * 64 + lowest_bit(word);
+                return { n < block_count_ ? NET_FW_ACTION_BLOCK : NET_FW_ACTION_ALLOW, firewall_decision::source_type::rule, rules_[n] };
+            }
+    }
+    return { outbound ? defaults.outbound : defaults.inbound, firewall_decision::source_type::default_action, 0 };
+}
+
+void firewall_classifier::classify(firewall_packet const * const packets, size_t const count, firewall_decision * const results, unsigned threads) const
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, (count + min_packets_per_thread - 1) / min_packets_per_thread));
+    threads = std::max(1u, threads);
+
+    std::vector<std::exception_ptr> errors(threads);
+    auto const worker = [&](unsigned const index)
+        {
+            try
+            {
+                auto const first = count * index / threads;
+                auto const last = count * (index + 1) / threads;
+                for (auto n = first; n < last; ++n)
+                    results[n] = classify(packets[n]);
+            }
+            catch (...)
+            {
+                errors[index] = std::current_exception();
+            }
+        };
+
+    {
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned n = 1; n < threads; ++n)
+            pool.emplace_back(worker, n);
+        worker(0);
+        for (auto & thread : pool)
+            thread.join();
+    }
+
+    for (auto const & error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+}
@@ -0,0 +1,139 @@
+﻿#pragma once
+
+#include "firewall_profile.hpp"
+#include "firewall_rules.hpp"
+#include "ip_address.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jb {
+
+namespace detail_firewall {
+
+// One axis of the rule space cut into elementary intervals: every interval maps to the bitset of
+// rules covering all of it. Identical bitsets are stored once, so wide, overlapping ranges stay
+// cheap. A lookup is one binary search.
+template<typename Key>
+class interval_dimension final
+{
+public:
+    struct range final
+    {
+        Key first;
+        Key last;
+        uint32_t rule;
+    };
+
+    void build(std::vector<range> ranges, size_t rule_count);
+
+    uint64_t const * lookup(Key const & key) const
+    {
+        auto const n = std::upper_bound(starts_.begin(), starts_.end(), key) - starts_.begin() - 1;
+        return rows_.data() + size_t(row_of_[n]) * words_;
+    }
+
+    size_t interval_count() const noexcept { return starts_.size(); }
+    size_t row_count() const noexcept { return words_ ? rows_.size() / words_ : 0; }
+
+private:
+    size_t words_ = 0;
+    std::vector<Key> starts_;
+    std::vector<uint32_t> row_of_;
+    std::vector<uint64_t> rows_;
+};
+
+}
+
+struct firewall_packet final
+{
+    static uint32_t const no_application = ~0u;
+    static uint32_t const no_service = ~0u;
+
+    NET_FW_RULE_DIRECTION direction;
+    NET_FW_PROFILE_TYPE2 profile;
+    uint16_t protocol;
+    ip_address local_address;
+    ip_address remote_address;
+    uint16_t local_port;
+    uint16_t remote_port;
+    // From firewall_classifier::application_id; no_application matches only rules without one.
+    uint32_t application = no_application;
+    // From firewall_classifier::service_id for traffic of a service; no_service matches only rules
+    // without one.
+    uint32_t service = no_service;
+};
+
+struct firewall_decision final
+{
+    enum class source_type : uint8_t
+    {
+        rule,
+        default_action,
+        block_all_inbound,
+        firewall_disabled,
+    };
+
+    NET_FW_ACTION action;
+    source_type source;
+    // Snapshot index of the deciding rule when source is rule.
+    uint32_t rule;
+};
+
+// The enabled rules of a snapshot plus the profile defaults compiled for offline evaluation. Every
+// field of a packet selects a precomputed rule bitset (direction/profile/protocol prefilter,
+// application, service, local and remote port intervals, local and remote address intervals) and
+// the candidates are the AND of those rows. A rule naming a service matches only that service's
+// traffic, a "*" service matches the traffic of every service. Block rules are laid out before
+// allow rules, so the first candidate found decides, as block wins over allow. Address keywords
+// such as LocalSubnet match every address.
+class firewall_classifier final
+{
+public:
+    firewall_classifier(firewall_rule_snapshot const & snapshot, firewall_defaults const & defaults);
+
+    uint32_t application_id(std::wstring_view const & path) const;
+    // Services no rule names share one id, which only rules without a service or with "*" match.
+    uint32_t service_id(std::wstring_view const & name) const;
+    size_t rule_count() const noexcept { return rules_.size(); }
+
+    firewall_decision classify(firewall_packet const & packet) const;
+    void classify(firewall_packet const * packets, size_t count, firewall_decision * results, unsigned threads = 0) const;
+
+private:
+    static size_t const protocol_count = 256;
+    static size_t const min_packets_per_thread = 4096;
+
+    uint64_t const * prefilter(size_t direction, size_t profile, size_t protocol_class) const
+    {
+        return prefilter_.data() + ((direction * 3 + profile) * protocol_classes_ + protocol_class) * words_;
+    }
+
+    firewall_defaults defaults_;
+    size_t words_ = 0;
+    size_t block_count_ = 0;
+    // Compiled index to snapshot index.
+    std::vector<uint32_t> rules_;
+
+    size_t protocol_classes_ = 1;
+    uint8_t protocol_class_[protocol_count] = {};
+    std::vector<uint64_t> prefilter_;
+
+    std::unordered_map<std::wstring, uint32_t> application_ids_;
+    // Row per application id, then the row for no_application.
+    std::vector<uint64_t> applications_;
+    std::unordered_map<std::wstring, uint32_t> service_ids_;
+    // Row per service id, then the row of the services no rule names, then the row for no_service.
+    std::vector<uint64_t> services_;
+
+    detail_firewall::interval_dimension<uint32_t> local_ports_;
+    detail_firewall::interval_dimension<uint32_t> remote_ports_;
+    detail_firewall::interval_dimension<ip_address> local_addresses_;
+    detail_firewall::interval_dimension<ip_address> remote_addresses_;
+};
+
+}
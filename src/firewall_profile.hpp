@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <array>
+#include <ostream>
+#include <utility>
+
+#ifdef _WIN32
+
+#include "instrument.hpp"
+#include "output.hpp"
+#include "status.hpp"
+
+#include <netfw.h>
+
+#else
+
+// The netfw.h values, so snapshots, fleets, rule sets and classifiers build without the Windows SDK.
+enum NET_FW_ACTION
+{
+    NET_FW_ACTION_BLOCK = 0,
+    NET_FW_ACTION_ALLOW = 1,
+    NET_FW_ACTION_MAX = 2,
+};
+
+enum NET_FW_RULE_DIRECTION
+{
+    NET_FW_RULE_DIR_IN = 1,
+    NET_FW_RULE_DIR_OUT = 2,
+    NET_FW_RULE_DIR_MAX = 3,
+};
+
+enum NET_FW_IP_PROTOCOL
+{
+    NET_FW_IP_PROTOCOL_TCP = 6,
+    NET_FW_IP_PROTOCOL_UDP = 17,
+    NET_FW_IP_PROTOCOL_ANY = 256,
+};
+
+enum NET_FW_PROFILE_TYPE2
+{
+    NET_FW_PROFILE2_DOMAIN = 0x1,
+    NET_FW_PROFILE2_PRIVATE = 0x2,
+    NET_FW_PROFILE2_PUBLIC = 0x4,
+    NET_FW_PROFILE2_ALL = 0x7FFFFFFF,
+};
+
+#endif
+
+namespace jb {
+
+// What a profile does with traffic no rule matches.
+struct firewall_profile_defaults final
+{
+    bool enabled = true;
+    bool block_all_inbound = false;
+    NET_FW_ACTION inbound = NET_FW_ACTION_BLOCK;
+    NET_FW_ACTION outbound = NET_FW_ACTION_ALLOW;
+};
+
+// Indexed by domain, private, public. Value-initialized entries are the Windows defaults.
+using firewall_defaults = std::array<firewall_profile_defaults, 3>;
+
+NET_FW_PROFILE_TYPE2 const firewall_profiles[] = { NET_FW_PROFILE2_DOMAIN, NET_FW_PROFILE2_PRIVATE, NET_FW_PROFILE2_PUBLIC };
+// Names of firewall_profiles, as printed and parsed.
+wchar_t const * const firewall_profile_names[] = { L"domain", L"private", L"public" };
+
+#ifdef _WIN32
+
+// Profile property reads shared by the firewall probe and the benchmarks. Policy is INetFwPolicy2
+// or anything with the same get_* members. Every property read is a profile_setting record.
+template <typename Fn>
+void check_VARIANT_BOOL(std::wostream & out, LPCWSTR const profile, LPCWSTR const name, Fn && fn)
+{
+    out << L"  " << name << L": ";
+    VARIANT_BOOL is_enabled;
+    if (is_succeeded(out, trace_call(api_call::INetFwPolicy2_get, [&] { return status::hresult(std::forward<Fn>(fn)(&is_enabled)); })))
+    {
+        out << (is_enabled ? L"enabled" : L"disabled");
+        output_record(out, L"profile_setting").text(L"profile", profile).text(L"setting", name).flag(L"value", is_enabled != VARIANT_FALSE);
+    }
+}
+
+template <typename Fn>
+void check_NET_FW_ACTION(std::wostream & out, LPCWSTR const profile, LPCWSTR const name, Fn && fn)
+{
+    out << L"  " << name << L": ";
+    NET_FW_ACTION action;
+    if (is_succeeded(out, trace_call(api_call::INetFwPolicy2_get, [&] { return status::hresult(std::forward<Fn>(fn)(&action)); })))
+    {
+        auto const verdict =
+            action == NET_FW_ACTION_BLOCK ? L"block" :
+            action == NET_FW_ACTION_ALLOW ? L"allow" : L"???";
+        out << verdict;
+        output_record(out, L"profile_setting").text(L"profile", profile).text(L"setting", name).text(L"value", verdict);
+    }
+}
+
+template <typename Policy>
+void check_profile(std::wostream & out, Policy * const net_fw_policy2, NET_FW_PROFILE_TYPE2 const net_fw_profile_type2)
+{
+    auto profile = L"multiple";
+    for (size_t n = 0; n < std::size(firewall_profiles); ++n)
+        if (net_fw_profile_type2 == firewall_profiles[n])
+            profile = firewall_profile_names[n];
+    out << L"FirewallProfileType:" <<
+        (net_fw_profile_type2 & NET_FW_PROFILE2_PUBLIC  ? L" public"  : L"") <<
+        (net_fw_profile_type2 & NET_FW_PROFILE2_DOMAIN  ? L" domain"  : L"") <<
+        (net_fw_profile_type2 & NET_FW_PROFILE2_PRIVATE ? L" private" : L"");
+    output_record(out, L"profile").text(L"profile", profile).number(L"type", static_cast<uint32_t>(net_fw_profile_type2));
+
+    check_VARIANT_BOOL(out, profile, L"FirewallEnabled"                             , [=](auto is_enabled) { return net_fw_policy2->get_FirewallEnabled                             (net_fw_profile_type2, is_enabled); });
+    check_VARIANT_BOOL(out, profile, L"BlockAllInboundTraffic"                      , [=](auto is_enabled) { return net_fw_policy2->get_BlockAllInboundTraffic                      (net_fw_profile_type2, is_enabled); });
+    check_VARIANT_BOOL(out, profile, L"NotificationsDisabled"                       , [=](auto is_enabled) { return net_fw_policy2->get_NotificationsDisabled                       (net_fw_profile_type2, is_enabled); });
+    check_VARIANT_BOOL(out, profile, L"UnicastResponsesToMulticastBroadcastDisabled", [=](auto is_enabled) { return net_fw_policy2->get_UnicastResponsesToMulticastBroadcastDisabled(net_fw_profile_type2, is_enabled); });
+
+    check_NET_FW_ACTION(out, profile, L"DefaultInboundAction" , [=](auto action) { return net_fw_policy2->get_DefaultInboundAction (net_fw_profile_type2, action); });
+    check_NET_FW_ACTION(out, profile, L"DefaultOutboundAction", [=](auto action) { return net_fw_policy2->get_DefaultOutboundAction(net_fw_profile_type2, action); });
+}
+
+// Properties that fail to read keep their defaults.
+template <typename Policy>
+firewall_defaults read_firewall_defaults(Policy * const net_fw_policy2)
+{
+    firewall_defaults result;
+    for (size_t n = 0; n < result.size(); ++n)
+    {
+        auto & defaults = result[n];
+        auto const profile = firewall_profiles[n];
+        VARIANT_BOOL value;
+        if (trace_call(api_call::INetFwPolicy2_get, [&] { return status::hresult(net_fw_policy2->get_FirewallEnabled(profile, &value)); }))
+            defaults.enabled = value != VARIANT_FALSE;
+        if (trace_call(api_call::INetFwPolicy2_get, [&] { return status::hresult(net_fw_policy2->get_BlockAllInboundTraffic(profile, &value)); }))
+            defaults.block_all_inbound = value != VARIANT_FALSE;
+        NET_FW_ACTION action;
+        if (trace_call(api_call::INetFwPolicy2_get, [&] { return status::hresult(net_fw_policy2->get_DefaultInboundAction(profile, &action)); }))
+            defaults.inbound = action;
+        if (trace_call(api_call::INetFwPolicy2_get, [&] { return status::hresult(net_fw_policy2->get_DefaultOutboundAction(profile, &action)); }))
+            defaults.outbound = action;
+    }
+    return result;
+}
+
+#endif
+
+}
@@ -0,0 +1,413 @@
+﻿#include "config.hpp"
+
+#include "firewall_rules.hpp"
+#include "firewall_text.hpp"
+
+#ifdef _WIN32
+#include "instrument.hpp"
+#include "on_exit.hpp"
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace jb {
+
+namespace {
+
+using detail_firewall::fold_case;
+using detail_firewall::for_each_item;
+using detail_firewall::is_any;
+using detail_firewall::lowest_bit;
+using detail_firewall::parse_port;
+using detail_firewall::trim;
+
+long const profile_bits[] = { NET_FW_PROFILE2_DOMAIN, NET_FW_PROFILE2_PRIVATE, NET_FW_PROFILE2_PUBLIC };
+
+long parse_protocol(std::wstring_view const & value)
+{
+    if (is_any(value))
+        return NET_FW_IP_PROTOCOL_ANY;
+    if (value == L"TCP")
+        return NET_FW_IP_PROTOCOL_TCP;
+    if (value == L"UDP")
+        return NET_FW_IP_PROTOCOL_UDP;
+    if (value == L"ICMPv4")
+        return 1;
+    if (value == L"ICMPv6")
+        return 58;
+    uint16_t number;
+    return parse_port(value, number) ? long(number) : long(NET_FW_IP_PROTOCOL_ANY);
+}
+
+long parse_profiles(std::wstring_view const & value)
+{
+    if (is_any(value))
+        return NET_FW_PROFILE2_ALL;
+    long result = 0;
+    for_each_item(value, [&](std::wstring_view const & item)
+        {
+            if (item == L"Domain")
+                result |= NET_FW_PROFILE2_DOMAIN;
+            else if (item == L"Private")
+                result |= NET_FW_PROFILE2_PRIVATE;
+            else if (item == L"Public")
+                result |= NET_FW_PROFILE2_PUBLIC;
+        });
+    return result;
+}
+
+// Text fields of a rule read from an export file; the record views point here.
+struct rule_text final
+{
+    std::wstring name;
+    std::wstring application;
+    std::wstring service;
+    std::wstring grouping;
+    std::wstring local_ports;
+    std::wstring remote_ports;
+    std::wstring local_addresses;
+    std::wstring remote_addresses;
+    firewall_rule rule;
+
+    firewall_rule const & record()
+    {
+        rule.name = name;
+        rule.application = application;
+        rule.service = service;
+        rule.grouping = grouping;
+        rule.local_ports = local_ports;
+        rule.remote_ports = remote_ports;
+        rule.local_addresses = local_addresses;
+        rule.remote_addresses = remote_addresses;
+        return rule;
+    }
+};
+
+#ifdef _WIN32
+
+// Empty string when the property is missing or the call fails.
+template<typename Fn>
+std::wstring get_BSTR(Fn && fn)
+{
+    BSTR value = nullptr;
+    if (!trace_call(api_call::INetFwRule_get, [&] { return status::hresult(std::forward<Fn>(fn)(&value)); }) || !value)
+        return std::wstring();
+    auto && free_value = make_on_exit_scope([value] { SysFreeString(value); });
+    return std::wstring(value, SysStringLen(value));
+}
+
+template<typename T, typename Fn>
+T get_property(T const default_value, Fn && fn)
+{
+    T value;
+    return trace_call(api_call::INetFwRule_get, [&] { return status::hresult(std::forward<Fn>(fn)(&value)); }) ? value : default_value;
+}
+
+void add_rule(firewall_rule_snapshot & snapshot, INetFwRule * const rule)
+{
+    rule_text text;
+    text.name             = get_BSTR([=](auto value) { return rule->get_Name            (value); });
+    text.application      = get_BSTR([=](auto value) { return rule->get_ApplicationName (value); });
+    text.service          = get_BSTR([=](auto value) { return rule->get_serviceName     (value); });
+    text.grouping         = get_BSTR([=](auto value) { return rule->get_Grouping        (value); });
+    text.local_ports      = get_BSTR([=](auto value) { return rule->get_LocalPorts      (value); });
+    text.remote_ports     = get_BSTR([=](auto value) { return rule->get_RemotePorts     (value); });
+    text.local_addresses  = get_BSTR([=](auto value) { return rule->get_LocalAddresses  (value); });
+    text.remote_addresses = get_BSTR([=](auto value) { return rule->get_RemoteAddresses (value); });
+    text.rule.protocol  = get_property(long(NET_FW_IP_PROTOCOL_ANY), [=](auto value) { return rule->get_Protocol (value); });
+    text.rule.direction = get_property(NET_FW_RULE_DIR_IN           , [=](auto value) { return rule->get_Direction(value); });
+    text.rule.action    = get_property(NET_FW_ACTION_ALLOW          , [=](auto value) { return rule->get_Action   (value); });
+    text.rule.profiles  = get_property(long(NET_FW_PROFILE2_ALL)    , [=](auto value) { return rule->get_Profiles (value); });
+    text.rule.enabled   = get_property(VARIANT_BOOL(VARIANT_FALSE)  , [=](auto value) { return rule->get_Enabled  (value); }) != VARIANT_FALSE;
+    snapshot.add(text.record());
+}
+
+#endif
+
+}
+
+firewall_rule_snapshot::string_id firewall_rule_snapshot::intern(std::wstring_view const & value)
+{
+    auto const found = string_ids_.find(value);
+    if (found != string_ids_.end())
+        return found->second;
+    auto const id = static_cast<string_id>(strings_.size());
+    strings_.emplace_back(value);
+    string_ids_.emplace(strings_.back(), id);
+    return id;
+}
+
+void firewall_rule_snapshot::check_frozen(bool const expected) const
+{
+    if (frozen_ != expected)
+        throw std::runtime_error(expected ? "Firewall rule snapshot is not frozen" : "Firewall rule snapshot is frozen");
+}
+
+void firewall_rule_snapshot::add(firewall_rule const & rule)
+{
+    check_frozen(false);
+    names_.push_back(intern(rule.name));
+    applications_.push_back(intern(rule.application));
+    services_.push_back(intern(rule.service));
+    groupings_.push_back(intern(rule.grouping));
+    local_ports_.push_back(intern(rule.local_ports));
+    remote_ports_.push_back(intern(rule.remote_ports));
+    local_addresses_.push_back(intern(rule.local_addresses));
+    remote_addresses_.push_back(intern(rule.remote_addresses));
+    protocols_.push_back(static_cast<uint16_t>(rule.protocol));
+    directions_.push_back(static_cast<uint8_t>(rule.direction));
+    actions_.push_back(static_cast<uint8_t>(rule.action));
+    profiles_.push_back(static_cast<uint32_t>(rule.profiles));
+    enabled_.push_back(rule.enabled ? 1 : 0);
+}
+
+// Comma separated ports and first-last ranges. "*"/"Any" matches every port; keywords such as RPC
+// or Teredo match no numeric port.
+void firewall_rule_snapshot::index_ports(uint32_t const rule, std::wstring_view const ports)
+{
+    if (is_any(ports))
+    {
+        set(any_port_, rule);
+        return;
+    }
+    for_each_item(ports, [&](std::wstring_view const & item)
+        {
+            auto const dash = item.find(L'-');
+            uint16_t first, last;
+            if (dash == std::wstring_view::npos)
+            {
+                if (parse_port(item, first))
+                    single_ports_.emplace_back(first, rule);
+            }
+            else if (parse_port(item.substr(0, dash), first) && parse_port(item.substr(dash + 1), last) && first <= last)
+                port_ranges_.push_back({ first, last, rule });
+        });
+}
+
+void firewall_rule_snapshot::freeze()
+{
+    check_frozen(false);
+    frozen_ = true;
+
+    any_application_ = make_bitset();
+    any_port_ = make_bitset();
+    inbound_ = make_bitset();
+    outbound_ = make_bitset();
+    for (auto & bits : by_profile_)
+        bits = make_bitset();
+    enabled_bits_ = make_bitset();
+
+    for (uint32_t n = 0, count = static_cast<uint32_t>(size()); n < count; ++n)
+    {
+        auto const application = strings_[applications_[n]];
+        if (is_any(application))
+            set(any_application_, n);
+        else
+            by_application_[fold_case(application)].push_back(n);
+
+        index_ports(n, strings_[local_ports_[n]]);
+
+        auto & protocol = by_protocol_[protocols_[n]];
+        if (protocol.empty())
+            protocol = make_bitset();
+        set(protocol, n);
+
+        set(directions_[n] == NET_FW_RULE_DIR_OUT ? outbound_ : inbound_, n);
+        for (size_t bit = 0; bit < std::size(profile_bits); ++bit)
+            if (profiles_[n] & profile_bits[bit])
+                set(by_profile_[bit], n);
+        if (enabled_[n])
+            set(enabled_bits_, n);
+    }
+
+    std::sort(single_ports_.begin(), single_ports_.end());
+    std::sort(port_ranges_.begin(), port_ranges_.end(), [](port_range const & left, port_range const & right) { return left.first < right.first; });
+}
+
+void firewall_rule_snapshot::intersect(bitset & bits, bitset const & other)
+{
+    for (size_t n = 0; n < bits.size(); ++n)
+        bits[n] &= other[n];
+}
+
+std::vector<uint32_t> firewall_rule_snapshot::find(firewall_rule_query const & query) const
+{
+    check_frozen(true);
+
+    bitset bits(make_bitset().size(), ~uint64_t(0));
+    if (auto const tail = size() % 64)
+        bits.back() = (uint64_t(1) << tail) - 1;
+
+    if (query.application)
+    {
+        auto matches = any_application_;
+        auto const found = by_application_.find(fold_case(*query.application));
+        if (found != by_application_.end())
+            for (auto const rule : found->second)
+                set(matches, rule);
+        intersect(bits, matches);
+    }
+
+    if (query.local_port)
+    {
+        auto const port = *query.local_port;
+        auto matches = any_port_;
+        auto const singles = std::equal_range(single_ports_.begin(), single_ports_.end(), std::make_pair(port, uint32_t(0)),
+            [](auto const & left, auto const & right) { return left.first < right.first; });
+        for (auto it = singles.first; it != singles.second; ++it)
+            set(matches, it->second);
+        for (auto const & range : port_ranges_)
+        {
+            if (range.first > port)
+                break;
+            if (range.last >= port)
+                set(matches, range.rule);
+        }
+        intersect(bits, matches);
+    }
+
+    if (query.protocol)
+    {
+        auto matches = make_bitset();
+        for (auto const protocol : { *query.protocol, long(NET_FW_IP_PROTOCOL_ANY) })
+        {
+            auto const found = by_protocol_.find(protocol);
+            if (found != by_protocol_.end())
+                for (size_t n = 0; n < matches.size(); ++n)
+                    matches[n] |= found->second[n];
+        }
+        intersect(bits, matches);
+    }
+
+    if (query.direction)
+        intersect(bits, *query.direction == NET_FW_RULE_DIR_OUT ? outbound_ : inbound_);
+
+    if (query.profiles)
+    {
+        auto matches = make_bitset();
+        for (size_t bit = 0; bit < std::size(profile_bits); ++bit)
+            if (query.profiles & profile_bits[bit])
+                for (size_t n = 0; n < matches.size(); ++n)
+                    matches[n] |= by_profile_[bit][n];
+        intersect(bits, matches);
+    }
+
+    if (query.enabled_only)
+        intersect(bits, enabled_bits_);
+
+    std::vector<uint32_t> result;
+    for (size_t n = 0; n < bits.size(); ++n)
+        for (auto word = bits[n]; word; word &= word - 1)
+            result.push_back(static_cast<uint32_t>(n * 64 + lowest_bit(word)));
+    return result;
+}
+
+void firewall_rule_snapshot::load(std::wistream & in)
+{
+    std::optional<rule_text> text;
+    auto const flush = [&]
+        {
+            if (text)
+                add(text->record());
+            text.reset();
+        };
+
+    std::wstring line;
+    while (std::getline(in, line))
+    {
+        auto const colon = line.find(L':');
+        if (colon == std::wstring::npos)
+            continue;
+        auto const key = trim(std::wstring_view(line).substr(0, colon));
+        auto const value = trim(std::wstring_view(line).substr(colon + 1));
+        if (key == L"Rule Name")
+        {
+            flush();
+            text.emplace();
+            text->name = value;
+            continue;
+        }
+        if (!text)
+            continue;
+        if (key == L"Enabled")
+            text->rule.enabled = value == L"Yes";
+        else if (key == L"Direction")
+            text->rule.direction = value == L"Out" ? NET_FW_RULE_DIR_OUT : NET_FW_RULE_DIR_IN;
+        else if (key == L"Profiles")
+            text->rule.profiles = parse_profiles(value);
+        else if (key == L"Grouping")
+            text->grouping = value;
+        else if (key == L"LocalIP")
+            text->local_addresses = value;
+        else if (key == L"RemoteIP")
+            text->remote_addresses = value;
+        else if (key == L"Protocol")
+            text->rule.protocol = parse_protocol(value);
+        else if (key == L"LocalPort")
+            text->local_ports = value;
+        else if (key == L"RemotePort")
+            text->remote_ports = value;
+        else if (key == L"Program")
+            text->application = is_any(value) ? std::wstring_view() : value;
+        else if (key == L"Service")
+            text->service = value;
+        else if (key == L"Action")
+            text->rule.action = value == L"Block" ? NET_FW_ACTION_BLOCK : NET_FW_ACTION_ALLOW;
+    }
+    flush();
+}
+
+#ifdef _WIN32
+
+status load_firewall_rules(INetFwPolicy2 * const policy, firewall_rule_snapshot & snapshot)
+{
+    INetFwRules * rules;
+    auto result = trace_call(api_call::INetFwPolicy2_get_Rules, [&] { return status::hresult(policy->get_Rules(&rules)); });
+    if (!result)
+        return result;
+    auto && free_rules = make_on_exit_scope([rules] { rules->Release(); });
+
+    IUnknown * unknown;
+    result = trace_call(api_call::INetFwRules_get__NewEnum, [&] { return status::hresult(rules->get__NewEnum(&unknown)); });
+    if (!result)
+        return result;
+    auto && free_unknown = make_on_exit_scope([unknown] { unknown->Release(); });
+
+    IEnumVARIANT * variants;
+    result = trace_call(api_call::IUnknown_QueryInterface, [&] { return status::hresult(unknown->QueryInterface(__uuidof(IEnumVARIANT), reinterpret_cast<void **>(&variants))); });
+    if (!result)
+        return result;
+    auto && free_variants = make_on_exit_scope([variants] { variants->Release(); });
+
+    firewall_rule_snapshot loaded;
+    ULONG const batch_size = 256;
+    VARIANT batch[batch_size];
+    for (;;)
+    {
+        ULONG fetched = 0;
+        result = trace_call(api_call::IEnumVARIANT_Next, [&] { return status::hresult(variants->Next(batch_size, batch, &fetched)); });
+        if (!result)
+            return result;
+        for (ULONG n = 0; n < fetched; ++n)
+        {
+            auto && clear_variant = make_on_exit_scope([&batch, n] { VariantClear(&batch[n]); });
+            if (batch[n].vt != VT_DISPATCH || !batch[n].pdispVal)
+                continue;
+            INetFwRule * rule;
+            if (FAILED(batch[n].pdispVal->QueryInterface(__uuidof(INetFwRule), reinterpret_cast<void **>(&rule))))
+                continue;
+            auto && free_rule = make_on_exit_scope([rule] { rule->Release(); });
+            add_rule(loaded, rule);
+        }
+        if (result.code() == S_FALSE || fetched < batch_size)
+            break;
+    }
+    loaded.freeze();
+    snapshot = std::move(loaded);
+    return status();
+}
+
+#endif
+
+}
@@ -0,0 +1,141 @@
+﻿#pragma once
+
+#include "firewall_profile.hpp"
+#include "status.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jb {
+
+// One rule as read from INetFwRule or from an export file. The views only need to live until
+// firewall_rule_snapshot::add returns.
+struct firewall_rule final
+{
+    std::wstring_view name;
+    std::wstring_view application;
+    std::wstring_view service;
+    std::wstring_view grouping;
+    std::wstring_view local_ports;
+    std::wstring_view remote_ports;
+    std::wstring_view local_addresses;
+    std::wstring_view remote_addresses;
+    long protocol = NET_FW_IP_PROTOCOL_ANY;
+    NET_FW_RULE_DIRECTION direction = NET_FW_RULE_DIR_IN;
+    NET_FW_ACTION action = NET_FW_ACTION_ALLOW;
+    long profiles = NET_FW_PROFILE2_ALL;
+    bool enabled = true;
+};
+
+// Every set field must match. A rule without an application or with any local port matches every
+// application or port; profiles is a NET_FW_PROFILE2_* mask, zero matches every profile.
+struct firewall_rule_query final
+{
+    std::optional<std::wstring> application;
+    std::optional<uint16_t> local_port;
+    std::optional<long> protocol;
+    std::optional<NET_FW_RULE_DIRECTION> direction;
+    long profiles = 0;
+    bool enabled_only = false;
+};
+
+// Columnar copy of the firewall rule set: one array per property, strings interned once. freeze()
+// builds the indexes, after which find() answers a query with a few bitset passes instead of a
+// walk over the COM collection.
+class firewall_rule_snapshot final
+{
+public:
+    using string_id = uint32_t;
+
+    void add(firewall_rule const & rule);
+    void freeze();
+
+    bool frozen() const noexcept { return frozen_; }
+    size_t size() const noexcept { return names_.size(); }
+    size_t string_count() const noexcept { return strings_.size(); }
+
+    std::wstring_view name(size_t const n) const { return strings_[names_[n]]; }
+    std::wstring_view application(size_t const n) const { return strings_[applications_[n]]; }
+    std::wstring_view service(size_t const n) const { return strings_[services_[n]]; }
+    std::wstring_view grouping(size_t const n) const { return strings_[groupings_[n]]; }
+    std::wstring_view local_ports(size_t const n) const { return strings_[local_ports_[n]]; }
+    std::wstring_view remote_ports(size_t const n) const { return strings_[remote_ports_[n]]; }
+    std::wstring_view local_addresses(size_t const n) const { return strings_[local_addresses_[n]]; }
+    std::wstring_view remote_addresses(size_t const n) const { return strings_[remote_addresses_[n]]; }
+    long protocol(size_t const n) const { return protocols_[n]; }
+    NET_FW_RULE_DIRECTION direction(size_t const n) const { return static_cast<NET_FW_RULE_DIRECTION>(directions_[n]); }
+    NET_FW_ACTION action(size_t const n) const { return static_cast<NET_FW_ACTION>(actions_[n]); }
+    long profiles(size_t const n) const { return profiles_[n]; }
+    bool enabled(size_t const n) const { return enabled_[n] != 0; }
+
+    // Indexes of the matching rules in ascending order.
+    std::vector<uint32_t> find(firewall_rule_query const & query) const;
+
+    // Reads the output of "netsh advfirewall firewall show rule name=all verbose".
+    void load(std::wistream & in);
+
+private:
+    using bitset = std::vector<uint64_t>;
+
+    struct port_range final
+    {
+        uint16_t first;
+        uint16_t last;
+        uint32_t rule;
+    };
+
+    string_id intern(std::wstring_view const & value);
+    void check_frozen(bool expected) const;
+    void index_ports(uint32_t rule, std::wstring_view ports);
+    bitset make_bitset() const { return bitset((size() + 63) / 64); }
+
+    static void set(bitset & bits, size_t const n) { bits[n / 64] |= uint64_t(1) << n % 64; }
+    static void intersect(bitset & bits, bitset const & other);
+
+    bool frozen_ = false;
+
+    std::deque<std::wstring> strings_;
+    std::unordered_map<std::wstring_view, string_id> string_ids_;
+
+    std::vector<string_id> names_;
+    std::vector<string_id> applications_;
+    std::vector<string_id> services_;
+    std::vector<string_id> groupings_;
+    std::vector<string_id> local_ports_;
+    std::vector<string_id> remote_ports_;
+    std::vector<string_id> local_addresses_;
+    std::vector<string_id> remote_addresses_;
+    std::vector<uint16_t> protocols_;
+    std::vector<uint8_t> directions_;
+    std::vector<uint8_t> actions_;
+    std::vector<uint32_t> profiles_;
+    std::vector<uint8_t> enabled_;
+
+    // Keyed by the upper-cased application path.
+    std::unordered_map<std::wstring, std::vector<uint32_t>> by_application_;
+    bitset any_application_;
+    std::vector<std::pair<uint16_t, uint32_t>> single_ports_;
+    std::vector<port_range> port_ranges_;
+    bitset any_port_;
+    std::unordered_map<long, bitset> by_protocol_;
+    bitset inbound_;
+    bitset outbound_;
+    bitset by_profile_[3];
+    bitset enabled_bits_;
+};
+
+#ifdef _WIN32
+
+// Reads every rule of the policy with batched IEnumVARIANT::Next calls. On success the snapshot is
+// replaced by the frozen rule set; on failure it is left as it was.
+status load_firewall_rules(INetFwPolicy2 * policy, firewall_rule_snapshot & snapshot);
+
+#endif
+
+}
@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cwctype>
+#include <string>
+#include <string_view>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace jb {
+
+namespace detail_firewall {
+
+// Shared by the rule snapshot and the classifier, so both read a rule's text the same way.
+
+inline size_t lowest_bit(uint64_t const word) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+}
+
+inline std::wstring fold_case(std::wstring_view const & value)
+{
+    std::wstring result(value);
+    for (auto & ch : result)
+        ch = static_cast<wchar_t>(std::towupper(ch));
+    return result;
+}
+
+// Blanks around list items and the CR of a CRLF line.
+inline std::wstring_view trim(std::wstring_view value)
+{
+    auto const is_blank = [](wchar_t const ch) { return ch == L' ' || ch == L'\t' || ch == L'\r' || ch == L'\n'; };
+    while (!value.empty() && is_blank(value.front()))
+        value.remove_prefix(1);
+    while (!value.empty() && is_blank(value.back()))
+        value.remove_suffix(1);
+    return value;
+}
+
+inline bool is_any(std::wstring_view const & value)
+{
+    return value.empty() || value == L"*" || value == L"Any";
+}
+
+// Calls fn with every trimmed, non-empty item of a comma separated list.
+template<typename Fn>
+void for_each_item(std::wstring_view list, Fn && fn)
+{
+    while (!list.empty())
+    {
+        auto const pos = list.find(L',');
+        auto const item = trim(list.substr(0, pos));
+        list = pos == std::wstring_view::npos ? std::wstring_view() : list.substr(pos + 1);
+        if (!item.empty())
+            fn(item);
+    }
+}
+
+inline bool parse_port(std::wstring_view const & text, uint16_t & value)
+{
+    if (text.empty() || text.size() > 5)
+        return false;
+    uint32_t result = 0;
+    for (auto const ch : text)
+    {
+        if (ch < L'0' || ch > L'9')
+            return false;
+        result = result * 10 + (ch - L'0');
+    }
+    if (result > 0xFFFF)
+        return false;
+    value = static_cast<uint16_t>(result);
+    return true;
+}
+
+}
+
+}
@@ -0,0 +1,497 @@
+﻿#include "config.hpp"
+
+#include "fleet.hpp"
+#include "firewall_profile.hpp"
+#include "format.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+namespace jb
+{
+
+namespace
+{
+
+unsigned const default_threads = 8;
+
+uint32_t const unmerged = ~uint32_t(0);
+
+// The containers one load worker has seen, with the name of their first host among its own.
+struct worker_containers final
+{
+    std::vector<sid> sids;
+    std::vector<std::wstring> names;
+    std::unordered_map<sid, uint32_t> ids;
+};
+
+// TOKEN_ELEVATION_TYPE values as the snapshots store them.
+uint32_t const token_elevation_default = 1;
+uint32_t const token_elevation_full = 2;
+uint32_t const token_elevation_limited = 3;
+
+uint16_t firewall_key(firewall_defaults const & firewall) noexcept
+{
+    uint16_t result = 0;
+    for (size_t n = 0; n < firewall.size(); ++n)
+    {
+        auto const & profile = firewall[n];
+        auto const bits =
+            (profile.enabled ? 1 : 0) |
+            (profile.block_all_inbound ? 2 : 0) |
+            (profile.inbound == NET_FW_ACTION_BLOCK ? 4 : 0) |
+            (profile.outbound == NET_FW_ACTION_BLOCK ? 8 : 0);
+        result |= static_cast<uint16_t>(bits << (4 * n));
+    }
+    return result;
+}
+
+void write_profile(std::wostream & out, unsigned const bits)
+{
+    out << (bits & 1 ? L"enabled" : L"disabled") << (bits & 2 ? L", block_all_inbound" : L"")
+        << L", inbound " << (bits & 4 ? L"block" : L"allow") << L", outbound " << (bits & 8 ? L"block" : L"allow");
+}
+
+// Unread parts first, so they never compare equal to a read value.
+using elevation_key = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+elevation_key make_elevation_key(fleet::host const & host) noexcept
+{
+    auto const read = host.present & (diagnostic_snapshot::has_elevation_flags | diagnostic_snapshot::has_token_elevation_type);
+    return elevation_key(read,
+        host.present & diagnostic_snapshot::has_elevation_flags ? host.elevation_flags : 0,
+        host.present & diagnostic_snapshot::has_token_elevation_type ? host.token_elevation_type : 0);
+}
+
+void write_elevation_key(std::wostream & out, elevation_key const & key)
+{
+    auto const read = std::get<0>(key);
+    auto const flags = std::get<1>(key);
+    auto const type = std::get<2>(key);
+    out << L"flags:";
+    if (!(read & diagnostic_snapshot::has_elevation_flags))
+        out << L" unread";
+    else
+    {
+        if (flags & 0x1)
+            out << L" uac";
+        if (flags & 0x2)
+            out << L" virtualization";
+        if (flags & 0x4)
+            out << L" installer_detection";
+        if (!(flags & 0x7))
+            out << L" none";
+    }
+    out << L", token: " << (
+        !(read & diagnostic_snapshot::has_token_elevation_type) ? L"unread" :
+        type == token_elevation_default ? L"default" :
+        type == token_elevation_limited ? L"limited" :
+        type == token_elevation_full    ? L"full"    : L"???");
+}
+
+size_t parse_count(std::wstring_view const text, size_t const value)
+{
+    if (text.empty())
+        return value;
+    size_t result = 0;
+    for (auto const ch : text)
+    {
+        if (ch < L'0' || ch > L'9' || result > (std::numeric_limits<size_t>::max() - 9) / 10)
+            throw std::runtime_error("Invalid fleet query count");
+        result = result * 10 + (ch - L'0');
+    }
+    return result;
+}
+
+}
+
+void fleet::load(std::filesystem::path const & directory, unsigned threads)
+{
+    std::vector<std::filesystem::path> paths;
+    for (auto const & entry : std::filesystem::directory_iterator(directory))
+        if (entry.is_regular_file() && entry.path().extension() == L".snapshot")
+            paths.push_back(entry.path());
+    std::sort(paths.begin(), paths.end());
+
+    hosts_.clear();
+    host_ids_.clear();
+    failures_.clear();
+    sids_.clear();
+    sid_ids_.clear();
+    container_names_.clear();
+    names_.clear();
+    name_ids_.clear();
+
+    if (!threads)
+        threads = default_threads;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, paths.size()));
+
+    // The containers of a host are the ids of its worker's table, in file order, until the merge.
+    std::vector<host> hosts(paths.size());
+    std::vector<std::string> messages(paths.size());
+    std::vector<unsigned> workers(paths.size());
+    std::vector<worker_containers> tables(threads);
+    auto const read_host = [&](size_t const n, unsigned const index)
+        {
+            workers[n] = index;
+            auto & item = hosts[n];
+            item.name = paths[n].stem().wstring();
+            snapshot_view view;
+            view.open(paths[n]);
+            item.present = view.present();
+            item.elevation_flags = view.elevation_flags();
+            item.token_elevation_type = view.token_elevation_type();
+            if (item.present & diagnostic_snapshot::has_firewall)
+            {
+                firewall_defaults firewall;
+                for (size_t k = 0; k < firewall.size(); ++k)
+                    firewall[k] = view.firewall(k);
+                item.firewall = firewall_key(firewall);
+            }
+
+            auto & table = tables[index];
+            auto const count = view.app_container_count();
+            item.containers.reserve(count);
+            for (size_t k = 0; k < count; ++k)
+            {
+                auto const entry = view.app_container_at(k);
+                auto const result = table.ids.emplace(entry.app_container, static_cast<uint32_t>(table.sids.size()));
+                if (result.second)
+                {
+                    table.sids.push_back(entry.app_container);
+                    table.names.emplace_back(entry.name);
+                }
+                item.containers.push_back(result.first->second);
+            }
+        };
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(threads);
+    auto const worker = [&](unsigned const index)
+        {
+            try
+            {
+                for (size_t n; (n = next.fetch_add(1, std::memory_order_relaxed)) < paths.size(); )
+                    try
+                    {
+                        read_host(n, index);
+                    }
+                    catch (std::runtime_error const & e)
+                    {
+                        messages[n] = e.what();
+                    }
+            }
+            catch (...)
+            {
+                errors[index] = std::current_exception();
+            }
+        };
+
+    if (threads)
+    {
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned n = 1; n < threads; ++n)
+            pool.emplace_back(worker, n);
+        worker(0);
+        for (auto & thread : pool)
+            thread.join();
+    }
+
+    for (auto const & error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    // A worker reads its hosts in file order, so the first host of a container in the merge is the
+    // first one of its table as well.
+    std::vector<std::vector<uint32_t>> merged(threads);
+    for (unsigned n = 0; n < threads; ++n)
+        merged[n].assign(tables[n].sids.size(), unmerged);
+    hosts_.reserve(hosts.size());
+    for (size_t n = 0; n < hosts.size(); ++n)
+    {
+        if (!messages[n].empty())
+        {
+            failures_.push_back({ std::move(hosts[n].name), std::move(messages[n]) });
+            continue;
+        }
+        auto & item = hosts[n];
+        auto const & table = tables[workers[n]];
+        auto & ids = merged[workers[n]];
+        for (auto & id : item.containers)
+        {
+            if (ids[id] == unmerged)
+            {
+                auto const result = sid_ids_.emplace(table.sids[id], static_cast<uint32_t>(sids_.size()));
+                if (result.second)
+                {
+                    sids_.push_back(table.sids[id]);
+                    auto const name = name_ids_.find(table.names[id]);
+                    if (name != name_ids_.end())
+                        container_names_.push_back(name->second);
+                    else
+                    {
+                        names_.push_back(table.names[id]);
+                        name_ids_.emplace(names_.back(), static_cast<uint32_t>(names_.size() - 1));
+                        container_names_.push_back(static_cast<uint32_t>(names_.size() - 1));
+                    }
+                }
+                ids[id] = result.first->second;
+            }
+            id = ids[id];
+        }
+        std::sort(item.containers.begin(), item.containers.end());
+        hosts_.push_back(std::move(item));
+    }
+    if (hosts_.size() >= std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Too many hosts");
+    host_ids_.reserve(hosts_.size());
+    for (size_t n = 0; n < hosts_.size(); ++n)
+        host_ids_.emplace(hosts_[n].name, static_cast<uint32_t>(n));
+
+    first_hosts_.assign(sids_.size() + 1, 0);
+    for (auto const & item : hosts_)
+        for (auto const id : item.containers)
+            ++first_hosts_[id + 1];
+    for (size_t n = 1; n < first_hosts_.size(); ++n)
+        first_hosts_[n] += first_hosts_[n - 1];
+    hosts_by_container_.resize(first_hosts_.back());
+    auto fill = first_hosts_;
+    for (size_t n = 0; n < hosts_.size(); ++n)
+        for (auto const id : hosts_[n].containers)
+            hosts_by_container_[fill[id]++] = static_cast<uint32_t>(n);
+}
+
+size_t fleet::find_host(std::wstring_view const name) const noexcept
+{
+    auto const found = host_ids_.find(name);
+    return found != host_ids_.end() ? found->second : hosts_.size();
+}
+
+std::vector<uint32_t> fleet::find_containers(std::wstring_view const text) const
+{
+    std::vector<uint32_t> result;
+    sid value;
+    if (sid::parse(text, value))
+    {
+        auto const found = sid_ids_.find(value);
+        if (found != sid_ids_.end())
+            result.push_back(found->second);
+        return result;
+    }
+    auto const name = name_ids_.find(text);
+    if (name != name_ids_.end())
+        for (size_t n = 0; n < container_names_.size(); ++n)
+            if (container_names_[n] == name->second)
+                result.push_back(static_cast<uint32_t>(n));
+    return result;
+}
+
+size_t fleet::memory_size() const noexcept
+{
+    size_t result = hosts_.capacity() * sizeof(host) + failures_.capacity() * sizeof(failure);
+    for (auto const & item : hosts_)
+        result += item.containers.capacity() * sizeof(uint32_t) + item.name.capacity() * sizeof(wchar_t);
+    for (auto const & name : names_)
+        result += sizeof name + name.capacity() * sizeof(wchar_t);
+    // Nodes of the hash tables, a key and value plus two pointers each.
+    result += host_ids_.size() * (sizeof(std::wstring_view) + 2 * sizeof(void *) + sizeof(uint32_t));
+    result += name_ids_.size() * (sizeof(std::wstring_view) + 2 * sizeof(void *) + sizeof(uint32_t));
+    result += sid_ids_.size() * (sizeof(sid) + 2 * sizeof(void *) + sizeof(uint32_t));
+    result += sids_.capacity() * sizeof(sid) + (container_names_.capacity() + first_hosts_.capacity() + hosts_by_container_.capacity()) * sizeof(uint32_t);
+    return result;
+}
+
+bool fleet::query(std::wostream & out, std::wstring_view const query) const
+{
+    auto const separator = query.find(L'=');
+    auto const name = query.substr(0, separator);
+    auto const argument = separator == std::wstring_view::npos ? std::wstring_view() : query.substr(separator + 1);
+    if (name == L"summary")
+        write_summary(out);
+    else if (name == L"host" && !argument.empty())
+        write_host(out, argument);
+    else if (name == L"container" && !argument.empty())
+        write_container(out, argument);
+    else if (name == L"top")
+        write_top(out, parse_count(argument, 10));
+    else if (name == L"rare")
+        write_rare(out, parse_count(argument, 1));
+    else if (name == L"firewall")
+        write_firewall(out);
+    else if (name == L"elevation")
+        write_elevation(out);
+    else
+        return false;
+    return true;
+}
+
+void fleet::write_summary(std::wostream & out) const
+{
+    out << L"Hosts: " << dec(hosts_.size()) << L", " << dec(failures_.size()) << L" failed\n";
+    for (auto const & item : failures_)
+    {
+        out << L"Failed: " << item.name << L": ";
+        for (auto const ch : item.message)
+            out << static_cast<wchar_t>(static_cast<unsigned char>(ch));
+        out << L'\n';
+    }
+    out << L"Containers: " << dec(sids_.size()) << L", " << dec(names_.size()) << L" names, " << dec(hosts_by_container_.size()) << L" placements\n";
+    out << L"Memory: " << dec(memory_size() / 1024) << L" KiB\n";
+}
+
+void fleet::write_host(std::wostream & out, std::wstring_view const name) const
+{
+    auto const n = find_host(name);
+    if (n == hosts_.size())
+    {
+        out << L"Host: " << name << L": not found\n";
+        return;
+    }
+    auto const & item = hosts_[n];
+    out << L"Host: " << item.name << L": present: 0x" << hex(item.present) << L", ";
+    write_elevation_key(out, make_elevation_key(item));
+    out << L'\n';
+    for (size_t k = 0; k < std::size(firewall_profile_names); ++k)
+    {
+        out << L"  " << firewall_profile_names[k] << L": ";
+        if (item.firewall == firewall_unread)
+            out << L"unread";
+        else
+            write_profile(out, item.firewall >> (4 * k) & 0xF);
+        out << L'\n';
+    }
+    out << L"  " << dec(item.containers.size()) << L" containers:\n";
+    for (auto const id : item.containers)
+        out << L"    " << sids_[id] << L": " << container_name(id) << L'\n';
+}
+
+void fleet::write_container(std::wostream & out, std::wstring_view const text) const
+{
+    auto const ids = find_containers(text);
+    if (ids.empty())
+        out << L"Container: " << text << L": not found\n";
+    for (auto const id : ids)
+    {
+        auto const count = container_host_count(id);
+        out << L"Container: " << sids_[id] << L": " << container_name(id) << L": " << dec(count) << L" hosts\n";
+        auto const hosts = container_hosts(id);
+        for (size_t k = 0; k < count; ++k)
+            out << L"  " << hosts_[hosts[k]].name << L'\n';
+    }
+}
+
+void fleet::write_top(std::wostream & out, size_t const count) const
+{
+    std::vector<uint32_t> ids(sids_.size());
+    for (size_t n = 0; n < ids.size(); ++n)
+        ids[n] = static_cast<uint32_t>(n);
+    auto const top = std::min(count, ids.size());
+    std::partial_sort(ids.begin(), ids.begin() + top, ids.end(), [this](uint32_t const left, uint32_t const right)
+        {
+            auto const left_count = container_host_count(left);
+            auto const right_count = container_host_count(right);
+            return left_count != right_count ? left_count > right_count : sids_[left] < sids_[right];
+        });
+    out << L"Top: " << dec(top) << L" of " << dec(ids.size()) << L" containers\n";
+    for (size_t n = 0; n < top; ++n)
+        out << L"  " << dec(container_host_count(ids[n])) << L" hosts: " << sids_[ids[n]] << L": " << container_name(ids[n]) << L'\n';
+}
+
+void fleet::write_rare(std::wostream & out, size_t const max_hosts) const
+{
+    std::vector<uint32_t> ids;
+    for (size_t n = 0; n < sids_.size(); ++n)
+        if (container_host_count(n) <= max_hosts)
+            ids.push_back(static_cast<uint32_t>(n));
+    std::sort(ids.begin(), ids.end(), [this](uint32_t const left, uint32_t const right)
+        {
+            auto const left_count = container_host_count(left);
+            auto const right_count = container_host_count(right);
+            return left_count != right_count ? left_count < right_count : sids_[left] < sids_[right];
+        });
+    out << L"Rare: " << dec(ids.size()) << L" containers on at most " << dec(max_hosts) << L" hosts\n";
+    for (auto const id : ids)
+    {
+        out << L"  " << sids_[id] << L": " << container_name(id) << L':';
+        auto const hosts = container_hosts(id);
+        for (size_t k = 0, count = container_host_count(id); k < count; ++k)
+            out << L' ' << hosts_[hosts[k]].name;
+        out << L'\n';
+    }
+}
+
+void fleet::write_firewall(std::wostream & out) const
+{
+    std::map<uint16_t, size_t> configurations;
+    size_t unread = 0;
+    size_t profiles[std::size(firewall_profile_names)][16] = {};
+    for (auto const & item : hosts_)
+    {
+        if (item.firewall == firewall_unread)
+        {
+            ++unread;
+            continue;
+        }
+        ++configurations[item.firewall];
+        for (size_t k = 0; k < std::size(firewall_profile_names); ++k)
+            ++profiles[k][item.firewall >> (4 * k) & 0xF];
+    }
+    out << L"Firewall: " << dec(hosts_.size() - unread) << L" hosts read, " << dec(unread) << L" unread, " << dec(configurations.size()) << L" configurations\n";
+    for (size_t k = 0; k < std::size(firewall_profile_names); ++k)
+    {
+        unsigned order[16];
+        for (unsigned n = 0; n < 16; ++n)
+            order[n] = n;
+        std::stable_sort(order, order + 16, [&](unsigned const left, unsigned const right) { return profiles[k][left] > profiles[k][right]; });
+        for (auto const bits : order)
+        {
+            if (!profiles[k][bits])
+                break;
+            out << L"  " << firewall_profile_names[k] << L": " << dec(profiles[k][bits]) << L" hosts: ";
+            write_profile(out, bits);
+            out << L'\n';
+        }
+    }
+}
+
+void fleet::write_elevation(std::wostream & out) const
+{
+    std::map<elevation_key, size_t> counts;
+    for (auto const & item : hosts_)
+        ++counts[make_elevation_key(item)];
+    auto common = counts.begin();
+    for (auto it = counts.begin(); it != counts.end(); ++it)
+        if (it->second > common->second)
+            common = it;
+
+    out << L"Elevation: " << dec(counts.size()) << L" combinations\n";
+    for (auto const & item : counts)
+    {
+        out << L"  " << dec(item.second) << L" hosts: ";
+        write_elevation_key(out, item.first);
+        out << L'\n';
+    }
+    if (common == counts.end())
+        return;
+    // Anything but the most common combination, and UAC being off even when most hosts have it so.
+    for (auto const & item : hosts_)
+    {
+        auto const key = make_elevation_key(item);
+        auto const uac_off = std::get<0>(key) & diagnostic_snapshot::has_elevation_flags && !(std::get<1>(key) & 0x1);
+        if (key == common->first && !uac_off)
+            continue;
+        out << L"Anomaly: " << item.name << L": ";
+        write_elevation_key(out, key);
+        out << L'\n';
+    }
+}
+
+}
@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include "sid.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jb {
+
+// Snapshot files of many hosts, held together for fleet statistics. App container SIDs and names
+// are interned across all hosts and the firewall defaults of a host are packed into one key, so a
+// host costs little more than the ids of its containers and ten thousand of them fit in memory.
+class fleet final
+{
+public:
+    static uint16_t const firewall_unread = 0xFFFF;
+
+    struct host final
+    {
+        std::wstring name;
+        uint32_t present = 0;
+        uint32_t elevation_flags = 0;
+        uint32_t token_elevation_type = 0;
+        // Four bits a profile: enabled, block_all_inbound, inbound and outbound blocked. firewall_unread
+        // when the host couldn't read it.
+        uint16_t firewall = firewall_unread;
+        // Container ids, sorted.
+        std::vector<uint32_t> containers;
+    };
+
+    struct failure final
+    {
+        std::wstring name;
+        std::string message;
+    };
+
+    fleet() = default;
+
+    fleet(fleet const &) = delete;
+    fleet & operator=(fleet const &) = delete;
+
+    // Replaces the hosts with every .snapshot file in directory, each named by its file stem. Workers
+    // take the next file as they finish one, since file sizes vary a lot, and intern its containers
+    // into tables of their own. The tables are merged in file order, so container ids and names
+    // don't depend on the scheduling. A file that can't be read is kept in failures instead.
+    void load(std::filesystem::path const & directory, unsigned threads = 0);
+
+    size_t host_count() const noexcept { return hosts_.size(); }
+    host const & host_at(size_t n) const noexcept { return hosts_[n]; }
+    // host_count() when there is none.
+    size_t find_host(std::wstring_view name) const noexcept;
+    std::vector<failure> const & failures() const noexcept { return failures_; }
+
+    size_t container_count() const noexcept { return sids_.size(); }
+    sid const & container_sid(size_t id) const noexcept { return sids_[id]; }
+    // The name of the first host that had it.
+    std::wstring_view container_name(size_t id) const noexcept { return names_[container_names_[id]]; }
+    size_t container_host_count(size_t id) const noexcept { return first_hosts_[id + 1] - first_hosts_[id]; }
+    // Hosts with the container, in load order.
+    uint32_t const * container_hosts(size_t id) const noexcept { return hosts_by_container_.data() + first_hosts_[id]; }
+    // The container with a SID in text form, or all containers named text.
+    std::vector<uint32_t> find_containers(std::wstring_view text) const;
+
+    // Bytes held, roughly.
+    size_t memory_size() const noexcept;
+
+    // Answers a query and returns true, false when it isn't one of "summary", "host=<name>",
+    // "container=<SID or name>", "top[=<count>]", "rare[=<hosts>]", "firewall" and "elevation".
+    bool query(std::wostream & out, std::wstring_view query) const;
+
+private:
+    void write_summary(std::wostream & out) const;
+    void write_host(std::wostream & out, std::wstring_view name) const;
+    void write_container(std::wostream & out, std::wstring_view text) const;
+    void write_top(std::wostream & out, size_t count) const;
+    void write_rare(std::wostream & out, size_t max_hosts) const;
+    void write_firewall(std::wostream & out) const;
+    void write_elevation(std::wostream & out) const;
+
+    std::vector<host> hosts_;
+    std::unordered_map<std::wstring_view, uint32_t> host_ids_;
+    std::vector<failure> failures_;
+
+    // Interning, merged from the load workers' tables.
+    std::vector<sid> sids_;
+    std::unordered_map<sid, uint32_t> sid_ids_;
+    std::vector<uint32_t> container_names_;
+    // A deque, so the name_ids_ keys stay put.
+    std::deque<std::wstring> names_;
+    std::unordered_map<std::wstring_view, uint32_t> name_ids_;
+
+    // Built after the load, indexed by container id.
+    std::vector<uint32_t> first_hosts_;
+    std::vector<uint32_t> hosts_by_container_;
+};
+
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <type_traits>
+
+namespace jb {
+
+// Stream-state-free number formatting: hex(x) prints 2 * sizeof(x) upper case digits, dec(x) prints
+// a decimal number. Both write the digits with one call and leave the stream flags untouched.
+template<typename T>
+struct hex_t
+{
+    T value;
+};
+
+template<typename T>
+struct dec_t
+{
+    T value;
+};
+
+template<typename T>
+hex_t<T> hex(T const value) noexcept
+{
+    static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "Integral value expected");
+    return { value };
+}
+
+template<typename T>
+dec_t<T> dec(T const value) noexcept
+{
+    static_assert(std::is_integral_v<T>, "Integral value expected");
+    return { value };
+}
+
+template<typename T>
+wchar_t * format_hex(wchar_t * const out, T const value) noexcept
+{
+    static wchar_t const digits[] = L"0123456789ABCDEF";
+    auto number = static_cast<uint64_t>(value);
+    for (auto n = 2 * sizeof(T); n-- > 0; number >>= 4)
+        out[n] = digits[number & 0xF];
+    return out + 2 * sizeof(T);
+}
+
+template<typename T>
+wchar_t * format_dec(wchar_t * out, T const value) noexcept
+{
+    wchar_t buffer[20];
+    auto ptr = buffer + sizeof buffer / sizeof *buffer;
+    auto const negative = std::is_signed_v<T> && value < 0;
+    auto number = negative ? uint64_t(0) - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    do
+        *--ptr = static_cast<wchar_t>(L'0' + number % 10);
+    while (number /= 10);
+    if (negative)
+        *out++ = L'-';
+    while (ptr != buffer + sizeof buffer / sizeof *buffer)
+        *out++ = *ptr++;
+    return out;
+}
+
+template<typename T>
+std::wostream & operator<<(std::wostream & out, hex_t<T> const value)
+{
+    wchar_t buffer[2 * sizeof(T)];
+    return out.write(buffer, format_hex(buffer, value.value) - buffer);
+}
+
+template<typename T>
+std::wostream & operator<<(std::wostream & out, dec_t<T> const value)
+{
+    wchar_t buffer[21];
+    return out.write(buffer, format_dec(buffer, value.value) - buffer);
+}
+
+}
@@ -0,0 +1,345 @@
+﻿#include "config.hpp"
+
+#include "instrument.hpp"
+
+#ifdef _WIN32
+#include "output.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace jb {
+
+namespace {
+
+size_t const histogram_size = 48;
+size_t const error_slots = 8;
+size_t const max_probes = 32;
+
+struct error_slot final
+{
+    std::atomic<uint32_t> code{ 0 };
+    std::atomic<uint64_t> count{ 0 };
+};
+
+struct call_counters final
+{
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> errors{ 0 };
+    std::atomic<uint64_t> total_ns{ 0 };
+    std::atomic<uint64_t> max_ns{ 0 };
+    std::atomic<uint64_t> histogram[histogram_size] = {};
+    error_slot error_codes[error_slots];
+    std::atomic<uint64_t> other_errors{ 0 };
+};
+
+struct allocation_counters final
+{
+    wchar_t const * name = nullptr;
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+};
+
+wchar_t const * const call_names[] =
+{
+#define CALL(N) L###N,
+#include "api_calls.inc"
+};
+
+call_counters calls[size_t(api_call::count)];
+
+std::mutex probes_mutex;
+allocation_counters probes[max_probes];
+size_t probe_count = 0;
+
+thread_local allocation_counters * current_probe = nullptr;
+
+// Every thread counts its own allocations, only it writes its counters, so counting takes no
+// locked instruction and no cache line is shared. process_allocations sums the threads alive and
+// the totals of the ones gone.
+struct thread_allocations final
+{
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    thread_allocations * previous = nullptr;
+    thread_allocations * next = nullptr;
+
+    thread_allocations() noexcept;
+    ~thread_allocations();
+};
+
+std::mutex threads_mutex;
+thread_allocations * threads_head = nullptr;
+allocation_stats threads_gone = {};
+
+thread_allocations::thread_allocations() noexcept
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    next = threads_head;
+    if (next)
+        next->previous = this;
+    threads_head = this;
+}
+
+thread_allocations::~thread_allocations()
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    threads_gone.count += count.load(std::memory_order_relaxed);
+    threads_gone.bytes += bytes.load(std::memory_order_relaxed);
+    (previous ? previous->next : threads_head) = next;
+    if (next)
+        next->previous = previous;
+}
+
+thread_local thread_allocations this_thread_allocations;
+
+size_t histogram_bucket(uint64_t const ns) noexcept
+{
+    if (!ns)
+        return 0;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, ns);
+#else
+    auto const index = static_cast<size_t>(63 - __builtin_clzll(ns));
+#endif
+    return index < histogram_size ? index : histogram_size - 1;
+}
+
+void count_allocation(size_t const size) noexcept
+{
+    auto & totals = this_thread_allocations;
+    totals.count.store(totals.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    totals.bytes.store(totals.bytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+    if (auto const probe = current_probe)
+    {
+        probe->count.fetch_add(1, std::memory_order_relaxed);
+        probe->bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+// Upper bound of the bucket holding the given fraction of the calls, capped by the maximum.
+uint64_t percentile_ns(call_counters const & counters, uint64_t const count, double const fraction) noexcept
+{
+    auto const max_ns = counters.max_ns.load(std::memory_order_relaxed);
+    auto const rank = static_cast<uint64_t>(fraction * (count - 1));
+    uint64_t seen = 0;
+    for (size_t n = 0; n < histogram_size; ++n)
+    {
+        seen += counters.histogram[n].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return std::min((uint64_t(2) << n) - 1, max_ns);
+    }
+    return max_ns;
+}
+
+std::string hex_code(uint32_t const code)
+{
+    static char const digits[] = "0123456789ABCDEF";
+    std::string result = "0x00000000";
+    for (size_t n = result.size(), value = code; n-- > 2; value >>= 4)
+        result[n] = digits[value & 0xF];
+    return result;
+}
+
+std::string narrow(wchar_t const * const name)
+{
+    std::string result;
+#ifdef _WIN32
+    utf16_to_utf8(name, result);
+#else
+    // The benchmarks' names are ASCII literals.
+    for (auto ptr = name; *ptr; ++ptr)
+        result.push_back(*ptr < 0x80 ? static_cast<char>(*ptr) : '?');
+#endif
+    return result;
+}
+
+}
+
+void record_call(api_call const id, uint64_t const elapsed_ns, status const result) noexcept
+{
+    auto & counters = calls[size_t(id)];
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+    counters.histogram[histogram_bucket(elapsed_ns)].fetch_add(1, std::memory_order_relaxed);
+    for (auto max_ns = counters.max_ns.load(std::memory_order_relaxed); max_ns < elapsed_ns; )
+        if (counters.max_ns.compare_exchange_weak(max_ns, elapsed_ns, std::memory_order_relaxed))
+            break;
+
+    if (result)
+        return;
+    counters.errors.fetch_add(1, std::memory_order_relaxed);
+    for (auto & slot : counters.error_codes)
+    {
+        auto code = slot.code.load(std::memory_order_relaxed);
+        if (!code && slot.code.compare_exchange_strong(code, result.code(), std::memory_order_relaxed))
+            code = result.code();
+        if (code == result.code())
+        {
+            slot.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    counters.other_errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+allocation_stats process_allocations() noexcept
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    auto result = threads_gone;
+    for (auto totals = threads_head; totals; totals = totals->next)
+    {
+        result.count += totals->count.load(std::memory_order_relaxed);
+        result.bytes += totals->bytes.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+allocation_scope::allocation_scope(wchar_t const * const name) :
+    previous_(current_probe)
+{
+    std::lock_guard<std::mutex> lock(probes_mutex);
+    size_t n = 0;
+    while (n < probe_count && probes[n].name != name)
+        ++n;
+    if (n == probe_count)
+    {
+        if (probe_count == max_probes)
+            return;
+        probes[probe_count++].name = name;
+    }
+    current_probe = &probes[n];
+}
+
+allocation_scope::~allocation_scope()
+{
+    current_probe = static_cast<allocation_counters *>(previous_);
+}
+
+void write_call_stats(std::ostream & out)
+{
+    auto const flags = out.flags();
+    out << std::left << std::setw(50) << "call" << std::right <<
+        std::setw(10) << "count" << std::setw(8) << "errors" <<
+        std::setw(12) << "total_us" << std::setw(10) << "p50_us" << std::setw(10) << "p99_us" << std::setw(10) << "max_us" << '\n';
+    for (size_t n = 0; n < size_t(api_call::count); ++n)
+    {
+        auto const & counters = calls[n];
+        auto const count = counters.count.load(std::memory_order_relaxed);
+        if (!count)
+            continue;
+        out << std::left << std::setw(50) << narrow(call_names[n]) << std::right <<
+            std::setw(10) << count <<
+            std::setw(8) << counters.errors.load(std::memory_order_relaxed) <<
+            std::setw(12) << counters.total_ns.load(std::memory_order_relaxed) / 1000 <<
+            std::setw(10) << percentile_ns(counters, count, 0.50) / 1000 <<
+            std::setw(10) << percentile_ns(counters, count, 0.99) / 1000 <<
+            std::setw(10) << counters.max_ns.load(std::memory_order_relaxed) / 1000 << '\n';
+    }
+
+    std::lock_guard<std::mutex> lock(probes_mutex);
+    out << '\n' << std::left << std::setw(50) << "probe" << std::right << std::setw(10) << "allocs" << std::setw(14) << "bytes" << '\n';
+    for (size_t n = 0; n < probe_count; ++n)
+        out << std::left << std::setw(50) << narrow(probes[n].name) << std::right <<
+            std::setw(10) << probes[n].count.load(std::memory_order_relaxed) <<
+            std::setw(14) << probes[n].bytes.load(std::memory_order_relaxed) << '\n';
+    out.flags(flags);
+}
+
+void write_call_stats_json(std::ostream & out)
+{
+    out << "{\"calls\":[";
+    auto first = true;
+    for (size_t n = 0; n < size_t(api_call::count); ++n)
+    {
+        auto const & counters = calls[n];
+        auto const count = counters.count.load(std::memory_order_relaxed);
+        if (!count)
+            continue;
+        if (!first)
+            out << ',';
+        first = false;
+        out << "{\"name\":\"" << narrow(call_names[n]) << "\"" <<
+            ",\"count\":" << count <<
+            ",\"errors\":" << counters.errors.load(std::memory_order_relaxed) <<
+            ",\"total_ns\":" << counters.total_ns.load(std::memory_order_relaxed) <<
+            ",\"p50_ns\":" << percentile_ns(counters, count, 0.50) <<
+            ",\"p99_ns\":" << percentile_ns(counters, count, 0.99) <<
+            ",\"max_ns\":" << counters.max_ns.load(std::memory_order_relaxed) <<
+            ",\"histogram_log2_ns\":[";
+        for (size_t bucket = 0; bucket < histogram_size; ++bucket)
+            out << (bucket ? "," : "") << counters.histogram[bucket].load(std::memory_order_relaxed);
+        out << "],\"error_codes\":{";
+        auto first_code = true;
+        for (auto const & slot : counters.error_codes)
+            if (auto const code = slot.code.load(std::memory_order_relaxed))
+            {
+                out << (first_code ? "\"" : ",\"") << hex_code(code) << "\":" << slot.count.load(std::memory_order_relaxed);
+                first_code = false;
+            }
+        out << "},\"other_errors\":" << counters.other_errors.load(std::memory_order_relaxed) << '}';
+    }
+
+    std::lock_guard<std::mutex> lock(probes_mutex);
+    out << "],\"probes\":[";
+    for (size_t n = 0; n < probe_count; ++n)
+        out << (n ? "," : "") << "{\"name\":\"" << narrow(probes[n].name) << "\"" <<
+            ",\"allocations\":" << probes[n].count.load(std::memory_order_relaxed) <<
+            ",\"bytes\":" << probes[n].bytes.load(std::memory_order_relaxed) << '}';
+    out << "]}\n";
+}
+
+}
+
+// Replaceable allocation functions: count, then defer to malloc, calling the new handler until it
+// succeeds or there is none. The standard nothrow forms call these; over-aligned allocations are
+// not counted.
+void * operator new(size_t const size)
+{
+    jb::count_allocation(size);
+    while (true)
+    {
+        if (auto const ptr = std::malloc(size ? size : 1))
+            return ptr;
+        auto const handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void * operator new[](size_t const size)
+{
+    return operator new(size);
+}
+
+void operator delete(void * const ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void * const ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void * const ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void * const ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include "status.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace jb {
+
+enum class api_call : uint32_t
+{
+#define CALL(N) N,
+#include "api_calls.inc"
+    count
+};
+
+// Counts the call, adds its latency to a log2 histogram and tallies the error code. Lock-free, safe
+// from any thread.
+void record_call(api_call id, uint64_t elapsed_ns, status result) noexcept;
+
+template<typename Fn>
+status trace_call(api_call const id, Fn && fn)
+{
+    auto const start = std::chrono::steady_clock::now();
+    status const result = std::forward<Fn>(fn)();
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    record_call(id, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()), result);
+    return result;
+}
+
+// Charges the current thread's heap allocations to the named probe while alive. The name must
+// outlive the process statistics, the probe registry's literals do.
+class allocation_scope final
+{
+public:
+    explicit allocation_scope(wchar_t const * name);
+    ~allocation_scope();
+
+    allocation_scope(allocation_scope const &) = delete;
+    allocation_scope & operator=(allocation_scope const &) = delete;
+
+private:
+    void * previous_;
+};
+
+struct allocation_stats final
+{
+    uint64_t count;
+    uint64_t bytes;
+};
+
+// Running totals of the heap allocations made by all threads, summed from their own counters.
+allocation_stats process_allocations() noexcept;
+
+// Human readable table of calls and probe allocations.
+void write_call_stats(std::ostream & out);
+
+// The same data plus raw histograms and error codes as one JSON object.
+void write_call_stats_json(std::ostream & out);
+
+}
@@ -0,0 +1,312 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace jb {
+
+// IPv4 or IPv6 address as a 128-bit big-endian number. IPv4 addresses are stored mapped
+// (::ffff:a.b.c.d), so both families sort and range-match in one key space.
+struct ip_address final
+{
+    static size_t const max_string_size = 40;
+
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    static constexpr ip_address from_ipv4(uint32_t const value) noexcept
+    {
+        return { 0, uint64_t(0xFFFF) << 32 | value };
+    }
+
+    static constexpr ip_address max() noexcept
+    {
+        return { ~uint64_t(0), ~uint64_t(0) };
+    }
+
+    bool is_ipv4() const noexcept { return !high && low >> 32 == 0xFFFF; }
+    uint32_t ipv4() const noexcept { return static_cast<uint32_t>(low); }
+
+    // Bit n counted from the most significant one.
+    bool bit(size_t const n) const noexcept
+    {
+        return (n < 64 ? high >> (63 - n) : low >> (127 - n)) & 1;
+    }
+
+    // Keeps the first prefix bits, clearing (or with fill, setting) the rest.
+    ip_address masked(size_t const prefix, bool const fill = false) const noexcept
+    {
+        auto const mask = [](size_t const bits) { return bits >= 64 ? ~uint64_t(0) : bits ? ~(~uint64_t(0) >> bits) : 0; };
+        auto const high_mask = mask(prefix);
+        auto const low_mask = mask(prefix > 64 ? prefix - 64 : 0);
+        return fill ?
+            ip_address{ high | ~high_mask, low | ~low_mask } :
+            ip_address{ high & high_mask, low & low_mask };
+    }
+
+    // Saturates at max().
+    ip_address next() const noexcept
+    {
+        if (~low)
+            return { high, low + 1 };
+        return ~high ? ip_address{ high + 1, 0 } : *this;
+    }
+
+    static bool parse(std::wstring_view const & text, ip_address & result) noexcept
+    {
+        return text.find(L':') == std::wstring_view::npos ? parse_ipv4(text, result) : parse_ipv6(text, result);
+    }
+
+    // Dotted quad for IPv4, RFC 5952 style for IPv6. The buffer must hold max_string_size
+    // characters, the result is not null-terminated.
+    wchar_t * format(wchar_t * out) const noexcept
+    {
+        if (is_ipv4())
+        {
+            for (auto shift = 32; shift > 0; )
+            {
+                out = format_dec(out, (ipv4() >> (shift -= 8)) & 0xFF);
+                if (shift)
+                    *out++ = L'.';
+            }
+            return out;
+        }
+
+        uint16_t groups[8];
+        for (size_t n = 0; n < 8; ++n)
+            groups[n] = static_cast<uint16_t>((n < 4 ? high >> (48 - 16 * n) : low >> (48 - 16 * (n - 4))) & 0xFFFF);
+        size_t best_first = 8, best_size = 0;
+        for (size_t n = 0; n < 8; )
+        {
+            if (groups[n])
+            {
+                ++n;
+                continue;
+            }
+            auto const first = n;
+            while (n < 8 && !groups[n])
+                ++n;
+            if (n - first > best_size && n - first > 1)
+            {
+                best_first = first;
+                best_size = n - first;
+            }
+        }
+        static wchar_t const digits[] = L"0123456789abcdef";
+        for (size_t n = 0; n < 8; ++n)
+        {
+            if (n == best_first)
+            {
+                *out++ = L':';
+                *out++ = L':';
+                n += best_size - 1;
+                continue;
+            }
+            if (n && n != best_first + best_size)
+                *out++ = L':';
+            auto started = false;
+            for (auto shift = 16; shift > 0; )
+            {
+                auto const digit = (groups[n] >> (shift -= 4)) & 0xF;
+                if (digit || started || !shift)
+                {
+                    *out++ = digits[digit];
+                    started = true;
+                }
+            }
+        }
+        return out;
+    }
+
+    std::wstring to_string() const
+    {
+        wchar_t buffer[max_string_size];
+        return std::wstring(buffer, format(buffer));
+    }
+
+    friend bool operator==(ip_address const & left, ip_address const & right) noexcept { return left.high == right.high && left.low == right.low; }
+    friend bool operator!=(ip_address const & left, ip_address const & right) noexcept { return !(left == right); }
+    friend bool operator<(ip_address const & left, ip_address const & right) noexcept { return left.high < right.high || (left.high == right.high && left.low < right.low); }
+    friend bool operator<=(ip_address const & left, ip_address const & right) noexcept { return !(right < left); }
+
+private:
+    static bool parse_ipv4(std::wstring_view const & text, ip_address & result) noexcept
+    {
+        uint32_t value = 0;
+        size_t parts = 0;
+        for (size_t pos = 0; pos <= text.size(); ++parts)
+        {
+            auto const end = std::min(text.find(L'.', pos), text.size());
+            if (parts == 4 || end == pos || end - pos > 3)
+                return false;
+            uint32_t part = 0;
+            for (; pos < end; ++pos)
+            {
+                if (text[pos] < L'0' || text[pos] > L'9')
+                    return false;
+                part = part * 10 + (text[pos] - L'0');
+            }
+            if (part > 255)
+                return false;
+            value = value << 8 | part;
+            pos = end + 1;
+        }
+        if (parts != 4)
+            return false;
+        result = from_ipv4(value);
+        return true;
+    }
+
+    static bool parse_ipv6(std::wstring_view const & text, ip_address & result) noexcept
+    {
+        uint16_t groups[8] = {};
+        size_t count = 0;
+        size_t gap = 8;
+        size_t pos = 0;
+        if (text.compare(0, 2, L"::") == 0)
+        {
+            gap = 0;
+            pos = 2;
+        }
+        while (pos < text.size())
+        {
+            if (count == 8)
+                return false;
+            // Embedded IPv4 tail, as in ::ffff:192.0.2.1.
+            if (text.find(L':', pos) == std::wstring_view::npos && text.find(L'.', pos) != std::wstring_view::npos)
+            {
+                ip_address ipv4;
+                if (count > 6 || !parse_ipv4(text.substr(pos), ipv4))
+                    return false;
+                groups[count++] = static_cast<uint16_t>(ipv4.ipv4() >> 16);
+                groups[count++] = static_cast<uint16_t>(ipv4.ipv4());
+                break;
+            }
+            uint32_t group = 0;
+            size_t digits = 0;
+            for (; pos < text.size() && text[pos] != L':'; ++pos, ++digits)
+            {
+                auto const ch = text[pos];
+                auto const digit =
+                    ch >= L'0' && ch <= L'9' ? ch - L'0' :
+                    ch >= L'a' && ch <= L'f' ? ch - L'a' + 10 :
+                    ch >= L'A' && ch <= L'F' ? ch - L'A' + 10 : -1;
+                if (digit < 0 || digits == 4)
+                    return false;
+                group = group << 4 | static_cast<uint32_t>(digit);
+            }
+            if (!digits)
+                return false;
+            groups[count++] = static_cast<uint16_t>(group);
+            if (pos == text.size())
+                break;
+            ++pos;
+            if (pos < text.size() && text[pos] == L':')
+            {
+                if (gap != 8)
+                    return false;
+                gap = count;
+                ++pos;
+            }
+            else if (pos == text.size())
+                return false;
+        }
+        if (gap == 8 ? count != 8 : count == 8)
+            return false;
+        if (gap != 8)
+        {
+            auto const tail = count - gap;
+            for (size_t n = 0; n < tail; ++n)
+                groups[7 - n] = groups[count - 1 - n];
+            for (size_t n = gap; n < 8 - tail; ++n)
+                groups[n] = 0;
+        }
+        result = ip_address();
+        for (size_t n = 0; n < 4; ++n)
+        {
+            result.high = result.high << 16 | groups[n];
+            result.low = result.low << 16 | groups[n + 4];
+        }
+        return true;
+    }
+
+    static wchar_t * format_dec(wchar_t * out, uint32_t const value) noexcept
+    {
+        if (value >= 100)
+            *out++ = static_cast<wchar_t>(L'0' + value / 100);
+        if (value >= 10)
+            *out++ = static_cast<wchar_t>(L'0' + value / 10 % 10);
+        *out++ = static_cast<wchar_t>(L'0' + value % 10);
+        return out;
+    }
+};
+
+struct ip_range final
+{
+    ip_address first;
+    ip_address last;
+};
+
+// Parses "a", "a-b", "a/prefix" and, for IPv4, "a/mask" as used by firewall rules.
+inline bool parse_ip_range(std::wstring_view const & text, ip_range & result) noexcept
+{
+    auto const dash = text.find(L'-');
+    if (dash != std::wstring_view::npos)
+        return
+            ip_address::parse(text.substr(0, dash), result.first) &&
+            ip_address::parse(text.substr(dash + 1), result.last) &&
+            result.first <= result.last;
+
+    auto const slash = text.find(L'/');
+    if (!ip_address::parse(text.substr(0, slash), result.first))
+        return false;
+    if (slash == std::wstring_view::npos)
+    {
+        result.last = result.first;
+        return true;
+    }
+
+    auto const suffix = text.substr(slash + 1);
+    size_t prefix = 0;
+    ip_address mask;
+    if (result.first.is_ipv4() && suffix.find(L'.') != std::wstring_view::npos)
+    {
+        if (!ip_address::parse(suffix, mask) || !mask.is_ipv4())
+            return false;
+        auto bits = mask.ipv4();
+        while (bits & 0x80000000u)
+        {
+            bits <<= 1;
+            ++prefix;
+        }
+        if (bits)
+            return false;
+    }
+    else
+    {
+        if (suffix.empty() || suffix.size() > 3)
+            return false;
+        for (auto const ch : suffix)
+        {
+            if (ch < L'0' || ch > L'9')
+                return false;
+            prefix = prefix * 10 + (ch - L'0');
+        }
+    }
+    if (result.first.is_ipv4())
+    {
+        if (prefix > 32)
+            return false;
+        prefix += 96;
+    }
+    else if (prefix > 128)
+        return false;
+    result.last = result.first.masked(prefix, true);
+    result.first = result.first.masked(prefix);
+    return true;
+}
+
+}
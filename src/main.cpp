@@ -1,28 +1,346 @@
-#include "run_elevation.hpp"
-#include "run_firewall.hpp"
-#include "run_networkisolation.hpp"
-
-#include <iostream>
-
-int main()
-{
-    try
-    {
-        auto & out = std::wcout;
-        jb::run_elevation(out);
-        jb::run_firewall(out);
-        jb::run_networkisolation(out);
-    }
-    catch (std::exception const & e)
-    {
-        std::cerr << "ERROR: " << e.what() << std::endl;
-        return 1;
-    }
-    catch (...)
-    {
-        std::cerr << "ERROR: Unknown" << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
+#include "config.hpp"
+
+#include "bench.hpp"
+#include "instrument.hpp"
+#include "on_exit.hpp"
+#include "output.hpp"
+#include "probe.hpp"
+#include "run_daemon.hpp"
+#include "run_elevation.hpp"
+#include "run_firewall.hpp"
+#include "run_firewall_rules.hpp"
+#include "run_fleet.hpp"
+#include "run_networkisolation.hpp"
+#include "run_process_survey.hpp"
+#include "run_snapshot.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+bool parse_option(std::string_view const & arg, std::string_view const & name, std::string_view & value)
+{
+    if (arg.size() <= name.size() || arg.compare(0, name.size(), name) != 0 || arg[name.size()] != '=')
+        return false;
+    value = arg.substr(name.size() + 1);
+    return true;
+}
+
+// name=<number> where the number is decimal and not zero. Sets invalid when it isn't.
+bool parse_number_option(std::string_view const & arg, std::string_view const & name, unsigned long & value, bool & invalid)
+{
+    std::string_view text;
+    if (!parse_option(arg, name, text))
+        return false;
+    value = 0;
+    invalid = text.empty() || text.size() > 9;
+    for (auto const ch : text)
+        if (ch < '0' || ch > '9')
+            invalid = true;
+        else
+            value = value * 10 + (ch - '0');
+    invalid = invalid || !value;
+    return true;
+}
+
+// --<probe>-timeout=<seconds> for any of the probes.
+bool parse_timeout_option(std::string_view const & arg, jb::probe * const probes, size_t const count, bool & invalid)
+{
+    for (size_t n = 0; n < count; ++n)
+    {
+        std::string name = "--";
+        for (auto ch = probes[n].name; *ch; ++ch)
+            name.push_back(static_cast<char>(*ch));
+        name += "-timeout";
+        unsigned long seconds;
+        if (parse_number_option(arg, name, seconds, invalid))
+        {
+            probes[n].timeout = std::chrono::seconds(seconds);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::wstring widen(std::string_view const & value)
+{
+    if (value.empty())
+        return std::wstring();
+    auto const size = MultiByteToWideChar(CP_ACP, 0, value.data(), static_cast<int>(value.size()), nullptr, 0);
+    std::wstring result(size, L'\0');
+    MultiByteToWideChar(CP_ACP, 0, value.data(), static_cast<int>(value.size()), result.data(), size);
+    return result;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    std::wstring binaries_cache_path;
+    jb::probe probes[] =
+    {
+        { L"elevation"       , jb::run_elevation, 10s },
+        { L"firewall"        , jb::run_firewall , 30s },
+        { L"networkisolation", [&binaries_cache_path](std::wostream & out) { jb::run_networkisolation(out, binaries_cache_path); }, 60s },
+    };
+    std::string_view output_name = "text";
+    auto print_stats = false;
+    auto bench = false;
+    auto bench_quick = false;
+    std::string stats_json_path;
+    std::wstring rules_file;
+    std::optional<std::wstring> rules_query;
+    size_t classify_count = 0;
+    jb::diagnose_options diagnose;
+    std::wstring snapshot_path;
+    std::wstring diff_from;
+    std::wstring diff_to;
+    std::optional<std::wstring> join;
+    auto watch = false;
+    jb::watch_options watch_options;
+    auto daemon = false;
+    jb::daemon_options daemon_options;
+    std::wstring query;
+    std::wstring fleet_directory;
+    auto survey = false;
+    unsigned survey_threads = 0;
+    jb::fleet_options fleet_options;
+    for (auto n = 1; n < argc; ++n)
+    {
+        std::string_view const arg = argv[n];
+        std::string_view value;
+        unsigned long number;
+        auto invalid = false;
+        if (parse_option(arg, "--output", value))
+            output_name = value;
+        else if (parse_option(arg, "--rules-file", value))
+            rules_file = widen(value);
+        else if (parse_option(arg, "--rules-query", value))
+            rules_query = widen(value);
+        else if (parse_number_option(arg, "--classify", number, invalid))
+            classify_count = number;
+        else if (parse_option(arg, "--diagnose", value))
+            diagnose.hosts_file = widen(value);
+        else if (parse_option(arg, "--diagnose-cache", value))
+            diagnose.cache_file = widen(value);
+        else if (parse_number_option(arg, "--diagnose-ttl", number, invalid))
+            diagnose.ttl = std::chrono::seconds(number);
+        else if (parse_number_option(arg, "--diagnose-threads", number, invalid))
+            diagnose.threads = static_cast<unsigned>(number);
+        else if (parse_option(arg, "--binaries-cache", value))
+            binaries_cache_path = widen(value);
+        else if (arg == "--diagnose-prescreen")
+            diagnose.prescreen = true;
+        else if (parse_option(arg, "--private-subnets", value))
+            diagnose.private_subnets = widen(value);
+        else if (parse_option(arg, "--snapshot", value))
+            snapshot_path = widen(value);
+        else if (parse_option(arg, "--diff", value))
+            diff_from = widen(value);
+        else if (parse_option(arg, "--diff-to", value))
+            diff_to = widen(value);
+        else if (arg == "--join")
+            join = std::wstring();
+        else if (parse_option(arg, "--join", value))
+            join = widen(value);
+        else if (arg == "--watch")
+            watch = true;
+        else if (parse_number_option(arg, "--watch-quiet", number, invalid))
+            watch_options.quiet = std::chrono::milliseconds(number);
+        else if (parse_number_option(arg, "--watch-max-delay", number, invalid))
+            watch_options.max_delay = std::chrono::milliseconds(number);
+        else if (arg == "--daemon")
+            daemon = true;
+        else if (parse_number_option(arg, "--daemon-threads", number, invalid))
+            daemon_options.threads = static_cast<unsigned>(number);
+        else if (parse_number_option(arg, "--daemon-refresh", number, invalid))
+            daemon_options.refresh = std::chrono::seconds(number);
+        else if (parse_option(arg, "--query", value))
+            query = widen(value);
+        else if (arg == "--survey")
+            survey = true;
+        else if (parse_number_option(arg, "--survey-threads", number, invalid))
+            survey_threads = static_cast<unsigned>(number);
+        else if (parse_option(arg, "--fleet", value))
+            fleet_directory = widen(value);
+        else if (parse_number_option(arg, "--fleet-threads", number, invalid))
+            fleet_options.threads = static_cast<unsigned>(number);
+        else if (parse_option(arg, "--fleet-query", value))
+            fleet_options.query = widen(value);
+        else if (arg == "--bench" || arg == "--bench=quick")
+        {
+            bench = true;
+            bench_quick = arg == "--bench=quick";
+        }
+        else if (parse_timeout_option(arg, probes, std::size(probes), invalid))
+            ;
+        else if (arg == "--stats")
+            print_stats = true;
+        else if (parse_option(arg, "--stats-json", value))
+            stats_json_path = value;
+        else
+        {
+            std::cerr << "ERROR: Unknown argument: " << arg << std::endl;
+            return 2;
+        }
+        if (invalid)
+        {
+            std::cerr << "ERROR: Invalid number: " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    // One mode at most, the probes run when there is none.
+    bool const modes[] =
+    {
+        bench, !snapshot_path.empty(), survey, !fleet_directory.empty(), !query.empty(), daemon, watch,
+        !diff_from.empty(), join.has_value(), !diagnose.hosts_file.empty(), classify_count != 0, rules_query.has_value(),
+    };
+    if (std::count(std::begin(modes), std::end(modes), true) > 1)
+    {
+        std::cerr << "ERROR: Conflicting modes: only one of --bench, --snapshot, --survey, --fleet, --query, --daemon, --watch, --diff, --join, --diagnose, --classify and --rules-query may be given" << std::endl;
+        return 2;
+    }
+    if (!rules_file.empty() && !classify_count && !rules_query)
+    {
+        std::cerr << "ERROR: --rules-file needs --classify or --rules-query" << std::endl;
+        return 2;
+    }
+
+    auto const sink = jb::make_output_sink(output_name, GetStdHandle(STD_OUTPUT_HANDLE));
+    if (!sink)
+    {
+        std::cerr << "ERROR: Unknown output format: " << output_name << std::endl;
+        return 2;
+    }
+
+    auto && dump_stats = jb::make_on_exit_scope([&]
+        {
+            if (print_stats)
+                jb::write_call_stats(std::cerr);
+            if (!stats_json_path.empty())
+            {
+                std::ofstream stats_json(stats_json_path);
+                jb::write_call_stats_json(stats_json);
+            }
+        });
+
+    std::wostream out(sink.get());
+    try
+    {
+        if (bench)
+        {
+            jb::run_bench(out, bench_quick);
+            sink->finish();
+            return 0;
+        }
+
+        if (!snapshot_path.empty())
+        {
+            jb::run_snapshot(out, snapshot_path);
+            sink->finish();
+            return 0;
+        }
+
+        if (survey)
+        {
+            jb::run_process_survey(out, survey_threads);
+            sink->finish();
+            return 0;
+        }
+
+        if (!fleet_directory.empty())
+        {
+            jb::run_fleet(out, std::wcin, fleet_directory, fleet_options);
+            sink->finish();
+            return 0;
+        }
+
+        if (!query.empty())
+        {
+            jb::run_query(out, query);
+            sink->finish();
+            return 0;
+        }
+
+        if (daemon)
+        {
+            daemon_options.watch = watch_options;
+            jb::run_daemon(out, daemon_options);
+            sink->finish();
+            return 0;
+        }
+
+        if (watch)
+        {
+            jb::run_watch(out, watch_options);
+            sink->finish();
+            return 0;
+        }
+
+        if (!diff_from.empty())
+        {
+            jb::run_snapshot_diff(out, diff_from, diff_to);
+            sink->finish();
+            return 0;
+        }
+
+        if (join)
+        {
+            jb::run_join(out, *join);
+            sink->finish();
+            return 0;
+        }
+
+        if (!diagnose.hosts_file.empty())
+        {
+            jb::run_diagnose_hosts(out, diagnose);
+            sink->finish();
+            return 0;
+        }
+
+        if (classify_count)
+        {
+            jb::run_firewall_classify(out, rules_file, classify_count);
+            sink->finish();
+            return 0;
+        }
+
+        if (rules_query)
+        {
+            jb::run_firewall_rules(out, rules_file, *rules_query);
+            sink->finish();
+            return 0;
+        }
+
+        auto const succeeded = jb::run_probes(probes, out, std::cerr);
+        sink->finish();
+        // A probe left running after its cancel may still use static state, so the process ends
+        // without destroying it.
+        if (!succeeded)
+            std::quick_exit(1);
+    }
+    catch (std::exception const & e)
+    {
+        sink->finish();
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (...)
+    {
+        sink->finish();
+        std::cerr << "ERROR: Unknown" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
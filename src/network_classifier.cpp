@@ -0,0 +1,229 @@
+﻿#include "config.hpp"
+
+#include "network_classifier.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace jb {
+
+namespace {
+
+size_t const ipv4_offset = 96;
+
+struct special_range final
+{
+    wchar_t const * prefix;
+    network_category category;
+};
+
+special_range const special_ranges[] =
+{
+    { L"0.0.0.0/0"         , network_category::internet        },
+    { L"0.0.0.0/8"         , network_category::ambiguous       },
+    { L"10.0.0.0/8"        , network_category::private_network },
+    { L"100.64.0.0/10"     , network_category::private_network },
+    { L"127.0.0.0/8"       , network_category::loopback        },
+    { L"169.254.0.0/16"    , network_category::private_network },
+    { L"172.16.0.0/12"     , network_category::private_network },
+    { L"192.168.0.0/16"    , network_category::private_network },
+    { L"224.0.0.0/4"       , network_category::ambiguous       },
+    { L"240.0.0.0/4"       , network_category::ambiguous       },
+    { L"::/0"              , network_category::internet        },
+    { L"::/128"            , network_category::ambiguous       },
+    { L"::1/128"           , network_category::loopback        },
+    { L"fc00::/7"          , network_category::private_network },
+    { L"fe80::/10"         , network_category::private_network },
+    { L"ff00::/8"          , network_category::ambiguous       },
+};
+
+void ipv4_bytes(uint32_t const value, uint8_t * const bytes) noexcept
+{
+    for (size_t n = 0; n < 4; ++n)
+        bytes[n] = static_cast<uint8_t>(value >> (24 - 8 * n));
+}
+
+void ipv6_bytes(ip_address const & value, uint8_t * const bytes) noexcept
+{
+    for (size_t n = 0; n < 8; ++n)
+    {
+        bytes[n] = static_cast<uint8_t>(value.high >> (56 - 8 * n));
+        bytes[n + 8] = static_cast<uint8_t>(value.low >> (56 - 8 * n));
+    }
+}
+
+// Number of trailing bits that are zero in first and one in last, as long as the block they span
+// starts at first and ends within last.
+size_t block_size(ip_address const & first, ip_address const & last) noexcept
+{
+    size_t bits = 0;
+    while (bits < 128 && first.masked(128 - bits - 1) == first && first.masked(128 - bits - 1, true) <= last)
+        ++bits;
+    return bits;
+}
+
+}
+
+wchar_t const * network_category_name(network_category const category) noexcept
+{
+    switch (category)
+    {
+    case network_category::ambiguous: return L"ambiguous";
+    case network_category::loopback: return L"loopback";
+    case network_category::private_network: return L"private";
+    case network_category::internet: return L"internet";
+    }
+    return L"???";
+}
+
+network_classifier::network_classifier() :
+    nodes_(2)
+{
+    for (auto const & item : special_ranges)
+    {
+        ip_range range;
+        if (!parse_ip_range(item.prefix, range))
+            throw std::runtime_error("Invalid special-purpose range");
+        add_range(range.first, range.last, item.category);
+    }
+}
+
+void network_classifier::add(ip_address const & prefix, size_t const length, network_category const category)
+{
+    if (length > 128)
+        throw std::runtime_error("Invalid prefix length");
+
+    auto const first = prefix.masked(length);
+    uint8_t bytes[16];
+    auto const ipv4_space = ip_address::from_ipv4(0);
+    if (length >= ipv4_offset && first.is_ipv4())
+    {
+        ipv4_bytes(first.ipv4(), bytes);
+        insert(ipv4_root, bytes, length - ipv4_offset, length, category);
+        return;
+    }
+    ipv6_bytes(first, bytes);
+    insert(ipv6_root, bytes, length, length, category);
+    // A shorter prefix covering all of ::ffff:0:0/96 applies to every IPv4 address too.
+    if (length < ipv4_offset && ipv4_space.masked(length) == first)
+        insert(ipv4_root, bytes, 0, length, category);
+}
+
+bool network_classifier::add_private_subnets(std::wstring_view list)
+{
+    std::vector<ip_range> ranges;
+    while (!list.empty())
+    {
+        auto const pos = list.find(L',');
+        auto item = list.substr(0, pos);
+        list = pos == std::wstring_view::npos ? std::wstring_view() : list.substr(pos + 1);
+        while (!item.empty() && item.front() == L' ')
+            item.remove_prefix(1);
+        while (!item.empty() && item.back() == L' ')
+            item.remove_suffix(1);
+        if (item.empty())
+            continue;
+        ip_range range;
+        if (!parse_ip_range(item, range))
+            return false;
+        ranges.push_back(range);
+    }
+    for (auto const & range : ranges)
+        add_range(range.first, range.last, network_category::private_network);
+    return true;
+}
+
+network_category network_classifier::classify(ip_address const & address) const noexcept
+{
+    uint8_t bytes[16];
+    uint32_t index;
+    size_t levels;
+    if (address.is_ipv4())
+    {
+        ipv4_bytes(address.ipv4(), bytes);
+        index = ipv4_root;
+        levels = 4;
+    }
+    else
+    {
+        ipv6_bytes(address, bytes);
+        index = ipv6_root;
+        levels = 16;
+    }
+
+    auto result = network_category::ambiguous;
+    for (size_t depth = 0; depth < levels; ++depth)
+    {
+        auto const & current = nodes_[index];
+        auto const slot = bytes[depth];
+        if (current.lengths[slot])
+            result = static_cast<network_category>(current.categories[slot]);
+        if (!(index = current.children[slot]))
+            break;
+    }
+    return result;
+}
+
+void network_classifier::classify(ip_address const * const addresses, size_t const count, network_category * const results) const noexcept
+{
+    for (size_t n = 0; n < count; ++n)
+        results[n] = classify(addresses[n]);
+}
+
+bool network_classifier::decides(network_category const category, NETISO_ERROR_TYPE & type) noexcept
+{
+    switch (category)
+    {
+    case network_category::private_network:
+        type = NETISO_ERROR_TYPE_PRIVATE_NETWORK;
+        return true;
+    case network_category::internet:
+        type = NETISO_ERROR_TYPE_INTERNET_CLIENT;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void network_classifier::insert(uint32_t const root, uint8_t const * const bytes, size_t const length, size_t const stored_length, network_category const category)
+{
+    auto index = root;
+    size_t depth = 0;
+    for (; length - depth * 8 > 8; ++depth)
+    {
+        auto child = nodes_[index].children[bytes[depth]];
+        if (!child)
+        {
+            child = static_cast<uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+            nodes_[index].children[bytes[depth]] = child;
+        }
+        index = child;
+    }
+
+    auto const rest = length - depth * 8;
+    size_t const span = size_t(1) << (8 - rest);
+    auto const first = rest ? bytes[depth] & ~(span - 1) : 0;
+    auto & current = nodes_[index];
+    for (auto slot = first; slot < first + span; ++slot)
+        if (current.lengths[slot] <= stored_length + 1)
+        {
+            current.categories[slot] = static_cast<uint8_t>(category);
+            current.lengths[slot] = static_cast<uint8_t>(stored_length + 1);
+        }
+}
+
+void network_classifier::add_range(ip_address first, ip_address const & last, network_category const category)
+{
+    while (first <= last)
+    {
+        auto const bits = block_size(first, last);
+        add(first, 128 - bits, category);
+        auto const end = first.masked(128 - bits, true);
+        if (end == ip_address::max())
+            break;
+        first = end.next();
+    }
+}
+
+}
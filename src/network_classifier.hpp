@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include "ip_address.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+
+#include <networkisolation.h>
+
+#else
+
+// The networkisolation.h values, so diagnoses build without the Windows SDK.
+enum NETISO_ERROR_TYPE
+{
+    NETISO_ERROR_TYPE_NONE = 0,
+    NETISO_ERROR_TYPE_PRIVATE_NETWORK = 1,
+    NETISO_ERROR_TYPE_INTERNET_CLIENT = 2,
+    NETISO_ERROR_TYPE_INTERNET_CLIENT_SERVER = 3,
+    NETISO_ERROR_TYPE_MAX = 4,
+};
+
+#endif
+
+namespace jb {
+
+enum class network_category : uint8_t
+{
+    ambiguous,
+    loopback,
+    private_network,
+    internet,
+};
+
+wchar_t const * network_category_name(network_category category) noexcept;
+
+// Decides which network an address belongs to by longest-prefix match, the way the network
+// isolation diagnosis does, without the OS call. Starts with the special-purpose ranges: private
+// (RFC 1918, shared, link-local, unique local), loopback, and unspecified, multicast and reserved
+// as ambiguous, everything else being internet. Configured private subnets are added on top.
+//
+// IPv4 and IPv6 have separate tries with an 8-bit stride, prefixes are expanded into the slots
+// they cover, so a lookup takes at most 4 or 16 steps.
+class network_classifier final
+{
+public:
+    network_classifier();
+
+    // The longest prefix wins, for the same prefix the later add.
+    void add(ip_address const & prefix, size_t length, network_category category);
+    // Comma separated "a/len", "a/mask", "a-b" or single addresses, all added as private. Nothing is
+    // added when any item is malformed.
+    bool add_private_subnets(std::wstring_view list);
+
+    network_category classify(ip_address const & address) const noexcept;
+    void classify(ip_address const * addresses, size_t count, network_category * results) const noexcept;
+
+    size_t node_count() const noexcept { return nodes_.size(); }
+
+    // Whether a category settles the diagnosis alone: private networks need privateNetworkClientServer,
+    // internet addresses internetClient. Loopback depends on the loopback exemptions and ambiguous
+    // addresses on the OS, both still need NetworkIsolationDiagnoseConnectFailureAndGetInfo.
+    static bool decides(network_category category, NETISO_ERROR_TYPE & type) noexcept;
+
+private:
+    static uint32_t const ipv4_root = 0;
+    static uint32_t const ipv6_root = 1;
+
+    struct node final
+    {
+        uint32_t children[256];
+        uint8_t categories[256];
+        // Prefix length plus one of the slot's entry, zero for none.
+        uint8_t lengths[256];
+    };
+
+    void insert(uint32_t root, uint8_t const * bytes, size_t length, size_t stored_length, network_category category);
+    void add_range(ip_address first, ip_address const & last, network_category category);
+
+    std::vector<node> nodes_;
+};
+
+}
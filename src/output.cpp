@@ -0,0 +1,424 @@
+﻿#include "config.hpp"
+
+#include "output.hpp"
+#include "format.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define JB_OUTPUT_SSE2 1
+#endif
+
+namespace jb {
+
+namespace {
+
+// Writes at most 3 bytes per UTF-16 code unit. Runs of 8 ASCII characters are narrowed with
+// SSE2 in one step.
+char * encode_utf8(wchar_t const * ptr, wchar_t const * const end, char * out) noexcept
+{
+    while (ptr != end)
+    {
+#ifdef JB_OUTPUT_SSE2
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            if (end - ptr >= 8)
+            {
+                auto const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr));
+                auto const high = _mm_and_si128(chunk, _mm_set1_epi16(static_cast<short>(0xFF80)));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF)
+                {
+                    _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(chunk, chunk));
+                    ptr += 8;
+                    out += 8;
+                    continue;
+                }
+            }
+        }
+#endif
+        auto code = static_cast<uint32_t>(*ptr++);
+        if (code < 0x80)
+        {
+            *out++ = static_cast<char>(code);
+            continue;
+        }
+        if (code < 0x800)
+        {
+            *out++ = static_cast<char>(0xC0 | code >> 6);
+            *out++ = static_cast<char>(0x80 | (code & 0x3F));
+            continue;
+        }
+        if (sizeof(wchar_t) == 2 && code >= 0xD800 && code <= 0xDFFF)
+        {
+            if (code < 0xDC00 && ptr != end && *ptr >= 0xDC00 && *ptr <= 0xDFFF)
+                code = 0x10000 + ((code - 0xD800) << 10) + (static_cast<uint32_t>(*ptr++) - 0xDC00);
+            else
+                code = 0xFFFD;
+        }
+        if (code < 0x10000)
+        {
+            *out++ = static_cast<char>(0xE0 | code >> 12);
+            *out++ = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            *out++ = static_cast<char>(0x80 | (code & 0x3F));
+            continue;
+        }
+        if (code > 0x10FFFF)
+            code = 0xFFFD;
+        *out++ = static_cast<char>(0xF0 | code >> 18);
+        *out++ = static_cast<char>(0x80 | (code >> 12 & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code & 0x3F));
+    }
+    return out;
+}
+
+size_t const max_utf8_size = sizeof(wchar_t) == 2 ? 3 : 4;
+
+// The parts of a record line, fields starting at the first field mark.
+struct record_view final
+{
+    std::wstring_view text;
+    std::wstring_view kind;
+    std::wstring_view fields;
+};
+
+bool split_record(std::wstring_view const & line, record_view & result) noexcept
+{
+    auto const mark = line.find(output_record::record_mark);
+    if (mark == std::wstring_view::npos)
+        return false;
+    result.text = line.substr(0, mark);
+    auto const rest = line.substr(mark + 1);
+    auto const end = rest.find(output_record::field_mark);
+    result.kind = rest.substr(0, end);
+    result.fields = end == std::wstring_view::npos ? std::wstring_view() : rest.substr(end);
+    return true;
+}
+
+bool parse_number(std::wstring_view const & text, uint64_t & value) noexcept
+{
+    if (text.empty() || text.size() > 20)
+        return false;
+    value = 0;
+    for (auto const ch : text)
+    {
+        if (ch < L'0' || ch > L'9')
+            return false;
+        auto const digit = static_cast<uint64_t>(ch - L'0');
+        if (value > (~uint64_t(0) - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// Calls fn(type, name, value) per field, type being '=', '#' or '?'. A number or flag that doesn't
+// parse is passed as text, a field without a type is skipped.
+template<typename Fn>
+void for_each_field(std::wstring_view fields, Fn && fn)
+{
+    while (!fields.empty())
+    {
+        fields.remove_prefix(1);
+        auto const end = fields.find(output_record::field_mark);
+        auto const field = fields.substr(0, end);
+        fields = end == std::wstring_view::npos ? std::wstring_view() : fields.substr(end);
+        auto const pos = field.find_first_of(L"=#?");
+        if (pos == std::wstring_view::npos)
+            continue;
+        auto type = field[pos];
+        auto const value = field.substr(pos + 1);
+        uint64_t number;
+        if ((type == L'#' && !parse_number(value, number)) || (type == L'?' && value != L"0" && value != L"1"))
+            type = L'=';
+        fn(type, field.substr(0, pos), value);
+    }
+}
+
+}
+
+output_record & output_record::text(wchar_t const * const name, std::wstring_view const & value)
+{
+    out_ << field_mark << name << L'=';
+    auto run = value.data();
+    auto const end = value.data() + value.size();
+    for (auto ptr = run; ptr != end; ++ptr)
+    {
+        if (*ptr != record_mark && *ptr != field_mark && *ptr != L'\n')
+            continue;
+        out_.write(run, ptr - run) << L' ';
+        run = ptr + 1;
+    }
+    out_.write(run, end - run);
+    return *this;
+}
+
+void utf16_to_utf8(std::wstring_view const & text, std::string & result)
+{
+    auto const offset = result.size();
+    result.resize(offset + max_utf8_size * text.size());
+    auto const end = encode_utf8(text.data(), text.data() + text.size(), result.data() + offset);
+    result.resize(end - result.data());
+}
+
+output_sink::output_sink(HANDLE const handle, size_t const buffer_size) :
+    handle_(handle),
+    buffer_(std::max<size_t>(buffer_size, 4096))
+{
+}
+
+output_sink::~output_sink()
+{
+    flush_output();
+}
+
+void output_sink::finish()
+{
+    if (!line_.empty())
+    {
+        write_line(line_);
+        line_.clear();
+    }
+    flush_output();
+}
+
+void output_sink::flush_output()
+{
+    write_out(buffer_.data(), used_);
+    used_ = 0;
+}
+
+void output_sink::append(char const * const data, size_t const size)
+{
+    if (used_ + size > buffer_.size())
+    {
+        flush_output();
+        if (size > buffer_.size())
+        {
+            write_out(data, size);
+            return;
+        }
+    }
+    std::memcpy(buffer_.data() + used_, data, size);
+    used_ += size;
+}
+
+void output_sink::append_utf8(std::wstring_view const & text)
+{
+    auto const size = max_utf8_size * text.size();
+    if (used_ + size > buffer_.size())
+    {
+        flush_output();
+        if (size > buffer_.size())
+        {
+            std::string result;
+            utf16_to_utf8(text, result);
+            write_out(result.data(), result.size());
+            return;
+        }
+    }
+    used_ = encode_utf8(text.data(), text.data() + text.size(), buffer_.data() + used_) - buffer_.data();
+}
+
+std::streamsize output_sink::xsputn(wchar_t const * const data, std::streamsize const size)
+{
+    auto const end = data + size;
+    for (auto ptr = data; ptr != end; )
+    {
+        auto const eol = std::find(ptr, end, L'\n');
+        if (eol == end)
+        {
+            line_.append(ptr, end);
+            break;
+        }
+        if (line_.empty())
+            write_line(std::wstring_view(ptr, eol - ptr));
+        else
+        {
+            line_.append(ptr, eol);
+            write_line(line_);
+            line_.clear();
+        }
+        ptr = eol + 1;
+    }
+    return size;
+}
+
+output_sink::int_type output_sink::overflow(int_type const ch)
+{
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        auto const value = traits_type::to_char_type(ch);
+        xsputn(&value, 1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int output_sink::sync()
+{
+    return 0;
+}
+
+void output_sink::write_out(char const * data, size_t size)
+{
+    while (size)
+    {
+        DWORD written;
+        if (!WriteFile(handle_, data, static_cast<DWORD>(std::min<size_t>(size, 1 << 30)), &written, nullptr) || !written)
+            return;
+        data += written;
+        size -= written;
+    }
+}
+
+text_output_sink::~text_output_sink()
+{
+    finish();
+}
+
+void text_output_sink::write_line(std::wstring_view const & line)
+{
+    record_view record;
+    append_utf8(split_record(line, record) ? record.text : line);
+    append("\r\n");
+}
+
+jsonl_output_sink::~jsonl_output_sink()
+{
+    finish();
+}
+
+void jsonl_output_sink::write_line(std::wstring_view const & line)
+{
+    wchar_t seq[21];
+    append("{\"seq\":");
+    append_utf8(std::wstring_view(seq, format_dec(seq, seq_++) - seq));
+    record_view record;
+    auto const is_record = split_record(line, record);
+    if (is_record)
+    {
+        append(",\"record\":\"");
+        append_string(record.kind);
+        append("\"");
+        for_each_field(record.fields, [this](wchar_t const type, std::wstring_view const & name, std::wstring_view const & value)
+            {
+                append(",\"");
+                append_string(name);
+                append("\":");
+                if (type == L'#')
+                    append_utf8(value);
+                else if (type == L'?')
+                    append(value == L"1" ? "true" : "false");
+                else
+                {
+                    append("\"");
+                    append_string(value);
+                    append("\"");
+                }
+            });
+    }
+    append(",\"text\":\"");
+    append_string(is_record ? record.text : line);
+    append("\"}\n");
+}
+
+// The characters of a JSON string, without the quotes.
+void jsonl_output_sink::append_string(std::wstring_view const & text)
+{
+    auto run = text.data();
+    auto const end = text.data() + text.size();
+    for (auto ptr = run; ptr != end; ++ptr)
+    {
+        auto const ch = *ptr;
+        if (ch != L'"' && ch != L'\\' && ch >= 0x20)
+            continue;
+        append_utf8(std::wstring_view(run, ptr - run));
+        run = ptr + 1;
+        if (ch == L'"')
+            append("\\\"");
+        else if (ch == L'\\')
+            append("\\\\");
+        else
+        {
+            static char const digits[] = "0123456789abcdef";
+            char const escape[] = { '\\', 'u', '0', '0', digits[ch >> 4 & 0xF], digits[ch & 0xF] };
+            append(escape, sizeof escape);
+        }
+    }
+    append_utf8(std::wstring_view(run, end - run));
+}
+
+binary_output_sink::~binary_output_sink()
+{
+    finish();
+}
+
+void binary_output_sink::write_line(std::wstring_view const & line)
+{
+    record_view record;
+    if (!split_record(line, record))
+    {
+        append_text(line);
+        append("\0", 1);
+        return;
+    }
+    append_text(record.text);
+
+    size_t const max_fields = 0xFF;
+    size_t count = 1;
+    for_each_field(record.fields, [&count](wchar_t, std::wstring_view const &, std::wstring_view const &) { ++count; });
+    count = std::min(count, max_fields);
+    char const header[] = { char(count), 0, char(6) };
+    append(header, sizeof header);
+    append("record", 6);
+    append_text(record.kind);
+    for_each_field(record.fields, [this, &count](wchar_t const type, std::wstring_view const & name, std::wstring_view const & value)
+        {
+            if (count-- <= 1)
+                return;
+            scratch_.clear();
+            utf16_to_utf8(name.substr(0, 0xFF / max_utf8_size), scratch_);
+            char const field_header[] = { char(type == L'#' ? 1 : type == L'?' ? 2 : 0), char(scratch_.size()) };
+            append(field_header, sizeof field_header);
+            append(scratch_);
+            if (type == L'#')
+            {
+                uint64_t number;
+                parse_number(value, number);
+                char bytes[8];
+                for (size_t n = 0; n < sizeof bytes; ++n)
+                    bytes[n] = char(number >> 8 * n);
+                append(bytes, sizeof bytes);
+            }
+            else if (type == L'?')
+                append(value == L"1" ? "\1" : "\0", 1);
+            else
+                append_text(value);
+        });
+}
+
+// A uint32 byte length and the UTF-8 text.
+void binary_output_sink::append_text(std::wstring_view const & text)
+{
+    scratch_.clear();
+    utf16_to_utf8(text, scratch_);
+    auto const size = static_cast<uint32_t>(scratch_.size());
+    char const header[] = { char(size), char(size >> 8), char(size >> 16), char(size >> 24) };
+    append(header, sizeof header);
+    append(scratch_);
+}
+
+std::unique_ptr<output_sink> make_output_sink(std::string_view const & name, HANDLE const handle)
+{
+    if (name == "text")
+        return std::make_unique<text_output_sink>(handle);
+    if (name == "jsonl")
+        return std::make_unique<jsonl_output_sink>(handle);
+    if (name == "binary")
+        return std::make_unique<binary_output_sink>(handle);
+    return nullptr;
+}
+
+}
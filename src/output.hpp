@@ -0,0 +1,156 @@
+﻿#pragma once
+
+#include "format.hpp"
+#include "sid.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace jb {
+
+// Ends the current line as a typed record: the text written so far stays the line's text, and the
+// kind and fields follow it in-band, so they pass through the probes' private buffers like any other
+// output. The text sink prints the text only, the JSON Lines and binary sinks the fields as well.
+// The line is ended when the record is destroyed.
+//
+// The encoding is U+001E and the kind, then per field U+001F, the name, and '=' with text, '#' with
+// a decimal number or '?' with 0 or 1.
+class output_record final
+{
+public:
+    static wchar_t const record_mark = L'\x1E';
+    static wchar_t const field_mark = L'\x1F';
+
+    output_record(std::wostream & out, wchar_t const * const kind) :
+        out_(out)
+    {
+        out_ << record_mark << kind;
+    }
+
+    ~output_record()
+    {
+        out_ << L'\n';
+    }
+
+    output_record(output_record const &) = delete;
+    output_record & operator=(output_record const &) = delete;
+
+    // Marks and line breaks in value become spaces.
+    output_record & text(wchar_t const * name, std::wstring_view const & value);
+
+    output_record & text(wchar_t const * const name, sid const & value)
+    {
+        out_ << field_mark << name << L'=' << value;
+        return *this;
+    }
+
+    output_record & number(wchar_t const * const name, uint64_t const value)
+    {
+        out_ << field_mark << name << L'#' << dec(value);
+        return *this;
+    }
+
+    output_record & flag(wchar_t const * const name, bool const value)
+    {
+        out_ << field_mark << name << (value ? L"?1" : L"?0");
+        return *this;
+    }
+
+private:
+    std::wostream & out_;
+};
+
+// Stream buffer behind the probes' std::wostream. Text is split into lines, every complete line is
+// encoded by the concrete sink into a large UTF-8 byte buffer, and the buffer is written to the
+// output handle only when it fills up, on flush_output() or finish(). Stream flushes (std::flush,
+// std::endl) don't reach the handle.
+class output_sink : public std::wstreambuf
+{
+public:
+    explicit output_sink(HANDLE handle, size_t buffer_size = default_buffer_size);
+    ~output_sink() override;
+
+    output_sink(output_sink const &) = delete;
+    output_sink & operator=(output_sink const &) = delete;
+
+    // Emits a pending unterminated line and writes the buffered bytes out.
+    void finish();
+    void flush_output();
+
+protected:
+    virtual void write_line(std::wstring_view const & line) = 0;
+
+    void append(char const * data, size_t size);
+    void append(std::string_view const & data) { append(data.data(), data.size()); }
+    void append_utf8(std::wstring_view const & text);
+
+    std::streamsize xsputn(wchar_t const * data, std::streamsize size) override;
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    static size_t const default_buffer_size = 1 << 20;
+
+    void write_out(char const * data, size_t size);
+
+    HANDLE const handle_;
+    std::wstring line_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+};
+
+// Plain text, one CRLF terminated line per probe line.
+class text_output_sink final : public output_sink
+{
+public:
+    using output_sink::output_sink;
+    ~text_output_sink() override;
+
+private:
+    void write_line(std::wstring_view const & line) override;
+};
+
+// JSON Lines: {"seq":N,"text":"..."} per probe line. A record adds "record":"<kind>" and its fields
+// before the text, numbers and flags as JSON numbers and booleans.
+class jsonl_output_sink final : public output_sink
+{
+public:
+    using output_sink::output_sink;
+    ~jsonl_output_sink() override;
+
+private:
+    void write_line(std::wstring_view const & line) override;
+    void append_string(std::wstring_view const & text);
+
+    uint64_t seq_ = 0;
+};
+
+// Binary, little-endian: per probe line a uint32 byte length and the UTF-8 text, then a uint8
+// field count, zero for plain lines. A record's first field is its kind, as text named "record".
+// A field is a uint8 type (0 text, 1 number, 2 flag), a uint8 byte length and the UTF-8 name, then
+// a uint32 byte length and the UTF-8 text, a uint64 or a uint8.
+class binary_output_sink final : public output_sink
+{
+public:
+    using output_sink::output_sink;
+    ~binary_output_sink() override;
+
+private:
+    void write_line(std::wstring_view const & line) override;
+    void append_text(std::wstring_view const & text);
+
+    std::string scratch_;
+};
+
+// Selects a sink by name: "text", "jsonl" or "binary". Returns nullptr for unknown names.
+std::unique_ptr<output_sink> make_output_sink(std::string_view const & name, HANDLE handle);
+
+// Appends the UTF-8 form of text; unpaired surrogates become U+FFFD.
+void utf16_to_utf8(std::wstring_view const & text, std::string & result);
+
+}
@@ -0,0 +1,149 @@
+﻿#include "config.hpp"
+
+#include "probe.hpp"
+#include "instrument.hpp"
+#include "on_exit.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace jb {
+
+namespace {
+
+// How often a timed out probe gets its I/O cancelled again, it may start more.
+auto const cancel_interval = std::chrono::milliseconds(100);
+// How long timed out probes get to return once cancelled. CancelSynchronousIo doesn't break COM
+// and RPC waits, so a probe stuck in one is left running.
+auto const cancel_grace = std::chrono::seconds(2);
+
+struct probe_task final
+{
+    std::wostringstream out;
+    std::string error;
+    bool done = false;
+    std::mutex mutex;
+    std::condition_variable done_cv;
+};
+
+void run_task(probe_task & task, std::function<void(std::wostream & out)> const & run)
+{
+    try
+    {
+        run(task.out);
+    }
+    catch (std::exception const & e)
+    {
+        task.error = e.what();
+        if (task.error.empty())
+            task.error = "Unknown";
+    }
+    catch (...)
+    {
+        task.error = "Unknown";
+    }
+}
+
+// Cancels the I/O of the thread until it is done or the deadline passes. Joins the thread when it
+// is done and returns true, otherwise detaches it, it owns a reference to its task.
+bool cancel(probe_task & task, std::thread & thread, std::chrono::steady_clock::time_point const deadline)
+{
+    {
+        std::unique_lock<std::mutex> lock(task.mutex);
+        while (!task.done && std::chrono::steady_clock::now() < deadline)
+        {
+            CancelSynchronousIo(thread.native_handle());
+            task.done_cv.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() + cancel_interval));
+        }
+        if (!task.done)
+        {
+            thread.detach();
+            return false;
+        }
+    }
+    thread.join();
+    return true;
+}
+
+std::string narrow_name(wchar_t const * name)
+{
+    std::string result;
+    for (; *name; ++name)
+        result.push_back(*name < 0x80 ? static_cast<char>(*name) : '?');
+    return result;
+}
+
+}
+
+bool run_probes(probe const * const probes, size_t const count, std::wostream & out, std::ostream & err)
+{
+    auto const start = std::chrono::steady_clock::now();
+
+    std::vector<std::shared_ptr<probe_task>> tasks;
+    std::vector<std::thread> threads(count);
+    tasks.reserve(count);
+    // Only reached with threads left on an exception, which doesn't wait for them.
+    auto && detach_threads = make_on_exit_scope([&]
+        {
+            for (auto & thread : threads)
+                if (thread.joinable())
+                    thread.detach();
+        });
+    for (size_t n = 0; n < count; ++n)
+    {
+        tasks.push_back(std::make_shared<probe_task>());
+        auto const task = tasks.back();
+        try
+        {
+            threads[n] = std::thread([task, name = probes[n].name, run = probes[n].run]
+                {
+                    {
+                        allocation_scope const allocations(name);
+                        run_task(*task, run);
+                    }
+                    std::lock_guard<std::mutex> lock(task->mutex);
+                    task->done = true;
+                    task->done_cv.notify_one();
+                });
+        }
+        catch (std::exception const & e)
+        {
+            task->error = e.what();
+            task->done = true;
+        }
+    }
+
+    auto result = true;
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto & task = *tasks[n];
+        std::unique_lock<std::mutex> lock(task.mutex);
+        if (!task.done_cv.wait_until(lock, start + probes[n].timeout, [&] { return task.done; }))
+        {
+            err << "ERROR: " << narrow_name(probes[n].name) << ": timed out after " << probes[n].timeout.count() << " ms" << std::endl;
+            result = false;
+            continue;
+        }
+        out << task.out.str();
+        if (!task.error.empty())
+        {
+            err << "ERROR: " << narrow_name(probes[n].name) << ": " << task.error << std::endl;
+            result = false;
+        }
+    }
+
+    auto const deadline = std::chrono::steady_clock::now() + cancel_grace;
+    for (size_t n = 0; n < count; ++n)
+        if (threads[n].joinable() && !cancel(*tasks[n], threads[n], deadline))
+            err << "ERROR: " << narrow_name(probes[n].name) << ": still running " << std::chrono::duration_cast<std::chrono::milliseconds>(cancel_grace).count() << " ms after cancel, abandoned" << std::endl;
+    return result;
+}
+
+}
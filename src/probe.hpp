@@ -0,0 +1,32 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <ostream>
+
+namespace jb {
+
+struct probe final
+{
+    wchar_t const * name;
+    std::function<void(std::wostream & out)> run;
+    std::chrono::milliseconds timeout;
+};
+
+// Runs every probe on its own thread, so each one gets its own COM apartment and private output
+// buffer. The buffers are copied to out in registry order as soon as all earlier probes are done,
+// so the merged output doesn't depend on scheduling. A probe that throws or misses its deadline is
+// reported to err and doesn't affect the others. The output of a timed out probe is dropped and
+// its thread is cancelled: the synchronous I/O it waits in is broken until it returns, for a few
+// seconds at most, after which the thread is reported and left running detached. Returns false if
+// any probe failed or timed out.
+bool run_probes(probe const * probes, size_t count, std::wostream & out, std::ostream & err);
+
+template<size_t N>
+bool run_probes(probe const (& probes)[N], std::wostream & out, std::ostream & err)
+{
+    return run_probes(probes, N, out, err);
+}
+
+}
@@ -0,0 +1,255 @@
+﻿#include "config.hpp"
+
+#include "process_survey.hpp"
+#include "on_exit.hpp"
+
+#ifdef _WIN32
+#include "instrument.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <tlhelp32.h>
+#endif
+
+namespace jb
+{
+
+namespace
+{
+
+unsigned const default_threads = 8;
+
+// What a worker reads from one token, interned into the table afterwards.
+struct process_token final
+{
+    status token_status;
+    uint32_t elevation_type = process_table::unread;
+    uint32_t elevated = process_table::unread;
+    uint32_t integrity = process_table::unread;
+    bool is_app_container = false;
+    sid app_container;
+    std::vector<sid> capabilities;
+};
+
+// The SIDs in token information are well formed, so the length comes from their header instead of
+// GetLengthSid.
+bool parse_sid(PSID const ptr, sid & value) noexcept
+{
+    return sid::parse(ptr, sid::max_binary_size, value);
+}
+
+template<typename T>
+bool read_token(process_source & source, HANDLE const token, TOKEN_INFORMATION_CLASS const type, std::vector<uint8_t> & buffer, T const * & result)
+{
+    if (!source.token_information(token, type, buffer) || buffer.size() < sizeof(T))
+        return false;
+    result = reinterpret_cast<T const *>(buffer.data());
+    return true;
+}
+
+void read_process_token(process_source & source, uint32_t const pid, std::vector<uint8_t> & buffer, process_token & result)
+{
+    HANDLE token;
+    result.token_status = source.open_token(pid, token);
+    if (!result.token_status)
+        return;
+    auto && close_token = make_on_exit_scope([&source, token] { source.close_token(token); });
+
+    TOKEN_ELEVATION_TYPE const * elevation_type;
+    if (read_token(source, token, TokenElevationType, buffer, elevation_type))
+        result.elevation_type = static_cast<uint32_t>(*elevation_type);
+    TOKEN_ELEVATION const * elevation;
+    if (read_token(source, token, TokenElevation, buffer, elevation))
+        result.elevated = elevation->TokenIsElevated != 0;
+    TOKEN_MANDATORY_LABEL const * label;
+    sid value;
+    if (read_token(source, token, TokenIntegrityLevel, buffer, label) && parse_sid(label->Label.Sid, value) && value.sub_authority_count())
+        result.integrity = value.sub_authority(value.sub_authority_count() - 1);
+
+    DWORD const * is_app_container;
+    if (!read_token(source, token, TokenIsAppContainer, buffer, is_app_container) || !*is_app_container)
+        return;
+    TOKEN_APPCONTAINER_INFORMATION const * app_container;
+    if (read_token(source, token, TokenAppContainerSid, buffer, app_container) && app_container->TokenAppContainer)
+        result.is_app_container = parse_sid(app_container->TokenAppContainer, result.app_container);
+    TOKEN_GROUPS const * capabilities;
+    if (read_token(source, token, TokenCapabilities, buffer, capabilities))
+        for (DWORD k = 0; k < capabilities->GroupCount; ++k)
+            if (parse_sid(capabilities->Groups[k].Sid, value))
+                result.capabilities.push_back(value);
+}
+
+}
+
+#ifdef _WIN32
+
+status toolhelp_process_source::processes(std::vector<process_entry> & result)
+{
+    result.clear();
+    HANDLE snapshot = INVALID_HANDLE_VALUE;
+    auto const error = trace_call(api_call::CreateToolhelp32Snapshot, [&]
+        {
+            snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+            return status::last_error(snapshot != INVALID_HANDLE_VALUE);
+        });
+    if (!error)
+        return error;
+    auto && close_snapshot = make_on_exit_scope([snapshot] { CloseHandle(snapshot); });
+
+    PROCESSENTRY32W entry;
+    entry.dwSize = sizeof entry;
+    for (auto more = Process32FirstW(snapshot, &entry); more; more = Process32NextW(snapshot, &entry))
+        result.push_back({ static_cast<uint32_t>(entry.th32ProcessID), static_cast<uint32_t>(entry.th32ParentProcessID), entry.szExeFile });
+    return GetLastError() == ERROR_NO_MORE_FILES ? status() : status::win32(GetLastError());
+}
+
+status toolhelp_process_source::open_token(uint32_t const pid, HANDLE & token)
+{
+    HANDLE process = nullptr;
+    auto const error = trace_call(api_call::OpenProcess, [&]
+        {
+            process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+            return status::last_error(process != nullptr);
+        });
+    if (!error)
+        return error;
+    auto && close_process = make_on_exit_scope([process] { CloseHandle(process); });
+    return trace_call(api_call::OpenProcessToken, [&] { return status::last_error(OpenProcessToken(process, TOKEN_QUERY, &token)); });
+}
+
+status toolhelp_process_source::token_information(HANDLE const token, TOKEN_INFORMATION_CLASS const type, std::vector<uint8_t> & buffer)
+{
+    buffer.resize(std::max<size_t>(buffer.capacity(), 256));
+    while (true)
+    {
+        DWORD size = 0;
+        auto const result = trace_call(api_call::GetTokenInformation, [&] { return status::last_error(GetTokenInformation(token, type, buffer.data(), static_cast<DWORD>(buffer.size()), &size)); });
+        if (result)
+        {
+            buffer.resize(size);
+            return result;
+        }
+        if (result.code() != ERROR_INSUFFICIENT_BUFFER || size <= buffer.size())
+            return result;
+        buffer.resize(size);
+    }
+}
+
+void toolhelp_process_source::close_token(HANDLE const token) noexcept
+{
+    CloseHandle(token);
+}
+
+#endif
+
+process_table survey_processes(process_source & source, std::vector<process_entry> const & processes, unsigned threads)
+{
+    if (processes.size() >= std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Too many processes");
+    std::vector<process_token> tokens(processes.size());
+
+    if (!threads)
+        threads = default_threads;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, processes.size()));
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(threads);
+    auto const worker = [&](unsigned const index)
+        {
+            try
+            {
+                std::vector<uint8_t> buffer;
+                for (size_t n; (n = next.fetch_add(1, std::memory_order_relaxed)) < processes.size(); )
+                    read_process_token(source, processes[n].pid, buffer, tokens[n]);
+            }
+            catch (...)
+            {
+                errors[index] = std::current_exception();
+            }
+        };
+
+    if (threads)
+    {
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned n = 1; n < threads; ++n)
+            pool.emplace_back(worker, n);
+        worker(0);
+        for (auto & thread : pool)
+            thread.join();
+    }
+
+    for (auto const & error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    process_table result;
+    std::unordered_map<std::wstring_view, uint32_t> string_ids;
+    string_ids.emplace(std::wstring_view(), 0);
+    std::unordered_map<sid, uint32_t> sid_ids;
+    sid_ids.emplace(sid(), 0);
+    auto const intern_sid = [&](sid const & value)
+        {
+            auto const found = sid_ids.emplace(value, static_cast<uint32_t>(result.sids_.size()));
+            if (found.second)
+                result.sids_.push_back(value);
+            return found.first->second;
+        };
+
+    auto const count = processes.size();
+    result.pids_.reserve(count);
+    result.parent_pids_.reserve(count);
+    result.images_.reserve(count);
+    result.token_statuses_.reserve(count);
+    result.elevation_types_.reserve(count);
+    result.elevated_.reserve(count);
+    result.integrities_.reserve(count);
+    result.app_containers_.reserve(count);
+    result.first_capabilities_.reserve(count + 1);
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto const & process = processes[n];
+        auto const & token = tokens[n];
+        result.pids_.push_back(process.pid);
+        result.parent_pids_.push_back(process.parent_pid);
+        // The keys point into processes, which outlive the build.
+        auto const image = string_ids.emplace(process.image, static_cast<uint32_t>(result.string_offsets_.size() - 1));
+        if (image.second)
+        {
+            result.chars_.insert(result.chars_.end(), process.image.begin(), process.image.end());
+            result.string_offsets_.push_back(static_cast<uint32_t>(result.chars_.size()));
+        }
+        result.images_.push_back(image.first->second);
+        result.token_statuses_.push_back(token.token_status);
+        result.elevation_types_.push_back(token.elevation_type);
+        result.elevated_.push_back(token.elevated);
+        result.integrities_.push_back(token.integrity);
+        result.app_containers_.push_back(token.is_app_container ? intern_sid(token.app_container) : 0);
+        for (auto const & capability : token.capabilities)
+            result.capabilities_.push_back(intern_sid(capability));
+        result.first_capabilities_.push_back(static_cast<uint32_t>(result.capabilities_.size()));
+    }
+    return result;
+}
+
+wchar_t const * integrity_name(uint32_t const rid) noexcept
+{
+    return
+        rid == process_table::unread                    ? L"unread"    :
+        rid >= SECURITY_MANDATORY_PROTECTED_PROCESS_RID ? L"protected" :
+        rid >= SECURITY_MANDATORY_SYSTEM_RID            ? L"system"    :
+        rid >= SECURITY_MANDATORY_HIGH_RID              ? L"high"      :
+        rid >= SECURITY_MANDATORY_MEDIUM_PLUS_RID       ? L"medium+"   :
+        rid >= SECURITY_MANDATORY_MEDIUM_RID            ? L"medium"    :
+        rid >= SECURITY_MANDATORY_LOW_RID               ? L"low"       : L"untrusted";
+}
+
+}
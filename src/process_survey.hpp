@@ -0,0 +1,170 @@
+﻿#pragma once
+
+#include "sid.hpp"
+#include "status.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _WIN32
+
+// The winnt.h token types and values the survey reads, so it builds and is tested without the
+// Windows SDK.
+using DWORD = uint32_t;
+using HANDLE = void *;
+using PSID = void *;
+
+enum TOKEN_INFORMATION_CLASS
+{
+    TokenElevationType = 18,
+    TokenElevation = 20,
+    TokenIntegrityLevel = 25,
+    TokenIsAppContainer = 29,
+    TokenCapabilities = 30,
+    TokenAppContainerSid = 31,
+};
+
+enum TOKEN_ELEVATION_TYPE
+{
+    TokenElevationTypeDefault = 1,
+    TokenElevationTypeFull = 2,
+    TokenElevationTypeLimited = 3,
+};
+
+struct TOKEN_ELEVATION
+{
+    DWORD TokenIsElevated;
+};
+
+struct SID_AND_ATTRIBUTES
+{
+    PSID Sid;
+    DWORD Attributes;
+};
+
+struct TOKEN_MANDATORY_LABEL
+{
+    SID_AND_ATTRIBUTES Label;
+};
+
+struct TOKEN_APPCONTAINER_INFORMATION
+{
+    PSID TokenAppContainer;
+};
+
+struct TOKEN_GROUPS
+{
+    DWORD GroupCount;
+    SID_AND_ATTRIBUTES Groups[1];
+};
+
+#define SECURITY_MANDATORY_LOW_RID               0x00001000L
+#define SECURITY_MANDATORY_MEDIUM_RID            0x00002000L
+#define SECURITY_MANDATORY_MEDIUM_PLUS_RID       0x00002100L
+#define SECURITY_MANDATORY_HIGH_RID              0x00003000L
+#define SECURITY_MANDATORY_SYSTEM_RID            0x00004000L
+#define SECURITY_MANDATORY_PROTECTED_PROCESS_RID 0x00005000L
+
+#endif
+
+namespace jb {
+
+struct process_entry final
+{
+    uint32_t pid;
+    uint32_t parent_pid;
+    std::wstring image;
+};
+
+// Where the process survey gets processes and their tokens. Tokens are opened, read and closed
+// from several worker threads at once.
+class process_source
+{
+public:
+    virtual ~process_source() = default;
+
+    // The running processes at one point in time.
+    virtual status processes(std::vector<process_entry> & result) = 0;
+    virtual status open_token(uint32_t pid, HANDLE & token) = 0;
+    // What GetTokenInformation returns, in buffer. The buffer is the worker's own and only grows, the
+    // pointers in the result point into it.
+    virtual status token_information(HANDLE token, TOKEN_INFORMATION_CLASS type, std::vector<uint8_t> & buffer) = 0;
+    virtual void close_token(HANDLE token) noexcept = 0;
+};
+
+#ifdef _WIN32
+
+// CreateToolhelp32Snapshot, OpenProcess with PROCESS_QUERY_LIMITED_INFORMATION and OpenProcessToken.
+class toolhelp_process_source final : public process_source
+{
+public:
+    status processes(std::vector<process_entry> & result) override;
+    status open_token(uint32_t pid, HANDLE & token) override;
+    status token_information(HANDLE token, TOKEN_INFORMATION_CLASS type, std::vector<uint8_t> & buffer) override;
+    void close_token(HANDLE token) noexcept override;
+};
+
+#endif
+
+// Token facts of every process, one array per field. Image names and SIDs are interned, id 0 being
+// the empty string and the empty sid.
+class process_table final
+{
+public:
+    static uint32_t const unread = ~uint32_t(0);
+
+    size_t size() const noexcept { return pids_.size(); }
+
+    uint32_t pid(size_t n) const noexcept { return pids_[n]; }
+    uint32_t parent_pid(size_t n) const noexcept { return parent_pids_[n]; }
+    std::wstring_view image(size_t n) const noexcept { return string(images_[n]); }
+    // Of opening the token, the other fields are unread when it failed.
+    status token_status(size_t n) const noexcept { return token_statuses_[n]; }
+    // A TOKEN_ELEVATION_TYPE, unread when it couldn't be read, as the ones below.
+    uint32_t elevation_type(size_t n) const noexcept { return elevation_types_[n]; }
+    uint32_t elevated(size_t n) const noexcept { return elevated_[n]; }
+    // The mandatory label RID, SECURITY_MANDATORY_*_RID.
+    uint32_t integrity(size_t n) const noexcept { return integrities_[n]; }
+    bool is_app_container(size_t n) const noexcept { return app_containers_[n] != 0; }
+    sid const & app_container(size_t n) const noexcept { return sids_[app_containers_[n]]; }
+    size_t capability_count(size_t n) const noexcept { return first_capabilities_[n + 1] - first_capabilities_[n]; }
+    sid const & capability(size_t n, size_t k) const noexcept { return sids_[capabilities_[first_capabilities_[n] + k]]; }
+
+    size_t sid_count() const noexcept { return sids_.size(); }
+    size_t string_count() const noexcept { return string_offsets_.size() - 1; }
+
+private:
+    friend process_table survey_processes(process_source & source, std::vector<process_entry> const & processes, unsigned threads);
+
+    std::wstring_view string(uint32_t id) const noexcept
+    {
+        return std::wstring_view(chars_.data() + string_offsets_[id], string_offsets_[id + 1] - string_offsets_[id]);
+    }
+
+    std::vector<uint32_t> pids_;
+    std::vector<uint32_t> parent_pids_;
+    std::vector<uint32_t> images_;
+    std::vector<status> token_statuses_;
+    std::vector<uint32_t> elevation_types_;
+    std::vector<uint32_t> elevated_;
+    std::vector<uint32_t> integrities_;
+    std::vector<uint32_t> app_containers_;
+    std::vector<uint32_t> first_capabilities_ = { 0 };
+    std::vector<uint32_t> capabilities_;
+
+    std::vector<sid> sids_ = { sid() };
+    std::vector<wchar_t> chars_;
+    std::vector<uint32_t> string_offsets_ = { 0, 0 };
+};
+
+// Reads the tokens of the processes on at most threads workers, each with a buffer of its own, that
+// pull the next process as they finish. A process that has exited or denies access only gets a
+// failed token_status.
+process_table survey_processes(process_source & source, std::vector<process_entry> const & processes, unsigned threads = 0);
+
+wchar_t const * integrity_name(uint32_t rid) noexcept;
+
+}
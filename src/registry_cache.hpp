@@ -0,0 +1,226 @@
+﻿#pragma once
+
+#include "registry_key.hpp"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace jb {
+
+namespace detail_registry {
+
+struct reg_backend_win32;
+
+// Cache of open keys below registered roots. Paths are hash-consed into ids (parent id + interned,
+// case-folded name), and open handles are kept in an LRU keyed by (root id, path id, access mask),
+// so reopening a hot key is a few hash lookups instead of a registry call. A root is held open by
+// the cache, so its id can't be confused with a later key that reuses the handle. Interning is
+// bounded: past max_paths distinct paths every table is dropped and refilled on demand.
+// A cache belongs to one thread; returned keys stay valid until its next open or erase call.
+template<typename Backend>
+class reg_key_cache final
+{
+public:
+    using key_type = reg_key<Backend>;
+
+    struct stats_t
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t resets;
+    };
+
+    explicit reg_key_cache(size_t const capacity = default_capacity, size_t const max_paths = default_max_paths) :
+        capacity_(capacity ? capacity : 1),
+        max_paths_(std::max(max_paths, capacity_))
+    {
+    }
+
+    reg_key_cache(reg_key_cache const &) = delete;
+    reg_key_cache & operator=(reg_key_cache const &) = delete;
+
+    // Registers a root and returns its id for open_key.
+    uint32_t add_root(key_type root)
+    {
+        roots_.push_back(std::move(root));
+        return static_cast<uint32_t>(roots_.size() - 1);
+    }
+
+    key_type const & root(uint32_t const root_id) const { return roots_.at(root_id); }
+
+    key_type const & open_key(uint32_t const root_id, std::wstring_view const & path, uint32_t const sam = reg_access::read)
+    {
+        auto const result = find_or_open(root_id, path, sam, true);
+        return *result;
+    }
+
+    // Returns nullptr when the key can't be opened.
+    key_type const * try_open_key(uint32_t const root_id, std::wstring_view const & path, uint32_t const sam = reg_access::read)
+    {
+        return find_or_open(root_id, path, sam, false);
+    }
+
+    // Drops the cached key, e.g. after it was found deleted, so the next open reopens it.
+    void erase(uint32_t const root_id, std::wstring_view const & path, uint32_t const sam = reg_access::read)
+    {
+        auto const it = index_.find({ root_id, find_path(path), sam });
+        if (it == index_.end())
+            return;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+
+    void clear()
+    {
+        index_.clear();
+        lru_.clear();
+    }
+
+    stats_t stats() const { return stats_; }
+    size_t size() const { return lru_.size(); }
+    size_t path_count() const { return path_index_.size(); }
+
+private:
+    struct entry_key
+    {
+        uint32_t root;
+        uint32_t path;
+        uint32_t sam;
+
+        bool operator==(entry_key const & right) const noexcept
+        {
+            return root == right.root && path == right.path && sam == right.sam;
+        }
+    };
+
+    struct entry_key_hasher
+    {
+        size_t operator()(entry_key const & key) const noexcept
+        {
+            uint64_t result = (uint64_t(key.root) << 32 | key.path) * 0x9E3779B97F4A7C15ull;
+            result ^= key.sam + 0xFF51AFD7ED558CCDull + (result << 6) + (result >> 2);
+            return static_cast<size_t>(result);
+        }
+    };
+
+    struct entry
+    {
+        entry_key id;
+        key_type key;
+    };
+
+    key_type const * find_or_open(uint32_t const root_id, std::wstring_view const & path, uint32_t const sam, bool const throw_if_failed)
+    {
+        auto const & root = roots_.at(root_id);
+        if (path_index_.size() >= max_paths_)
+        {
+            clear();
+            atoms_.clear();
+            path_index_.clear();
+            ++stats_.resets;
+        }
+        entry_key const key{ root_id, intern_path(path), sam };
+        auto const it = index_.find(key);
+        if (it != index_.end())
+        {
+            ++stats_.hits;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return &it->second->key;
+        }
+
+        ++stats_.misses;
+        key_type opened;
+        if (throw_if_failed)
+            opened = root.open_key(path, true, sam);
+        else
+        {
+            auto result = root.try_open_key(path, sam);
+            if (!result)
+                return nullptr;
+            opened = std::move(*result);
+        }
+        lru_.push_front({ key, std::move(opened) });
+        index_.emplace(key, lru_.begin());
+        if (lru_.size() > capacity_)
+        {
+            index_.erase(lru_.back().id);
+            lru_.pop_back();
+            ++stats_.evictions;
+        }
+        return &lru_.front().key;
+    }
+
+    template<typename Fn>
+    static uint32_t walk_path(std::wstring_view path, Fn && step)
+    {
+        auto id = root_path;
+        while (!path.empty() && id != unknown_path)
+        {
+            auto const pos = path.find(L'\\');
+            auto const name = path.substr(0, pos);
+            path = pos == std::wstring_view::npos ? std::wstring_view() : path.substr(pos + 1);
+            if (!name.empty())
+                id = step(id, name);
+        }
+        return id;
+    }
+
+    void fold(std::wstring_view const & name)
+    {
+        folded_.assign(name);
+        for (auto & ch : folded_)
+            ch = reg_upcase(ch);
+    }
+
+    uint32_t intern_path(std::wstring_view const & path)
+    {
+        return walk_path(path, [this](uint32_t const parent, std::wstring_view const & name)
+            {
+                fold(name);
+                auto const atom = atoms_.emplace(folded_, static_cast<uint32_t>(atoms_.size())).first->second;
+                return path_index_.emplace(uint64_t(parent) << 32 | atom, static_cast<uint32_t>(path_index_.size() + 1)).first->second;
+            });
+    }
+
+    uint32_t find_path(std::wstring_view const & path)
+    {
+        return walk_path(path, [this](uint32_t const parent, std::wstring_view const & name)
+            {
+                fold(name);
+                auto const atom = atoms_.find(folded_);
+                if (atom == atoms_.end())
+                    return unknown_path;
+                auto const it = path_index_.find(uint64_t(parent) << 32 | atom->second);
+                return it == path_index_.end() ? unknown_path : it->second;
+            });
+    }
+
+    static uint32_t const root_path = 0;
+    static uint32_t const unknown_path = ~uint32_t(0);
+    static size_t const default_capacity = 256;
+    static size_t const default_max_paths = 64 * 1024;
+
+    size_t const capacity_;
+    size_t const max_paths_;
+    stats_t stats_ = {};
+
+    std::vector<key_type> roots_;
+
+    std::wstring folded_;
+    std::unordered_map<std::wstring, uint32_t> atoms_;
+    std::unordered_map<uint64_t, uint32_t> path_index_;
+
+    std::list<entry> lru_;
+    std::unordered_map<entry_key, typename std::list<entry>::iterator, entry_key_hasher> index_;
+};
+
+}
+
+template<typename Backend>
+using basic_reg_key_cache = detail_registry::reg_key_cache<Backend>;
+
+using reg_key_cache = basic_reg_key_cache<detail_registry::reg_backend_win32>;
+
+}
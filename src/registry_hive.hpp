@@ -0,0 +1,614 @@
+﻿#pragma once
+
+#include "registry_key.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace jb {
+
+namespace detail_registry {
+
+struct reg_backend_hive;
+
+// Read-only view of an offline registry hive file (regf format, e.g. NTUSER.DAT or UsrClass.dat).
+// Cells, subkey lists and value lists are walked in place inside the mapped file; every cell
+// access is bounds checked and a malformed hive is reported as reg_status::bad_db.
+// Lookups binary-search the sorted lf/lh subkey lists; enumeration indexes the subkey cells, which
+// the first enumeration of a key collects once.
+class reg_hive_file final
+{
+public:
+    struct cursor
+    {
+        cursor(reg_hive_file const * const hive, uint32_t const cell) noexcept :
+            hive(hive),
+            cell(cell)
+        {
+        }
+
+        reg_hive_file const * hive;
+        uint32_t cell;
+
+        // Subkey cells in index order, cut short at a malformed list. Built under the mutex by the
+        // first enumeration, read without it once has_subkeys is set.
+        std::vector<uint32_t> subkeys;
+        std::atomic<bool> has_subkeys{ false };
+        std::mutex mutex;
+    };
+
+    reg_hive_file() = default;
+
+    reg_hive_file(reg_hive_file const &) = delete;
+    reg_hive_file & operator=(reg_hive_file const &) = delete;
+
+    ~reg_hive_file()
+    {
+        close();
+    }
+
+    // Maps the file on Win32, elsewhere reads it into memory.
+    void open(wchar_t const * const path)
+    {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Can't open registry hive file");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size))
+        {
+            close();
+            throw std::runtime_error("Can't get registry hive file size");
+        }
+        mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_)
+        {
+            close();
+            throw std::runtime_error("Can't map registry hive file");
+        }
+        view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (!view_)
+        {
+            close();
+            throw std::runtime_error("Can't map registry hive file");
+        }
+        attach(view_, static_cast<size_t>(size.QuadPart));
+#else
+        std::ifstream in(std::filesystem::path(path), std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Can't open registry hive file");
+        image_.resize(static_cast<size_t>(std::filesystem::file_size(path)));
+        if (!in.read(reinterpret_cast<char *>(image_.data()), static_cast<std::streamsize>(image_.size())))
+        {
+            close();
+            throw std::runtime_error("Can't read registry hive file");
+        }
+        attach(image_.data(), image_.size());
+#endif
+    }
+
+    // Uses a caller-owned hive image, which must outlive the hive.
+    void attach(void const * const data, size_t const size)
+    {
+        data_ = static_cast<uint8_t const *>(data);
+        size_ = size;
+        if (size_ < base_block_size || std::memcmp(data_, "regf", 4) != 0)
+            throw std::runtime_error("Invalid registry hive signature");
+        auto const bins_size = read32(data_ + 0x28);
+        if (bins_size < size_ - base_block_size)
+            size_ = base_block_size + bins_size;
+        root_cursor_.cell = read32(data_ + 0x24);
+        root_cursor_.subkeys.clear();
+        root_cursor_.has_subkeys = false;
+        if (!key_cell(root_cursor_.cell))
+            throw std::runtime_error("Invalid registry hive root key");
+    }
+
+    void close() noexcept
+    {
+#ifdef _WIN32
+        if (view_)
+            UnmapViewOfFile(view_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        view_ = nullptr;
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        image_ = std::vector<uint8_t>();
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    basic_reg_key<reg_backend_hive> root(wchar_t const * const path = L"") const;
+
+private:
+    friend struct reg_backend_hive;
+
+    static size_t const base_block_size = 0x1000;
+
+    static uint16_t read16(uint8_t const * const ptr) noexcept { return uint16_t(ptr[0] | ptr[1] << 8); }
+    static uint32_t read32(uint8_t const * const ptr) noexcept { return uint32_t(ptr[0]) | uint32_t(ptr[1]) << 8 | uint32_t(ptr[2]) << 16 | uint32_t(ptr[3]) << 24; }
+
+    // Returns the cell payload or nullptr when the offset does not address an allocated cell
+    // holding at least min_size bytes.
+    uint8_t const * cell(uint32_t const offset, uint32_t const min_size, uint32_t * const cell_size = nullptr) const noexcept
+    {
+        auto const pos = base_block_size + size_t(offset);
+        if (offset == ~uint32_t(0) || pos + 4 > size_)
+            return nullptr;
+        auto const raw = static_cast<int32_t>(read32(data_ + pos));
+        if (raw >= 0)
+            return nullptr;
+        auto const size = uint32_t(-int64_t(raw)) - 4;
+        if (size < min_size || pos + 4 + size > size_)
+            return nullptr;
+        if (cell_size)
+            *cell_size = size;
+        return data_ + pos + 4;
+    }
+
+    uint8_t const * key_cell(uint32_t const offset) const noexcept
+    {
+        uint32_t size;
+        auto const ptr = cell(offset, 76, &size);
+        if (!ptr || ptr[0] != 'n' || ptr[1] != 'k' || 76u + read16(ptr + 72) > size)
+            return nullptr;
+        return ptr;
+    }
+
+    uint8_t const * value_cell(uint32_t const offset) const noexcept
+    {
+        uint32_t size;
+        auto const ptr = cell(offset, 20, &size);
+        if (!ptr || ptr[0] != 'v' || ptr[1] != 'k' || 20u + read16(ptr + 2) > size)
+            return nullptr;
+        return ptr;
+    }
+
+    // Names are either Latin-1 ("compressed") or UTF-16LE.
+    struct name_ref
+    {
+        uint8_t const * data;
+        uint32_t size;
+        bool compressed;
+
+        size_t length() const noexcept { return compressed ? size : size / 2; }
+        wchar_t at(size_t const n) const noexcept { return compressed ? wchar_t(data[n]) : wchar_t(read16(data + 2 * n)); }
+    };
+
+    static name_ref key_name(uint8_t const * const key) noexcept { return { key + 76, read16(key + 72), !!(read16(key + 2) & 0x0020) }; }
+    static name_ref value_name(uint8_t const * const value) noexcept { return { value + 20, read16(value + 2), !!(read16(value + 16) & 0x0001) }; }
+
+    static bool equal_name(name_ref const & left, std::wstring_view const & right) noexcept
+    {
+        if (left.length() != right.size())
+            return false;
+        for (size_t n = 0; n < right.size(); ++n)
+            if (reg_upcase(left.at(n)) != reg_upcase(right[n]))
+                return false;
+        return true;
+    }
+
+    // Visits the subkey cells of a subkey list (lf/lh/li, or ri of those) in index order until fn
+    // returns false. Returns false on malformed lists.
+    template<typename Fn>
+    bool for_each_subkey(uint32_t const list, Fn && fn) const
+    {
+        auto const ptr = cell(list, 4);
+        if (!ptr)
+            return false;
+        bool stop = false;
+        if (ptr[0] != 'r' || ptr[1] != 'i')
+            return for_each_leaf(list, fn, stop);
+        auto const count = read16(ptr + 2);
+        if (!cell(list, 4 + count * 4))
+            return false;
+        for (uint32_t n = 0; n < count && !stop; ++n)
+            if (!for_each_leaf(read32(ptr + 4 + n * 4), fn, stop))
+                return false;
+        return true;
+    }
+
+    template<typename Fn>
+    bool for_each_leaf(uint32_t const list, Fn & fn, bool & stop) const
+    {
+        auto const ptr = cell(list, 4);
+        if (!ptr)
+            return false;
+        uint32_t stride;
+        if (ptr[0] == 'l' && (ptr[1] == 'f' || ptr[1] == 'h'))
+            stride = 8;
+        else if (ptr[0] == 'l' && ptr[1] == 'i')
+            stride = 4;
+        else
+            return false;
+        auto const count = read16(ptr + 2);
+        if (!cell(list, 4 + count * stride))
+            return false;
+        for (uint32_t n = 0; n < count; ++n)
+            if (!fn(read32(ptr + 4 + n * stride)))
+            {
+                stop = true;
+                break;
+            }
+        return true;
+    }
+
+    // Subkey lists are sorted by upper-cased name, so lf/lh leaves are binary-searched: the
+    // lower bound is confirmed by the lh hash, then by the name. li leaves have no order.
+    uint32_t find_subkey(uint8_t const * const key, std::wstring_view const & name) const noexcept
+    {
+        uint32_t result = ~uint32_t(0);
+        if (!read32(key + 20))
+            return result;
+        auto const list = read32(key + 28);
+        auto const ptr = cell(list, 4);
+        if (!ptr)
+            return result;
+        auto const hash = name_hash(name);
+        if (ptr[0] != 'r' || ptr[1] != 'i')
+            return find_in_leaf(list, name, hash);
+        auto const count = read16(ptr + 2);
+        if (!cell(list, 4 + count * 4))
+            return result;
+        for (uint32_t n = 0; n < count && result == ~uint32_t(0); ++n)
+            result = find_in_leaf(read32(ptr + 4 + n * 4), name, hash);
+        return result;
+    }
+
+    uint32_t find_in_leaf(uint32_t const list, std::wstring_view const & name, uint32_t const hash) const noexcept
+    {
+        auto const not_found = ~uint32_t(0);
+        auto const ptr = cell(list, 4);
+        if (!ptr || ptr[0] != 'l')
+            return not_found;
+        auto const count = read16(ptr + 2);
+        if (ptr[1] == 'i')
+        {
+            if (!cell(list, 4 + count * 4))
+                return not_found;
+            for (uint32_t n = 0; n < count; ++n)
+            {
+                auto const offset = read32(ptr + 4 + n * 4);
+                auto const child = key_cell(offset);
+                if (child && equal_name(key_name(child), name))
+                    return offset;
+            }
+            return not_found;
+        }
+        if ((ptr[1] != 'f' && ptr[1] != 'h') || !cell(list, 4 + count * 8))
+            return not_found;
+
+        uint32_t first = 0;
+        uint32_t last = count;
+        while (first < last)
+        {
+            auto const middle = first + (last - first) / 2;
+            auto const child = key_cell(read32(ptr + 4 + middle * 8));
+            if (!child)
+                return not_found;
+            if (compare_name(key_name(child), name) < 0)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        if (first == count || (ptr[1] == 'h' && read32(ptr + 8 + first * 8) != hash))
+            return not_found;
+        auto const offset = read32(ptr + 4 + first * 8);
+        auto const child = key_cell(offset);
+        return child && equal_name(key_name(child), name) ? offset : not_found;
+    }
+
+    // The hash lh lists keep next to each subkey.
+    static uint32_t name_hash(std::wstring_view const & name) noexcept
+    {
+        uint32_t result = 0;
+        for (auto const ch : name)
+            result = result * 37 + reg_upcase(ch);
+        return result;
+    }
+
+    static int compare_name(name_ref const & left, std::wstring_view const & right) noexcept
+    {
+        auto const length = left.length();
+        auto const size = std::min(length, right.size());
+        for (size_t n = 0; n < size; ++n)
+        {
+            auto const a = reg_upcase(left.at(n));
+            auto const b = reg_upcase(right[n]);
+            if (a != b)
+                return a < b ? -1 : 1;
+        }
+        return length < right.size() ? -1 : length > right.size() ? 1 : 0;
+    }
+
+    // The subkey cells of a key, collected on first use.
+    std::vector<uint32_t> const & subkeys(cursor & key, uint8_t const * const ptr) const
+    {
+        if (!key.has_subkeys.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> lock(key.mutex);
+            if (!key.has_subkeys.load(std::memory_order_relaxed))
+            {
+                // The count is untrusted, a list cell can't hold more than one subkey per 4 bytes.
+                uint32_t list_size = 0;
+                cell(read32(ptr + 28), 4, &list_size);
+                key.subkeys.reserve(std::min(read32(ptr + 20), list_size / 4));
+                for_each_subkey(read32(ptr + 28), [&](uint32_t const offset)
+                    {
+                        key.subkeys.push_back(offset);
+                        return true;
+                    });
+                key.has_subkeys.store(true, std::memory_order_release);
+            }
+        }
+        return key.subkeys;
+    }
+
+    uint8_t const * value_list(uint8_t const * const key) const noexcept
+    {
+        auto const count = read32(key + 36);
+        return count && count <= ~uint32_t(0) / 4 ? cell(read32(key + 40), count * 4) : nullptr;
+    }
+
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    void const * view_ = nullptr;
+#else
+    std::vector<uint8_t> image_;
+#endif
+    uint8_t const * data_ = nullptr;
+    size_t size_ = 0;
+    cursor root_cursor_{ this, 0 };
+};
+
+struct reg_backend_hive
+{
+    using handle_type = reg_hive_file::cursor *;
+
+    static void close(handle_type const key) noexcept
+    {
+        delete key;
+    }
+
+    static reg_status create_key(handle_type const key, wchar_t const * const path, uint32_t const sam, handle_type & result)
+    {
+        auto const error = open_key(key, path, sam, result);
+        return error == reg_status::not_found ? reg_status::access_denied : error;
+    }
+
+    static reg_status open_key(handle_type const key, wchar_t const * const path, uint32_t, handle_type & result)
+    {
+        if (!key)
+            return reg_status::invalid_handle;
+        auto const & hive = *key->hive;
+        auto offset = key->cell;
+        for (std::wstring_view rest(path ? path : L""); !rest.empty(); )
+        {
+            auto const pos = rest.find(L'\\');
+            auto const name = rest.substr(0, pos);
+            rest = pos == std::wstring_view::npos ? std::wstring_view() : rest.substr(pos + 1);
+            if (name.empty())
+                continue;
+            auto const ptr = hive.key_cell(offset);
+            if (!ptr)
+                return reg_status::bad_db;
+            offset = hive.find_subkey(ptr, name);
+            if (offset == ~uint32_t(0))
+                return reg_status::not_found;
+        }
+        if (!hive.key_cell(offset))
+            return reg_status::bad_db;
+        result = new reg_hive_file::cursor{ &hive, offset };
+        return reg_status::success;
+    }
+
+    static reg_status delete_key(handle_type, wchar_t const *)
+    {
+        return reg_status::access_denied;
+    }
+
+    static reg_status delete_value(handle_type, wchar_t const *)
+    {
+        return reg_status::access_denied;
+    }
+
+    static reg_status query_info(handle_type const key, reg_key_info & info)
+    {
+        auto const ptr = key ? key->hive->key_cell(key->cell) : nullptr;
+        if (!ptr)
+            return key ? reg_status::bad_db : reg_status::invalid_handle;
+        info.key_count = reg_hive_file::read32(ptr + 20);
+        info.max_key_name_size = (reg_hive_file::read32(ptr + 52) & 0xFFFF) / sizeof(wchar_t);
+        info.value_count = reg_hive_file::read32(ptr + 36);
+        info.max_value_name_size = reg_hive_file::read32(ptr + 60) / sizeof(wchar_t);
+        info.max_value_data_size = reg_hive_file::read32(ptr + 64);
+        info.last_write_time = uint64_t(reg_hive_file::read32(ptr + 8)) << 32 | reg_hive_file::read32(ptr + 4);
+        return reg_status::success;
+    }
+
+    static reg_status enum_key(handle_type const key, uint32_t const index, wchar_t * const name, uint32_t & name_size)
+    {
+        auto const ptr = key ? key->hive->key_cell(key->cell) : nullptr;
+        if (!ptr)
+            return key ? reg_status::bad_db : reg_status::invalid_handle;
+        auto const & hive = *key->hive;
+        if (index >= reg_hive_file::read32(ptr + 20))
+            return reg_status::no_more_items;
+        auto const & subkeys = hive.subkeys(*key, ptr);
+        auto const child = index < subkeys.size() ? hive.key_cell(subkeys[index]) : nullptr;
+        if (!child)
+            return reg_status::bad_db;
+        return copy_name(reg_hive_file::key_name(child), name, name_size);
+    }
+
+    static reg_status enum_value(handle_type const key, uint32_t const index, wchar_t * const name, uint32_t & name_size)
+    {
+        auto const ptr = key ? key->hive->key_cell(key->cell) : nullptr;
+        if (!ptr)
+            return key ? reg_status::bad_db : reg_status::invalid_handle;
+        auto const & hive = *key->hive;
+        if (index >= reg_hive_file::read32(ptr + 36))
+            return reg_status::no_more_items;
+        auto const list = hive.value_list(ptr);
+        auto const value = list ? hive.value_cell(reg_hive_file::read32(list + 4 * index)) : nullptr;
+        if (!value)
+            return reg_status::bad_db;
+        return copy_name(reg_hive_file::value_name(value), name, name_size);
+    }
+
+    static reg_status set_value(handle_type, wchar_t const *, reg_type, uint8_t const *, uint32_t)
+    {
+        return reg_status::access_denied;
+    }
+
+    static reg_status query_value(handle_type const key, wchar_t const * const name, reg_type & type, uint8_t * const data, uint32_t & data_size)
+    {
+        auto const ptr = key ? key->hive->key_cell(key->cell) : nullptr;
+        if (!ptr)
+            return key ? reg_status::bad_db : reg_status::invalid_handle;
+        auto const & hive = *key->hive;
+        auto const count = reg_hive_file::read32(ptr + 36);
+        auto const list = hive.value_list(ptr);
+        if (count && !list)
+            return reg_status::bad_db;
+        std::wstring_view const value_name(name ? name : L"");
+        for (uint32_t n = 0; n < count; ++n)
+        {
+            auto const value = hive.value_cell(reg_hive_file::read32(list + 4 * n));
+            if (!value)
+                return reg_status::bad_db;
+            if (reg_hive_file::equal_name(reg_hive_file::value_name(value), value_name))
+                return read_data(hive, value, type, data, data_size);
+        }
+        return reg_status::not_found;
+    }
+
+    static reg_status query_multiple_values(handle_type, reg_value_entry *, uint32_t, uint8_t *, uint32_t &)
+    {
+        return reg_status::not_supported;
+    }
+
+    static reg_status notify_change(handle_type, bool, void *)
+    {
+        return reg_status::not_supported;
+    }
+
+private:
+    static reg_status copy_name(reg_hive_file::name_ref const & source, wchar_t * const name, uint32_t & name_size)
+    {
+        auto const length = source.length();
+        if (!name || name_size <= length)
+        {
+            name_size = static_cast<uint32_t>(length + 1);
+            return reg_status::more_data;
+        }
+        for (size_t n = 0; n < length; ++n)
+            name[n] = source.at(n);
+        name[length] = L'\0';
+        name_size = static_cast<uint32_t>(length);
+        return reg_status::success;
+    }
+
+    // Strings are UTF-16 in the hive; where wchar_t is wider they are widened, as the other
+    // backends return wchar_t strings.
+    static reg_status read_data(reg_hive_file const & hive, uint8_t const * const value, reg_type & type, uint8_t * const data, uint32_t & data_size)
+    {
+        auto const size = reg_hive_file::read32(value + 4) & 0x7FFFFFFF;
+        type = static_cast<reg_type>(reg_hive_file::read32(value + 12));
+        auto const capacity = data_size;
+        auto const is_string = type == reg_type::sz || type == reg_type::expand_sz || type == reg_type::multi_sz || type == reg_type::link;
+        if (sizeof(wchar_t) == 2 || !is_string)
+        {
+            data_size = size;
+            if (!data)
+                return reg_status::success;
+            if (capacity < size)
+                return reg_status::more_data;
+            return read_raw(hive, value, size, data);
+        }
+        auto const length = size / 2;
+        data_size = static_cast<uint32_t>(length * sizeof(wchar_t));
+        if (!data)
+            return reg_status::success;
+        if (capacity < data_size)
+            return reg_status::more_data;
+        std::vector<uint8_t> raw(size);
+        auto const error = read_raw(hive, value, size, raw.data());
+        if (error != reg_status::success)
+            return error;
+        for (uint32_t n = 0; n < length; ++n)
+        {
+            auto const ch = static_cast<wchar_t>(reg_hive_file::read16(raw.data() + 2 * n));
+            std::memcpy(data + n * sizeof(wchar_t), &ch, sizeof ch);
+        }
+        return reg_status::success;
+    }
+
+    static reg_status read_raw(reg_hive_file const & hive, uint8_t const * const value, uint32_t const size, uint8_t * const data)
+    {
+        if (reg_hive_file::read32(value + 4) & 0x80000000)
+        {
+            // Up to 4 bytes are stored in the data offset field itself.
+            if (size > 4)
+                return reg_status::bad_db;
+            std::memcpy(data, value + 8, size);
+            return reg_status::success;
+        }
+        auto const offset = reg_hive_file::read32(value + 8);
+        uint32_t cell_size;
+        auto const ptr = hive.cell(offset, 0, &cell_size);
+        if (!ptr)
+            return size ? reg_status::bad_db : reg_status::success;
+        if (size <= cell_size)
+        {
+            std::memcpy(data, ptr, size);
+            return reg_status::success;
+        }
+
+        // Big data: "db" header pointing to a list of segments of up to 16344 bytes each.
+        if (cell_size < 8 || ptr[0] != 'd' || ptr[1] != 'b')
+            return reg_status::bad_db;
+        auto const segment_count = reg_hive_file::read16(ptr + 2);
+        auto const segments = hive.cell(reg_hive_file::read32(ptr + 4), segment_count * 4);
+        if (!segments)
+            return reg_status::bad_db;
+        uint32_t copied = 0;
+        for (uint32_t n = 0; n < segment_count && copied < size; ++n)
+        {
+            uint32_t segment_size;
+            auto const segment = hive.cell(reg_hive_file::read32(segments + 4 * n), 0, &segment_size);
+            if (!segment)
+                return reg_status::bad_db;
+            auto const chunk = std::min<uint32_t>({ segment_size, 16344, size - copied });
+            std::memcpy(data + copied, segment, chunk);
+            copied += chunk;
+        }
+        return copied == size ? reg_status::success : reg_status::bad_db;
+    }
+};
+
+inline basic_reg_key<reg_backend_hive> reg_hive_file::root(wchar_t const * const path) const
+{
+    if (!data_)
+        throw std::runtime_error("Registry hive file is not open");
+    return basic_reg_key<reg_backend_hive>::make_root(path, const_cast<cursor *>(&root_cursor_));
+}
+
+}
+
+using detail_registry::reg_hive_file;
+using reg_hive_key = basic_reg_key<detail_registry::reg_backend_hive>;
+
+}
@@ -0,0 +1,1074 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <exception>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+
+#include "on_exit.hpp"
+#include "status.hpp"
+
+namespace jb {
+
+namespace detail_registry {
+
+// Outcome of a backend call. The values are the Win32 error codes, so the Win32 backend passes its
+// LSTATUS through unchanged and a failure surfaced as a status keeps the native code.
+enum class reg_status : uint32_t
+{
+    success = 0,
+    not_found = 2,
+    access_denied = 5,
+    invalid_handle = 6,
+    invalid_data = 13,
+    not_supported = 50,
+    more_data = 234,
+    no_more_items = 259,
+    bad_db = 1009,
+    datatype_mismatch = 1629,
+};
+
+inline status reg_error(reg_status const error) noexcept
+{
+    return status::win32(static_cast<uint32_t>(error));
+}
+
+// Type of a registry value, the values are the Win32 REG_* constants.
+enum class reg_type : uint32_t
+{
+    none = 0,
+    sz = 1,
+    expand_sz = 2,
+    binary = 3,
+    dword = 4,
+    dword_big_endian = 5,
+    link = 6,
+    multi_sz = 7,
+    qword = 11,
+};
+
+// Access rights requested for an opened key, the values are the Win32 KEY_* masks.
+struct reg_access
+{
+    static constexpr uint32_t query_value = 0x0001;
+    static constexpr uint32_t set_value = 0x0002;
+    static constexpr uint32_t create_sub_key = 0x0004;
+    static constexpr uint32_t enumerate_sub_keys = 0x0008;
+    static constexpr uint32_t notify = 0x0010;
+    static constexpr uint32_t all_access = 0xF003F;
+    static constexpr uint32_t read = query_value | enumerate_sub_keys;
+};
+
+// Ordinal upper-casing of registry names: the simple one-to-one mappings of the Latin, Greek and
+// Cyrillic blocks, independent of the user locale like the registry's own upcase table. Other
+// characters are left as is.
+inline wchar_t reg_upcase(wchar_t const ch) noexcept
+{
+    if (ch < 0x80)
+        return ch >= L'a' && ch <= L'z' ? static_cast<wchar_t>(ch - 0x20) : ch;
+
+    struct range
+    {
+        uint16_t first;
+        uint16_t last;
+        int16_t delta;
+        uint16_t stride;
+    };
+
+    static constexpr range ranges[] =
+    {
+        { 0x00E0, 0x00F6, -32, 1 },
+        { 0x00F8, 0x00FE, -32, 1 },
+        { 0x00FF, 0x00FF, 121, 1 },
+        { 0x0101, 0x012F, -1, 2 },
+        { 0x0133, 0x0137, -1, 2 },
+        { 0x013A, 0x0148, -1, 2 },
+        { 0x014B, 0x0177, -1, 2 },
+        { 0x017A, 0x017E, -1, 2 },
+        { 0x03AC, 0x03AC, -38, 1 },
+        { 0x03AD, 0x03AF, -37, 1 },
+        { 0x03B1, 0x03C1, -32, 1 },
+        { 0x03C2, 0x03C2, -31, 1 },
+        { 0x03C3, 0x03CB, -32, 1 },
+        { 0x03CC, 0x03CC, -64, 1 },
+        { 0x03CD, 0x03CE, -63, 1 },
+        { 0x0430, 0x044F, -32, 1 },
+        { 0x0450, 0x045F, -80, 1 },
+        { 0x0461, 0x0481, -1, 2 },
+        { 0x048B, 0x04BF, -1, 2 },
+        { 0xFF41, 0xFF5A, -32, 1 },
+    };
+
+    for (auto const & item : ranges)
+    {
+        if (ch < item.first)
+            break;
+        if (ch <= item.last && (ch - item.first) % item.stride == 0)
+            return static_cast<wchar_t>(ch + item.delta);
+    }
+    return ch;
+}
+
+// Registry names are compared case-insensitively.
+inline int compare_reg_name(std::wstring_view const & left, std::wstring_view const & right) noexcept
+{
+    auto const size = std::min(left.size(), right.size());
+    for (size_t n = 0; n < size; ++n)
+    {
+        auto const l = reg_upcase(left[n]);
+        auto const r = reg_upcase(right[n]);
+        if (l != r)
+            return l < r ? -1 : 1;
+    }
+    return left.size() < right.size() ? -1 : left.size() > right.size() ? 1 : 0;
+}
+
+template<typename Data>
+wchar_t const * reg_value_SZ(Data & data)
+{
+    auto const count = data.size() / sizeof(wchar_t);
+    if (!count)
+        throw std::runtime_error("Empty string buffer size");
+    auto const ptr = reinterpret_cast<wchar_t *>(data.data());
+    ptr[count - 1] = L'\0';
+    return ptr;
+}
+
+template<typename Data>
+uint32_t reg_value_DWORD(Data & data)
+{
+    if (data.size() < sizeof(uint32_t))
+        throw std::runtime_error("Too small DWORD buffer size");
+    return *reinterpret_cast<uint32_t const *>(data.data());
+}
+
+template<typename Data>
+uint64_t reg_value_QWORD(Data & data)
+{
+    if (data.size() < sizeof(uint64_t))
+        throw std::runtime_error("Too small QWORD buffer size");
+    return *reinterpret_cast<uint64_t const *>(data.data());
+}
+
+// Byte buffer with inline storage: values up to InlineSize bytes are read without a heap allocation.
+template<size_t InlineSize>
+class reg_small_buffer final
+{
+public:
+    reg_small_buffer() noexcept = default;
+
+    reg_small_buffer(reg_small_buffer const &) = delete;
+    reg_small_buffer & operator=(reg_small_buffer const &) = delete;
+
+    uint8_t * data() noexcept { return heap_ ? heap_.get() : inline_; }
+    uint8_t const * data() const noexcept { return heap_ ? heap_.get() : inline_; }
+    size_t size() const noexcept { return size_; }
+    size_t capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return !size_; }
+
+    void clear() noexcept { size_ = 0; }
+
+    void resize(size_t const size)
+    {
+        if (size > capacity_)
+        {
+            std::unique_ptr<uint8_t[]> heap(new uint8_t[size]);
+            std::copy_n(data(), size_, heap.get());
+            heap_ = std::move(heap);
+            capacity_ = size;
+        }
+        size_ = size;
+    }
+
+private:
+    alignas(uint64_t) uint8_t inline_[InlineSize];
+    std::unique_ptr<uint8_t[]> heap_;
+    size_t size_ = 0;
+    size_t capacity_ = InlineSize;
+};
+
+using reg_value_buffer = reg_small_buffer<256>;
+
+// Values fetched together by reg_key::get_values, all stored in one buffer from the caller's
+// memory resource. Missing values have type reg_type::none.
+struct reg_values
+{
+    struct item
+    {
+        reg_type type;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    explicit reg_values(std::pmr::memory_resource * const resource) :
+        data(resource),
+        items(resource)
+    {
+    }
+
+    std::pmr::vector<uint8_t> data;
+    std::pmr::vector<item> items;
+
+    size_t size() const noexcept { return items.size(); }
+    reg_type type(size_t const n) const noexcept { return items[n].type; }
+    uint8_t const * bytes(size_t const n) const noexcept { return data.data() + items[n].offset; }
+
+    bool get_SZ(size_t const n, std::wstring_view & value) const
+    {
+        switch (items[n].type)
+        {
+        case reg_type::none:
+            return false;
+        case reg_type::expand_sz:
+        case reg_type::sz:
+        {
+            auto const ptr = reinterpret_cast<wchar_t const *>(bytes(n));
+            auto size = items[n].size / sizeof(wchar_t);
+            while (size && !ptr[size - 1])
+                --size;
+            value = std::wstring_view(ptr, size);
+            return true;
+        }
+        default:
+            throw std::runtime_error("Expected REG_SZ or REG_EXPAND_SZ registry value type");
+        }
+    }
+
+    bool get_DWORD(size_t const n, uint32_t & value) const
+    {
+        switch (items[n].type)
+        {
+        case reg_type::none:
+            return false;
+        case reg_type::dword:
+            if (items[n].size < sizeof(uint32_t))
+                throw std::runtime_error("Too small DWORD buffer size");
+            std::memcpy(&value, bytes(n), sizeof value);
+            return true;
+        default:
+            throw std::runtime_error("Expected REG_DWORD registry value type");
+        }
+    }
+
+    bool get_QWORD(size_t const n, uint64_t & value) const
+    {
+        switch (items[n].type)
+        {
+        case reg_type::none:
+            return false;
+        case reg_type::qword:
+            if (items[n].size < sizeof(uint64_t))
+                throw std::runtime_error("Too small QWORD buffer size");
+            std::memcpy(&value, bytes(n), sizeof value);
+            return true;
+        default:
+            throw std::runtime_error("Expected REG_QWORD registry value type");
+        }
+    }
+};
+
+struct reg_key_info
+{
+    uint32_t key_count;
+    uint32_t max_key_name_size;
+    uint32_t value_count;
+    uint32_t max_value_name_size;
+    uint32_t max_value_data_size;
+    // FILETIME ticks.
+    uint64_t last_write_time;
+};
+
+// Layout of VALENTW, so the Win32 backend hands the array to RegQueryMultipleValuesW as is.
+struct reg_value_entry
+{
+    wchar_t * name;
+    uint32_t size;
+    uintptr_t ptr;
+    reg_type type;
+};
+
+// Result of reading one value from every subkey: names and values are stored back to back in one
+// null-separated blob, entry n spans offsets[2 * n] (name) and offsets[2 * n + 1] (value).
+struct reg_subkey_values
+{
+    std::wstring blob;
+    std::vector<uint32_t> offsets;
+    std::vector<reg_type> types;
+
+    size_t size() const noexcept { return types.size(); }
+    bool empty() const noexcept { return types.empty(); }
+
+    std::wstring_view name(size_t const n) const noexcept { return part(2 * n); }
+    std::wstring_view value(size_t const n) const noexcept { return part(2 * n + 1); }
+    reg_type type(size_t const n) const noexcept { return types[n]; }
+    bool found(size_t const n) const noexcept { return types[n] != reg_type::none; }
+
+private:
+    std::wstring_view part(size_t const n) const noexcept
+    {
+        return std::wstring_view(blob).substr(offsets[n], offsets[n + 1] - offsets[n] - 1);
+    }
+};
+
+template<typename Backend>
+struct reg_key
+{
+    using backend_type = Backend;
+    using handle_type = typename Backend::handle_type;
+
+    reg_key() :
+        key_(nullptr, deleter_normal())
+    {
+    }
+
+    reg_key(reg_key const & right) = default;
+    reg_key & operator=(reg_key const & right) = default;
+
+    void swap(reg_key & right) noexcept
+    {
+        key_.swap(right.key_);
+        path_.swap(right.path_);
+    }
+
+    reg_key(reg_key && right) noexcept :
+        key_(nullptr, deleter_normal())
+    {
+        swap(right);
+    }
+
+    reg_key & operator=(reg_key && right) noexcept
+    {
+        reg_key tmp;
+        swap(tmp);
+        swap(right);
+        return *this;
+    }
+
+    // Predefined root keys, only for backends that provide them (the Win32 one).
+    #define KEY(N, K, T) \
+        template<typename B = Backend, typename = decltype(B::N())> \
+        static reg_key const & N() \
+        { \
+            static reg_key const root_key(L###T, B::N(), root_reg_key_t()); \
+            return root_key; \
+        }
+    #include "root_keys.inc"
+
+    // Non-owning key over a backend root handle that outlives it.
+    static reg_key make_root(wchar_t const * const path, handle_type const key)
+    {
+        return reg_key(path, key, root_reg_key_t());
+    }
+
+    bool empty() const noexcept { return !key_; }
+    explicit operator bool() const noexcept { return !!key_; }
+    bool operator!() const noexcept { return !key_; }
+
+    // Full path as opened, with '\\' separators and the root name first.
+    std::wstring const & path() const { return path_; }
+    handle_type handle() const noexcept { return key_.get(); }
+
+    reg_key create_key(std::wstring_view const & path, uint32_t const sam = reg_access::all_access) const
+    {
+        auto result_path = child_path(path);
+        handle_type hkey = nullptr;
+        auto const error = Backend::create_key(key_.get(), path.data(), sam, hkey);
+        if (error != reg_status::success)
+            throw std::runtime_error("Failed to create registry key");
+        return reg_key(std::move(result_path), hkey);
+    }
+
+    reg_key open_key(std::wstring_view const & path, bool const throw_if_nof_found = true, uint32_t const sam = reg_access::read) const
+    {
+        auto result_path = child_path(path);
+        handle_type hkey = nullptr;
+        auto const error = Backend::open_key(key_.get(), path.data(), sam, hkey);
+        if (error != reg_status::success)
+        {
+            if (!throw_if_nof_found && error == reg_status::not_found)
+                return reg_key(std::move(result_path));
+            throw std::runtime_error("Failed to open registry key");
+        }
+        return reg_key(std::move(result_path), hkey);
+    }
+
+    expected<reg_key> try_open_key(std::wstring_view const & path, uint32_t const sam = reg_access::read) const
+    {
+        handle_type hkey = nullptr;
+        auto const error = Backend::open_key(key_.get(), path.data(), sam, hkey);
+        if (error != reg_status::success)
+            return reg_error(error);
+        return reg_key(child_path(path), hkey);
+    }
+
+    bool delete_key(std::wstring_view const & path, bool const throw_if_nof_found = true) const
+    {
+        auto const error = Backend::delete_key(key_.get(), path.data());
+        if (error == reg_status::success)
+            return true;
+        if (!throw_if_nof_found && error == reg_status::not_found)
+            return false;
+        throw std::runtime_error("Can't delete registry key");
+    }
+
+    void delete_value(std::wstring_view const & name) const
+    {
+        auto const error = Backend::delete_value(key_.get(), name.data());
+        if (error != reg_status::success)
+            throw std::runtime_error("Failed to delete registry value");
+    }
+
+    reg_key_info query_info() const
+    {
+        reg_key_info info;
+        auto const error = Backend::query_info(key_.get(), info);
+        if (error != reg_status::success)
+            throw std::runtime_error("Can't query registry key info");
+        return info;
+    }
+
+    // Signals event once on the next change of a name or value of the key, or of any key below it
+    // with watch_subtree. The request is one-shot: call again after every signal.
+    void notify_change(void * const event, bool const watch_subtree) const
+    {
+        auto const error = Backend::notify_change(key_.get(), watch_subtree, event);
+        if (error != reg_status::success)
+            throw std::runtime_error("Can't watch registry key");
+    }
+
+    // Lazy enumeration of subkey or value names. Every name is a view into one buffer owned by the
+    // range and pre-sized from the key info, so it is valid only until the iterator is advanced.
+    // The range borrows the native handle of its key and must not outlive it.
+    class name_range final
+    {
+    public:
+        class iterator final
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::wstring_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = std::wstring_view const *;
+            using reference = std::wstring_view const &;
+
+            iterator() noexcept = default;
+
+            reference operator*() const noexcept { return range_->name_; }
+            pointer operator->() const noexcept { return &range_->name_; }
+
+            iterator & operator++()
+            {
+                if (!range_->next())
+                    range_ = nullptr;
+                return *this;
+            }
+
+            bool operator==(iterator const & right) const noexcept { return range_ == right.range_; }
+            bool operator!=(iterator const & right) const noexcept { return range_ != right.range_; }
+
+        private:
+            friend class name_range;
+
+            explicit iterator(name_range * const range) noexcept :
+                range_(range)
+            {
+            }
+
+            name_range * range_ = nullptr;
+        };
+
+        name_range(name_range const &) = delete;
+        name_range & operator=(name_range const &) = delete;
+
+        name_range(name_range &&) = default;
+        name_range & operator=(name_range &&) = default;
+
+        iterator begin()
+        {
+            index_ = 0;
+            return iterator(next() ? this : nullptr);
+        }
+
+        iterator end() noexcept { return iterator(); }
+
+        size_t size_hint() const noexcept { return count_; }
+
+        std::pmr::vector<std::pmr::wstring> collect(std::pmr::memory_resource * const resource = std::pmr::get_default_resource())
+        {
+            std::pmr::vector<std::pmr::wstring> result(resource);
+            result.reserve(count_);
+            for (auto && name : *this)
+                result.emplace_back(name);
+            return result;
+        }
+
+    private:
+        friend struct reg_key;
+
+        name_range(reg_key const & key, bool const is_value) :
+            key_(key.handle()),
+            is_value_(is_value)
+        {
+            auto const info = key.query_info();
+            count_ = is_value_ ? info.value_count : info.key_count;
+            buffer_.resize((is_value_ ? info.max_value_name_size : info.max_key_name_size) + 1);
+        }
+
+        bool next()
+        {
+            while (true)
+            {
+                auto name_size = static_cast<uint32_t>(buffer_.size());
+                auto const error = is_value_ ?
+                    Backend::enum_value(key_, index_, buffer_.data(), name_size) :
+                    Backend::enum_key(key_, index_, buffer_.data(), name_size);
+                if (error == reg_status::success)
+                {
+                    name_ = std::wstring_view(buffer_.data(), name_size);
+                    ++index_;
+                    return true;
+                }
+                if (error == reg_status::no_more_items)
+                    return false;
+                if (error == reg_status::more_data)
+                {
+                    buffer_.resize(2 * buffer_.size());
+                    continue;
+                }
+                throw std::runtime_error(is_value_ ? "Can't enum registry value names" : "Can't enum registry key names");
+            }
+        }
+
+        handle_type key_;
+        bool is_value_;
+        uint32_t index_ = 0;
+        uint32_t count_ = 0;
+        std::vector<wchar_t> buffer_;
+        std::wstring_view name_;
+    };
+
+    name_range keys() const { return name_range(*this, false); }
+    name_range values() const { return name_range(*this, true); }
+
+    // Reads the string value from every subkey, fanning the subkeys out over a worker pool. Every
+    // worker reuses one data buffer that keeps the largest size seen, so a value is normally read
+    // with a single call. Missing subkeys or values are reported as reg_type::none.
+    reg_subkey_values get_subkey_values_SZ(std::wstring_view const & name, unsigned threads = 0) const
+    {
+        std::wstring names;
+        std::vector<uint32_t> name_offsets;
+        {
+            auto range = keys();
+            name_offsets.reserve(range.size_hint() + 1);
+            for (auto && key_name : range)
+            {
+                name_offsets.push_back(static_cast<uint32_t>(names.size()));
+                names.append(key_name);
+                names.push_back(L'\0');
+            }
+            name_offsets.push_back(static_cast<uint32_t>(names.size()));
+        }
+        auto const count = name_offsets.size() - 1;
+
+        struct chunk_t
+        {
+            std::wstring values;
+            std::vector<uint32_t> offsets;
+            std::vector<reg_type> types;
+            std::exception_ptr error;
+        };
+
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned>(std::min<size_t>(threads, (count + min_keys_per_thread - 1) / min_keys_per_thread));
+        threads = std::max(1u, threads);
+        std::vector<chunk_t> chunks(threads);
+        std::wstring const value_name(name);
+
+        auto const worker = [&](unsigned const index)
+            {
+                auto & chunk = chunks[index];
+                try
+                {
+                    auto const first = count * index / threads;
+                    auto const last = count * (index + 1) / threads;
+                    std::vector<uint8_t> data(init_bulk_data_size);
+                    chunk.offsets.reserve(last - first);
+                    chunk.types.reserve(last - first);
+                    for (auto n = first; n < last; ++n)
+                    {
+                        chunk.offsets.push_back(static_cast<uint32_t>(chunk.values.size()));
+                        auto const type = read_subkey_value_SZ(names.c_str() + name_offsets[n], value_name.c_str(), data, chunk.values);
+                        chunk.values.push_back(L'\0');
+                        chunk.types.push_back(type);
+                    }
+                }
+                catch (...)
+                {
+                    chunk.error = std::current_exception();
+                }
+            };
+
+        {
+            std::vector<std::thread> pool;
+            pool.reserve(threads - 1);
+            for (unsigned n = 1; n < threads; ++n)
+                pool.emplace_back(worker, n);
+            worker(0);
+            for (auto & thread : pool)
+                thread.join();
+        }
+
+        reg_subkey_values result;
+        result.blob.reserve(names.size() + std::accumulate(chunks.begin(), chunks.end(), size_t(0), [](size_t const sum, chunk_t const & chunk) { return sum + chunk.values.size(); }));
+        result.offsets.reserve(2 * count + 1);
+        result.types.reserve(count);
+        size_t n = 0;
+        for (auto & chunk : chunks)
+        {
+            if (chunk.error)
+                std::rethrow_exception(chunk.error);
+            for (size_t k = 0; k < chunk.types.size(); ++k, ++n)
+            {
+                result.offsets.push_back(static_cast<uint32_t>(result.blob.size()));
+                result.blob.append(names, name_offsets[n], name_offsets[n + 1] - name_offsets[n]);
+                result.offsets.push_back(static_cast<uint32_t>(result.blob.size()));
+                auto const value_end = k + 1 < chunk.offsets.size() ? chunk.offsets[k + 1] : chunk.values.size();
+                result.blob.append(chunk.values, chunk.offsets[k], value_end - chunk.offsets[k]);
+                result.types.push_back(chunk.types[k]);
+            }
+        }
+        result.offsets.push_back(static_cast<uint32_t>(result.blob.size()));
+        return result;
+    }
+
+    // Calls fn for every subkey or value name without throwing; enumeration failures are returned.
+    template<typename Fn>
+    status try_enum_keys(Fn && fn) const
+    {
+        return try_enum(false, fn);
+    }
+
+    template<typename Fn>
+    status try_enum_values(Fn && fn) const
+    {
+        return try_enum(true, fn);
+    }
+
+    std::vector<std::wstring> get_key_names() const
+    {
+        return collect_names(keys());
+    }
+
+    std::vector<std::wstring> get_value_names() const
+    {
+        return collect_names(values());
+    }
+
+    void set_value(std::wstring_view const & name, reg_type const type, size_t const data_size, uint8_t const * const data) const
+    {
+        auto const error = Backend::set_value(key_.get(), name.data(), type, data, static_cast<uint32_t>(data_size));
+        if (error != reg_status::success)
+            throw std::runtime_error("Can't set registry value");
+    }
+
+    reg_type get_value(std::wstring_view const & name, std::vector<uint8_t> & data, bool const throw_if_nof_found = true) const
+    {
+        return get_value_data(name, data, throw_if_nof_found);
+    }
+
+    reg_type get_value(std::wstring_view const & name, reg_value_buffer & data, bool const throw_if_nof_found = true) const
+    {
+        return get_value_data(name, data, throw_if_nof_found);
+    }
+
+    // Fetches a set of values in one RegQueryMultipleValuesW pass, falling back to one query per
+    // value when the backend can't or some of the values are missing.
+    reg_values get_values(std::initializer_list<std::wstring_view> const names, std::pmr::memory_resource * const resource = std::pmr::get_default_resource()) const
+    {
+        return get_values(names.begin(), names.size(), resource);
+    }
+
+    // data_size_hint is the expected total size of all values, 0 picks a default per value.
+    reg_values get_values(std::wstring_view const * const names, size_t const name_count, std::pmr::memory_resource * const resource = std::pmr::get_default_resource(), size_t const data_size_hint = 0) const
+    {
+        reg_values result(resource);
+        auto const count = static_cast<uint32_t>(name_count);
+        result.items.reserve(count);
+
+        std::pmr::vector<reg_value_entry> entries(resource);
+        entries.reserve(count);
+        for (size_t n = 0; n < name_count; ++n)
+            entries.push_back({ const_cast<wchar_t *>(names[n].data()), 0, 0, reg_type::none });
+
+        auto data_size = static_cast<uint32_t>(data_size_hint ? data_size_hint : count * init_multi_data_size);
+        while (true)
+        {
+            result.data.resize(data_size);
+            auto const error = Backend::query_multiple_values(key_.get(), entries.data(), count, result.data.data(), data_size);
+            if (error == reg_status::success)
+            {
+                result.data.resize(data_size);
+                auto const base = reinterpret_cast<uintptr_t>(result.data.data());
+                for (auto && entry : entries)
+                    result.items.push_back({ entry.type, static_cast<uint32_t>(entry.ptr - base), entry.size });
+                return result;
+            }
+            if (error != reg_status::more_data)
+                break;
+        }
+
+        result.data.clear();
+        for (size_t n = 0; n < name_count; ++n)
+        {
+            auto const & name = names[n];
+            auto type = reg_type::none;
+            auto const offset = static_cast<uint32_t>(result.data.size());
+            uint32_t size = 0;
+            auto error = Backend::query_value(key_.get(), name.data(), type, nullptr, size);
+            while (error == reg_status::success || error == reg_status::more_data)
+            {
+                result.data.resize(offset + size);
+                error = Backend::query_value(key_.get(), name.data(), type, result.data.data() + offset, size);
+                if (error == reg_status::success)
+                    break;
+            }
+            if (error == reg_status::not_found)
+            {
+                type = reg_type::none;
+                size = 0;
+            }
+            else if (error != reg_status::success)
+                throw std::runtime_error("Can't get registry value");
+            result.data.resize(offset + size);
+            result.items.push_back({ type, offset, size });
+        }
+        return result;
+    }
+
+    void set_value_SZ(std::wstring_view const & name, std::wstring_view const & value, reg_type const type = reg_type::sz) const
+    {
+        if (!(type == reg_type::sz || type == reg_type::expand_sz))
+            throw std::runtime_error("Invalid type");
+        set_value(name, type, (value.size() + 1) * sizeof(wchar_t), reinterpret_cast<uint8_t const *>(value.data()));
+    }
+
+    void set_value_DWORD(std::wstring_view const & name, uint32_t const value) const
+    {
+        set_value(name, reg_type::dword, sizeof(value), reinterpret_cast<uint8_t const *>(&value));
+    }
+
+    void set_value_QWORD(std::wstring_view const & name, uint64_t const value) const
+    {
+        set_value(name, reg_type::qword, sizeof(value), reinterpret_cast<uint8_t const *>(&value));
+    }
+
+    bool get_value_SZ(std::wstring_view const & name, std::wstring & value, bool const throw_if_nof_found = true) const
+    {
+        reg_value_buffer data;
+        auto const type = get_value(name, data, throw_if_nof_found);
+        switch (type)
+        {
+        case reg_type::none:
+            return false;
+        case reg_type::expand_sz:
+        case reg_type::sz:
+            value = reg_value_SZ(data);
+            return true;
+        default:
+            throw std::runtime_error("Expected REG_SZ or REG_EXPAND_SZ registry value type");
+        }
+    }
+
+    std::wstring get_value_SZ(std::wstring_view const & name) const
+    {
+        std::wstring value;
+        get_value_SZ(name, value);
+        return value;
+    }
+
+    std::optional<std::wstring> get_value_SZ(std::wstring_view const & name, bool const throw_if_nof_found) const
+    {
+        std::wstring value;
+        if (!get_value_SZ(name, value, throw_if_nof_found))
+            return std::nullopt;
+        return value;
+    }
+
+    bool get_value_DWORD(std::wstring_view const & name, uint32_t & value, bool const throw_if_nof_found = true) const
+    {
+        reg_value_buffer data;
+        auto const type = get_value(name, data, throw_if_nof_found);
+        switch (type)
+        {
+        case reg_type::none:
+            return false;
+        case reg_type::dword:
+            value = reg_value_DWORD(data);
+            return true;
+        default:
+            throw std::runtime_error("Expected REG_DWORD registry value type");
+        }
+    }
+
+    uint32_t get_value_DWORD(std::wstring_view const & name) const
+    {
+        uint32_t value;
+        get_value_DWORD(name, value);
+        return value;
+    }
+
+    std::optional<uint32_t> get_value_DWORD(std::wstring_view const & name, bool const throw_if_nof_found) const
+    {
+        uint32_t value;
+        if (!get_value_DWORD(name, value, throw_if_nof_found))
+            return std::nullopt;
+        return value;
+    }
+
+    bool get_value_QWORD(std::wstring_view const & name, uint64_t & value, bool const throw_if_nof_found = true) const
+    {
+        reg_value_buffer data;
+        auto const type = get_value(name, data, throw_if_nof_found);
+        switch (type)
+        {
+        case reg_type::none:
+            return false;
+        case reg_type::qword:
+            value = reg_value_QWORD(data);
+            return true;
+        default:
+            throw std::runtime_error("Expected REG_QWORD registry value type");
+        }
+    }
+
+    uint64_t get_value_QWORD(std::wstring_view const & name) const
+    {
+        uint64_t value;
+        get_value_QWORD(name, value);
+        return value;
+    }
+
+    std::optional<uint64_t> get_value_QWORD(std::wstring_view const & name, bool const throw_if_nof_found) const
+    {
+        uint64_t value;
+        if (!get_value_QWORD(name, value, throw_if_nof_found))
+            return std::nullopt;
+        return value;
+    }
+
+    expected<std::wstring> try_get_value_SZ(std::wstring_view const & name) const
+    {
+        reg_value_buffer data;
+        reg_type type;
+        auto const result = try_get_value_data(name, data, type);
+        if (!result)
+            return result;
+        if (type != reg_type::sz && type != reg_type::expand_sz)
+            return reg_error(reg_status::datatype_mismatch);
+        if (data.size() < sizeof(wchar_t))
+            return reg_error(reg_status::invalid_data);
+        return std::wstring(reg_value_SZ(data));
+    }
+
+    expected<uint32_t> try_get_value_DWORD(std::wstring_view const & name) const
+    {
+        reg_value_buffer data;
+        reg_type type;
+        auto const result = try_get_value_data(name, data, type);
+        if (!result)
+            return result;
+        if (type != reg_type::dword)
+            return reg_error(reg_status::datatype_mismatch);
+        if (data.size() < sizeof(uint32_t))
+            return reg_error(reg_status::invalid_data);
+        return reg_value_DWORD(data);
+    }
+
+    expected<uint64_t> try_get_value_QWORD(std::wstring_view const & name) const
+    {
+        reg_value_buffer data;
+        reg_type type;
+        auto const result = try_get_value_data(name, data, type);
+        if (!result)
+            return result;
+        if (type != reg_type::qword)
+            return reg_error(reg_status::datatype_mismatch);
+        if (data.size() < sizeof(uint64_t))
+            return reg_error(reg_status::invalid_data);
+        return reg_value_QWORD(data);
+    }
+
+private:
+    template<typename Data>
+    status try_get_value_data(std::wstring_view const & name, Data & data, reg_type & type) const
+    {
+        data.resize(std::max(data.capacity(), size_t(init_data_size)));
+        while (true)
+        {
+            auto data_size = static_cast<uint32_t>(data.size());
+            auto const error = Backend::query_value(key_.get(), name.data(), type, data.empty() ? nullptr : data.data(), data_size);
+            if (error == reg_status::success)
+            {
+                data.resize(data_size);
+                return status();
+            }
+            if (error == reg_status::more_data)
+            {
+                data.resize(data_size);
+                continue;
+            }
+            data.clear();
+            return reg_error(error);
+        }
+    }
+
+    template<typename Data>
+    reg_type get_value_data(std::wstring_view const & name, Data & data, bool const throw_if_nof_found) const
+    {
+        reg_type type;
+        auto const result = try_get_value_data(name, data, type);
+        if (result)
+            return type;
+        if (!throw_if_nof_found && result.code() == static_cast<uint32_t>(reg_status::not_found))
+            return reg_type::none;
+        throw std::runtime_error("Can't get registry value");
+    }
+
+    template<typename Fn>
+    status try_enum(bool const is_value, Fn & fn) const
+    {
+        reg_key_info info;
+        auto error = Backend::query_info(key_.get(), info);
+        if (error != reg_status::success)
+            return reg_error(error);
+        std::vector<wchar_t> buffer((is_value ? info.max_value_name_size : info.max_key_name_size) + 1);
+        for (uint32_t index = 0; ; )
+        {
+            auto name_size = static_cast<uint32_t>(buffer.size());
+            error = is_value ?
+                Backend::enum_value(key_.get(), index, buffer.data(), name_size) :
+                Backend::enum_key(key_.get(), index, buffer.data(), name_size);
+            if (error == reg_status::success)
+            {
+                fn(std::wstring_view(buffer.data(), name_size));
+                ++index;
+            }
+            else if (error == reg_status::more_data)
+                buffer.resize(2 * buffer.size());
+            else if (error == reg_status::no_more_items)
+                return status();
+            else
+                return reg_error(error);
+        }
+    }
+
+
+    reg_type read_subkey_value_SZ(wchar_t const * const key_name, wchar_t const * const name, std::vector<uint8_t> & data, std::wstring & value) const
+    {
+        handle_type hkey = nullptr;
+        auto error = Backend::open_key(key_.get(), key_name, reg_access::query_value, hkey);
+        if (error == reg_status::not_found)
+            return reg_type::none;
+        if (error != reg_status::success)
+            throw std::runtime_error("Failed to open registry key");
+        auto && close_key = make_on_exit_scope([hkey] { Backend::close(hkey); });
+        while (true)
+        {
+            reg_type type;
+            auto data_size = static_cast<uint32_t>(data.size());
+            error = Backend::query_value(hkey, name, type, data.data(), data_size);
+            if (error == reg_status::success)
+            {
+                if (type != reg_type::sz && type != reg_type::expand_sz)
+                    throw std::runtime_error("Expected REG_SZ or REG_EXPAND_SZ registry value type");
+                auto const ptr = reinterpret_cast<wchar_t const *>(data.data());
+                auto size = data_size / sizeof(wchar_t);
+                while (size && !ptr[size - 1])
+                    --size;
+                value.append(ptr, size);
+                return type;
+            }
+            if (error == reg_status::not_found)
+                return reg_type::none;
+            if (error == reg_status::more_data)
+            {
+                data.resize(data_size);
+                continue;
+            }
+            throw std::runtime_error("Can't get registry value");
+        }
+    }
+
+    static std::vector<std::wstring> collect_names(name_range && range)
+    {
+        std::vector<std::wstring> result;
+        result.reserve(range.size_hint());
+        for (auto && name : range)
+            result.emplace_back(name);
+        return result;
+    }
+
+    std::wstring child_path(std::wstring_view const & path) const
+    {
+        std::wstring result;
+        result.reserve(path_.size() + 1 + path.size());
+        result.append(path_);
+        if (!path_.empty() && !path.empty())
+            result.push_back(L'\\');
+        result.append(path);
+        return result;
+    }
+
+    reg_key(std::wstring path, handle_type const hkey = nullptr) :
+        key_(hkey, deleter_normal()),
+        path_(std::move(path))
+    {
+    }
+
+    struct root_reg_key_t {};
+
+    reg_key(wchar_t const * const path, handle_type const hkey, root_reg_key_t const) :
+        key_(hkey, deleter_empty()),
+        path_(path)
+    {
+    }
+
+    struct deleter_normal { void operator()(handle_type handle) const noexcept { Backend::close(handle); } };
+    struct deleter_empty { void operator()(handle_type) const noexcept {} };
+
+    std::shared_ptr<std::remove_pointer_t<handle_type>> key_;
+    std::wstring path_;
+
+    static uint32_t const grow_name_size = 16;
+    static uint32_t const init_data_size = 16;
+    static uint32_t const init_bulk_data_size = 512;
+    static uint32_t const init_multi_data_size = 64;
+    static size_t const min_keys_per_thread = 256;
+};
+
+}
+
+template<typename Backend>
+using basic_reg_key = detail_registry::reg_key<Backend>;
+
+using detail_registry::compare_reg_name;
+using detail_registry::reg_access;
+using detail_registry::reg_status;
+using detail_registry::reg_subkey_values;
+using detail_registry::reg_type;
+using detail_registry::reg_upcase;
+
+}
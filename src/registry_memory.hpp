@@ -0,0 +1,518 @@
+﻿#pragma once
+
+#include "registry_key.hpp"
+
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <unordered_map>
+
+namespace jb {
+
+namespace detail_registry {
+
+struct reg_backend_memory;
+
+// Read-only in-memory hive. Keys are collected by add_key/add_value (or load from a .reg style
+// text fixture) and freeze() lays them out as a flat node array where the children of every key
+// are contiguous and sorted, so lookups are binary searches and enumeration is an index.
+// Names are interned case-insensitively, the first spelling wins.
+class reg_memory_hive final
+{
+public:
+    struct cursor
+    {
+        reg_memory_hive const * hive;
+        uint32_t node;
+    };
+
+    reg_memory_hive() :
+        root_cursor_{ this, 0 }
+    {
+        build_nodes_.push_back({ intern(L""), 0, 0 });
+    }
+
+    reg_memory_hive(reg_memory_hive const &) = delete;
+    reg_memory_hive & operator=(reg_memory_hive const &) = delete;
+
+    uint32_t add_key(std::wstring_view path)
+    {
+        check_not_frozen();
+        uint32_t key = 0;
+        while (!path.empty())
+        {
+            auto const pos = path.find(L'\\');
+            auto const name = path.substr(0, pos);
+            path = pos == std::wstring_view::npos ? std::wstring_view() : path.substr(pos + 1);
+            if (name.empty())
+                continue;
+            auto const atom = intern(name);
+            auto const result = build_children_.emplace(uint64_t(key) << 32 | atom, static_cast<uint32_t>(build_nodes_.size()));
+            if (result.second)
+                build_nodes_.push_back({ atom, key, 0 });
+            key = result.first->second;
+        }
+        return key;
+    }
+
+    void set_last_write_time(uint32_t const key, uint64_t const time)
+    {
+        check_not_frozen();
+        build_nodes_[key].last_write_time = time;
+    }
+
+    // A value added again under the same name, in any case, replaces the earlier one, as a later
+    // line of a .reg import does.
+    void add_value(uint32_t const key, std::wstring_view const & name, reg_type const type, void const * const data, size_t const data_size)
+    {
+        check_not_frozen();
+        auto const atom = intern(name);
+        value const item{ key, atom, type, static_cast<uint32_t>(data_.size()), static_cast<uint32_t>(data_size) };
+        auto const result = build_values_.emplace(uint64_t(key) << 32 | atom, static_cast<uint32_t>(values_.size()));
+        if (result.second)
+            values_.push_back(item);
+        else
+            values_[result.first->second] = item;
+        auto const bytes = static_cast<uint8_t const *>(data);
+        data_.insert(data_.end(), bytes, bytes + data_size);
+    }
+
+    void add_value_SZ(uint32_t const key, std::wstring_view const & name, std::wstring_view const & value)
+    {
+        std::wstring const str(value);
+        add_value(key, name, reg_type::sz, str.c_str(), (str.size() + 1) * sizeof(wchar_t));
+    }
+
+    void add_value_DWORD(uint32_t const key, std::wstring_view const & name, uint32_t const value)
+    {
+        add_value(key, name, reg_type::dword, &value, sizeof value);
+    }
+
+    void add_value_QWORD(uint32_t const key, std::wstring_view const & name, uint64_t const value)
+    {
+        add_value(key, name, reg_type::qword, &value, sizeof value);
+    }
+
+    // Subset of the regedit export format: [key] sections, "name"="string", @= default values,
+    // dword: and hex(N): data with '\' line continuations, ';' comments.
+    void load(std::wistream & in)
+    {
+        uint32_t key = 0;
+        bool has_key = false;
+        std::wstring line;
+        std::wstring part;
+        while (std::getline(in, line))
+        {
+            while (!line.empty() && (line.back() == L'\r' || line.back() == L'\n'))
+                line.pop_back();
+            while (!line.empty() && line.back() == L'\\' && line.find(L'=') != std::wstring::npos && std::getline(in, part))
+            {
+                line.pop_back();
+                auto const pos = part.find_first_not_of(L" \t");
+                line.append(part, pos == std::wstring::npos ? part.size() : pos);
+                while (!line.empty() && line.back() == L'\r')
+                    line.pop_back();
+            }
+            if (line.empty() || line[0] == L';' || line.compare(0, 8, L"Windows ") == 0 || line.compare(0, 7, L"REGEDIT") == 0)
+                continue;
+            if (line[0] == L'[')
+            {
+                if (line.back() != L']')
+                    throw std::runtime_error("Invalid registry fixture key line");
+                key = add_key(std::wstring_view(line).substr(1, line.size() - 2));
+                has_key = true;
+                continue;
+            }
+            if (!has_key)
+                throw std::runtime_error("Registry fixture value outside of key");
+            load_value(key, line);
+        }
+    }
+
+    void freeze();
+
+    bool frozen() const noexcept { return frozen_; }
+    size_t key_count() const noexcept { return frozen_ ? nodes_.size() : build_nodes_.size(); }
+    size_t value_count() const noexcept { return values_.size(); }
+
+    basic_reg_key<reg_backend_memory> root() const;
+
+private:
+    friend struct reg_backend_memory;
+
+    struct build_node
+    {
+        uint32_t name;
+        uint32_t parent;
+        uint64_t last_write_time;
+    };
+
+    struct node
+    {
+        uint32_t name;
+        uint32_t first_child;
+        uint32_t child_count;
+        uint32_t first_value;
+        uint32_t value_count;
+        uint64_t last_write_time;
+    };
+
+    struct value
+    {
+        uint32_t key;
+        uint32_t name;
+        reg_type type;
+        uint32_t data_offset;
+        uint32_t data_size;
+    };
+
+    struct atom
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    void check_not_frozen() const
+    {
+        if (frozen_)
+            throw std::runtime_error("In-memory registry hive is frozen");
+    }
+
+    uint32_t intern(std::wstring_view const & name)
+    {
+        std::wstring folded(name);
+        for (auto & ch : folded)
+            ch = reg_upcase(ch);
+        auto const result = atom_index_.emplace(std::move(folded), static_cast<uint32_t>(atoms_.size()));
+        if (result.second)
+        {
+            atoms_.push_back({ static_cast<uint32_t>(names_.size()), static_cast<uint32_t>(name.size()) });
+            names_.append(name);
+        }
+        return result.first->second;
+    }
+
+    std::wstring_view name(uint32_t const atom) const noexcept
+    {
+        return std::wstring_view(names_).substr(atoms_[atom].offset, atoms_[atom].size);
+    }
+
+    void load_value(uint32_t const key, std::wstring const & line)
+    {
+        size_t pos = 0;
+        std::wstring value_name;
+        if (line[0] == L'@')
+            pos = 1;
+        else if (!parse_quoted(line, pos, value_name))
+            throw std::runtime_error("Invalid registry fixture value name");
+        if (pos >= line.size() || line[pos++] != L'=')
+            throw std::runtime_error("Invalid registry fixture value line");
+        auto const data = std::wstring_view(line).substr(pos);
+        if (!data.empty() && data[0] == L'"')
+        {
+            std::wstring str;
+            if (!parse_quoted(line, pos, str))
+                throw std::runtime_error("Invalid registry fixture string value");
+            add_value_SZ(key, value_name, str);
+        }
+        else if (data.compare(0, 6, L"dword:") == 0)
+            add_value_DWORD(key, value_name, static_cast<uint32_t>(std::stoul(std::wstring(data.substr(6)), nullptr, 16)));
+        else if (data.compare(0, 3, L"hex") == 0)
+        {
+            auto type = reg_type::binary;
+            auto pos_data = data.find(L':');
+            if (pos_data == std::wstring_view::npos)
+                throw std::runtime_error("Invalid registry fixture hex value");
+            if (data.size() > 4 && data[3] == L'(')
+                type = static_cast<reg_type>(std::stoul(std::wstring(data.substr(4, pos_data - 5)), nullptr, 16));
+            std::vector<uint8_t> bytes;
+            for (auto rest = data.substr(pos_data + 1); !rest.empty(); )
+            {
+                auto const comma = rest.find(L',');
+                auto const item = rest.substr(0, comma);
+                if (!item.empty())
+                    bytes.push_back(static_cast<uint8_t>(std::stoul(std::wstring(item), nullptr, 16)));
+                rest = comma == std::wstring_view::npos ? std::wstring_view() : rest.substr(comma + 1);
+            }
+            add_value(key, value_name, type, bytes.data(), bytes.size());
+        }
+        else
+            throw std::runtime_error("Unsupported registry fixture value type");
+    }
+
+    static bool parse_quoted(std::wstring const & line, size_t & pos, std::wstring & result)
+    {
+        if (pos >= line.size() || line[pos] != L'"')
+            return false;
+        for (++pos; pos < line.size(); ++pos)
+        {
+            auto ch = line[pos];
+            if (ch == L'"')
+            {
+                ++pos;
+                return true;
+            }
+            if (ch == L'\\' && pos + 1 < line.size())
+                ch = line[++pos];
+            result.push_back(ch);
+        }
+        return false;
+    }
+
+    uint32_t find_child(uint32_t const key, std::wstring_view const & child_name) const noexcept
+    {
+        auto const first = nodes_.begin() + nodes_[key].first_child;
+        auto const last = first + nodes_[key].child_count;
+        auto const it = std::lower_bound(first, last, child_name, [this](node const & item, std::wstring_view const & right)
+            {
+                return compare_reg_name(name(item.name), right) < 0;
+            });
+        if (it == last || compare_reg_name(name(it->name), child_name) != 0)
+            return invalid_index;
+        return static_cast<uint32_t>(it - nodes_.begin());
+    }
+
+    uint32_t find_value(uint32_t const key, std::wstring_view const & value_name) const noexcept
+    {
+        auto const first = values_.begin() + nodes_[key].first_value;
+        auto const last = first + nodes_[key].value_count;
+        auto const it = std::lower_bound(first, last, value_name, [this](value const & item, std::wstring_view const & right)
+            {
+                return compare_reg_name(name(item.name), right) < 0;
+            });
+        if (it == last || compare_reg_name(name(it->name), value_name) != 0)
+            return invalid_index;
+        return static_cast<uint32_t>(it - values_.begin());
+    }
+
+    uint32_t find_key(uint32_t key, std::wstring_view path) const noexcept
+    {
+        while (!path.empty() && key != invalid_index)
+        {
+            auto const pos = path.find(L'\\');
+            auto const child_name = path.substr(0, pos);
+            path = pos == std::wstring_view::npos ? std::wstring_view() : path.substr(pos + 1);
+            if (!child_name.empty())
+                key = find_child(key, child_name);
+        }
+        return key;
+    }
+
+    static uint32_t const invalid_index = ~uint32_t(0);
+
+    bool frozen_ = false;
+    cursor root_cursor_;
+
+    std::wstring names_;
+    std::vector<atom> atoms_;
+    std::unordered_map<std::wstring, uint32_t> atom_index_;
+
+    std::vector<build_node> build_nodes_;
+    std::unordered_map<uint64_t, uint32_t> build_children_;
+    // (key, name atom) to the position of the value in values_.
+    std::unordered_map<uint64_t, uint32_t> build_values_;
+
+    std::vector<node> nodes_;
+    std::vector<value> values_;
+    std::vector<uint8_t> data_;
+};
+
+struct reg_backend_memory
+{
+    using handle_type = reg_memory_hive::cursor *;
+
+    static void close(handle_type const key) noexcept
+    {
+        delete key;
+    }
+
+    static reg_status create_key(handle_type const key, wchar_t const * const path, uint32_t const sam, handle_type & result)
+    {
+        auto const error = open_key(key, path, sam, result);
+        return error == reg_status::not_found ? reg_status::access_denied : error;
+    }
+
+    static reg_status open_key(handle_type const key, wchar_t const * const path, uint32_t, handle_type & result)
+    {
+        if (!key || !key->hive->frozen_)
+            return reg_status::invalid_handle;
+        auto const node = key->hive->find_key(key->node, path ? path : L"");
+        if (node == reg_memory_hive::invalid_index)
+            return reg_status::not_found;
+        result = new reg_memory_hive::cursor{ key->hive, node };
+        return reg_status::success;
+    }
+
+    static reg_status delete_key(handle_type, wchar_t const *)
+    {
+        return reg_status::access_denied;
+    }
+
+    static reg_status delete_value(handle_type, wchar_t const *)
+    {
+        return reg_status::access_denied;
+    }
+
+    static reg_status query_info(handle_type const key, reg_key_info & info)
+    {
+        if (!key)
+            return reg_status::invalid_handle;
+        auto const & hive = *key->hive;
+        auto const & node = hive.nodes_[key->node];
+        info = reg_key_info();
+        info.key_count = node.child_count;
+        info.value_count = node.value_count;
+        info.last_write_time = node.last_write_time;
+        for (auto n = node.first_child; n < node.first_child + node.child_count; ++n)
+            info.max_key_name_size = std::max<uint32_t>(info.max_key_name_size, hive.atoms_[hive.nodes_[n].name].size);
+        for (auto n = node.first_value; n < node.first_value + node.value_count; ++n)
+        {
+            info.max_value_name_size = std::max<uint32_t>(info.max_value_name_size, hive.atoms_[hive.values_[n].name].size);
+            info.max_value_data_size = std::max<uint32_t>(info.max_value_data_size, hive.values_[n].data_size);
+        }
+        return reg_status::success;
+    }
+
+    static reg_status enum_key(handle_type const key, uint32_t const index, wchar_t * const name, uint32_t & name_size)
+    {
+        if (!key)
+            return reg_status::invalid_handle;
+        auto const & node = key->hive->nodes_[key->node];
+        if (index >= node.child_count)
+            return reg_status::no_more_items;
+        return copy_name(key->hive->name(key->hive->nodes_[node.first_child + index].name), name, name_size);
+    }
+
+    static reg_status enum_value(handle_type const key, uint32_t const index, wchar_t * const name, uint32_t & name_size)
+    {
+        if (!key)
+            return reg_status::invalid_handle;
+        auto const & node = key->hive->nodes_[key->node];
+        if (index >= node.value_count)
+            return reg_status::no_more_items;
+        return copy_name(key->hive->name(key->hive->values_[node.first_value + index].name), name, name_size);
+    }
+
+    static reg_status set_value(handle_type, wchar_t const *, reg_type, uint8_t const *, uint32_t)
+    {
+        return reg_status::access_denied;
+    }
+
+    static reg_status query_value(handle_type const key, wchar_t const * const name, reg_type & type, uint8_t * const data, uint32_t & data_size)
+    {
+        if (!key)
+            return reg_status::invalid_handle;
+        auto const & hive = *key->hive;
+        auto const index = hive.find_value(key->node, name ? name : L"");
+        if (index == reg_memory_hive::invalid_index)
+            return reg_status::not_found;
+        auto const & value = hive.values_[index];
+        type = value.type;
+        auto const capacity = data_size;
+        data_size = value.data_size;
+        if (!data)
+            return reg_status::success;
+        if (capacity < value.data_size)
+            return reg_status::more_data;
+        std::copy_n(hive.data_.data() + value.data_offset, value.data_size, data);
+        return reg_status::success;
+    }
+
+    static reg_status query_multiple_values(handle_type, reg_value_entry *, uint32_t, uint8_t *, uint32_t &)
+    {
+        return reg_status::not_supported;
+    }
+
+    static reg_status notify_change(handle_type, bool, void *)
+    {
+        return reg_status::not_supported;
+    }
+
+private:
+    static reg_status copy_name(std::wstring_view const & source, wchar_t * const name, uint32_t & name_size)
+    {
+        if (!name || name_size <= source.size())
+        {
+            name_size = static_cast<uint32_t>(source.size() + 1);
+            return reg_status::more_data;
+        }
+        std::copy(source.begin(), source.end(), name);
+        name[source.size()] = L'\0';
+        name_size = static_cast<uint32_t>(source.size());
+        return reg_status::success;
+    }
+};
+
+inline void reg_memory_hive::freeze()
+{
+    check_not_frozen();
+
+    // Bucket the keys by parent, sort every bucket by name and lay them out breadth-first.
+    auto const count = build_nodes_.size();
+    std::vector<uint32_t> offsets(count + 1);
+    for (size_t n = 1; n < count; ++n)
+        ++offsets[build_nodes_[n].parent + 1];
+    for (size_t n = 0; n < count; ++n)
+        offsets[n + 1] += offsets[n];
+    std::vector<uint32_t> children(count ? count - 1 : 0);
+    {
+        auto fill = offsets;
+        for (uint32_t n = 1; n < count; ++n)
+            children[fill[build_nodes_[n].parent]++] = n;
+    }
+    auto const less_name = [this](uint32_t const left, uint32_t const right)
+        {
+            return compare_reg_name(name(build_nodes_[left].name), name(build_nodes_[right].name)) < 0;
+        };
+
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> remap(count);
+    order.reserve(count);
+    order.push_back(0);
+    nodes_.resize(count);
+    for (size_t n = 0; n < order.size(); ++n)
+    {
+        auto const old_index = order[n];
+        remap[old_index] = static_cast<uint32_t>(n);
+        auto const first = children.begin() + offsets[old_index];
+        auto const last = children.begin() + offsets[old_index + 1];
+        std::sort(first, last, less_name);
+        nodes_[n] = { build_nodes_[old_index].name, static_cast<uint32_t>(order.size()), static_cast<uint32_t>(last - first), 0, 0, build_nodes_[old_index].last_write_time };
+        order.insert(order.end(), first, last);
+    }
+
+    for (auto & item : values_)
+        item.key = remap[item.key];
+    std::stable_sort(values_.begin(), values_.end(), [this](value const & left, value const & right)
+        {
+            if (left.key != right.key)
+                return left.key < right.key;
+            return compare_reg_name(name(left.name), name(right.name)) < 0;
+        });
+    for (uint32_t n = static_cast<uint32_t>(values_.size()); n-- > 0; )
+    {
+        auto & item = nodes_[values_[n].key];
+        item.first_value = n;
+        ++item.value_count;
+    }
+
+    build_nodes_ = std::vector<build_node>();
+    build_children_ = std::unordered_map<uint64_t, uint32_t>();
+    build_values_ = std::unordered_map<uint64_t, uint32_t>();
+    atom_index_ = std::unordered_map<std::wstring, uint32_t>();
+    frozen_ = true;
+}
+
+inline basic_reg_key<reg_backend_memory> reg_memory_hive::root() const
+{
+    if (!frozen_)
+        throw std::runtime_error("In-memory registry hive is not frozen");
+    return basic_reg_key<reg_backend_memory>::make_root(L"", const_cast<cursor *>(&root_cursor_));
+}
+
+}
+
+using detail_registry::reg_memory_hive;
+using reg_memory_key = basic_reg_key<detail_registry::reg_backend_memory>;
+
+}
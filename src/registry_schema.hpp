@@ -0,0 +1,108 @@
+﻿#pragma once
+
+#include "registry_key.hpp"
+
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+
+namespace jb {
+
+namespace detail_registry {
+
+// Decoding of a value whose registry type is known at compile time.
+template<reg_type Type>
+struct reg_schema_type;
+
+template<>
+struct reg_schema_type<reg_type::sz>
+{
+    using value_type = std::wstring;
+
+    static constexpr size_t size_hint = 64 * sizeof(wchar_t);
+
+    static bool accepts(reg_type const type) noexcept { return type == reg_type::sz || type == reg_type::expand_sz; }
+
+    static value_type decode(uint8_t const * const data, uint32_t const size)
+    {
+        auto const ptr = reinterpret_cast<wchar_t const *>(data);
+        auto count = size / sizeof(wchar_t);
+        while (count && !ptr[count - 1])
+            --count;
+        return value_type(ptr, count);
+    }
+};
+
+template<>
+struct reg_schema_type<reg_type::dword>
+{
+    using value_type = uint32_t;
+
+    static constexpr size_t size_hint = sizeof(value_type);
+
+    static bool accepts(reg_type const type) noexcept { return type == reg_type::dword; }
+
+    static value_type decode(uint8_t const * const data, uint32_t const size)
+    {
+        if (size < sizeof(value_type))
+            throw std::runtime_error("Too small DWORD buffer size");
+        value_type value;
+        std::memcpy(&value, data, sizeof value);
+        return value;
+    }
+};
+
+template<>
+struct reg_schema_type<reg_type::qword>
+{
+    using value_type = uint64_t;
+
+    static constexpr size_t size_hint = sizeof(value_type);
+
+    static bool accepts(reg_type const type) noexcept { return type == reg_type::qword; }
+
+    static value_type decode(uint8_t const * const data, uint32_t const size)
+    {
+        if (size < sizeof(value_type))
+            throw std::runtime_error("Too small QWORD buffer size");
+        value_type value;
+        std::memcpy(&value, data, sizeof value);
+        return value;
+    }
+};
+
+template<reg_type Type>
+using reg_schema_value_t = std::optional<typename reg_schema_type<Type>::value_type>;
+
+// Reads every field of a schema struct with one multi-value fetch. A schema declares its fields
+// through an X-macro list FIELD(member, ValueName, reg_type enumerator) and provides value_names,
+// data_size_hint and visit(); see appcontainer_mapping.hpp. Missing values stay empty, values of
+// an unexpected type throw.
+template<typename Schema, typename Backend>
+Schema read_schema(reg_key<Backend> const & key, std::pmr::memory_resource * const resource = std::pmr::get_default_resource())
+{
+    auto const values = key.get_values(Schema::value_names, std::size(Schema::value_names), resource, Schema::data_size_hint);
+    Schema result;
+    size_t n = 0;
+    Schema::visit(result, [&](auto const tag, auto & field)
+        {
+            using type = reg_schema_type<decltype(tag)::value>;
+            auto const index = n++;
+            auto const value_type = values.type(index);
+            if (value_type == reg_type::none)
+                return;
+            if (!type::accepts(value_type))
+                throw std::runtime_error("Unexpected registry value type");
+            field = type::decode(values.bytes(index), values.items[index].size);
+        });
+    return result;
+}
+
+}
+
+using detail_registry::reg_schema_type;
+using detail_registry::reg_schema_value_t;
+using detail_registry::read_schema;
+
+}
@@ -0,0 +1,161 @@
+﻿#include "config.hpp"
+
+#include "run_daemon.hpp"
+#include "daemon.hpp"
+#include "firewall_profile.hpp"
+#include "format.hpp"
+#include "run_snapshot.hpp"
+#include "status.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace jb
+{
+
+void run_daemon(std::wostream & out, daemon_options const & options)
+{
+    reg_change_source source;
+    auto const parts = add_snapshot_watches(out, source);
+
+    // Made on this thread and kept: COM, INetFwPolicy2 and the Mappings key live as long as the daemon.
+    snapshot_session session;
+    diagnostic_snapshot snapshot;
+    daemon_model model;
+    session.collect(snapshot, all_snapshot_parts);
+    model.publish(snapshot);
+
+    daemon_server server(model, options.threads);
+    out << L"Daemon: " << daemon_pipe_name << L": " << dec(options.threads) << L" threads" << std::endl;
+    // The full refresh keeps its own schedule, however often the watched keys change.
+    auto next_refresh = std::chrono::steady_clock::now() + options.refresh;
+    // Parts of a refresh that failed, reread with the next one. Until then the model published last
+    // is served.
+    uint32_t failed = 0;
+    while (true)
+    {
+        auto const now = std::chrono::steady_clock::now();
+        auto const timeout = next_refresh > now ? std::chrono::ceil<std::chrono::milliseconds>(next_refresh - now) : std::chrono::milliseconds(0);
+        auto const changes = wait_coalesced(source, timeout, options.watch);
+        uint32_t stale = 0;
+        if (std::chrono::steady_clock::now() >= next_refresh)
+        {
+            stale = all_snapshot_parts;
+            next_refresh = std::chrono::steady_clock::now() + options.refresh;
+        }
+        for (size_t n = 0; n < parts.size(); ++n)
+            if (changes & (1u << n))
+                stale |= parts[n];
+        if (!stale)
+            continue;
+        stale |= failed;
+
+        auto const start = std::chrono::steady_clock::now();
+        try
+        {
+            session.collect(snapshot, stale);
+        }
+        catch (std::exception const & e)
+        {
+            failed = stale;
+            out << L"Refresh failed: ";
+            for (auto const ch : std::string_view(e.what()))
+                out << static_cast<wchar_t>(static_cast<unsigned char>(ch));
+            out << std::endl;
+            continue;
+        }
+        failed = 0;
+        auto const generation = model.publish(snapshot);
+        auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        out << L"Refresh: generation " << dec(generation) << L":";
+        for (uint32_t part = 1; part && part <= stale; part <<= 1)
+            if (stale & part)
+                out << L' ' << snapshot_part_name(part);
+        out << L": " << dec(static_cast<uint64_t>(elapsed.count())) << L" ms, " << dec(server.requests()) << L" requests served" << std::endl;
+    }
+}
+
+void run_query(std::wostream & out, std::wstring const & query)
+{
+    auto const separator = query.find(L'=');
+    auto const name = query.substr(0, separator);
+    auto const argument = separator == std::wstring::npos ? std::wstring() : query.substr(separator + 1);
+
+    daemon_op op;
+    if (name == L"ping")
+        op = daemon_op::ping;
+    else if (name == L"info")
+        op = daemon_op::info;
+    else if (name == L"firewall")
+        op = daemon_op::firewall;
+    else if (name == L"app_container" && !argument.empty())
+        op = daemon_op::app_container;
+    else if (name == L"snapshot" && !argument.empty())
+        op = daemon_op::snapshot;
+    else
+        throw std::runtime_error("Invalid daemon query");
+
+    daemon_client client;
+    client.open(5000);
+    std::vector<uint8_t> result;
+    auto const start = std::chrono::steady_clock::now();
+    auto const error = op == daemon_op::app_container ?
+        client.request(op, argument.data(), argument.size() * sizeof(wchar_t), result) :
+        client.request(op, nullptr, 0, result);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    out << L"Query: " << name << L": " << dec(static_cast<uint64_t>(elapsed.count())) << L" us: ";
+    if (!is_succeeded(out, error))
+        return;
+    out << L"succeeded\n";
+
+    switch (op)
+    {
+    case daemon_op::info:
+    {
+        uint64_t generation;
+        int64_t created;
+        uint32_t present;
+        if (result.size() != sizeof generation + sizeof created + sizeof present)
+            throw std::runtime_error("Invalid daemon info");
+        std::memcpy(&generation, result.data(), sizeof generation);
+        std::memcpy(&created, result.data() + sizeof generation, sizeof created);
+        std::memcpy(&present, result.data() + sizeof generation + sizeof created, sizeof present);
+        out << L"Generation: " << dec(generation) << L", created: " << dec(created) << L", present: 0x" << hex(present) << L'\n';
+        break;
+    }
+
+    case daemon_op::firewall:
+        if (result.size() != 4 * std::size(firewall_profile_names))
+            throw std::runtime_error("Invalid daemon firewall answer");
+        for (size_t n = 0; n < std::size(firewall_profile_names); ++n)
+        {
+            auto const bytes = result.data() + 4 * n;
+            out << firewall_profile_names[n] << L": enabled: " << (bytes[0] ? L"yes" : L"no") << L", block_all_inbound: " << (bytes[1] ? L"yes" : L"no")
+                << L", inbound: " << (bytes[2] == NET_FW_ACTION_BLOCK ? L"block" : L"allow") << L", outbound: " << (bytes[3] == NET_FW_ACTION_BLOCK ? L"block" : L"allow") << L'\n';
+        }
+        break;
+
+    case daemon_op::app_container:
+        out << std::wstring_view(reinterpret_cast<wchar_t const *>(result.data()), result.size() / sizeof(wchar_t));
+        break;
+
+    case daemon_op::snapshot:
+    {
+        std::ofstream file(std::filesystem::path{ argument }, std::ios::binary | std::ios::trunc);
+        if (!file.write(reinterpret_cast<char const *>(result.data()), result.size()).flush())
+            throw std::runtime_error("Can't write the snapshot file");
+        out << L"Snapshot: " << argument << L": " << dec(result.size()) << L" bytes\n";
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include "watch.hpp"
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+namespace jb
+{
+
+struct daemon_options final
+{
+    unsigned threads = 4;
+    // Everything is reread this often too, for the state no watched key shows.
+    std::chrono::seconds refresh = std::chrono::seconds(60);
+    watch_options watch;
+};
+
+// Keeps a snapshot_session and a daemon_model current from registry change notifications and
+// serves it over daemon_pipe_name. Runs until the process is stopped.
+void run_daemon(std::wostream & out, daemon_options const & options);
+
+// Sends one query to a running daemon and prints the answer with its round trip time:
+// "ping", "info", "firewall", "app_container=<SID>" or "snapshot=<file>", which saves the
+// daemon's snapshot for --diff.
+void run_query(std::wostream & out, std::wstring const & query);
+
+}
@@ -1,10 +1,10 @@
-﻿#pragma once
-
-#include <ostream>
-
-namespace jb
-{
-
-void run_elevation(std::wostream & out);
-
+﻿#pragma once
+
+#include <ostream>
+
+namespace jb
+{
+
+void run_elevation(std::wostream & out);
+
 }
\ No newline at end of file
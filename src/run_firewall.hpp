@@ -1,10 +1,10 @@
-﻿#pragma once
-
-#include <ostream>
-
-namespace jb
-{
-
-void run_firewall(std::wostream & out);
-
+﻿#pragma once
+
+#include <ostream>
+
+namespace jb
+{
+
+void run_firewall(std::wostream & out);
+
 }
\ No newline at end of file
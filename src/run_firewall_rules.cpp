@@ -0,0 +1,269 @@
+﻿#include "config.hpp"
+
+#include "run_firewall_rules.hpp"
+#include "firewall_classifier.hpp"
+#include "firewall_profile.hpp"
+#include "firewall_rules.hpp"
+#include "format.hpp"
+#include "instrument.hpp"
+#include "on_exit.hpp"
+#include "output.hpp"
+#include "status.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace jb
+{
+
+namespace
+{
+
+bool parse_number(std::wstring_view const & text, long & value)
+{
+    if (text.empty() || text.size() > 5)
+        return false;
+    value = 0;
+    for (auto const ch : text)
+    {
+        if (ch < L'0' || ch > L'9')
+            return false;
+        value = value * 10 + (ch - L'0');
+    }
+    return true;
+}
+
+firewall_rule_query parse_query(std::wstring_view query)
+{
+    firewall_rule_query result;
+    while (!query.empty())
+    {
+        auto const pos = query.find(L';');
+        auto const item = query.substr(0, pos);
+        query = pos == std::wstring_view::npos ? std::wstring_view() : query.substr(pos + 1);
+        if (item.empty())
+            continue;
+        auto const eq = item.find(L'=');
+        auto const key = item.substr(0, eq);
+        auto const value = eq == std::wstring_view::npos ? std::wstring_view() : item.substr(eq + 1);
+        long number;
+        if (key == L"app")
+            result.application = std::wstring(value);
+        else if (key == L"port" && parse_number(value, number) && number <= 0xFFFF)
+            result.local_port = static_cast<uint16_t>(number);
+        else if (key == L"protocol")
+        {
+            if (value == L"tcp")
+                result.protocol = NET_FW_IP_PROTOCOL_TCP;
+            else if (value == L"udp")
+                result.protocol = NET_FW_IP_PROTOCOL_UDP;
+            else if (value == L"any")
+                result.protocol = NET_FW_IP_PROTOCOL_ANY;
+            else if (parse_number(value, number))
+                result.protocol = number;
+            else
+                throw std::runtime_error("Invalid protocol in firewall rule query");
+        }
+        else if (key == L"direction" && (value == L"in" || value == L"out"))
+            result.direction = value == L"in" ? NET_FW_RULE_DIR_IN : NET_FW_RULE_DIR_OUT;
+        else if (key == L"profile")
+        {
+            for (auto rest = value; !rest.empty(); )
+            {
+                auto const comma = rest.find(L',');
+                auto const name = rest.substr(0, comma);
+                rest = comma == std::wstring_view::npos ? std::wstring_view() : rest.substr(comma + 1);
+                size_t n = 0;
+                while (n < std::size(firewall_profile_names) && name != firewall_profile_names[n])
+                    ++n;
+                if (n == std::size(firewall_profile_names))
+                    throw std::runtime_error("Invalid profile in firewall rule query");
+                result.profiles |= firewall_profiles[n];
+            }
+        }
+        else if (key == L"enabled" && value == L"yes")
+            result.enabled_only = true;
+        else
+            throw std::runtime_error("Invalid firewall rule query");
+    }
+    return result;
+}
+
+// Reads the profile defaults as well when defaults is not null.
+bool load_live_rules(std::wostream & out, firewall_rule_snapshot & snapshot, firewall_defaults * const defaults)
+{
+    out << L"CoInitializeEx: ";
+    if (!is_succeeded(out, trace_call(api_call::CoInitializeEx, [&] { return status::hresult(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)); })))
+        return false;
+    auto && free_com = make_on_exit_scope([] { CoUninitialize(); });
+    out << L"succeeded\n";
+
+    out << L"CoCreateInstance: INetFwPolicy2: ";
+    INetFwPolicy2 * net_fw_policy2;
+    if (!is_succeeded(out, trace_call(api_call::CoCreateInstance, [&] { return status::hresult(CoCreateInstance(__uuidof(NetFwPolicy2), nullptr, CLSCTX_INPROC_SERVER, __uuidof(INetFwPolicy2), reinterpret_cast<void **>(&net_fw_policy2))); })))
+        return false;
+    auto && free_net_fw_policy2 = make_on_exit_scope([net_fw_policy2] { net_fw_policy2->Release(); });
+    out << L"succeeded\n";
+
+    out << L"INetFwPolicy2: Rules: ";
+    if (!is_succeeded(out, load_firewall_rules(net_fw_policy2, snapshot)))
+        return false;
+    out << L"succeeded\n";
+
+    if (defaults)
+        *defaults = read_firewall_defaults(net_fw_policy2);
+    return true;
+}
+
+bool load_rules(std::wostream & out, std::wstring const & file, firewall_rule_snapshot & snapshot, firewall_defaults * const defaults)
+{
+    if (file.empty())
+        return load_live_rules(out, snapshot, defaults);
+
+    std::wifstream in(std::filesystem::path{ file });
+    if (!in)
+        throw std::runtime_error("Can't open the firewall rule file");
+    snapshot.load(in);
+    snapshot.freeze();
+    return true;
+}
+
+// Traffic over private and public addresses and common ports. Half of the packets come from the
+// application of a random rule, and from its service when it names one.
+std::vector<firewall_packet> make_traffic(size_t const count, firewall_rule_snapshot const & snapshot, firewall_classifier const & classifier, uint64_t const seed)
+{
+    static uint16_t const ports[] = { 53, 80, 135, 443, 445, 3389, 5353, 8080 };
+
+    std::mt19937_64 random(seed);
+    std::vector<firewall_packet> result(count);
+    for (auto & packet : result)
+    {
+        packet.direction = random() % 2 ? NET_FW_RULE_DIR_OUT : NET_FW_RULE_DIR_IN;
+        packet.profile = firewall_profiles[random() % std::size(firewall_profiles)];
+        packet.protocol = static_cast<uint16_t>(random() % 4 ? NET_FW_IP_PROTOCOL_TCP : NET_FW_IP_PROTOCOL_UDP);
+        packet.local_address = ip_address::from_ipv4(0xC0A80000u | static_cast<uint32_t>(random() % 0x10000));
+        packet.remote_address = random() % 2 ?
+            ip_address::from_ipv4(0x0A000000u | static_cast<uint32_t>(random() % 0x1000000)) :
+            ip_address::from_ipv4(static_cast<uint32_t>(random()));
+        packet.local_port = random() % 2 ? ports[random() % std::size(ports)] : static_cast<uint16_t>(random());
+        packet.remote_port = static_cast<uint16_t>(49152 + random() % 16384);
+        if (snapshot.size() && random() % 2)
+        {
+            auto const rule = random() % snapshot.size();
+            packet.application = classifier.application_id(snapshot.application(rule));
+            auto const service = snapshot.service(rule);
+            if (!service.empty() && service != L"Any")
+                packet.service = classifier.service_id(service);
+        }
+    }
+    return result;
+}
+
+wchar_t const * source_name(firewall_decision::source_type const source)
+{
+    switch (source)
+    {
+    case firewall_decision::source_type::rule: return L"rule";
+    case firewall_decision::source_type::default_action: return L"default";
+    case firewall_decision::source_type::block_all_inbound: return L"block_all_inbound";
+    case firewall_decision::source_type::firewall_disabled: return L"firewall_disabled";
+    }
+    return L"unknown";
+}
+
+}
+
+void run_firewall_rules(std::wostream & out, std::wstring const & file, std::wstring_view const query)
+{
+    auto const rule_query = parse_query(query);
+
+    firewall_rule_snapshot snapshot;
+    if (!load_rules(out, file, snapshot, nullptr))
+        return;
+    out << L"FirewallRules: " << dec(snapshot.size()) << L" rules, " << dec(snapshot.string_count()) << L" strings\n";
+
+    auto const start = std::chrono::steady_clock::now();
+    auto const matches = snapshot.find(rule_query);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    out << L"Query: " << query << L": " << dec(matches.size()) << L" matches in " << dec(elapsed.count()) << L" us\n";
+    for (auto const n : matches)
+    {
+        auto const direction = snapshot.direction(n) == NET_FW_RULE_DIR_OUT ? L"out" : L"in";
+        auto const action = snapshot.action(n) == NET_FW_ACTION_BLOCK ? L"block" : L"allow";
+        out << L"  #" << dec(n) << L": " << snapshot.name(n) << L": " <<
+            direction << L' ' <<
+            action << L' ' <<
+            (snapshot.enabled(n) ? L"enabled" : L"disabled") << L' ' <<
+            L"protocol=" << dec(snapshot.protocol(n)) << L' ' <<
+            L"ports=" << snapshot.local_ports(n) << L' ' <<
+            L"profiles=0x" << hex(snapshot.profiles(n)) << L' ' <<
+            L"app=" << snapshot.application(n);
+        output_record(out, L"rule").number(L"index", n).text(L"name", snapshot.name(n)).text(L"direction", direction).text(L"action", action).
+            flag(L"enabled", snapshot.enabled(n)).number(L"protocol", snapshot.protocol(n)).text(L"ports", snapshot.local_ports(n)).
+            number(L"profiles", snapshot.profiles(n)).text(L"application", snapshot.application(n));
+    }
+}
+
+void run_firewall_classify(std::wostream & out, std::wstring const & file, size_t const count)
+{
+    firewall_rule_snapshot snapshot;
+    firewall_defaults defaults;
+    if (!load_rules(out, file, snapshot, &defaults))
+        return;
+
+    auto const compile_start = std::chrono::steady_clock::now();
+    firewall_classifier const classifier(snapshot, defaults);
+    auto const compile_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - compile_start);
+    out << L"FirewallClassifier: " << dec(classifier.rule_count()) << L" of " << dec(snapshot.size()) << L" rules compiled in " << dec(compile_elapsed.count()) << L" us\n";
+
+    auto const packets = make_traffic(count, snapshot, classifier, 0x436C617373696679ull);
+
+    std::vector<firewall_decision> decisions(count);
+    auto const start = std::chrono::steady_clock::now();
+    classifier.classify(packets.data(), count, decisions.data());
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    out << L"Classify: " << dec(count) << L" packets in " << dec(elapsed.count()) << L" us";
+    if (elapsed.count())
+        out << L", " << dec(static_cast<uint64_t>(count * 1e6 / elapsed.count())) << L" packets/s";
+    out << L'\n';
+
+    size_t totals[4][2] = {};
+    std::vector<size_t> hits(snapshot.size());
+    for (auto const & decision : decisions)
+    {
+        ++totals[static_cast<size_t>(decision.source)][decision.action == NET_FW_ACTION_BLOCK ? 0 : 1];
+        if (decision.source == firewall_decision::source_type::rule)
+            ++hits[decision.rule];
+    }
+    for (size_t source = 0; source < 4; ++source)
+        for (size_t action = 0; action < 2; ++action)
+            if (totals[source][action])
+            {
+                auto const name = source_name(static_cast<firewall_decision::source_type>(source));
+                auto const verdict = action ? L"allow" : L"block";
+                out << L"  " << name << L' ' << verdict << L": " << dec(totals[source][action]);
+                output_record(out, L"verdict").text(L"source", name).text(L"verdict", verdict).number(L"packets", totals[source][action]);
+            }
+
+    size_t const top_count = 10;
+    std::vector<uint32_t> top;
+    for (uint32_t n = 0; n < hits.size(); ++n)
+        if (hits[n])
+            top.push_back(n);
+    auto const top_end = top.begin() + std::min(top_count, top.size());
+    std::partial_sort(top.begin(), top_end, top.end(), [&](uint32_t const left, uint32_t const right) { return hits[left] > hits[right]; });
+    top.erase(top_end, top.end());
+    for (auto const n : top)
+    {
+        out << L"  #" << dec(n) << L": " << snapshot.name(n) << L": " << dec(hits[n]) << L" packets";
+        output_record(out, L"rule_hits").number(L"index", n).text(L"name", snapshot.name(n)).number(L"packets", hits[n]);
+    }
+}
+
+}
@@ -0,0 +1,21 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace jb
+{
+
+// Snapshots the firewall rules, from the live policy or from an export file when file is not
+// empty, and prints the ones matching query: "app=<path>;port=<n>;protocol=tcp|udp|any|<n>;
+// direction=in|out;profile=domain,private,public;enabled=yes", every part optional.
+void run_firewall_rules(std::wostream & out, std::wstring const & file, std::wstring_view query);
+
+// Compiles the same snapshot into a firewall_classifier and classifies count generated packets
+// against it. The profile defaults come from the live policy, an export file gets the Windows
+// defaults. Prints the throughput, the decision mix and the rules that decided most packets.
+void run_firewall_classify(std::wostream & out, std::wstring const & file, size_t count);
+
+}
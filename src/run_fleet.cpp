@@ -0,0 +1,54 @@
+﻿#include "config.hpp"
+
+#include "run_fleet.hpp"
+#include "fleet.hpp"
+#include "format.hpp"
+
+#include <chrono>
+#include <stdexcept>
+
+namespace jb
+{
+
+namespace
+{
+
+void answer(std::wostream & out, fleet const & hosts, std::wstring const & query)
+{
+    auto const start = std::chrono::steady_clock::now();
+    if (!hosts.query(out, query))
+        out << L"Query: " << query << L": unknown, use summary, host=<name>, container=<SID or name>, top[=<count>], rare[=<hosts>], firewall or elevation\n";
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    out << L"Query: " << query << L": " << dec(static_cast<uint64_t>(elapsed.count())) << L" us" << std::endl;
+}
+
+}
+
+void run_fleet(std::wostream & out, std::wistream & in, std::wstring const & directory, fleet_options const & options)
+{
+    fleet hosts;
+    auto const start = std::chrono::steady_clock::now();
+    hosts.load(directory, options.threads);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    out << L"Fleet: " << directory << L": loaded in " << dec(static_cast<uint64_t>(elapsed.count())) << L" ms\n";
+    hosts.query(out, L"summary");
+    out.flush();
+
+    if (!options.query.empty())
+    {
+        answer(out, hosts, options.query);
+        return;
+    }
+    for (std::wstring line; std::getline(in, line); )
+    {
+        if (!line.empty() && line.back() == L'\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+        if (line == L"quit")
+            break;
+        answer(out, hosts, line);
+    }
+}
+
+}
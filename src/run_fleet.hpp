@@ -0,0 +1,22 @@
+﻿#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace jb
+{
+
+struct fleet_options final
+{
+    unsigned threads = 0;
+    // Answered instead of reading queries from the input.
+    std::wstring query;
+};
+
+// Loads the snapshot files in directory as a fleet and prints its summary, then answers the query
+// in options, or one query a line from in until the input ends or a line is "quit". Every answer
+// ends with its time.
+void run_fleet(std::wostream & out, std::wistream & in, std::wstring const & directory, fleet_options const & options);
+
+}
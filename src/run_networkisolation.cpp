@@ -1,142 +1,254 @@
-﻿#include "config.hpp"
-
-#include "run_networkisolation.hpp"
-#include "on_exit.hpp"
-#include "registry.hpp"
-
-#include <iomanip>
-#include <unordered_set>
-
-#include <networkisolation.h>
-#include <sddl.h>
-
-
-namespace jb {
-
-namespace {
-
-bool is_succeeded(std::wostream & out, DWORD const error)
-{
-    if (error == ERROR_SUCCESS)
-        return true;
-    out << L"failed: 0x" << std::hex << std::uppercase << std::setw(2 * sizeof error) << std::setfill(L'0') << error << std::endl;
-    return false;
-}
-
-void check_NetworkIsolationDiagnoseConnectFailure(std::wostream & out, LPCWSTR const host)
-{
-    out << L"NetworkIsolationDiagnoseConnectFailureAndGetInfo: '" << host << L"': ";
-    NETISO_ERROR_TYPE type;
-    if (is_succeeded(out, NetworkIsolationDiagnoseConnectFailureAndGetInfo(host, &type)))
-        out << (
-            type == NETISO_ERROR_TYPE_NONE                   ? L"none"                   :
-            type == NETISO_ERROR_TYPE_PRIVATE_NETWORK        ? L"private"                :
-            type == NETISO_ERROR_TYPE_INTERNET_CLIENT        ? L"internet_client"        :
-            type == NETISO_ERROR_TYPE_INTERNET_CLIENT_SERVER ? L"internet_client_server" : L"???") << std::endl;
-}
-
-struct sid_hasher
-{
-    size_t operator()(PSID const sid) const
-    {
-        return GetLengthSid(sid);
-    }
-};
-
-struct sid_equal_to
-{
-    size_t operator()(PSID const sid1, PSID const sid2) const
-    {
-        return !!EqualSid(sid1, sid2);
-    };
-};
-
-void check_NetworkIsolationEnumAppContainers(std::wostream & out, DWORD const flags)
-{
-    out << L"NetworkIsolationEnumAppContainers: 0x" << std::hex << std::uppercase << std::setw(2 * sizeof flags) << std::setfill(L'0') << flags << L": ";
-    DWORD size;
-    PINET_FIREWALL_APP_CONTAINER ptr;
-    if (is_succeeded(out, NetworkIsolationEnumAppContainers(flags, &size, &ptr)))
-    {
-        auto && free_ptr = make_on_exit_scope([ptr] { NetworkIsolationFreeAppContainers(ptr); });
-        std::unordered_set<PSID, sid_hasher, sid_equal_to> exist_sids;
-        out << std::dec << size << L":" << std::endl;
-        for (DWORD n = 0; n < size; ++n)
-        {
-            out << L"  #" << std::dec << n << L": ";
-            auto const sid = ptr[n].appContainerSid;
-            auto const exist_sid = exist_sids.insert(sid).second;
-            out << (exist_sid ? L"first" : L"duplicate") << L": ";
-
-            LPWSTR str;
-            if (is_succeeded(out, ConvertSidToStringSidW(sid, &str) ? ERROR_SUCCESS : GetLastError()))
-            {
-                auto && free_str = make_on_exit_scope([str] { LocalFree(str); });
-                out << str << L": " << ptr[n].appContainerName << std::endl;
-            }
-        }
-        out << L"  @" << std::dec << exist_sids.size() << std::endl;
-    }
-}
-
-void check_NetworkIsolationGetAppContainerConfig(std::wostream & out)
-{
-    out << L"NetworkIsolationGetAppContainerConfig: ";
-    DWORD size;
-    PSID_AND_ATTRIBUTES ptr;
-    if (is_succeeded(out, NetworkIsolationGetAppContainerConfig(&size, &ptr)))
-    {
-        auto && free_ptr = make_on_exit_scope([ptr, size]
-            {
-                for (auto n = size; n-- > 0; )
-                    HeapFree(GetProcessHeap(), 0, ptr[n].Sid);
-                HeapFree(GetProcessHeap(), 0, ptr);
-            });
-
-        out << std::dec << size << L":" << std::endl;
-        for (DWORD n = 0; n < size; ++n)
-        {
-            out << L"  #" << std::dec << n << L": ";
-            LPWSTR str;
-            if (is_succeeded(out, ConvertSidToStringSidW(ptr[n].Sid, &str) ? ERROR_SUCCESS : GetLastError()))
-            {
-                auto && free_str = make_on_exit_scope([str] { LocalFree(str); });
-                out << str << L": 0x" << std::hex << std::uppercase << std::setw(2 * sizeof ptr[n].Attributes) << std::setfill(L'0') << ptr[n].Attributes<< std::endl;
-            }
-        }
-
-    }
-}
-
-void check_MappingRegistry(std::wostream & out, reg_key const & mapping_key)
-{
-    auto const names = mapping_key.get_key_names();
-    auto const size = names.size();
-
-    out << mapping_key.path().wstring() << L": " << std::dec << size << L": " << std::endl;
-    for (DWORD n = 0; n < size; ++n)
-    {
-        auto const & name = names[n];
-        std::wstring value;
-        mapping_key.open_key(name).get_value_SZ(L"Moniker", value);
-        out << L"  #" << std::dec << n << L": " << name << L": " << value << std::endl;
-    }
-}
-
-}
-
-void run_networkisolation(std::wostream & out)
-{
-    check_NetworkIsolationDiagnoseConnectFailure(out, L"127.0.0.1");
-    check_NetworkIsolationDiagnoseConnectFailure(out, L"::1");
-    check_NetworkIsolationDiagnoseConnectFailure(out, L"localhost");
-
-    check_NetworkIsolationEnumAppContainers(out, 0);
-    check_NetworkIsolationEnumAppContainers(out, NETISO_FLAG_FORCE_COMPUTE_BINARIES);
-
-    check_NetworkIsolationGetAppContainerConfig(out);
-
-    check_MappingRegistry(out, reg_key::current_user().open_key(L"SOFTWARE\\Classes\\Local Settings\\Software\\Microsoft\\Windows\\CurrentVersion\\AppContainer\\Mappings"));
-}
-
-}
\ No newline at end of file
+﻿#include "config.hpp"
+
+#include "run_networkisolation.hpp"
+#include "appcontainer_list.hpp"
+#include "appcontainer_mapping.hpp"
+#include "appcontainer_report.hpp"
+#include "binaries_cache.hpp"
+#include "diagnose.hpp"
+#include "format.hpp"
+#include "instrument.hpp"
+#include "network_classifier.hpp"
+#include "on_exit.hpp"
+#include "output.hpp"
+#include "registry.hpp"
+#include "sid.hpp"
+#include "status.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <networkisolation.h>
+
+
+namespace jb {
+
+namespace {
+
+void check_NetworkIsolationDiagnoseConnectFailure(std::wostream & out, LPCWSTR const host)
+{
+    out << L"NetworkIsolationDiagnoseConnectFailureAndGetInfo: '" << host << L"': ";
+    NETISO_ERROR_TYPE type;
+    if (is_succeeded(out, netiso_diagnose_source().diagnose(host, type)))
+    {
+        out << netiso_error_type_name(type);
+        output_record(out, L"diagnosis").text(L"host", host).text(L"verdict", netiso_error_type_name(type)).text(L"source", L"call");
+    }
+}
+
+void check_NetworkIsolationEnumAppContainers(std::wostream & out, DWORD const flags)
+{
+    out << L"NetworkIsolationEnumAppContainers: 0x" << hex(flags) << L": ";
+    DWORD size;
+    PINET_FIREWALL_APP_CONTAINER ptr;
+    if (!is_succeeded(out, trace_call(api_call::NetworkIsolationEnumAppContainers, [&] { return status::win32(NetworkIsolationEnumAppContainers(flags, &size, &ptr)); })))
+        return;
+    app_container_list list;
+    {
+        auto && free_ptr = make_on_exit_scope([ptr] { NetworkIsolationFreeAppContainers(ptr); });
+        list.assign(ptr, size);
+    }
+    write_app_containers(out, list);
+}
+
+// Last write time of the container's Mappings subkey, zero when it has none.
+uint64_t mapping_last_write_time(expected<reg_key> const & mapping_key, sid const & value)
+{
+    if (!mapping_key)
+        return 0;
+    auto const key = mapping_key->try_open_key(value.to_string(), KEY_QUERY_VALUE);
+    return key ? key->query_info().last_write_time : 0;
+}
+
+// NETISO_FLAG_FORCE_COMPUTE_BINARIES through binaries_cache: the plain enumeration lists the
+// containers, and only when one of them is missing from the cache or its Mappings subkey was
+// written since is the full computation done, after which the cache is rewritten. The OS can't
+// compute the binaries of a single container, so any miss recomputes all of them.
+void check_NetworkIsolationEnumAppContainers_cached(std::wostream & out, std::filesystem::path const & cache_path)
+{
+    auto const start = std::chrono::steady_clock::now();
+    out << L"NetworkIsolationEnumAppContainers: 0x" << hex(NETISO_FLAG_FORCE_COMPUTE_BINARIES) << L": ";
+    DWORD size;
+    PINET_FIREWALL_APP_CONTAINER ptr;
+    if (!is_succeeded(out, trace_call(api_call::NetworkIsolationEnumAppContainers, [&] { return status::win32(NetworkIsolationEnumAppContainers(0, &size, &ptr)); })))
+        return;
+    auto && free_ptr = make_on_exit_scope([ptr] { NetworkIsolationFreeAppContainers(ptr); });
+
+    auto const mapping_key = reg_key::current_user().try_open_key(appcontainer_mapping::path);
+    binaries_cache cache;
+    cache.open(cache_path);
+    std::vector<size_t> found(size);
+    size_t hits = 0;
+    for (DWORD n = 0; n < size; ++n)
+    {
+        sid value;
+        found[n] = parse_sid(ptr[n].appContainerSid, value) ? cache.find(value, mapping_last_write_time(mapping_key, value)) : cache.size();
+        if (found[n] != cache.size())
+            ++hits;
+    }
+
+    if (size && hits == size)
+    {
+        std::vector<LPWSTR> binaries;
+        for (DWORD n = 0; n < size; ++n)
+            for (size_t k = 0, count = cache.binary_count(found[n]); k < count; ++k)
+                binaries.push_back(const_cast<LPWSTR>(cache.binary(found[n], k)));
+        std::vector<INET_FIREWALL_APP_CONTAINER> entries(ptr, ptr + size);
+        for (DWORD n = 0, first = 0; n < size; ++n)
+        {
+            entries[n].binaries.count = static_cast<DWORD>(cache.binary_count(found[n]));
+            entries[n].binaries.binaries = binaries.data() + first;
+            first += entries[n].binaries.count;
+        }
+        write_app_containers(out, entries.data(), size);
+
+        auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        auto const saved = cache.compute_ns() > uint64_t(elapsed) ? cache.compute_ns() - elapsed : 0;
+        out << L"BinariesCache: " << dec(hits) << L"/" << dec(size) << L" hits, " << dec(saved / 1000000) << L" ms saved\n";
+        return;
+    }
+    cache.close();
+
+    auto const compute_start = std::chrono::steady_clock::now();
+    DWORD computed_size;
+    PINET_FIREWALL_APP_CONTAINER computed;
+    if (!is_succeeded(out, trace_call(api_call::NetworkIsolationEnumAppContainers, [&] { return status::win32(NetworkIsolationEnumAppContainers(NETISO_FLAG_FORCE_COMPUTE_BINARIES, &computed_size, &computed)); })))
+        return;
+    auto const compute_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - compute_start).count();
+    app_container_list list;
+    {
+        auto && free_computed = make_on_exit_scope([computed] { NetworkIsolationFreeAppContainers(computed); });
+        list.assign(computed, computed_size);
+    }
+    write_app_containers(out, list);
+
+    std::vector<app_container_binaries> entries;
+    entries.reserve(list.size());
+    for (size_t n = 0, count = list.size(); n < count; ++n)
+    {
+        if (!list.valid(n))
+            continue;
+        app_container_binaries entry;
+        entry.app_container = list.app_container(n);
+        entry.last_write_time = mapping_last_write_time(mapping_key, entry.app_container);
+        for (size_t k = 0, binary_count = list.binary_count(n); k < binary_count; ++k)
+            entry.binaries.emplace_back(list.binary(n, k));
+        entries.push_back(std::move(entry));
+    }
+    binaries_cache::write(cache_path, std::move(entries), static_cast<uint64_t>(compute_ns));
+    out << L"BinariesCache: " << dec(hits) << L"/" << dec(size) << L" hits, recomputed in " << dec(compute_ns / 1000000) << L" ms\n";
+}
+
+void check_NetworkIsolationGetAppContainerConfig(std::wostream & out)
+{
+    out << L"NetworkIsolationGetAppContainerConfig: ";
+    DWORD size;
+    PSID_AND_ATTRIBUTES ptr;
+    if (is_succeeded(out, trace_call(api_call::NetworkIsolationGetAppContainerConfig, [&] { return status::win32(NetworkIsolationGetAppContainerConfig(&size, &ptr)); })))
+    {
+        auto && free_ptr = make_on_exit_scope([ptr, size]
+            {
+                for (auto n = size; n-- > 0; )
+                    HeapFree(GetProcessHeap(), 0, ptr[n].Sid);
+                HeapFree(GetProcessHeap(), 0, ptr);
+            });
+
+        out << dec(size) << L":\n";
+        for (DWORD n = 0; n < size; ++n)
+        {
+            out << L"  #" << dec(n) << L": ";
+            sid value;
+            if (is_succeeded(out, status::win32(parse_sid(ptr[n].Sid, value) ? ERROR_SUCCESS : ERROR_INVALID_SID)))
+            {
+                out << value << L": 0x" << hex(ptr[n].Attributes);
+                output_record(out, L"loopback_exemption").number(L"index", n).text(L"sid", value).number(L"attributes", ptr[n].Attributes);
+            }
+        }
+
+    }
+}
+
+}
+
+void run_networkisolation(std::wostream & out, std::wstring const & binaries_cache_path)
+{
+    check_NetworkIsolationDiagnoseConnectFailure(out, L"127.0.0.1");
+    check_NetworkIsolationDiagnoseConnectFailure(out, L"::1");
+    check_NetworkIsolationDiagnoseConnectFailure(out, L"localhost");
+
+    check_NetworkIsolationEnumAppContainers(out, 0);
+    if (binaries_cache_path.empty())
+        check_NetworkIsolationEnumAppContainers(out, NETISO_FLAG_FORCE_COMPUTE_BINARIES);
+    else
+        check_NetworkIsolationEnumAppContainers_cached(out, binaries_cache_path);
+
+    check_NetworkIsolationGetAppContainerConfig(out);
+
+    check_MappingRegistry(out, reg_key::current_user().open_key(appcontainer_mapping::path));
+}
+
+void run_diagnose_hosts(std::wostream & out, diagnose_options const & options)
+{
+    host_list list;
+    if (options.hosts_file == L"-")
+        list = read_hosts(std::wcin);
+    else
+    {
+        std::wifstream in(std::filesystem::path{ options.hosts_file });
+        if (!in)
+            throw std::runtime_error("Can't open the host list file");
+        list = read_hosts(in);
+    }
+    out << L"Hosts: " << dec(list.lines) << L" lines, " << dec(list.hosts.size()) << L" unique, " << dec(list.duplicates) << L" duplicates, " << dec(list.invalid) << L" invalid\n";
+
+    diagnose_cache cache(options.ttl);
+    if (!options.cache_file.empty())
+        cache.load(options.cache_file);
+
+    network_classifier prescreen;
+    if (!prescreen.add_private_subnets(options.private_subnets))
+        throw std::runtime_error("Invalid private subnet list");
+
+    netiso_diagnose_source source;
+    auto const start = std::chrono::steady_clock::now();
+    auto const results = diagnose_hosts(source, list.hosts, &cache, options.prescreen ? &prescreen : nullptr, options.threads);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    size_t cached = 0, local = 0, failed = 0;
+    for (size_t n = 0; n < results.size(); ++n)
+    {
+        auto const & result = results[n];
+        out << L"NetworkIsolationDiagnoseConnectFailureAndGetInfo: '" << list.hosts[n] << L"': ";
+        wchar_t const * source_name = L"call";
+        if (result.local)
+        {
+            ++local;
+            source_name = L"local";
+            out << netiso_error_type_name(result.type) << L" (local)";
+        }
+        else if (result.cached)
+        {
+            ++cached;
+            source_name = L"cached";
+            out << netiso_error_type_name(result.type) << L" (cached)";
+        }
+        else if (is_succeeded(out, result.result))
+            out << netiso_error_type_name(result.type);
+        else
+        {
+            ++failed;
+            continue;
+        }
+        output_record(out, L"diagnosis").text(L"host", list.hosts[n]).text(L"verdict", netiso_error_type_name(result.type)).text(L"source", source_name);
+    }
+    out << L"Diagnosed: " << dec(results.size() - cached - local) << L" calls, " << dec(cached) << L" cached, " << dec(local) << L" local, " << dec(failed) << L" failed in " << dec(elapsed.count()) << L" ms\n";
+
+    if (!options.cache_file.empty())
+        cache.save(options.cache_file);
+}
+
+}
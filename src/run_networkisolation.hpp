@@ -1,10 +1,32 @@
-﻿#pragma once
-
-#include <ostream>
-
-namespace jb
-{
-
-void run_networkisolation(std::wostream & out);
-
+﻿#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+namespace jb
+{
+
+// Keeps the NETISO_FLAG_FORCE_COMPUTE_BINARIES result in a binaries_cache file at
+// binaries_cache_path, an empty path turns it off.
+void run_networkisolation(std::wostream & out, std::wstring const & binaries_cache_path);
+
+struct diagnose_options final
+{
+    // Host list file, "-" for stdin.
+    std::wstring hosts_file;
+    // Empty for no cache.
+    std::wstring cache_file;
+    std::chrono::seconds ttl = std::chrono::hours(1);
+    // Zero for the default.
+    unsigned threads = 0;
+    // Settle IP literals with network_classifier, only the ambiguous ones reach the OS.
+    bool prescreen = false;
+    // Added to the prescreen classifier as private networks.
+    std::wstring private_subnets;
+};
+
+// Diagnoses every distinct host of the list, one per line, and prints the results in list order.
+void run_diagnose_hosts(std::wostream & out, diagnose_options const & options);
+
 }
\ No newline at end of file
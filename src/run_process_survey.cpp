@@ -0,0 +1,108 @@
+﻿#include "config.hpp"
+
+#include "run_process_survey.hpp"
+#include "appcontainer_list.hpp"
+#include "format.hpp"
+#include "instrument.hpp"
+#include "on_exit.hpp"
+#include "process_survey.hpp"
+#include "sid_join.hpp"
+#include "status.hpp"
+
+#include <chrono>
+#include <vector>
+
+#include <networkisolation.h>
+
+namespace jb
+{
+
+namespace
+{
+
+wchar_t const * elevation_type_name(uint32_t const type) noexcept
+{
+    return
+        type == process_table::unread     ? L"unread"  :
+        type == TokenElevationTypeDefault ? L"default" :
+        type == TokenElevationTypeLimited ? L"limited" :
+        type == TokenElevationTypeFull    ? L"full"    : L"???";
+}
+
+}
+
+void run_process_survey(std::wostream & out, unsigned const threads)
+{
+    toolhelp_process_source source;
+    std::vector<process_entry> processes;
+    out << L"CreateToolhelp32Snapshot: ";
+    if (!is_succeeded(out, source.processes(processes)))
+        return;
+    out << dec(processes.size()) << L" processes\n";
+
+    auto const start = std::chrono::steady_clock::now();
+    auto const table = survey_processes(source, processes, threads);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    app_container_list containers;
+    out << L"NetworkIsolationEnumAppContainers: ";
+    DWORD size;
+    PINET_FIREWALL_APP_CONTAINER ptr;
+    auto const enumerated = trace_call(api_call::NetworkIsolationEnumAppContainers, [&] { return status::win32(NetworkIsolationEnumAppContainers(0, &size, &ptr)); });
+    if (is_succeeded(out, enumerated))
+    {
+        {
+            auto && free_ptr = make_on_exit_scope([ptr] { NetworkIsolationFreeAppContainers(ptr); });
+            containers.assign(ptr, size);
+        }
+        out << dec(containers.size()) << L" app containers\n";
+    }
+    sid_index const container_index(containers.app_containers(), containers.size());
+
+    size_t read = 0;
+    std::vector<sid> process_containers;
+    size_t unregistered = 0;
+    for (size_t n = 0, count = table.size(); n < count; ++n)
+    {
+        out << L"  #" << dec(table.pid(n)) << L": " << table.image(n) << L": parent " << dec(table.parent_pid(n)) << L": ";
+        if (!is_succeeded(out, table.token_status(n)))
+            continue;
+        ++read;
+        out << elevation_type_name(table.elevation_type(n)) << L", " <<
+            (table.elevated(n) == process_table::unread ? L"elevation unread" : table.elevated(n) ? L"elevated" : L"not elevated") << L", " <<
+            integrity_name(table.integrity(n));
+        if (table.is_app_container(n))
+        {
+            auto const & value = table.app_container(n);
+            process_containers.push_back(value);
+            out << L", app_container " << value;
+            if (enumerated)
+            {
+                auto const found = container_index.find(value);
+                out << L": ";
+                if (found != sid_index::npos)
+                    out << containers.name(found);
+                else
+                {
+                    out << L"unregistered";
+                    ++unregistered;
+                }
+            }
+            out << L", " << dec(table.capability_count(n)) << L" capabilities";
+        }
+        out << L'\n';
+    }
+
+    out << L"Processes: " << dec(table.size()) << L", " << dec(read) << L" tokens read, " << dec(table.size() - read) << L" failed in " << dec(static_cast<uint64_t>(elapsed.count())) << L" ms\n";
+    out << L"AppContainer processes: " << dec(process_containers.size());
+    if (!enumerated)
+    {
+        out << L", app containers not enumerated: 0x" << hex(enumerated.code()) << L'\n';
+        return;
+    }
+    auto const joined = join_sids(process_containers.data(), process_containers.size(), containers.app_containers(), containers.size());
+    out << L" in " << dec(joined.matched.size() + joined.left_only.size()) << L" containers, " <<
+        dec(unregistered) << L" unregistered, " << dec(joined.right_only.size()) << L" app containers without a process\n";
+}
+
+}
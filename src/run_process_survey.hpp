@@ -0,0 +1,15 @@
+﻿#pragma once
+
+#include <ostream>
+
+namespace jb
+{
+
+// The elevation facts of every process token, with integrity level, AppContainer and capability
+// count, read on threads workers. AppContainer processes are matched with the enumerated app
+// containers, the ones running in a container the enumeration doesn't know are counted apart.
+// When the enumeration fails the containers are printed by SID only and nothing is counted as
+// unregistered.
+void run_process_survey(std::wostream & out, unsigned threads);
+
+}
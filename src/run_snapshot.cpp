@@ -0,0 +1,431 @@
+﻿#include "config.hpp"
+
+#include "run_snapshot.hpp"
+#include "appcontainer_list.hpp"
+#include "appcontainer_mapping.hpp"
+#include "appcontainer_report.hpp"
+#include "firewall_profile.hpp"
+#include "format.hpp"
+#include "instrument.hpp"
+#include "on_exit.hpp"
+#include "registry.hpp"
+#include "registry_cache.hpp"
+#include "sid_join.hpp"
+#include "snapshot.hpp"
+#include "status.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <netfw.h>
+#include <networkisolation.h>
+
+extern "C" {
+
+NTSTATUS
+    NTAPI
+    RtlQueryElevationFlags(
+        DWORD* pFlags
+    );
+
+}
+
+namespace jb
+{
+
+namespace
+{
+
+void collect_elevation(diagnostic_snapshot & snapshot)
+{
+    DWORD elevation;
+    if (trace_call(api_call::RtlQueryElevationFlags, [&] { return status::ntstatus(RtlQueryElevationFlags(&elevation)); }))
+    {
+        snapshot.elevation_flags = elevation;
+        snapshot.present |= diagnostic_snapshot::has_elevation_flags;
+    }
+
+    HANDLE token;
+    if (trace_call(api_call::OpenProcessToken, [&] { return status::last_error(OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)); }))
+    {
+        auto && free_handle = make_on_exit_scope([token] { CloseHandle(token); });
+        DWORD size;
+        TOKEN_ELEVATION_TYPE token_elevation_type;
+        if (trace_call(api_call::GetTokenInformation, [&] { return status::last_error(GetTokenInformation(token, TokenElevationType, &token_elevation_type, sizeof token_elevation_type, &size)); }))
+        {
+            snapshot.token_elevation_type = static_cast<uint32_t>(token_elevation_type);
+            snapshot.present |= diagnostic_snapshot::has_token_elevation_type;
+        }
+    }
+}
+
+// Without NETISO_FLAG_FORCE_COMPUTE_BINARIES, so binaries are only there when the OS has them already.
+void collect_app_containers(diagnostic_snapshot & snapshot)
+{
+    DWORD size;
+    PINET_FIREWALL_APP_CONTAINER ptr;
+    if (!trace_call(api_call::NetworkIsolationEnumAppContainers, [&] { return status::win32(NetworkIsolationEnumAppContainers(0, &size, &ptr)); }))
+        return;
+    app_container_list list;
+    {
+        auto && free_ptr = make_on_exit_scope([ptr] { NetworkIsolationFreeAppContainers(ptr); });
+        list.assign(ptr, size);
+    }
+
+    snapshot.app_containers.reserve(list.size());
+    for (size_t n = 0, count = list.size(); n < count; ++n)
+    {
+        if (!list.valid(n))
+            continue;
+        snapshot_app_container entry;
+        entry.app_container = list.app_container(n);
+        entry.user = list.user(n);
+        entry.name = list.name(n);
+        entry.display_name = list.display_name(n);
+        entry.description = list.description(n);
+        entry.package_full_name = list.package_full_name(n);
+        entry.working_directory = list.working_directory(n);
+        for (size_t k = 0, capability_count = list.capability_count(n); k < capability_count; ++k)
+            entry.capabilities.push_back({ list.capability(n, k), list.capability_attributes(n, k) });
+        for (size_t k = 0, binary_count = list.binary_count(n); k < binary_count; ++k)
+            entry.binaries.emplace_back(list.binary(n, k));
+        snapshot.app_containers.push_back(std::move(entry));
+    }
+    snapshot.present |= diagnostic_snapshot::has_app_containers;
+}
+
+void collect_config(diagnostic_snapshot & snapshot)
+{
+    DWORD size;
+    PSID_AND_ATTRIBUTES ptr;
+    if (!trace_call(api_call::NetworkIsolationGetAppContainerConfig, [&] { return status::win32(NetworkIsolationGetAppContainerConfig(&size, &ptr)); }))
+        return;
+    auto && free_ptr = make_on_exit_scope([ptr, size]
+        {
+            for (auto n = size; n-- > 0; )
+                HeapFree(GetProcessHeap(), 0, ptr[n].Sid);
+            HeapFree(GetProcessHeap(), 0, ptr);
+        });
+
+    snapshot.config.reserve(size);
+    for (DWORD n = 0; n < size; ++n)
+    {
+        snapshot_capability entry;
+        if (parse_sid(ptr[n].Sid, entry.value))
+        {
+            entry.attributes = ptr[n].Attributes;
+            snapshot.config.push_back(entry);
+        }
+    }
+    snapshot.present |= diagnostic_snapshot::has_config;
+}
+
+// The subkeys are opened through the session's cache, so a refresh reuses the handles of the
+// unchanged ones. A cached handle goes stale when its subkey is deleted and created again: that
+// read fails and is retried once on a fresh handle.
+void collect_mappings(diagnostic_snapshot & snapshot, reg_key_cache & keys, uint32_t const mapping_root)
+{
+    for (auto && name : keys.root(mapping_root).keys())
+    {
+        snapshot_mapping entry;
+        if (!sid::parse(name, entry.app_container))
+            continue;
+        auto key = keys.try_open_key(mapping_root, name, KEY_QUERY_VALUE);
+        if (!key)
+            continue;
+        appcontainer_mapping values;
+        try
+        {
+            values = read_schema<appcontainer_mapping>(*key);
+        }
+        catch (std::runtime_error const &)
+        {
+            keys.erase(mapping_root, name, KEY_QUERY_VALUE);
+            key = keys.try_open_key(mapping_root, name, KEY_QUERY_VALUE);
+            if (!key)
+                continue;
+            values = read_schema<appcontainer_mapping>(*key);
+        }
+        entry.display_name = values.display_name.value_or(std::wstring());
+        entry.description = values.description.value_or(std::wstring());
+        entry.moniker = values.moniker.value_or(std::wstring());
+        snapshot.mappings.push_back(std::move(entry));
+    }
+    snapshot.present |= diagnostic_snapshot::has_mappings;
+}
+
+void write_counts(std::wostream & out, snapshot_view const & view)
+{
+    out << dec(view.app_container_count()) << L" app containers, " << dec(view.config_count()) << L" config entries, " << dec(view.mapping_count()) << L" mappings, "
+        << dec(view.string_count()) << L" strings, " << dec(view.sid_count()) << L" SIDs\n";
+}
+
+// SIDs of one joined part, with the text printed for an unmatched one. The labels point into the
+// snapshot or the view the keys came from.
+struct join_part final
+{
+    bool present = false;
+    std::vector<sid> keys;
+    std::vector<std::wstring_view> labels;
+};
+
+void write_join(std::wostream & out, join_part const & app_containers, join_part const & config, join_part const & mappings)
+{
+    out << L"Join: " << dec(app_containers.keys.size()) << L" app containers, " << dec(config.keys.size()) << L" config entries, " << dec(mappings.keys.size()) << L" mappings\n";
+    if (!app_containers.present)
+    {
+        out << L"Join: app containers were not read\n";
+        return;
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+    auto const exempt = join_sids(app_containers.keys.data(), app_containers.keys.size(), config.keys.data(), config.keys.size());
+    auto const mapped = join_sids(app_containers.keys.data(), app_containers.keys.size(), mappings.keys.data(), mappings.keys.size());
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    // A part that wasn't read would show every app container as unmatched.
+    if (config.present)
+    {
+        out << L"Loopback exempt: " << dec(exempt.matched.size()) << L" app containers, " << dec(exempt.left_only.size()) << L" not exempt\n";
+        for (auto const n : exempt.right_only)
+            out << L"Orphaned exemption: " << config.keys[n] << L'\n';
+    }
+    else
+        out << L"Loopback exempt: config was not read\n";
+    if (mappings.present)
+    {
+        out << L"Mapped: " << dec(mapped.matched.size()) << L" app containers\n";
+        for (auto const n : mapped.left_only)
+            out << L"Unmapped app container: " << app_containers.keys[n] << L": " << app_containers.labels[n] << L'\n';
+        for (auto const n : mapped.right_only)
+            out << L"Stale mapping: " << mappings.keys[n] << L": " << mappings.labels[n] << L'\n';
+    }
+    else
+        out << L"Mapped: mappings were not read\n";
+    if (exempt.left_duplicates || exempt.right_duplicates || mapped.right_duplicates)
+        out << L"Duplicates: " << dec(exempt.left_duplicates) << L" app containers, " << dec(exempt.right_duplicates) << L" config entries, " << dec(mapped.right_duplicates) << L" mappings\n";
+    out << L"Joined in " << dec(static_cast<uint64_t>(elapsed.count())) << L" us\n";
+}
+
+}
+
+snapshot_session::snapshot_session() :
+    keys_(max_cached_keys)
+{
+    if (trace_call(api_call::CoInitializeEx, [&] { return status::hresult(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)); }))
+    {
+        com_ = true;
+        if (!trace_call(api_call::CoCreateInstance, [&] { return status::hresult(CoCreateInstance(__uuidof(NetFwPolicy2), nullptr, CLSCTX_INPROC_SERVER, __uuidof(INetFwPolicy2), reinterpret_cast<void **>(&net_fw_policy2_))); }))
+            net_fw_policy2_ = nullptr;
+    }
+    open_mapping_root();
+}
+
+void snapshot_session::open_mapping_root()
+{
+    auto key = reg_key::current_user().try_open_key(appcontainer_mapping::path);
+    if (key)
+        mapping_root_ = keys_.add_root(std::move(*key));
+}
+
+snapshot_session::~snapshot_session()
+{
+    if (net_fw_policy2_)
+        net_fw_policy2_->Release();
+    if (com_)
+        CoUninitialize();
+}
+
+void snapshot_session::collect(diagnostic_snapshot & snapshot, uint32_t const parts)
+{
+    FILETIME created;
+    GetSystemTimeAsFileTime(&created);
+    snapshot.created = static_cast<int64_t>(uint64_t(created.dwHighDateTime) << 32 | created.dwLowDateTime);
+    snapshot.present &= ~parts;
+    if (parts & (diagnostic_snapshot::has_elevation_flags | diagnostic_snapshot::has_token_elevation_type))
+        collect_elevation(snapshot);
+    if (parts & diagnostic_snapshot::has_firewall)
+    {
+        snapshot.firewall = firewall_defaults();
+        if (net_fw_policy2_)
+        {
+            snapshot.firewall = read_firewall_defaults(net_fw_policy2_);
+            snapshot.present |= diagnostic_snapshot::has_firewall;
+        }
+    }
+    if (parts & diagnostic_snapshot::has_app_containers)
+    {
+        snapshot.app_containers.clear();
+        collect_app_containers(snapshot);
+    }
+    if (parts & diagnostic_snapshot::has_config)
+    {
+        snapshot.config.clear();
+        collect_config(snapshot);
+    }
+    if (parts & diagnostic_snapshot::has_mappings)
+    {
+        snapshot.mappings.clear();
+        // The key may be created after the session, by the first package install.
+        if (mapping_root_ == no_root)
+            open_mapping_root();
+        if (mapping_root_ != no_root)
+            collect_mappings(snapshot, keys_, mapping_root_);
+    }
+}
+
+void collect_snapshot(diagnostic_snapshot & snapshot, uint32_t const parts)
+{
+    snapshot_session().collect(snapshot, parts);
+}
+
+void run_snapshot(std::wostream & out, std::wstring const & path)
+{
+    diagnostic_snapshot snapshot;
+    collect_snapshot(snapshot, all_snapshot_parts);
+    write_snapshot(path, snapshot);
+    snapshot_view view;
+    view.open(path);
+    out << L"Snapshot: " << path << L": ";
+    write_counts(out, view);
+}
+
+void run_snapshot_diff(std::wostream & out, std::wstring const & from, std::wstring const & to)
+{
+    snapshot_view from_view;
+    from_view.open(from);
+
+    // The live state goes through a temporary file, so both sides are compared in the same form.
+    std::filesystem::path to_path = to;
+    auto && remove_live = make_on_exit_scope([&]
+        {
+            if (to.empty())
+            {
+                std::error_code error;
+                std::filesystem::remove(to_path, error);
+            }
+        });
+    if (to.empty())
+    {
+        to_path = std::filesystem::temp_directory_path() / (L"NetFwTest." + std::to_wstring(GetCurrentProcessId()) + L".snapshot");
+        diagnostic_snapshot snapshot;
+        collect_snapshot(snapshot, all_snapshot_parts);
+        write_snapshot(to_path, snapshot);
+    }
+    snapshot_view to_view;
+    to_view.open(to_path);
+
+    out << L"From: " << from << L": ";
+    write_counts(out, from_view);
+    out << L"To: " << (to.empty() ? std::wstring(L"live") : to) << L": ";
+    write_counts(out, to_view);
+
+    auto const start = std::chrono::steady_clock::now();
+    auto const changes = diff_snapshots(from_view, to_view, out);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    out << L"Differences: " << dec(changes) << L" in " << dec(static_cast<uint64_t>(elapsed.count())) << L" us\n";
+}
+
+void run_join(std::wostream & out, std::wstring const & path)
+{
+    join_part app_containers;
+    join_part config;
+    join_part mappings;
+    auto const add = [](join_part & part, sid const & key, std::wstring_view const label)
+        {
+            part.keys.push_back(key);
+            part.labels.push_back(label);
+        };
+
+    // The live state is joined as the OS returns it, a file has one record per SID already.
+    diagnostic_snapshot snapshot;
+    snapshot_view view;
+    if (path.empty())
+    {
+        collect_snapshot(snapshot, diagnostic_snapshot::has_app_containers | diagnostic_snapshot::has_config | diagnostic_snapshot::has_mappings);
+        out << L"Source: live\n";
+        for (auto const & item : snapshot.app_containers)
+            add(app_containers, item.app_container, item.name);
+        for (auto const & item : snapshot.config)
+            add(config, item.value, std::wstring_view());
+        for (auto const & item : snapshot.mappings)
+            add(mappings, item.app_container, item.moniker);
+    }
+    else
+    {
+        view.open(path);
+        out << L"Source: " << path << L'\n';
+        for (size_t n = 0, count = view.app_container_count(); n < count; ++n)
+        {
+            auto const item = view.app_container_at(n);
+            add(app_containers, item.app_container, item.name);
+        }
+        for (size_t n = 0, count = view.config_count(); n < count; ++n)
+            add(config, view.config(n).value, std::wstring_view());
+        for (size_t n = 0, count = view.mapping_count(); n < count; ++n)
+        {
+            auto const item = view.mapping_at(n);
+            add(mappings, item.app_container, item.moniker);
+        }
+    }
+    auto const present = path.empty() ? snapshot.present : view.present();
+    app_containers.present = (present & diagnostic_snapshot::has_app_containers) != 0;
+    config.present = (present & diagnostic_snapshot::has_config) != 0;
+    mappings.present = (present & diagnostic_snapshot::has_mappings) != 0;
+    write_join(out, app_containers, config, mappings);
+}
+
+std::vector<uint32_t> add_snapshot_watches(std::wostream & out, reg_change_source & source)
+{
+    struct watched final
+    {
+        reg_key const & (*root)();
+        wchar_t const * path;
+        uint32_t parts;
+    };
+    // Config is reread on both, it can follow a package change as well as a policy change.
+    static watched const keys[] =
+    {
+        { &reg_key::current_user , appcontainer_mapping::path                                                 , diagnostic_snapshot::has_mappings | diagnostic_snapshot::has_app_containers | diagnostic_snapshot::has_config },
+        { &reg_key::local_machine, L"SYSTEM\\CurrentControlSet\\Services\\SharedAccess\\Parameters\\FirewallPolicy", diagnostic_snapshot::has_firewall | diagnostic_snapshot::has_config                                            },
+        { &reg_key::local_machine, L"SOFTWARE\\Policies\\Microsoft\\WindowsFirewall"                          , diagnostic_snapshot::has_firewall                                                                            },
+    };
+    std::vector<uint32_t> parts;
+    for (auto const & item : keys)
+    {
+        out << L"Watch: " << item.root().path() << L'\\' << item.path << L": ";
+        auto const bit = source.add(item.root(), item.path, true);
+        if (!is_succeeded(out, bit ? status() : bit.error()))
+            continue;
+        parts.push_back(item.parts);
+        out << (source.pending(*bit) ? L"missing, watching for it\n" : L"succeeded\n");
+    }
+    return parts;
+}
+
+void run_watch(std::wostream & out, watch_options const & options)
+{
+    reg_change_source source;
+    auto const parts = add_snapshot_watches(out, source);
+
+    // Keeps COM, the firewall policy and the Mappings key for the whole watch.
+    snapshot_session session;
+    auto const collect = [&session](diagnostic_snapshot & snapshot, uint32_t const stale) { session.collect(snapshot, stale); };
+    diagnostic_snapshot model;
+    collect(model, all_snapshot_parts);
+    {
+        auto const image = build_snapshot(model);
+        snapshot_view view;
+        view.attach(image.data(), image.size());
+        out << L"Model: ";
+        write_counts(out, view);
+        out.flush();
+    }
+    watch_snapshot(source, parts, model, collect, options, out);
+}
+
+}
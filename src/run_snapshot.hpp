@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include "registry.hpp"
+#include "registry_cache.hpp"
+#include "snapshot.hpp"
+#include "status.hpp"
+#include "watch.hpp"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <netfw.h>
+
+namespace jb
+{
+
+uint32_t const all_snapshot_parts =
+    diagnostic_snapshot::has_elevation_flags | diagnostic_snapshot::has_token_elevation_type | diagnostic_snapshot::has_firewall |
+    diagnostic_snapshot::has_app_containers | diagnostic_snapshot::has_config | diagnostic_snapshot::has_mappings;
+
+// What the snapshot reads keep open between calls: the COM apartment, INetFwPolicy2, the Mappings
+// key and a cache of its subkeys. Use it on the thread that made it.
+class snapshot_session final
+{
+public:
+    snapshot_session();
+    ~snapshot_session();
+
+    snapshot_session(snapshot_session const &) = delete;
+    snapshot_session & operator=(snapshot_session const &) = delete;
+
+    // Rereads the live state of the given diagnostic_snapshot::has_* parts, the rest is kept. A
+    // part that can't be read is left empty with its present bit cleared.
+    void collect(diagnostic_snapshot & snapshot, uint32_t parts);
+
+private:
+    void open_mapping_root();
+
+    static uint32_t const no_root = ~uint32_t(0);
+    static size_t const max_cached_keys = 4096;
+
+    bool com_ = false;
+    INetFwPolicy2 * net_fw_policy2_ = nullptr;
+    reg_key_cache keys_;
+    uint32_t mapping_root_ = no_root;
+};
+
+// collect through a session of its own.
+void collect_snapshot(diagnostic_snapshot & snapshot, uint32_t parts);
+
+// Reads the live diagnostic state and writes it to a snapshot file.
+void run_snapshot(std::wostream & out, std::wstring const & path);
+
+// Prints the differences between the snapshot at from and the one at to, or the live state when to
+// is empty.
+void run_snapshot_diff(std::wostream & out, std::wstring const & from, std::wstring const & to);
+
+// Joins the app containers with the loopback exemptions and the Mappings subkeys on their SIDs,
+// from the snapshot at path or the live state when it is empty. Prints the counts, the exemptions
+// and mappings without an app container and the app containers without a mapping.
+void run_join(std::wostream & out, std::wstring const & path);
+
+// Watches the Mappings and firewall policy keys with source and returns the parts every bit of
+// it affects. Prints the keys: a missing one is watched for through its parent, one that can't be
+// opened for another reason is left out.
+std::vector<uint32_t> add_snapshot_watches(std::wostream & out, reg_change_source & source);
+
+// Reads the live state once, then watches the Mappings and firewall policy keys and rereads only
+// the parts a change can affect, printing the differences. Runs until the process is stopped.
+void run_watch(std::wostream & out, watch_options const & options);
+
+}
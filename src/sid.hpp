@@ -0,0 +1,241 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace jb {
+
+// Inline copy of a binary SID: revision, sub-authority count, 48-bit big-endian identifier
+// authority, up to 15 little-endian 32-bit sub-authorities. No OS calls are needed to parse,
+// compare, hash or format it.
+struct sid final
+{
+    static size_t const max_sub_authorities = 15;
+    static size_t const header_size = 8;
+    static size_t const max_binary_size = header_size + max_sub_authorities * sizeof(uint32_t);
+    static size_t const max_string_size = 192;
+
+    sid() noexcept = default;
+
+    static bool parse(void const * const data, size_t const size, sid & result) noexcept
+    {
+        if (size < header_size)
+            return false;
+        auto const bytes = static_cast<uint8_t const *>(data);
+        if (bytes[0] != 1 || bytes[1] > max_sub_authorities)
+            return false;
+        auto const binary_size = header_size + bytes[1] * sizeof(uint32_t);
+        if (size < binary_size)
+            return false;
+        result = sid();
+        std::memcpy(result.words_, bytes, binary_size);
+        return true;
+    }
+
+    static sid from_binary(void const * const data, size_t const size)
+    {
+        sid result;
+        if (!parse(data, size, result))
+            throw std::runtime_error("Invalid binary SID");
+        return result;
+    }
+
+    // Inverse of format(): "S-1-<authority>-<sub authority>...", the authority in decimal or
+    // 0x-prefixed hex.
+    static bool parse(std::wstring_view text, sid & result) noexcept
+    {
+        if (text.compare(0, 2, L"S-") != 0)
+            return false;
+        text.remove_prefix(2);
+        uint8_t binary[max_binary_size] = {};
+        size_t part = 0;
+        while (true)
+        {
+            auto const end = text.find(L'-');
+            uint64_t value;
+            if (!parse_number(text.substr(0, end), part == 1, value))
+                return false;
+            if (part == 0)
+            {
+                if (value != 1)
+                    return false;
+                binary[0] = 1;
+            }
+            else if (part == 1)
+            {
+                if (value >> 48)
+                    return false;
+                for (size_t n = 2; n < header_size; ++n)
+                    binary[n] = static_cast<uint8_t>(value >> (8 * (header_size - 1 - n)));
+            }
+            else
+            {
+                if (part - 2 == max_sub_authorities || value >> 32)
+                    return false;
+                auto const ptr = binary + header_size + (part - 2) * sizeof(uint32_t);
+                for (size_t n = 0; n < sizeof(uint32_t); ++n)
+                    ptr[n] = static_cast<uint8_t>(value >> (8 * n));
+            }
+            ++part;
+            if (end == std::wstring_view::npos)
+                break;
+            text.remove_prefix(end + 1);
+        }
+        if (part < 2)
+            return false;
+        binary[1] = static_cast<uint8_t>(part - 2);
+        return parse(binary, header_size + (part - 2) * sizeof(uint32_t), result);
+    }
+
+    bool empty() const noexcept { return !revision(); }
+
+    uint8_t revision() const noexcept { return bytes()[0]; }
+    uint8_t sub_authority_count() const noexcept { return bytes()[1]; }
+    size_t binary_size() const noexcept { return header_size + sub_authority_count() * sizeof(uint32_t); }
+    uint8_t const * data() const noexcept { return bytes(); }
+
+    uint64_t identifier_authority() const noexcept
+    {
+        uint64_t result = 0;
+        for (size_t n = 2; n < header_size; ++n)
+            result = result << 8 | bytes()[n];
+        return result;
+    }
+
+    uint32_t sub_authority(size_t const n) const noexcept
+    {
+        auto const ptr = bytes() + header_size + n * sizeof(uint32_t);
+        return uint32_t(ptr[0]) | uint32_t(ptr[1]) << 8 | uint32_t(ptr[2]) << 16 | uint32_t(ptr[3]) << 24;
+    }
+
+    size_t hash() const noexcept
+    {
+        uint64_t result = 0x9E3779B97F4A7C15ull;
+        for (size_t n = 0, count = word_count(); n < count; ++n)
+        {
+            result ^= words_[n];
+            result *= 0xFF51AFD7ED558CCDull;
+            result ^= result >> 32;
+        }
+        return static_cast<size_t>(result);
+    }
+
+    // Same textual form as ConvertSidToStringSidW. The buffer must hold max_string_size characters,
+    // the result is not null-terminated.
+    wchar_t * format(wchar_t * out) const noexcept
+    {
+        *out++ = L'S';
+        *out++ = L'-';
+        out = format_dec(out, revision());
+        *out++ = L'-';
+        auto const authority = identifier_authority();
+        if (authority >> 32)
+        {
+            static wchar_t const digits[] = L"0123456789abcdef";
+            *out++ = L'0';
+            *out++ = L'x';
+            for (auto shift = 48; shift > 0; )
+                *out++ = digits[(authority >> (shift -= 4)) & 0xF];
+        }
+        else
+            out = format_dec(out, authority);
+        for (size_t n = 0, count = sub_authority_count(); n < count; ++n)
+        {
+            *out++ = L'-';
+            out = format_dec(out, sub_authority(n));
+        }
+        return out;
+    }
+
+    std::wstring to_string() const
+    {
+        wchar_t buffer[max_string_size];
+        return std::wstring(buffer, format(buffer));
+    }
+
+    friend bool operator==(sid const & left, sid const & right) noexcept
+    {
+        for (size_t n = 0, count = left.word_count(); n < count; ++n)
+            if (left.words_[n] != right.words_[n])
+                return false;
+        return true;
+    }
+
+    friend bool operator!=(sid const & left, sid const & right) noexcept { return !(left == right); }
+
+    friend bool operator<(sid const & left, sid const & right) noexcept
+    {
+        auto const left_size = left.binary_size();
+        auto const right_size = right.binary_size();
+        auto const result = std::memcmp(left.data(), right.data(), left_size < right_size ? left_size : right_size);
+        return result < 0 || (result == 0 && left_size < right_size);
+    }
+
+private:
+    uint8_t const * bytes() const noexcept { return reinterpret_cast<uint8_t const *>(words_); }
+
+    // The count byte lives in the first word, so equal prefixes imply equal word counts.
+    size_t word_count() const noexcept { return (binary_size() + sizeof(uint64_t) - 1) / sizeof(uint64_t); }
+
+    static bool parse_number(std::wstring_view text, bool const allow_hex, uint64_t & value) noexcept
+    {
+        uint64_t base = 10;
+        if (allow_hex && text.size() > 2 && text[0] == L'0' && (text[1] == L'x' || text[1] == L'X'))
+        {
+            base = 16;
+            text.remove_prefix(2);
+        }
+        if (text.empty() || text.size() > 20)
+            return false;
+        value = 0;
+        for (auto const ch : text)
+        {
+            uint64_t const digit =
+                ch >= L'0' && ch <= L'9' ? ch - L'0' :
+                ch >= L'a' && ch <= L'f' ? ch - L'a' + 10 :
+                ch >= L'A' && ch <= L'F' ? ch - L'A' + 10 : 16;
+            if (digit >= base || value > (~uint64_t(0) - digit) / base)
+                return false;
+            value = value * base + digit;
+        }
+        return true;
+    }
+
+    static wchar_t * format_dec(wchar_t * out, uint64_t value) noexcept
+    {
+        wchar_t buffer[20];
+        auto ptr = buffer + sizeof buffer / sizeof *buffer;
+        do
+            *--ptr = static_cast<wchar_t>(L'0' + value % 10);
+        while (value /= 10);
+        while (ptr != buffer + sizeof buffer / sizeof *buffer)
+            *out++ = *ptr++;
+        return out;
+    }
+
+    uint64_t words_[(max_binary_size + sizeof(uint64_t) - 1) / sizeof(uint64_t)] = {};
+};
+
+inline std::wostream & operator<<(std::wostream & out, sid const & value)
+{
+    wchar_t buffer[sid::max_string_size];
+    return out.write(buffer, value.format(buffer) - buffer);
+}
+
+}
+
+namespace std {
+
+template<>
+struct hash<jb::sid>
+{
+    size_t operator()(jb::sid const & value) const noexcept { return value.hash(); }
+};
+
+}
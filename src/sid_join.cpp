@@ -0,0 +1,81 @@
+﻿#include "config.hpp"
+
+#include "sid_join.hpp"
+
+#include <limits>
+#include <stdexcept>
+
+namespace jb
+{
+
+sid_index::sid_index(sid const * const keys, size_t const count) :
+    keys_(keys)
+{
+    if (count >= std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Too many SIDs to index");
+    size_t size = 16;
+    while (size < count * 2)
+        size *= 2;
+    slots_.assign(size, 0);
+    mask_ = size - 1;
+    for (size_t n = 0; n < count; ++n)
+    {
+        for (auto slot = keys[n].hash() & mask_; ; slot = (slot + 1) & mask_)
+        {
+            auto & value = slots_[slot];
+            if (!value)
+            {
+                value = static_cast<uint32_t>(n + 1);
+                break;
+            }
+            if (keys[value - 1] == keys[n])
+            {
+                ++duplicates_;
+                break;
+            }
+        }
+    }
+}
+
+size_t sid_index::find(sid const & value) const noexcept
+{
+    for (auto slot = value.hash() & mask_; ; slot = (slot + 1) & mask_)
+    {
+        auto const position = slots_[slot];
+        if (!position)
+            return npos;
+        if (keys_[position - 1] == value)
+            return position - 1;
+    }
+}
+
+sid_join join_sids(sid const * const left, size_t const left_count, sid const * const right, size_t const right_count)
+{
+    sid_index const left_index(left, left_count);
+    sid_index const right_index(right, right_count);
+
+    sid_join result;
+    result.left_duplicates = left_index.duplicates();
+    result.right_duplicates = right_index.duplicates();
+
+    std::vector<bool> right_matched(right_count);
+    for (size_t n = 0; n < left_count; ++n)
+    {
+        if (left_index.find(left[n]) != n)
+            continue;
+        auto const match = right_index.find(left[n]);
+        if (match == sid_index::npos)
+            result.left_only.push_back(static_cast<uint32_t>(n));
+        else
+        {
+            result.matched.emplace_back(static_cast<uint32_t>(n), static_cast<uint32_t>(match));
+            right_matched[match] = true;
+        }
+    }
+    for (size_t n = 0; n < right_count; ++n)
+        if (!right_matched[n] && right_index.find(right[n]) == n)
+            result.right_only.push_back(static_cast<uint32_t>(n));
+    return result;
+}
+
+}
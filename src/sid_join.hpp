@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include "sid.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace jb {
+
+// Open-addressing hash index from a SID to the position of its first occurrence in a key array the
+// index doesn't own. Slots hold positions plus one, at most half of them are used, so a lookup
+// rarely touches more than a cache line or two of slots before it compares a key.
+class sid_index final
+{
+public:
+    static size_t const npos = ~size_t(0);
+
+    sid_index(sid const * keys, size_t count);
+
+    // Position of the first key equal to value, npos when there is none.
+    size_t find(sid const & value) const noexcept;
+
+    // Keys that repeat an earlier one.
+    size_t duplicates() const noexcept { return duplicates_; }
+
+private:
+    sid const * keys_;
+    std::vector<uint32_t> slots_;
+    size_t mask_;
+    size_t duplicates_ = 0;
+};
+
+// Positions of a join of two SID keyed lists. Both sides keep their order, a repeated SID is only
+// counted in the side's duplicates.
+struct sid_join final
+{
+    std::vector<std::pair<uint32_t, uint32_t>> matched;
+    std::vector<uint32_t> left_only;
+    std::vector<uint32_t> right_only;
+    size_t left_duplicates = 0;
+    size_t right_duplicates = 0;
+};
+
+// Indexes both sides once and probes the right index with the left keys, linear in the total count.
+sid_join join_sids(sid const * left, size_t left_count, sid const * right, size_t right_count);
+
+}
@@ -0,0 +1,665 @@
+﻿#include "config.hpp"
+
+#include "snapshot.hpp"
+#include "firewall_profile.hpp"
+#include "format.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace jb {
+
+namespace {
+
+size_t const npos = ~size_t(0);
+
+size_t align8(size_t const size) noexcept
+{
+    return (size + 7) & ~size_t(7);
+}
+
+struct present_name final
+{
+    uint32_t bit;
+    wchar_t const * name;
+};
+
+present_name const present_names[] =
+{
+    { diagnostic_snapshot::has_elevation_flags     , L"elevation_flags"      },
+    { diagnostic_snapshot::has_token_elevation_type, L"token_elevation_type" },
+    { diagnostic_snapshot::has_firewall            , L"firewall"             },
+    { diagnostic_snapshot::has_app_containers      , L"app_containers"       },
+    { diagnostic_snapshot::has_config              , L"config"               },
+    { diagnostic_snapshot::has_mappings            , L"mappings"             },
+};
+
+// Calls fn(from_index, to_index) for every key of two sorted sequences, npos standing for the side
+// the key is missing from.
+template<typename FromKey, typename ToKey, typename Less, typename Fn>
+void merge(size_t const from_count, size_t const to_count, FromKey && from_key, ToKey && to_key, Less && less, Fn && fn)
+{
+    size_t from = 0, to = 0;
+    while (from < from_count || to < to_count)
+    {
+        if (to == to_count || (from < from_count && less(from_key(from), to_key(to))))
+            fn(from++, npos);
+        else if (from == from_count || less(to_key(to), from_key(from)))
+            fn(npos, to++);
+        else
+            fn(from++, to++);
+    }
+}
+
+auto const sid_less = [](sid const & left, sid const & right) { return left < right; };
+auto const string_less = [](std::wstring_view const & left, std::wstring_view const & right) { return left < right; };
+
+class snapshot_writer final
+{
+public:
+    snapshot_writer()
+    {
+        string(std::wstring_view());
+    }
+
+    uint32_t string(std::wstring_view const & value)
+    {
+        auto const result = string_ids_.emplace(std::wstring(value), static_cast<uint32_t>(strings.size()));
+        if (result.second)
+        {
+            strings.push_back({ static_cast<uint32_t>(chars.size()), static_cast<uint32_t>(value.size()) });
+            chars.insert(chars.end(), value.begin(), value.end());
+            chars.push_back(L'\0');
+        }
+        return result.first->second;
+    }
+
+    uint32_t sid_id(sid const & value)
+    {
+        auto const result = sid_ids_.emplace(value, static_cast<uint32_t>(sids.size()));
+        if (result.second)
+        {
+            sids.push_back({ static_cast<uint32_t>(sid_bytes.size()), static_cast<uint32_t>(value.binary_size()) });
+            sid_bytes.insert(sid_bytes.end(), value.data(), value.data() + value.binary_size());
+        }
+        return result.first->second;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> strings;
+    std::vector<wchar_t> chars;
+    std::vector<std::pair<uint32_t, uint32_t>> sids;
+    std::vector<uint8_t> sid_bytes;
+
+private:
+    std::unordered_map<std::wstring, uint32_t> string_ids_;
+    std::unordered_map<sid, uint32_t> sid_ids_;
+};
+
+// Positions of items sorted by key, first of every run of equal keys only.
+template<typename T, typename Key>
+std::vector<size_t> sorted_unique(std::vector<T> const & items, Key && key)
+{
+    std::vector<size_t> order(items.size());
+    for (size_t n = 0; n < order.size(); ++n)
+        order[n] = n;
+    std::stable_sort(order.begin(), order.end(), [&](size_t const left, size_t const right) { return key(items[left]) < key(items[right]); });
+    order.erase(std::unique(order.begin(), order.end(), [&](size_t const left, size_t const right) { return key(items[left]) == key(items[right]); }), order.end());
+    return order;
+}
+
+template<typename Fn>
+void diff_string(size_t & changes, Fn && prefix, wchar_t const * const name, std::wstring_view const & from, std::wstring_view const & to)
+{
+    if (from == to)
+        return;
+    ++changes;
+    prefix(L'~') << name << L": '" << from << L"' -> '" << to << L"'\n";
+}
+
+}
+
+wchar_t const * snapshot_part_name(uint32_t const part) noexcept
+{
+    for (auto const & item : present_names)
+        if (item.bit == part)
+            return item.name;
+    return L"unknown";
+}
+
+char const snapshot_view::magic[4] = { 'N', 'F', 'S', 'S' };
+
+std::vector<uint8_t> build_snapshot(diagnostic_snapshot const & snapshot)
+{
+    using view = snapshot_view;
+    snapshot_writer writer;
+
+    std::vector<view::file_firewall> firewall;
+    if (snapshot.present & diagnostic_snapshot::has_firewall)
+        for (auto const & profile : snapshot.firewall)
+            firewall.push_back({ profile.enabled, profile.block_all_inbound, static_cast<uint8_t>(profile.inbound), static_cast<uint8_t>(profile.outbound) });
+
+    std::vector<view::file_app_container> app_containers;
+    std::vector<view::file_capability> capabilities;
+    std::vector<uint32_t> binaries;
+    for (auto const n : sorted_unique(snapshot.app_containers, [](snapshot_app_container const & item) { return item.app_container; }))
+    {
+        auto const & item = snapshot.app_containers[n];
+        view::file_app_container record = {};
+        record.app_container = writer.sid_id(item.app_container);
+        record.user = writer.sid_id(item.user);
+        record.name = writer.string(item.name);
+        record.display_name = writer.string(item.display_name);
+        record.description = writer.string(item.description);
+        record.package_full_name = writer.string(item.package_full_name);
+        record.working_directory = writer.string(item.working_directory);
+        record.first_capability = static_cast<uint32_t>(capabilities.size());
+        for (auto const k : sorted_unique(item.capabilities, [](snapshot_capability const & capability) { return capability.value; }))
+            capabilities.push_back({ writer.sid_id(item.capabilities[k].value), item.capabilities[k].attributes });
+        record.capability_count = static_cast<uint32_t>(capabilities.size() - record.first_capability);
+        record.first_binary = static_cast<uint32_t>(binaries.size());
+        for (auto const k : sorted_unique(item.binaries, [](std::wstring const & binary) { return std::wstring_view(binary); }))
+            binaries.push_back(writer.string(item.binaries[k]));
+        record.binary_count = static_cast<uint32_t>(binaries.size() - record.first_binary);
+        app_containers.push_back(record);
+    }
+
+    std::vector<view::file_capability> config;
+    for (auto const n : sorted_unique(snapshot.config, [](snapshot_capability const & item) { return item.value; }))
+        config.push_back({ writer.sid_id(snapshot.config[n].value), snapshot.config[n].attributes });
+
+    std::vector<view::file_mapping> mappings;
+    for (auto const n : sorted_unique(snapshot.mappings, [](snapshot_mapping const & item) { return item.app_container; }))
+    {
+        auto const & item = snapshot.mappings[n];
+        mappings.push_back({ writer.sid_id(item.app_container), writer.string(item.display_name), writer.string(item.description), writer.string(item.moniker) });
+    }
+
+    struct part final
+    {
+        view::section_id id;
+        void const * data;
+        size_t count;
+        size_t size;
+    };
+    part const parts[] =
+    {
+        { view::section_strings       , writer.strings.data()  , writer.strings.size()  , writer.strings.size() * sizeof(view::file_span)       },
+        { view::section_chars         , writer.chars.data()    , writer.chars.size()    , writer.chars.size() * sizeof(wchar_t)                 },
+        { view::section_sids          , writer.sids.data()     , writer.sids.size()     , writer.sids.size() * sizeof(view::file_span)          },
+        { view::section_sid_bytes     , writer.sid_bytes.data(), writer.sid_bytes.size(), writer.sid_bytes.size()                               },
+        { view::section_firewall      , firewall.data()        , firewall.size()        , firewall.size() * sizeof(view::file_firewall)         },
+        { view::section_app_containers, app_containers.data()  , app_containers.size()  , app_containers.size() * sizeof(view::file_app_container) },
+        { view::section_capabilities  , capabilities.data()    , capabilities.size()    , capabilities.size() * sizeof(view::file_capability)   },
+        { view::section_binaries      , binaries.data()        , binaries.size()        , binaries.size() * sizeof(uint32_t)                    },
+        { view::section_config        , config.data()          , config.size()          , config.size() * sizeof(view::file_capability)         },
+        { view::section_mappings      , mappings.data()        , mappings.size()        , mappings.size() * sizeof(view::file_mapping)          },
+    };
+    static_assert(sizeof(view::file_span) == sizeof(std::pair<uint32_t, uint32_t>), "Span layout mismatch");
+
+    view::file_header header = {};
+    std::memcpy(header.magic, view::magic, sizeof view::magic);
+    header.version = view::version;
+    header.char_size = sizeof(wchar_t);
+    header.section_count = static_cast<uint32_t>(std::size(parts));
+    header.present = snapshot.present;
+    header.elevation_flags = snapshot.elevation_flags;
+    header.token_elevation_type = snapshot.token_elevation_type;
+    header.created = snapshot.created;
+
+    std::vector<view::file_section> sections;
+    auto offset = align8(sizeof header + std::size(parts) * sizeof(view::file_section));
+    for (auto const & item : parts)
+    {
+        sections.push_back({ item.id, static_cast<uint32_t>(item.count), offset, item.size });
+        offset = align8(offset + item.size);
+    }
+
+    std::vector<uint8_t> result(offset);
+    std::memcpy(result.data(), &header, sizeof header);
+    std::memcpy(result.data() + sizeof header, sections.data(), sections.size() * sizeof(view::file_section));
+    for (size_t n = 0; n < std::size(parts); ++n)
+        if (parts[n].size)
+            std::memcpy(result.data() + sections[n].offset, parts[n].data, parts[n].size);
+    return result;
+}
+
+void write_snapshot(std::filesystem::path const & path, diagnostic_snapshot const & snapshot)
+{
+    auto const image = build_snapshot(snapshot);
+    auto temp = path;
+    temp += L".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Can't create the snapshot file");
+        if (!out.write(reinterpret_cast<char const *>(image.data()), image.size()).flush())
+            throw std::runtime_error("Can't write the snapshot file");
+    }
+    std::filesystem::rename(temp, path);
+}
+
+void snapshot_view::open(std::filesystem::path const & path)
+{
+    close();
+#ifdef _WIN32
+    file_ = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Can't open snapshot file");
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size))
+    {
+        close();
+        throw std::runtime_error("Can't get snapshot file size");
+    }
+    mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    view_ = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view_)
+    {
+        close();
+        throw std::runtime_error("Can't map snapshot file");
+    }
+    void const * const data = view_;
+    auto const data_size = static_cast<size_t>(size.QuadPart);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Can't open snapshot file");
+    image_.resize(static_cast<size_t>(std::filesystem::file_size(path)));
+    if (!in.read(reinterpret_cast<char *>(image_.data()), static_cast<std::streamsize>(image_.size())))
+    {
+        close();
+        throw std::runtime_error("Can't read snapshot file");
+    }
+    void const * const data = image_.data();
+    auto const data_size = image_.size();
+#endif
+    try
+    {
+        attach(data, data_size);
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+void snapshot_view::attach(void const * const data, size_t const size)
+{
+    header_ = nullptr;
+    strings_ = chars_ = sids_ = sid_bytes_ = firewall_ = app_containers_ = capabilities_ = binaries_ = config_ = mappings_ = section();
+
+    auto const bytes = static_cast<uint8_t const *>(data);
+    if (size < sizeof(file_header))
+        throw std::runtime_error("Invalid snapshot size");
+    auto const header = reinterpret_cast<file_header const *>(bytes);
+    if (std::memcmp(header->magic, magic, sizeof magic) != 0)
+        throw std::runtime_error("Invalid snapshot signature");
+    if (header->version != version || header->char_size != sizeof(wchar_t))
+        throw std::runtime_error("Unsupported snapshot version");
+    if (header->section_count > (size - sizeof(file_header)) / sizeof(file_section))
+        throw std::runtime_error("Invalid snapshot section table");
+
+    struct target final
+    {
+        section snapshot_view::* member;
+        size_t record_size;
+    };
+    static target const targets[section_end] =
+    {
+        {},
+        { &snapshot_view::strings_       , sizeof(file_span)          },
+        { &snapshot_view::chars_         , sizeof(wchar_t)            },
+        { &snapshot_view::sids_          , sizeof(file_span)          },
+        { &snapshot_view::sid_bytes_     , 1                          },
+        { &snapshot_view::firewall_      , sizeof(file_firewall)      },
+        { &snapshot_view::app_containers_, sizeof(file_app_container) },
+        { &snapshot_view::capabilities_  , sizeof(file_capability)    },
+        { &snapshot_view::binaries_      , sizeof(uint32_t)           },
+        { &snapshot_view::config_        , sizeof(file_capability)    },
+        { &snapshot_view::mappings_      , sizeof(file_mapping)       },
+    };
+    uint32_t seen = 0;
+    auto const sections = reinterpret_cast<file_section const *>(bytes + sizeof(file_header));
+    for (uint32_t n = 0; n < header->section_count; ++n)
+    {
+        auto const & item = sections[n];
+        // Unknown sections are skipped, so later versions can add some.
+        if (!item.id || item.id >= section_end)
+            continue;
+        if (seen & (1u << item.id) || item.offset % 8 || item.offset > size || size - item.offset < item.size || item.size != uint64_t(item.count) * targets[item.id].record_size)
+            throw std::runtime_error("Invalid snapshot section");
+        seen |= 1u << item.id;
+        this->*targets[item.id].member = { bytes + item.offset, item.count };
+    }
+    header_ = header;
+
+    try
+    {
+        validate();
+    }
+    catch (...)
+    {
+        header_ = nullptr;
+        throw;
+    }
+}
+
+void snapshot_view::validate() const
+{
+    auto const fail = [] { throw std::runtime_error("Invalid snapshot record"); };
+    auto const chars = reinterpret_cast<wchar_t const *>(chars_.data);
+    for (size_t n = 0; n < strings_.count; ++n)
+    {
+        auto const & span = record<file_span>(strings_, n);
+        if (span.offset >= chars_.count || chars_.count - span.offset <= span.size || chars[span.offset + span.size])
+            fail();
+    }
+    if (!strings_.count)
+        fail();
+    for (size_t n = 0; n < sids_.count; ++n)
+    {
+        auto const & span = record<file_span>(sids_, n);
+        sid value;
+        if (span.offset > sid_bytes_.count || sid_bytes_.count - span.offset < span.size || !sid::parse(sid_bytes_.data + span.offset, span.size, value))
+            fail();
+    }
+    auto const check_string = [&](uint32_t const id) { if (id >= strings_.count) fail(); };
+    auto const check_sid = [&](uint32_t const id) { if (id >= sids_.count) fail(); };
+
+    if (firewall_.count != 0 && firewall_.count != firewall_defaults().size())
+        fail();
+    for (size_t n = 0; n < capabilities_.count; ++n)
+        check_sid(record<file_capability>(capabilities_, n).sid);
+    for (size_t n = 0; n < binaries_.count; ++n)
+        check_string(record<uint32_t>(binaries_, n));
+    for (size_t n = 0; n < app_containers_.count; ++n)
+    {
+        auto const & item = record<file_app_container>(app_containers_, n);
+        check_sid(item.app_container);
+        check_sid(item.user);
+        for (auto const id : { item.name, item.display_name, item.description, item.package_full_name, item.working_directory })
+            check_string(id);
+        if (item.first_capability > capabilities_.count || capabilities_.count - item.first_capability < item.capability_count ||
+            item.first_binary > binaries_.count || binaries_.count - item.first_binary < item.binary_count)
+            fail();
+        if (n && !(sid_at(record<file_app_container>(app_containers_, n - 1).app_container) < sid_at(item.app_container)))
+            fail();
+    }
+    for (size_t n = 0; n < config_.count; ++n)
+    {
+        check_sid(record<file_capability>(config_, n).sid);
+        if (n && !(sid_at(record<file_capability>(config_, n - 1).sid) < sid_at(record<file_capability>(config_, n).sid)))
+            fail();
+    }
+    for (size_t n = 0; n < mappings_.count; ++n)
+    {
+        auto const & item = record<file_mapping>(mappings_, n);
+        check_sid(item.app_container);
+        for (auto const id : { item.display_name, item.description, item.moniker })
+            check_string(id);
+        if (n && !(sid_at(record<file_mapping>(mappings_, n - 1).app_container) < sid_at(item.app_container)))
+            fail();
+    }
+}
+
+void snapshot_view::close() noexcept
+{
+#ifdef _WIN32
+    if (view_)
+        UnmapViewOfFile(view_);
+    if (mapping_)
+        CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_);
+    view_ = nullptr;
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    image_ = std::vector<uint8_t>();
+#endif
+    header_ = nullptr;
+}
+
+firewall_profile_defaults snapshot_view::firewall(size_t const profile) const noexcept
+{
+    firewall_profile_defaults result;
+    if (profile < firewall_.count)
+    {
+        auto const & item = record<file_firewall>(firewall_, profile);
+        result.enabled = item.enabled != 0;
+        result.block_all_inbound = item.block_all_inbound != 0;
+        result.inbound = static_cast<NET_FW_ACTION>(item.inbound);
+        result.outbound = static_cast<NET_FW_ACTION>(item.outbound);
+    }
+    return result;
+}
+
+snapshot_view::app_container snapshot_view::app_container_at(size_t const n) const noexcept
+{
+    auto const & item = record<file_app_container>(app_containers_, n);
+    return
+    {
+        sid_at(item.app_container),
+        sid_at(item.user),
+        string(item.name),
+        string(item.display_name),
+        string(item.description),
+        string(item.package_full_name),
+        string(item.working_directory),
+        item.first_capability,
+        item.capability_count,
+        item.first_binary,
+        item.binary_count,
+    };
+}
+
+size_t snapshot_view::find_app_container(sid const & value) const noexcept
+{
+    size_t first = 0, last = app_containers_.count;
+    while (first < last)
+    {
+        auto const middle = first + (last - first) / 2;
+        if (sid_at(record<file_app_container>(app_containers_, middle).app_container) < value)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return first < app_containers_.count && sid_at(record<file_app_container>(app_containers_, first).app_container) == value ? first : app_containers_.count;
+}
+
+snapshot_capability snapshot_view::capability(size_t const n) const noexcept
+{
+    auto const & item = record<file_capability>(capabilities_, n);
+    return { sid_at(item.sid), item.attributes };
+}
+
+std::wstring_view snapshot_view::binary(size_t const n) const noexcept
+{
+    return string(record<uint32_t>(binaries_, n));
+}
+
+snapshot_capability snapshot_view::config(size_t const n) const noexcept
+{
+    auto const & item = record<file_capability>(config_, n);
+    return { sid_at(item.sid), item.attributes };
+}
+
+snapshot_view::mapping snapshot_view::mapping_at(size_t const n) const noexcept
+{
+    auto const & item = record<file_mapping>(mappings_, n);
+    return { sid_at(item.app_container), string(item.display_name), string(item.description), string(item.moniker) };
+}
+
+std::wstring_view snapshot_view::string(uint32_t const id) const noexcept
+{
+    auto const & span = record<file_span>(strings_, id);
+    return std::wstring_view(reinterpret_cast<wchar_t const *>(chars_.data) + span.offset, span.size);
+}
+
+sid snapshot_view::sid_at(uint32_t const id) const noexcept
+{
+    auto const & span = record<file_span>(sids_, id);
+    sid result;
+    sid::parse(sid_bytes_.data + span.offset, span.size, result);
+    return result;
+}
+
+size_t diff_snapshots(snapshot_view const & from, snapshot_view const & to, std::wostream & out)
+{
+    size_t changes = 0;
+    auto const both = from.present() & to.present();
+
+    for (auto const & item : present_names)
+        if ((from.present() ^ to.present()) & item.bit)
+        {
+            ++changes;
+            out << L"~ " << item.name << L": " << (from.present() & item.bit ? L"read" : L"failed") << L" -> " << (to.present() & item.bit ? L"read" : L"failed") << L'\n';
+        }
+
+    if (both & diagnostic_snapshot::has_elevation_flags && from.elevation_flags() != to.elevation_flags())
+    {
+        ++changes;
+        out << L"~ elevation_flags: 0x" << hex(from.elevation_flags()) << L" -> 0x" << hex(to.elevation_flags()) << L'\n';
+    }
+    if (both & diagnostic_snapshot::has_token_elevation_type && from.token_elevation_type() != to.token_elevation_type())
+    {
+        ++changes;
+        out << L"~ token_elevation_type: " << dec(from.token_elevation_type()) << L" -> " << dec(to.token_elevation_type()) << L'\n';
+    }
+
+    if (both & diagnostic_snapshot::has_firewall)
+        for (size_t n = 0; n < std::size(firewall_profile_names); ++n)
+        {
+            auto const left = from.firewall(n);
+            auto const right = to.firewall(n);
+            auto const flag = [&](wchar_t const * const name, bool const before, bool const after)
+                {
+                    if (before == after)
+                        return;
+                    ++changes;
+                    out << L"~ firewall." << firewall_profile_names[n] << L'.' << name << L": " << (before ? L"yes" : L"no") << L" -> " << (after ? L"yes" : L"no") << L'\n';
+                };
+            auto const action = [&](wchar_t const * const name, NET_FW_ACTION const before, NET_FW_ACTION const after)
+                {
+                    if (before == after)
+                        return;
+                    ++changes;
+                    out << L"~ firewall." << firewall_profile_names[n] << L'.' << name << L": " << (before == NET_FW_ACTION_BLOCK ? L"block" : L"allow") << L" -> " << (after == NET_FW_ACTION_BLOCK ? L"block" : L"allow") << L'\n';
+                };
+            flag(L"enabled", left.enabled, right.enabled);
+            flag(L"block_all_inbound", left.block_all_inbound, right.block_all_inbound);
+            action(L"inbound", left.inbound, right.inbound);
+            action(L"outbound", left.outbound, right.outbound);
+        }
+
+    if (both & diagnostic_snapshot::has_app_containers)
+        merge(from.app_container_count(), to.app_container_count(),
+            [&](size_t const n) { return from.app_container_at(n).app_container; },
+            [&](size_t const n) { return to.app_container_at(n).app_container; },
+            sid_less,
+            [&](size_t const left_index, size_t const right_index)
+            {
+                if (left_index == npos || right_index == npos)
+                {
+                    ++changes;
+                    auto const item = left_index == npos ? to.app_container_at(right_index) : from.app_container_at(left_index);
+                    out << (left_index == npos ? L"+ " : L"- ") << L"app_container " << item.app_container << L": " << item.name << L'\n';
+                    return;
+                }
+                auto const left = from.app_container_at(left_index);
+                auto const right = to.app_container_at(right_index);
+                auto const prefix = [&](wchar_t const mark) -> std::wostream & { return out << mark << L" app_container " << left.app_container << L": "; };
+                if (left.user != right.user)
+                {
+                    ++changes;
+                    prefix(L'~') << L"user: " << left.user << L" -> " << right.user << L'\n';
+                }
+                diff_string(changes, prefix, L"name", left.name, right.name);
+                diff_string(changes, prefix, L"display_name", left.display_name, right.display_name);
+                diff_string(changes, prefix, L"description", left.description, right.description);
+                diff_string(changes, prefix, L"package_full_name", left.package_full_name, right.package_full_name);
+                diff_string(changes, prefix, L"working_directory", left.working_directory, right.working_directory);
+                merge(left.capability_count, right.capability_count,
+                    [&](size_t const n) { return from.capability(left.first_capability + n).value; },
+                    [&](size_t const n) { return to.capability(right.first_capability + n).value; },
+                    sid_less,
+                    [&](size_t const before, size_t const after)
+                    {
+                        auto const left_capability = before == npos ? snapshot_capability() : from.capability(left.first_capability + before);
+                        auto const right_capability = after == npos ? snapshot_capability() : to.capability(right.first_capability + after);
+                        if (before != npos && after != npos && left_capability.attributes == right_capability.attributes)
+                            return;
+                        ++changes;
+                        if (before == npos)
+                            prefix(L'+') << L"capability " << right_capability.value << L'\n';
+                        else if (after == npos)
+                            prefix(L'-') << L"capability " << left_capability.value << L'\n';
+                        else
+                            prefix(L'~') << L"capability " << left_capability.value << L": 0x" << hex(left_capability.attributes) << L" -> 0x" << hex(right_capability.attributes) << L'\n';
+                    });
+                merge(left.binary_count, right.binary_count,
+                    [&](size_t const n) { return from.binary(left.first_binary + n); },
+                    [&](size_t const n) { return to.binary(right.first_binary + n); },
+                    string_less,
+                    [&](size_t const before, size_t const after)
+                    {
+                        if (before != npos && after != npos)
+                            return;
+                        ++changes;
+                        if (before == npos)
+                            prefix(L'+') << L"binary " << to.binary(right.first_binary + after) << L'\n';
+                        else
+                            prefix(L'-') << L"binary " << from.binary(left.first_binary + before) << L'\n';
+                    });
+            });
+
+    if (both & diagnostic_snapshot::has_config)
+        merge(from.config_count(), to.config_count(),
+            [&](size_t const n) { return from.config(n).value; },
+            [&](size_t const n) { return to.config(n).value; },
+            sid_less,
+            [&](size_t const left_index, size_t const right_index)
+            {
+                auto const left = left_index == npos ? snapshot_capability() : from.config(left_index);
+                auto const right = right_index == npos ? snapshot_capability() : to.config(right_index);
+                if (left_index != npos && right_index != npos && left.attributes == right.attributes)
+                    return;
+                ++changes;
+                if (left_index == npos)
+                    out << L"+ config " << right.value << L'\n';
+                else if (right_index == npos)
+                    out << L"- config " << left.value << L'\n';
+                else
+                    out << L"~ config " << left.value << L": 0x" << hex(left.attributes) << L" -> 0x" << hex(right.attributes) << L'\n';
+            });
+
+    if (both & diagnostic_snapshot::has_mappings)
+        merge(from.mapping_count(), to.mapping_count(),
+            [&](size_t const n) { return from.mapping_at(n).app_container; },
+            [&](size_t const n) { return to.mapping_at(n).app_container; },
+            sid_less,
+            [&](size_t const left_index, size_t const right_index)
+            {
+                if (left_index == npos || right_index == npos)
+                {
+                    ++changes;
+                    auto const item = left_index == npos ? to.mapping_at(right_index) : from.mapping_at(left_index);
+                    out << (left_index == npos ? L"+ " : L"- ") << L"mapping " << item.app_container << L": " << item.moniker << L'\n';
+                    return;
+                }
+                auto const left = from.mapping_at(left_index);
+                auto const right = to.mapping_at(right_index);
+                auto const prefix = [&](wchar_t const mark) -> std::wostream & { return out << mark << L" mapping " << left.app_container << L": "; };
+                diff_string(changes, prefix, L"display_name", left.display_name, right.display_name);
+                diff_string(changes, prefix, L"description", left.description, right.description);
+                diff_string(changes, prefix, L"moniker", left.moniker, right.moniker);
+            });
+
+    return changes;
+}
+
+}
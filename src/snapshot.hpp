@@ -0,0 +1,269 @@
+﻿#pragma once
+
+#include "firewall_profile.hpp"
+#include "sid.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace jb {
+
+struct snapshot_capability final
+{
+    sid value;
+    uint32_t attributes;
+};
+
+struct snapshot_app_container final
+{
+    sid app_container;
+    sid user;
+    std::wstring name;
+    std::wstring display_name;
+    std::wstring description;
+    std::wstring package_full_name;
+    std::wstring working_directory;
+    std::vector<snapshot_capability> capabilities;
+    std::vector<std::wstring> binaries;
+};
+
+struct snapshot_mapping final
+{
+    sid app_container;
+    std::wstring display_name;
+    std::wstring description;
+    std::wstring moniker;
+};
+
+// Everything the probes read, in a form that can be written and compared. present has a bit per
+// part that was read successfully.
+struct diagnostic_snapshot final
+{
+    enum : uint32_t
+    {
+        has_elevation_flags = 1 << 0,
+        has_token_elevation_type = 1 << 1,
+        has_firewall = 1 << 2,
+        has_app_containers = 1 << 3,
+        has_config = 1 << 4,
+        has_mappings = 1 << 5,
+    };
+
+    uint32_t present = 0;
+    int64_t created = 0;
+    uint32_t elevation_flags = 0;
+    uint32_t token_elevation_type = 0;
+    firewall_defaults firewall;
+    std::vector<snapshot_app_container> app_containers;
+    std::vector<snapshot_capability> config;
+    std::vector<snapshot_mapping> mappings;
+};
+
+// Name of a diagnostic_snapshot::has_* bit, as printed by diff_snapshots.
+wchar_t const * snapshot_part_name(uint32_t part) noexcept;
+
+// Builds the versioned binary form read by snapshot_view. Strings and SIDs are interned, records
+// are sorted by SID (a repeated SID keeps its first record), capabilities by SID and binaries by
+// path.
+std::vector<uint8_t> build_snapshot(diagnostic_snapshot const & snapshot);
+
+// Writes build_snapshot's image, replacing the file through a temporary one next to it.
+void write_snapshot(std::filesystem::path const & path, diagnostic_snapshot const & snapshot);
+
+// Read-only view of a snapshot file, mapped and read in place. Every offset and index is checked
+// when the file is opened, a malformed file throws.
+class snapshot_view final
+{
+public:
+    struct app_container final
+    {
+        sid app_container;
+        sid user;
+        std::wstring_view name;
+        std::wstring_view display_name;
+        std::wstring_view description;
+        std::wstring_view package_full_name;
+        std::wstring_view working_directory;
+        size_t first_capability;
+        size_t capability_count;
+        size_t first_binary;
+        size_t binary_count;
+    };
+
+    struct mapping final
+    {
+        sid app_container;
+        std::wstring_view display_name;
+        std::wstring_view description;
+        std::wstring_view moniker;
+    };
+
+    snapshot_view() = default;
+
+    snapshot_view(snapshot_view const &) = delete;
+    snapshot_view & operator=(snapshot_view const &) = delete;
+
+    ~snapshot_view()
+    {
+        close();
+    }
+
+    void open(std::filesystem::path const & path);
+    // Uses a caller-owned image, which must outlive the view.
+    void attach(void const * data, size_t size);
+    void close() noexcept;
+
+    uint32_t present() const noexcept { return header_->present; }
+    int64_t created() const noexcept { return header_->created; }
+    uint32_t elevation_flags() const noexcept { return header_->elevation_flags; }
+    uint32_t token_elevation_type() const noexcept { return header_->token_elevation_type; }
+    firewall_profile_defaults firewall(size_t profile) const noexcept;
+
+    size_t app_container_count() const noexcept { return app_containers_.count; }
+    app_container app_container_at(size_t n) const noexcept;
+    // Binary search, app_container_count() when it is not there.
+    size_t find_app_container(sid const & value) const noexcept;
+    snapshot_capability capability(size_t n) const noexcept;
+    std::wstring_view binary(size_t n) const noexcept;
+
+    size_t config_count() const noexcept { return config_.count; }
+    snapshot_capability config(size_t n) const noexcept;
+
+    size_t mapping_count() const noexcept { return mappings_.count; }
+    mapping mapping_at(size_t n) const noexcept;
+
+    size_t string_count() const noexcept { return strings_.count; }
+    size_t sid_count() const noexcept { return sids_.count; }
+
+private:
+    friend std::vector<uint8_t> build_snapshot(diagnostic_snapshot const & snapshot);
+
+    struct file_header final
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t char_size;
+        uint32_t section_count;
+        uint32_t present;
+        uint32_t elevation_flags;
+        uint32_t token_elevation_type;
+        uint32_t reserved;
+        int64_t created;
+    };
+
+    enum section_id : uint32_t
+    {
+        section_strings = 1,
+        section_chars,
+        section_sids,
+        section_sid_bytes,
+        section_firewall,
+        section_app_containers,
+        section_capabilities,
+        section_binaries,
+        section_config,
+        section_mappings,
+        section_end,
+    };
+
+    struct file_section final
+    {
+        uint32_t id;
+        uint32_t count;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // Of a string in chars or a SID in sid_bytes.
+    struct file_span final
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct file_firewall final
+    {
+        uint8_t enabled;
+        uint8_t block_all_inbound;
+        uint8_t inbound;
+        uint8_t outbound;
+    };
+
+    struct file_app_container final
+    {
+        uint32_t app_container;
+        uint32_t user;
+        uint32_t name;
+        uint32_t display_name;
+        uint32_t description;
+        uint32_t package_full_name;
+        uint32_t working_directory;
+        uint32_t first_capability;
+        uint32_t capability_count;
+        uint32_t first_binary;
+        uint32_t binary_count;
+        uint32_t reserved;
+    };
+
+    struct file_capability final
+    {
+        uint32_t sid;
+        uint32_t attributes;
+    };
+
+    struct file_mapping final
+    {
+        uint32_t app_container;
+        uint32_t display_name;
+        uint32_t description;
+        uint32_t moniker;
+    };
+
+    struct section final
+    {
+        uint8_t const * data = nullptr;
+        size_t count = 0;
+    };
+
+    static char const magic[4];
+    static uint32_t const version = 1;
+
+    template<typename T>
+    T const & record(section const & from, size_t const n) const noexcept { return reinterpret_cast<T const *>(from.data)[n]; }
+
+    std::wstring_view string(uint32_t id) const noexcept;
+    sid sid_at(uint32_t id) const noexcept;
+    void validate() const;
+
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    void const * view_ = nullptr;
+#else
+    std::vector<uint8_t> image_;
+#endif
+
+    file_header const * header_ = nullptr;
+    section strings_;
+    section chars_;
+    section sids_;
+    section sid_bytes_;
+    section firewall_;
+    section app_containers_;
+    section capabilities_;
+    section binaries_;
+    section config_;
+    section mappings_;
+};
+
+// Compares two snapshots and prints one line per difference: "+" for what only to has, "-" for
+// what only from has, "~" for a changed value. Every keyed part is walked once by a merge of the
+// sorted records, so the cost is linear in the snapshot sizes. Returns the number of differences.
+size_t diff_snapshots(snapshot_view const & from, snapshot_view const & to, std::wostream & out);
+
+}
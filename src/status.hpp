@@ -0,0 +1,139 @@
+﻿#pragma once
+
+#include "config.hpp"
+#include "format.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+
+namespace jb {
+
+// Outcome of a Win32, COM or native call: the raw code and whether it counts as success. The
+// codes are taken as fixed-width integers, so only last_error depends on the Windows headers.
+class status final
+{
+public:
+    constexpr status() noexcept = default;
+
+    // Win32 error code, ERROR_SUCCESS (0) is the only success.
+    static constexpr status win32(uint32_t const error) noexcept
+    {
+        return status(error, error == 0);
+    }
+
+#ifdef _WIN32
+    static status last_error(BOOL const result) noexcept
+    {
+        return result ? status() : win32(GetLastError());
+    }
+#endif
+
+    // HRESULT, succeeded when not negative.
+    static constexpr status hresult(int32_t const hr) noexcept
+    {
+        return status(static_cast<uint32_t>(hr), hr >= 0);
+    }
+
+    static constexpr status ntstatus(int32_t const value) noexcept
+    {
+        return status(static_cast<uint32_t>(value), value >= 0);
+    }
+
+    constexpr bool succeeded() const noexcept { return succeeded_; }
+    constexpr explicit operator bool() const noexcept { return succeeded_; }
+    constexpr bool operator!() const noexcept { return !succeeded_; }
+
+    constexpr uint32_t code() const noexcept { return code_; }
+
+private:
+    constexpr status(uint32_t const code, bool const succeeded) noexcept :
+        code_(code),
+        succeeded_(succeeded)
+    {
+    }
+
+    uint32_t code_ = 0;
+    bool succeeded_ = true;
+};
+
+// Either a value or the status of the failed call, for hot paths where misses are common and
+// exceptions are too expensive.
+template<typename T>
+class expected final
+{
+public:
+    expected(T const & value) :
+        value_(value)
+    {
+    }
+
+    expected(T && value) :
+        value_(std::move(value))
+    {
+    }
+
+    // Only a failed status: a successful one would leave neither a value nor an error to report.
+    expected(status const error) :
+        error_(error)
+    {
+        if (error)
+            throw std::logic_error("Expected constructed from a successful status");
+    }
+
+    bool has_value() const noexcept { return value_.has_value(); }
+    explicit operator bool() const noexcept { return value_.has_value(); }
+
+    status error() const noexcept { return error_; }
+
+    T & value() &
+    {
+        check();
+        return *value_;
+    }
+
+    T const & value() const &
+    {
+        check();
+        return *value_;
+    }
+
+    T && value() &&
+    {
+        check();
+        return std::move(*value_);
+    }
+
+    template<typename U>
+    T value_or(U && default_value) const &
+    {
+        return value_ ? *value_ : static_cast<T>(std::forward<U>(default_value));
+    }
+
+    T & operator*() & noexcept { return *value_; }
+    T const & operator*() const & noexcept { return *value_; }
+    T * operator->() noexcept { return &*value_; }
+    T const * operator->() const noexcept { return &*value_; }
+
+private:
+    void check() const
+    {
+        if (!value_)
+            throw std::runtime_error("Expected value is not available");
+    }
+
+    std::optional<T> value_;
+    status error_;
+};
+
+inline bool is_succeeded(std::wostream & out, status const result)
+{
+    if (result)
+        return true;
+    out << L"failed: 0x" << hex(result.code()) << L'\n';
+    return false;
+}
+
+}
@@ -0,0 +1,131 @@
+﻿#include "config.hpp"
+
+#include "watch.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace jb {
+
+namespace {
+
+bool is_missing(status const error) noexcept
+{
+    return error.code() == static_cast<uint32_t>(reg_status::not_found);
+}
+
+expected<reg_key> open_ancestor(reg_key const & root, std::wstring path)
+{
+    while (true)
+    {
+        auto const end = path.rfind(L'\\');
+        path.resize(end == std::wstring::npos ? 0 : end);
+        auto key = root.try_open_key(path, KEY_NOTIFY);
+        if (key || path.empty() || !is_missing(key.error()))
+            return key;
+    }
+}
+
+}
+
+reg_change_source::~reg_change_source()
+{
+    // Closing the keys ends the pending notifications before their events go.
+    watches_.clear();
+    for (auto const event : events_)
+        CloseHandle(event);
+}
+
+// Opens and watches the key, or its ancestor while the key is missing. The key is looked for
+// again once the ancestor is watched, so one created in between isn't missed.
+status reg_change_source::arm(watch & item, HANDLE const event)
+{
+    while (true)
+    {
+        auto key = item.root.try_open_key(item.path, KEY_NOTIFY);
+        if (key)
+        {
+            item.pending = false;
+            item.key = std::move(*key);
+            item.key.notify_change(event, item.watch_subtree);
+            return status();
+        }
+        if (!is_missing(key.error()))
+            return key.error();
+
+        auto ancestor = open_ancestor(item.root, item.path);
+        if (!ancestor)
+            return ancestor.error();
+        item.pending = true;
+        item.key = std::move(*ancestor);
+        item.key.notify_change(event, true);
+        auto const again = item.root.try_open_key(item.path, KEY_NOTIFY);
+        if (!again && is_missing(again.error()))
+            return status();
+    }
+}
+
+expected<uint32_t> reg_change_source::add(reg_key const & root, std::wstring path, bool const watch_subtree)
+{
+    if (events_.size() == 32 || events_.size() == MAXIMUM_WAIT_OBJECTS)
+        throw std::runtime_error("Too many watched registry keys");
+    auto const event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!event)
+        throw std::runtime_error("Can't create registry change event");
+    try
+    {
+        watch item{ root, std::move(path), watch_subtree, false, reg_key() };
+        auto const result = arm(item, event);
+        if (!result)
+        {
+            CloseHandle(event);
+            return result;
+        }
+        watches_.push_back(std::move(item));
+        events_.push_back(event);
+    }
+    catch (...)
+    {
+        CloseHandle(event);
+        throw;
+    }
+    return 1u << (events_.size() - 1);
+}
+
+bool reg_change_source::pending(uint32_t const bit) const
+{
+    for (size_t n = 0; n < watches_.size(); ++n)
+        if (bit == 1u << n)
+            return watches_[n].pending;
+    throw std::runtime_error("Unknown registry watch");
+}
+
+bool reg_change_source::wait_once(std::chrono::milliseconds const timeout, uint32_t & changes)
+{
+    if (events_.empty())
+        return false;
+    auto const count = static_cast<DWORD>(events_.size());
+    auto const milliseconds = timeout == infinite ? INFINITE : static_cast<DWORD>(std::min<std::chrono::milliseconds::rep>(timeout.count(), INFINITE - 1));
+    auto const result = WaitForMultipleObjects(count, events_.data(), FALSE, milliseconds);
+    if (result == WAIT_TIMEOUT)
+        return false;
+    if (result >= WAIT_OBJECT_0 + count)
+        throw std::runtime_error("Can't wait for registry changes");
+
+    // The events reset themselves: the one returned by the wait is, the rest are by the check. A
+    // change below the ancestor of a key that is still missing isn't reported, wait waits on.
+    changes = 0;
+    for (DWORD n = 0; n < count; ++n)
+        if (n == result - WAIT_OBJECT_0 || WaitForSingleObject(events_[n], 0) == WAIT_OBJECT_0)
+        {
+            auto & item = watches_[n];
+            auto const was_pending = item.pending;
+            if (!arm(item, events_[n]))
+                throw std::runtime_error("Can't watch registry key");
+            if (!was_pending || !item.pending)
+                changes |= 1u << n;
+        }
+    return true;
+}
+
+}
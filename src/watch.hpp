@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include "change_source.hpp"
+#include "registry.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace jb {
+
+// RegNotifyChangeKeyValue on up to 32 keys. A signaled key is watched again before wait returns,
+// so a change made while its owner reads the key is reported by the next wait. A key that doesn't
+// exist yet is watched through its nearest existing ancestor: its bit is reported when it appears
+// and when it is deleted, after which the ancestor is watched again.
+class reg_change_source final : public change_source
+{
+public:
+    reg_change_source() = default;
+
+    reg_change_source(reg_change_source const &) = delete;
+    reg_change_source & operator=(reg_change_source const &) = delete;
+
+    ~reg_change_source();
+
+    // Watches path below root. Returns its bit, or the error when path can't be opened for a reason
+    // other than being missing.
+    expected<uint32_t> add(reg_key const & root, std::wstring path, bool watch_subtree);
+
+    // Whether the key of the bit is missing and its ancestor is watched for it.
+    bool pending(uint32_t bit) const;
+
+private:
+    bool wait_once(std::chrono::milliseconds timeout, uint32_t & changes) override;
+
+    struct watch final
+    {
+        reg_key root;
+        std::wstring path;
+        bool watch_subtree;
+        // key is the nearest existing ancestor of path, watched with its subtree for path to appear.
+        bool pending;
+        reg_key key;
+    };
+
+    static status arm(watch & item, HANDLE event);
+
+    std::vector<watch> watches_;
+    std::vector<HANDLE> events_;
+};
+
+}
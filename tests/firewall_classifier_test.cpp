@@ -0,0 +1,143 @@
+﻿#include "test.hpp"
+
+#include "firewall_classifier.hpp"
+
+#include <stdexcept>
+
+using namespace jb;
+
+namespace {
+
+firewall_rule make_rule(std::wstring_view const & name, NET_FW_ACTION const action)
+{
+    firewall_rule rule;
+    rule.name = name;
+    rule.action = action;
+    return rule;
+}
+
+firewall_packet make_packet(uint16_t const local_port)
+{
+    firewall_packet packet;
+    packet.direction = NET_FW_RULE_DIR_IN;
+    packet.profile = NET_FW_PROFILE2_PRIVATE;
+    packet.protocol = NET_FW_IP_PROTOCOL_TCP;
+    if (!ip_address::parse(L"192.168.1.10", packet.local_address) || !ip_address::parse(L"10.1.2.3", packet.remote_address))
+        throw std::runtime_error("Invalid test address");
+    packet.local_port = local_port;
+    packet.remote_port = 50000;
+    return packet;
+}
+
+bool decided_by(firewall_decision const & decision, uint32_t const rule, NET_FW_ACTION const action)
+{
+    return decision.source == firewall_decision::source_type::rule && decision.rule == rule && decision.action == action;
+}
+
+}
+
+JB_TEST(block_wins_over_allow)
+{
+    firewall_rule_snapshot snapshot;
+    auto allow = make_rule(L"Allow web", NET_FW_ACTION_ALLOW);
+    allow.local_ports = L"80, 443";
+    snapshot.add(allow);
+    auto block = make_rule(L"Block range", NET_FW_ACTION_BLOCK);
+    block.local_ports = L"400-500";
+    snapshot.add(block);
+    auto disabled = make_rule(L"Disabled", NET_FW_ACTION_BLOCK);
+    disabled.enabled = false;
+    snapshot.add(disabled);
+    snapshot.freeze();
+
+    firewall_classifier const classifier(snapshot, firewall_defaults());
+    JB_CHECK(classifier.rule_count() == 2);
+    JB_CHECK(decided_by(classifier.classify(make_packet(80)), 0, NET_FW_ACTION_ALLOW));
+    JB_CHECK(decided_by(classifier.classify(make_packet(443)), 1, NET_FW_ACTION_BLOCK));
+
+    auto const other = classifier.classify(make_packet(22));
+    JB_CHECK(other.source == firewall_decision::source_type::default_action);
+    JB_CHECK(other.action == NET_FW_ACTION_BLOCK);
+}
+
+JB_TEST(applications_and_addresses)
+{
+    firewall_rule_snapshot snapshot;
+    auto app = make_rule(L"App", NET_FW_ACTION_ALLOW);
+    app.application = L"C:\\App\\app.exe";
+    app.remote_addresses = L"10.0.0.0/8";
+    snapshot.add(app);
+    auto subnet = make_rule(L"Subnet", NET_FW_ACTION_ALLOW);
+    subnet.application = L"C:\\Other\\other.exe";
+    subnet.remote_addresses = L"LocalSubnet";
+    snapshot.add(subnet);
+    snapshot.freeze();
+
+    firewall_classifier const classifier(snapshot, firewall_defaults());
+    auto packet = make_packet(80);
+    JB_CHECK(classifier.classify(packet).source == firewall_decision::source_type::default_action);
+
+    packet.application = classifier.application_id(L"c:\\app\\APP.EXE");
+    JB_CHECK(decided_by(classifier.classify(packet), 0, NET_FW_ACTION_ALLOW));
+    JB_CHECK(ip_address::parse(L"8.8.8.8", packet.remote_address));
+    JB_CHECK(classifier.classify(packet).source == firewall_decision::source_type::default_action);
+
+    // Address keywords match every address.
+    packet.application = classifier.application_id(L"C:\\Other\\other.exe");
+    JB_CHECK(decided_by(classifier.classify(packet), 1, NET_FW_ACTION_ALLOW));
+    JB_CHECK(classifier.application_id(L"C:\\Unknown.exe") == firewall_packet::no_application);
+}
+
+JB_TEST(services)
+{
+    firewall_rule_snapshot snapshot;
+    auto dns = make_rule(L"DNS service", NET_FW_ACTION_BLOCK);
+    dns.service = L"dnscache";
+    snapshot.add(dns);
+    auto every = make_rule(L"Every service", NET_FW_ACTION_ALLOW);
+    every.service = L"*";
+    every.local_ports = L"53";
+    snapshot.add(every);
+    auto no_service = make_rule(L"No service", NET_FW_ACTION_ALLOW);
+    no_service.service = L"Any";
+    no_service.local_ports = L"80";
+    snapshot.add(no_service);
+    snapshot.freeze();
+
+    firewall_classifier const classifier(snapshot, firewall_defaults());
+    auto packet = make_packet(53);
+    JB_CHECK(classifier.classify(packet).source == firewall_decision::source_type::default_action);
+
+    packet.service = classifier.service_id(L"DnsCache");
+    JB_CHECK(decided_by(classifier.classify(packet), 0, NET_FW_ACTION_BLOCK));
+
+    packet.service = classifier.service_id(L"w32time");
+    JB_CHECK(packet.service != firewall_packet::no_service);
+    JB_CHECK(decided_by(classifier.classify(packet), 1, NET_FW_ACTION_ALLOW));
+
+    packet.local_port = 80;
+    JB_CHECK(decided_by(classifier.classify(packet), 2, NET_FW_ACTION_ALLOW));
+    packet.service = firewall_packet::no_service;
+    JB_CHECK(decided_by(classifier.classify(packet), 2, NET_FW_ACTION_ALLOW));
+}
+
+JB_TEST(profile_defaults)
+{
+    firewall_rule_snapshot snapshot;
+    snapshot.add(make_rule(L"Allow all", NET_FW_ACTION_ALLOW));
+    snapshot.freeze();
+
+    firewall_defaults defaults;
+    defaults[1].block_all_inbound = true;
+    defaults[2].enabled = false;
+    firewall_classifier const classifier(snapshot, defaults);
+
+    auto packet = make_packet(80);
+    JB_CHECK(classifier.classify(packet).source == firewall_decision::source_type::block_all_inbound);
+    packet.direction = NET_FW_RULE_DIR_OUT;
+    JB_CHECK(classifier.classify(packet).source == firewall_decision::source_type::default_action);
+    packet.profile = NET_FW_PROFILE2_PUBLIC;
+    JB_CHECK(classifier.classify(packet).source == firewall_decision::source_type::firewall_disabled);
+    packet.profile = NET_FW_PROFILE2_ALL;
+    JB_CHECK_THROWS(classifier.classify(packet));
+}
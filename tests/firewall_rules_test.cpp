@@ -0,0 +1,171 @@
+﻿#include "test.hpp"
+
+#include "firewall_rules.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+// Trimmed output of "netsh advfirewall firewall show rule name=all verbose".
+wchar_t const netsh_text[] =
+    L"\r\n"
+    L"Rule Name:                            Web Server\r\n"
+    L"----------------------------------------------------------------------\r\n"
+    L"Enabled:                              Yes\r\n"
+    L"Direction:                            In\r\n"
+    L"Profiles:                             Domain,Private\r\n"
+    L"Grouping:                             Web\r\n"
+    L"LocalIP:                              Any\r\n"
+    L"RemoteIP:                             10.0.0.0/8\r\n"
+    L"Protocol:                             TCP\r\n"
+    L"LocalPort:                            80,443,8000-8080\r\n"
+    L"RemotePort:                           Any\r\n"
+    L"Edge traversal:                       No\r\n"
+    L"Program:                              C:\\Web\\server.exe\r\n"
+    L"Service:                              Any\r\n"
+    L"InterfaceTypes:                       Any\r\n"
+    L"Action:                               Allow\r\n"
+    L"\r\n"
+    L"Rule Name:                            Block Telemetry\r\n"
+    L"----------------------------------------------------------------------\r\n"
+    L"Enabled:                              No\r\n"
+    L"Direction:                            Out\r\n"
+    L"Profiles:                             Public\r\n"
+    L"Protocol:                             Any\r\n"
+    L"LocalPort:                            Any\r\n"
+    L"Program:                              Any\r\n"
+    L"Action:                               Block\r\n"
+    L"\r\n"
+    L"Rule Name:                            Core Networking - DNS (UDP-Out)\r\n"
+    L"----------------------------------------------------------------------\r\n"
+    L"Enabled:                              Yes\r\n"
+    L"Direction:                            Out\r\n"
+    L"Profiles:                             Any\r\n"
+    L"Protocol:                             UDP\r\n"
+    L"LocalPort:                            Any\r\n"
+    L"RemotePort:                           53\r\n"
+    L"Program:                              %SystemRoot%\\system32\\svchost.exe\r\n"
+    L"Service:                              dnscache\r\n"
+    L"Action:                               Allow\r\n"
+    L"\r\n"
+    L"Rule Name:                            ICMP Echo\r\n"
+    L"----------------------------------------------------------------------\r\n"
+    L"Enabled:                              Yes\r\n"
+    L"Direction:                            In\r\n"
+    L"Profiles:                             Private\r\n"
+    L"Protocol:                             ICMPv4\r\n"
+    L"Action:                               Allow\r\n"
+    L"Ok.\r\n";
+
+firewall_rule_snapshot load(std::wstring const & text)
+{
+    std::wistringstream in(text);
+    firewall_rule_snapshot snapshot;
+    snapshot.load(in);
+    snapshot.freeze();
+    return snapshot;
+}
+
+}
+
+JB_TEST(netsh_fields)
+{
+    auto const snapshot = load(netsh_text);
+    JB_CHECK(snapshot.size() == 4);
+
+    JB_CHECK(snapshot.name(0) == L"Web Server");
+    JB_CHECK(snapshot.enabled(0));
+    JB_CHECK(snapshot.direction(0) == NET_FW_RULE_DIR_IN);
+    JB_CHECK(snapshot.profiles(0) == (NET_FW_PROFILE2_DOMAIN | NET_FW_PROFILE2_PRIVATE));
+    JB_CHECK(snapshot.grouping(0) == L"Web");
+    JB_CHECK(snapshot.remote_addresses(0) == L"10.0.0.0/8");
+    JB_CHECK(snapshot.protocol(0) == NET_FW_IP_PROTOCOL_TCP);
+    JB_CHECK(snapshot.local_ports(0) == L"80,443,8000-8080");
+    JB_CHECK(snapshot.application(0) == L"C:\\Web\\server.exe");
+    JB_CHECK(snapshot.action(0) == NET_FW_ACTION_ALLOW);
+
+    JB_CHECK(snapshot.name(1) == L"Block Telemetry");
+    JB_CHECK(!snapshot.enabled(1));
+    JB_CHECK(snapshot.direction(1) == NET_FW_RULE_DIR_OUT);
+    JB_CHECK(snapshot.profiles(1) == NET_FW_PROFILE2_PUBLIC);
+    JB_CHECK(snapshot.protocol(1) == NET_FW_IP_PROTOCOL_ANY);
+    JB_CHECK(snapshot.application(1).empty());
+    JB_CHECK(snapshot.action(1) == NET_FW_ACTION_BLOCK);
+
+    JB_CHECK(snapshot.profiles(2) == NET_FW_PROFILE2_ALL);
+    JB_CHECK(snapshot.protocol(2) == NET_FW_IP_PROTOCOL_UDP);
+    JB_CHECK(snapshot.remote_ports(2) == L"53");
+    JB_CHECK(snapshot.service(2) == L"dnscache");
+
+    JB_CHECK(snapshot.protocol(3) == 1);
+    JB_CHECK(snapshot.local_ports(3).empty());
+}
+
+JB_TEST(netsh_queries)
+{
+    auto const snapshot = load(netsh_text);
+    auto const find = [&](firewall_rule_query const & query) { return snapshot.find(query); };
+
+    firewall_rule_query web;
+    web.application = L"c:\\web\\SERVER.EXE";
+    web.direction = NET_FW_RULE_DIR_IN;
+    JB_CHECK(find(web) == (std::vector<uint32_t>{ 0, 3 }));
+
+    // The ICMP rule has no local port, so it matches every port.
+    web.local_port = 443;
+    JB_CHECK(find(web) == (std::vector<uint32_t>{ 0, 3 }));
+    web.local_port = 8080;
+    JB_CHECK(find(web) == (std::vector<uint32_t>{ 0, 3 }));
+    web.local_port = 8081;
+    JB_CHECK(find(web) == std::vector<uint32_t>{ 3 });
+    web.protocol = NET_FW_IP_PROTOCOL_TCP;
+    JB_CHECK(find(web).empty());
+
+    firewall_rule_query outbound;
+    outbound.direction = NET_FW_RULE_DIR_OUT;
+    outbound.protocol = NET_FW_IP_PROTOCOL_UDP;
+    JB_CHECK(find(outbound) == (std::vector<uint32_t>{ 1, 2 }));
+    outbound.enabled_only = true;
+    JB_CHECK(find(outbound) == std::vector<uint32_t>{ 2 });
+
+    firewall_rule_query domain;
+    domain.profiles = NET_FW_PROFILE2_DOMAIN;
+    JB_CHECK(find(domain) == (std::vector<uint32_t>{ 0, 2 }));
+}
+
+JB_TEST(netsh_noise_is_ignored)
+{
+    JB_CHECK(load(L"").size() == 0);
+    JB_CHECK(load(L"No rules match the specified criteria.\r\n").size() == 0);
+
+    // Fields before the first rule name and lines without a colon belong to no rule.
+    auto const snapshot = load(
+        L"Enabled: No\r\n"
+        L"garbage\r\n"
+        L"Rule Name: Only\r\n"
+        L"LocalPort: 1-2-3, 99999, 70000-80000, RPC, 22\r\n"
+        L"Protocol: 400000\r\n");
+    JB_CHECK(snapshot.size() == 1);
+    JB_CHECK(snapshot.enabled(0));
+    JB_CHECK(snapshot.protocol(0) == NET_FW_IP_PROTOCOL_ANY);
+
+    firewall_rule_query query;
+    query.local_port = 22;
+    JB_CHECK(snapshot.find(query) == std::vector<uint32_t>{ 0 });
+    query.local_port = 1;
+    JB_CHECK(snapshot.find(query).empty());
+}
+
+JB_TEST(frozen_snapshot_rejects_changes)
+{
+    auto snapshot = load(netsh_text);
+    JB_CHECK(snapshot.frozen());
+    JB_CHECK_THROWS(snapshot.add(firewall_rule()));
+    JB_CHECK_THROWS(snapshot.freeze());
+
+    firewall_rule_snapshot open;
+    JB_CHECK_THROWS(open.find(firewall_rule_query()));
+}
@@ -0,0 +1,180 @@
+﻿#include "test.hpp"
+
+#include "fleet.hpp"
+#include "snapshot.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+sid make_sid(std::wstring const & text)
+{
+    sid result;
+    if (!sid::parse(text, result))
+        throw std::runtime_error("Invalid test SID");
+    return result;
+}
+
+sid app_container(uint32_t const n)
+{
+    return make_sid(L"S-1-15-2-" + std::to_wstring(n) + L"-1-2-3-4-5-6");
+}
+
+// Host n has the containers 0 to n + 1, so container k is on hosts max(k - 1, 0) and up. Container
+// 2 is named like container 1. Host 2 has UAC off and allows inbound traffic on the private profile.
+class fleet_directory final
+{
+public:
+    static size_t const hosts = 4;
+
+    fleet_directory() :
+        path_(std::filesystem::temp_directory_path() / "NetFwTest.test.fleet")
+    {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+        for (uint32_t n = 0; n < hosts; ++n)
+        {
+            diagnostic_snapshot snapshot;
+            snapshot.present = diagnostic_snapshot::has_elevation_flags | diagnostic_snapshot::has_firewall | diagnostic_snapshot::has_app_containers;
+            snapshot.elevation_flags = n == 2 ? 0 : 1;
+            if (n == 2)
+                snapshot.firewall[1].inbound = NET_FW_ACTION_ALLOW;
+            for (uint32_t k = 0; k <= n + 1; ++k)
+            {
+                snapshot_app_container item;
+                item.app_container = app_container(k);
+                item.user = make_sid(L"S-1-5-21-1-2-3-1001");
+                item.name = L"package" + std::to_wstring(k == 2 ? 1 : k);
+                snapshot.app_containers.push_back(std::move(item));
+            }
+            write_snapshot(path_ / (L"host" + std::to_wstring(n) + L".snapshot"), snapshot);
+        }
+        std::ofstream(path_ / "broken.snapshot") << "not a snapshot";
+        std::ofstream(path_ / "notes.txt") << "ignored";
+    }
+
+    ~fleet_directory()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(path_, error);
+    }
+
+    std::filesystem::path const & path() const noexcept { return path_; }
+
+private:
+    std::filesystem::path const path_;
+};
+
+std::wstring query(fleet const & loaded, std::wstring_view const text)
+{
+    std::wostringstream out;
+    if (!loaded.query(out, text))
+        return L"<not a query>";
+    return out.str();
+}
+
+}
+
+JB_TEST(load_keeps_hosts_and_failures)
+{
+    fleet_directory const directory;
+    fleet loaded;
+    loaded.load(directory.path());
+    JB_CHECK(loaded.host_count() == fleet_directory::hosts);
+    JB_CHECK(loaded.failures().size() == 1 && loaded.failures()[0].name == L"broken");
+    JB_CHECK(loaded.find_host(L"host0") == 0);
+    JB_CHECK(loaded.find_host(L"host3") == 3);
+    JB_CHECK(loaded.find_host(L"broken") == loaded.host_count());
+    JB_CHECK(loaded.host_at(1).containers.size() == 3);
+    JB_CHECK(loaded.host_at(2).firewall != loaded.host_at(1).firewall);
+    JB_CHECK(loaded.host_at(0).firewall == loaded.host_at(3).firewall);
+    JB_CHECK(loaded.container_count() == fleet_directory::hosts + 1);
+}
+
+JB_TEST(containers_and_their_hosts)
+{
+    fleet_directory const directory;
+    fleet loaded;
+    loaded.load(directory.path());
+    for (uint32_t k = 0; k <= fleet_directory::hosts; ++k)
+    {
+        auto const found = loaded.find_containers(app_container(k).to_string());
+        JB_CHECK(found.size() == 1);
+        if (found.size() != 1)
+            continue;
+        auto const id = found[0];
+        JB_CHECK(loaded.container_sid(id) == app_container(k));
+        auto const first_host = k ? k - 1 : 0;
+        JB_CHECK(loaded.container_host_count(id) == fleet_directory::hosts - first_host);
+        auto const hosts = loaded.container_hosts(id);
+        for (size_t n = 0; n < loaded.container_host_count(id); ++n)
+            JB_CHECK(hosts[n] == first_host + n);
+    }
+    JB_CHECK(loaded.find_containers(L"package1").size() == 2);
+    JB_CHECK(loaded.find_containers(L"package9").empty());
+    JB_CHECK(loaded.find_containers(app_container(9).to_string()).empty());
+}
+
+JB_TEST(thread_count_does_not_change_the_result)
+{
+    fleet_directory const directory;
+    auto const placements = [&](unsigned const threads)
+        {
+            fleet loaded;
+            loaded.load(directory.path(), threads);
+            std::map<std::wstring, std::vector<uint32_t>> result;
+            for (size_t id = 0; id < loaded.container_count(); ++id)
+            {
+                auto const hosts = loaded.container_hosts(id);
+                result[loaded.container_sid(id).to_string()].assign(hosts, hosts + loaded.container_host_count(id));
+            }
+            return result;
+        };
+    auto const serial = placements(1);
+    JB_CHECK(serial.size() == fleet_directory::hosts + 1);
+    JB_CHECK(placements(3) == serial);
+    JB_CHECK(placements(16) == serial);
+}
+
+JB_TEST(container_ids_follow_file_order)
+{
+    fleet_directory const directory;
+    for (unsigned const threads : { 1u, 3u, 16u })
+    {
+        fleet loaded;
+        loaded.load(directory.path(), threads);
+        JB_CHECK(loaded.container_count() == fleet_directory::hosts + 1);
+        for (uint32_t k = 0; k < loaded.container_count(); ++k)
+        {
+            JB_CHECK(loaded.container_sid(k) == app_container(k));
+            JB_CHECK(loaded.container_name(k) == L"package" + std::to_wstring(k == 2 ? 1 : k));
+        }
+    }
+}
+
+JB_TEST(queries)
+{
+    fleet_directory const directory;
+    fleet loaded;
+    loaded.load(directory.path());
+    auto const summary = query(loaded, L"summary");
+    JB_CHECK(summary.find(L"Hosts: 4, 1 failed\n") == 0);
+    JB_CHECK(summary.find(L"Failed: broken: ") != std::wstring::npos);
+    JB_CHECK(summary.find(L"Containers: 5, 4 names, 14 placements\n") != std::wstring::npos);
+    JB_CHECK(query(loaded, L"host=host1").find(L"Host: host1: ") == 0);
+    JB_CHECK(query(loaded, L"host=missing") == L"Host: missing: not found\n");
+    JB_CHECK(query(loaded, L"container=package0").find(L"package0") != std::wstring::npos);
+    for (auto const text : { L"top", L"top=2", L"rare", L"rare=2", L"firewall", L"elevation" })
+        JB_CHECK(query(loaded, text) != L"<not a query>");
+    JB_CHECK(query(loaded, L"bogus") == L"<not a query>");
+    JB_CHECK(query(loaded, L"host") == L"<not a query>");
+    JB_CHECK_THROWS(query(loaded, L"top=x"));
+}
@@ -0,0 +1,88 @@
+﻿#include "test.hpp"
+
+#include "ip_address.hpp"
+
+#include <string>
+
+using namespace jb;
+
+namespace {
+
+std::wstring round_trip(std::wstring_view const & text)
+{
+    ip_address value;
+    return ip_address::parse(text, value) ? value.to_string() : L"<invalid>";
+}
+
+}
+
+JB_TEST(ipv4_parse_and_format)
+{
+    ip_address value;
+    JB_CHECK(ip_address::parse(L"192.168.1.20", value));
+    JB_CHECK(value.is_ipv4());
+    JB_CHECK(value.ipv4() == 0xC0A80114u);
+    JB_CHECK(value == ip_address::from_ipv4(0xC0A80114u));
+    JB_CHECK(round_trip(L"0.0.0.0") == L"0.0.0.0");
+    JB_CHECK(round_trip(L"255.255.255.255") == L"255.255.255.255");
+}
+
+JB_TEST(ipv4_rejects_malformed)
+{
+    ip_address value;
+    JB_CHECK(!ip_address::parse(L"", value));
+    JB_CHECK(!ip_address::parse(L"1.2.3", value));
+    JB_CHECK(!ip_address::parse(L"1.2.3.4.5", value));
+    JB_CHECK(!ip_address::parse(L"256.1.1.1", value));
+    JB_CHECK(!ip_address::parse(L"1..2.3", value));
+    JB_CHECK(!ip_address::parse(L"1.2.3.x", value));
+}
+
+JB_TEST(ipv6_canonical_form)
+{
+    JB_CHECK(round_trip(L"::1") == L"::1");
+    JB_CHECK(round_trip(L"::") == L"::");
+    JB_CHECK(round_trip(L"2001:0DB8:0000:0000:0000:0000:0000:0001") == L"2001:db8::1");
+    JB_CHECK(round_trip(L"2001:db8:0:1:0:0:0:1") == L"2001:db8:0:1::1");
+    JB_CHECK(round_trip(L"fe80::1:0:0:2") == L"fe80::1:0:0:2");
+    JB_CHECK(round_trip(L"::ffff:10.0.0.1") == L"10.0.0.1");
+}
+
+JB_TEST(ipv6_rejects_malformed)
+{
+    ip_address value;
+    JB_CHECK(!ip_address::parse(L"1::2::3", value));
+    JB_CHECK(!ip_address::parse(L"12345::", value));
+    JB_CHECK(!ip_address::parse(L"1:2:3:4:5:6:7:8:9", value));
+    JB_CHECK(!ip_address::parse(L"g::", value));
+}
+
+JB_TEST(ordering_and_masks)
+{
+    auto const v4 = ip_address::from_ipv4(0x0A000001u);
+    ip_address v6;
+    JB_CHECK(ip_address::parse(L"2001:db8::1", v6));
+    JB_CHECK(v4 < v6);
+    JB_CHECK(!(v6 < v4));
+    JB_CHECK(v4.next() == ip_address::from_ipv4(0x0A000002u));
+    JB_CHECK(ip_address::max().next() == ip_address::max());
+    JB_CHECK(v4.masked(96 + 8) == ip_address::from_ipv4(0x0A000000u));
+    JB_CHECK(v4.masked(96 + 8, true) == ip_address::from_ipv4(0x0AFFFFFFu));
+}
+
+JB_TEST(ranges)
+{
+    ip_range range;
+    JB_CHECK(parse_ip_range(L"10.0.0.0/8", range));
+    JB_CHECK(range.first == ip_address::from_ipv4(0x0A000000u) && range.last == ip_address::from_ipv4(0x0AFFFFFFu));
+    JB_CHECK(parse_ip_range(L"192.168.0.0/255.255.0.0", range));
+    JB_CHECK(range.last == ip_address::from_ipv4(0xC0A8FFFFu));
+    JB_CHECK(parse_ip_range(L"10.0.0.1-10.0.0.9", range));
+    JB_CHECK(range.first.ipv4() == 0x0A000001u && range.last.ipv4() == 0x0A000009u);
+    JB_CHECK(parse_ip_range(L"fe80::/10", range));
+    JB_CHECK(range.first.to_string() == L"fe80::");
+    JB_CHECK(!parse_ip_range(L"10.0.0.9-10.0.0.1", range));
+    JB_CHECK(!parse_ip_range(L"10.0.0.0/33", range));
+    JB_CHECK(!parse_ip_range(L"10.0.0.0/255.0.255.0", range));
+    JB_CHECK(!parse_ip_range(L"::/129", range));
+}
@@ -0,0 +1,82 @@
+﻿#include "test.hpp"
+
+#include "network_classifier.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+network_category classify(network_classifier const & classifier, std::wstring_view const & text)
+{
+    ip_address address;
+    if (!ip_address::parse(text, address))
+        throw std::runtime_error("Invalid test address");
+    return classifier.classify(address);
+}
+
+}
+
+JB_TEST(special_purpose_ranges)
+{
+    network_classifier const classifier;
+    JB_CHECK(classify(classifier, L"10.1.2.3") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"172.16.0.1") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"172.32.0.1") == network_category::internet);
+    JB_CHECK(classify(classifier, L"192.168.255.255") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"169.254.1.1") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"127.0.0.1") == network_category::loopback);
+    JB_CHECK(classify(classifier, L"0.0.0.0") == network_category::ambiguous);
+    JB_CHECK(classify(classifier, L"224.0.0.251") == network_category::ambiguous);
+    JB_CHECK(classify(classifier, L"8.8.8.8") == network_category::internet);
+    JB_CHECK(classify(classifier, L"::1") == network_category::loopback);
+    JB_CHECK(classify(classifier, L"fe80::1") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"fd00::1") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"ff02::1") == network_category::ambiguous);
+    JB_CHECK(classify(classifier, L"2606:4700::1111") == network_category::internet);
+}
+
+JB_TEST(configured_private_subnets)
+{
+    network_classifier classifier;
+    JB_CHECK(classifier.add_private_subnets(L"203.0.113.0/24, 198.51.100.10-198.51.100.20,2001:db8::/32"));
+    JB_CHECK(classify(classifier, L"203.0.113.77") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"203.0.114.1") == network_category::internet);
+    JB_CHECK(classify(classifier, L"198.51.100.15") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"198.51.100.21") == network_category::internet);
+    JB_CHECK(classify(classifier, L"2001:db8:1::1") == network_category::private_network);
+    JB_CHECK(classify(classifier, L"2001:db9::1") == network_category::internet);
+}
+
+JB_TEST(malformed_list_adds_nothing)
+{
+    network_classifier classifier;
+    auto const nodes = classifier.node_count();
+    JB_CHECK(!classifier.add_private_subnets(L"203.0.113.0/24,not-an-address"));
+    JB_CHECK(classifier.node_count() == nodes);
+    JB_CHECK(classify(classifier, L"203.0.113.77") == network_category::internet);
+}
+
+JB_TEST(longest_prefix_wins)
+{
+    network_classifier classifier;
+    ip_address prefix;
+    JB_CHECK(ip_address::parse(L"10.20.0.0", prefix));
+    classifier.add(prefix, 96 + 16, network_category::internet);
+    JB_CHECK(classify(classifier, L"10.20.30.40") == network_category::internet);
+    JB_CHECK(classify(classifier, L"10.21.30.40") == network_category::private_network);
+}
+
+JB_TEST(batch_matches_single)
+{
+    network_classifier const classifier;
+    std::vector<ip_address> addresses;
+    for (uint32_t n = 0; n < 4096; ++n)
+        addresses.push_back(ip_address::from_ipv4(n * 0x00100F01u));
+    std::vector<network_category> categories(addresses.size());
+    classifier.classify(addresses.data(), addresses.size(), categories.data());
+    for (size_t n = 0; n < addresses.size(); ++n)
+        JB_CHECK(categories[n] == classifier.classify(addresses[n]));
+}
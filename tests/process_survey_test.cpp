@@ -0,0 +1,244 @@
+﻿#include "test.hpp"
+
+#include "process_survey.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+sid parse(std::wstring const & text)
+{
+    sid result;
+    if (!sid::parse(text, result))
+        throw std::runtime_error("Invalid test SID");
+    return result;
+}
+
+// Processes with pids 4, 8, 12...: every third one denies access, every fourth one that doesn't
+// runs in one of two app containers with pid % 3 + 1 capabilities, the rest are medium integrity
+// and elevated when the pid is a multiple of 5. Token information is laid out in the buffer the
+// way GetTokenInformation does it. Throws from token_information for the process with pid throw_pid.
+class fake_source final : public process_source
+{
+public:
+    explicit fake_source(size_t const count, uint32_t const throw_pid = 0) : count_(count), throw_pid_(throw_pid) {}
+
+    status processes(std::vector<process_entry> & result) override
+    {
+        result.clear();
+        for (size_t n = 0; n < count_; ++n)
+        {
+            auto const pid = static_cast<uint32_t>(4 * (n + 1));
+            result.push_back({ pid, n ? pid - 4 : 0, in_container(pid) ? L"app.exe" : L"svchost.exe" });
+        }
+        return status();
+    }
+
+    status open_token(uint32_t const pid, HANDLE & token) override
+    {
+        if (denied(pid))
+            return status::win32(5);
+        ++open_;
+        token = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(pid));
+        return status();
+    }
+
+    status token_information(HANDLE const token, TOKEN_INFORMATION_CLASS const type, std::vector<uint8_t> & buffer) override
+    {
+        auto const pid = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(token));
+        if (pid == throw_pid_)
+            throw std::runtime_error("Token information failed");
+        auto const put = [&buffer](auto const & value)
+            {
+                buffer.resize(sizeof value);
+                std::memcpy(buffer.data(), &value, sizeof value);
+            };
+        // A header of header_size, then the SIDs it points to.
+        auto const layout = [&buffer](size_t const header_size, std::vector<sid> const & sids)
+            {
+                auto size = header_size;
+                for (auto const & value : sids)
+                    size += value.binary_size();
+                buffer.assign(size, 0);
+                std::vector<PSID> result;
+                size = header_size;
+                for (auto const & value : sids)
+                {
+                    std::memcpy(buffer.data() + size, value.data(), value.binary_size());
+                    result.push_back(buffer.data() + size);
+                    size += value.binary_size();
+                }
+                return result;
+            };
+
+        auto const container = in_container(pid);
+        switch (type)
+        {
+        case TokenElevationType:
+            put(pid % 5 ? TokenElevationTypeLimited : TokenElevationTypeFull);
+            break;
+
+        case TokenElevation:
+            put(TOKEN_ELEVATION{ pid % 5 == 0 });
+            break;
+
+        case TokenIntegrityLevel:
+        {
+            auto const pointers = layout(sizeof(TOKEN_MANDATORY_LABEL), { parse(L"S-1-16-" + std::to_wstring(container ? SECURITY_MANDATORY_LOW_RID : SECURITY_MANDATORY_MEDIUM_RID)) });
+            reinterpret_cast<TOKEN_MANDATORY_LABEL *>(buffer.data())->Label.Sid = pointers[0];
+            break;
+        }
+
+        case TokenIsAppContainer:
+            put(static_cast<DWORD>(container));
+            break;
+
+        case TokenAppContainerSid:
+        {
+            if (!container)
+            {
+                put(TOKEN_APPCONTAINER_INFORMATION{ nullptr });
+                break;
+            }
+            auto const pointers = layout(sizeof(TOKEN_APPCONTAINER_INFORMATION), { app_container(pid) });
+            reinterpret_cast<TOKEN_APPCONTAINER_INFORMATION *>(buffer.data())->TokenAppContainer = pointers[0];
+            break;
+        }
+
+        case TokenCapabilities:
+        {
+            std::vector<sid> sids;
+            for (uint32_t k = 0; container && k < pid % 3 + 1; ++k)
+                sids.push_back(parse(L"S-1-15-3-" + std::to_wstring(k + 1)));
+            auto const header_size = std::max(sizeof(TOKEN_GROUPS), offsetof(TOKEN_GROUPS, Groups) + sids.size() * sizeof(SID_AND_ATTRIBUTES));
+            auto const pointers = layout(header_size, sids);
+            auto & groups = *reinterpret_cast<TOKEN_GROUPS *>(buffer.data());
+            groups.GroupCount = static_cast<DWORD>(sids.size());
+            for (size_t n = 0; n < sids.size(); ++n)
+                groups.Groups[n].Sid = pointers[n];
+            break;
+        }
+
+        default:
+            return status::win32(87);
+        }
+        return status();
+    }
+
+    void close_token(HANDLE) noexcept override
+    {
+        ++closed_;
+    }
+
+    static bool denied(uint32_t const pid) noexcept { return pid / 4 % 3 == 0; }
+    static bool in_container(uint32_t const pid) noexcept { return !denied(pid) && pid / 4 % 4 == 0; }
+    static sid app_container(uint32_t const pid) { return parse(L"S-1-15-2-" + std::to_wstring(pid / 16 % 2) + L"-1000-2000"); }
+
+    size_t open() const noexcept { return open_.load(); }
+    size_t closed() const noexcept { return closed_.load(); }
+
+private:
+    size_t const count_;
+    uint32_t const throw_pid_;
+    std::atomic<size_t> open_{ 0 };
+    std::atomic<size_t> closed_{ 0 };
+};
+
+void check_table(process_table const & table, std::vector<process_entry> const & processes)
+{
+    JB_CHECK(table.size() == processes.size());
+    for (size_t n = 0; n < table.size(); ++n)
+    {
+        auto const pid = processes[n].pid;
+        JB_CHECK(table.pid(n) == pid);
+        JB_CHECK(table.parent_pid(n) == processes[n].parent_pid);
+        JB_CHECK(table.image(n) == processes[n].image);
+        if (fake_source::denied(pid))
+        {
+            JB_CHECK(!table.token_status(n) && table.token_status(n).code() == 5);
+            JB_CHECK(table.elevation_type(n) == process_table::unread);
+            JB_CHECK(table.elevated(n) == process_table::unread);
+            JB_CHECK(table.integrity(n) == process_table::unread);
+            JB_CHECK(!table.is_app_container(n) && table.capability_count(n) == 0);
+            continue;
+        }
+        JB_CHECK(table.token_status(n));
+        JB_CHECK(table.elevation_type(n) == uint32_t(pid % 5 ? TokenElevationTypeLimited : TokenElevationTypeFull));
+        JB_CHECK(table.elevated(n) == (pid % 5 == 0));
+        if (fake_source::in_container(pid))
+        {
+            JB_CHECK(table.integrity(n) == SECURITY_MANDATORY_LOW_RID);
+            JB_CHECK(table.is_app_container(n) && table.app_container(n) == fake_source::app_container(pid));
+            JB_CHECK(table.capability_count(n) == pid % 3 + 1);
+            for (size_t k = 0; k < table.capability_count(n); ++k)
+                JB_CHECK(table.capability(n, k) == parse(L"S-1-15-3-" + std::to_wstring(k + 1)));
+        }
+        else
+        {
+            JB_CHECK(table.integrity(n) == SECURITY_MANDATORY_MEDIUM_RID);
+            JB_CHECK(!table.is_app_container(n) && table.capability_count(n) == 0);
+        }
+    }
+}
+
+}
+
+JB_TEST(survey_reads_every_token)
+{
+    fake_source source(100);
+    std::vector<process_entry> processes;
+    JB_CHECK(source.processes(processes));
+    auto const table = survey_processes(source, processes, 1);
+    check_table(table, processes);
+    JB_CHECK(source.open() == source.closed());
+    // The empty SID, two containers and three capabilities; the empty string and two images.
+    JB_CHECK(table.sid_count() == 6);
+    JB_CHECK(table.string_count() == 3);
+}
+
+JB_TEST(survey_on_workers_matches_serial)
+{
+    fake_source source(1000);
+    std::vector<process_entry> processes;
+    source.processes(processes);
+    auto const serial = survey_processes(source, processes, 1);
+    for (unsigned const threads : { 0u, 2u, 7u, 64u })
+    {
+        auto const table = survey_processes(source, processes, threads);
+        check_table(table, processes);
+        JB_CHECK(table.sid_count() == serial.sid_count());
+        JB_CHECK(table.string_count() == serial.string_count());
+    }
+    JB_CHECK(source.open() == source.closed());
+}
+
+JB_TEST(survey_of_no_processes)
+{
+    fake_source source(0);
+    JB_CHECK(survey_processes(source, {}).size() == 0);
+}
+
+JB_TEST(survey_rethrows_worker_errors)
+{
+    fake_source source(100, 8);
+    std::vector<process_entry> processes;
+    source.processes(processes);
+    JB_CHECK_THROWS(survey_processes(source, processes, 4));
+    JB_CHECK(source.open() == source.closed());
+}
+
+JB_TEST(integrity_names)
+{
+    JB_CHECK(std::wstring(integrity_name(process_table::unread)) == L"unread");
+    JB_CHECK(std::wstring(integrity_name(SECURITY_MANDATORY_LOW_RID)) == L"low");
+    JB_CHECK(std::wstring(integrity_name(SECURITY_MANDATORY_MEDIUM_RID + 0x10)) == L"medium");
+    JB_CHECK(std::wstring(integrity_name(SECURITY_MANDATORY_SYSTEM_RID)) == L"system");
+    JB_CHECK(std::wstring(integrity_name(0)) == L"untrusted");
+}
@@ -0,0 +1,144 @@
+﻿#include "test.hpp"
+
+#include "registry_cache.hpp"
+#include "registry_memory.hpp"
+
+#include <string>
+
+using namespace jb;
+
+namespace {
+
+using memory_key_cache = basic_reg_key_cache<detail_registry::reg_backend_memory>;
+
+// Software\Key0 ... Software\Key<count - 1>, each with its index as the Index value.
+void load(reg_memory_hive & hive, uint32_t const count)
+{
+    for (uint32_t n = 0; n < count; ++n)
+        hive.add_value_DWORD(hive.add_key(L"Software\\Key" + std::to_wstring(n)), L"Index", n);
+    hive.freeze();
+}
+
+std::wstring key_path(uint32_t const n)
+{
+    return L"Software\\Key" + std::to_wstring(n);
+}
+
+}
+
+JB_TEST(cache_hit_after_miss)
+{
+    reg_memory_hive hive;
+    load(hive, 2);
+    memory_key_cache cache;
+    auto const root = cache.add_root(hive.root());
+
+    auto const & first = cache.open_key(root, key_path(1));
+    JB_CHECK(first.get_value_DWORD(L"Index") == 1);
+    JB_CHECK(cache.stats().misses == 1 && cache.stats().hits == 0);
+    auto const & second = cache.open_key(root, key_path(1));
+    JB_CHECK(&second == &first);
+    JB_CHECK(cache.stats().misses == 1 && cache.stats().hits == 1);
+    JB_CHECK(cache.size() == 1);
+}
+
+JB_TEST(cache_evicts_least_recently_used)
+{
+    reg_memory_hive hive;
+    load(hive, 4);
+    memory_key_cache cache(3);
+    auto const root = cache.add_root(hive.root());
+
+    cache.open_key(root, key_path(0));
+    cache.open_key(root, key_path(1));
+    cache.open_key(root, key_path(2));
+    // Key0 becomes the most recently used, so Key1 goes first.
+    cache.open_key(root, key_path(0));
+    cache.open_key(root, key_path(3));
+    JB_CHECK(cache.size() == 3 && cache.stats().evictions == 1);
+    auto const misses = cache.stats().misses;
+    cache.open_key(root, key_path(0));
+    cache.open_key(root, key_path(2));
+    JB_CHECK(cache.stats().misses == misses);
+    cache.open_key(root, key_path(1));
+    JB_CHECK(cache.stats().misses == misses + 1 && cache.stats().evictions == 2);
+    cache.open_key(root, key_path(3));
+    JB_CHECK(cache.stats().misses == misses + 2);
+}
+
+JB_TEST(cache_paths_are_case_folded)
+{
+    reg_memory_hive hive;
+    load(hive, 1);
+    memory_key_cache cache;
+    auto const root = cache.add_root(hive.root());
+
+    auto const & first = cache.open_key(root, L"Software\\Key0");
+    auto const & second = cache.open_key(root, L"SOFTWARE\\key0");
+    auto const & third = cache.open_key(root, L"\\software\\\\KEY0\\");
+    JB_CHECK(&second == &first && &third == &first);
+    JB_CHECK(cache.stats().misses == 1 && cache.stats().hits == 2);
+    JB_CHECK(cache.path_count() == 2);
+    // Another access mask is another entry.
+    cache.open_key(root, L"software\\key0", reg_access::read | reg_access::notify);
+    JB_CHECK(cache.stats().misses == 2 && cache.size() == 2);
+}
+
+JB_TEST(cache_resets_past_max_paths)
+{
+    reg_memory_hive hive;
+    load(hive, 8);
+    memory_key_cache cache(2, 4);
+    auto const root = cache.add_root(hive.root());
+
+    // Software plus three keys fill the path table, the next open drops it.
+    for (uint32_t n = 0; n < 3; ++n)
+        cache.open_key(root, key_path(n));
+    JB_CHECK(cache.path_count() == 4 && cache.stats().resets == 0);
+    cache.open_key(root, key_path(3));
+    JB_CHECK(cache.stats().resets == 1);
+    JB_CHECK(cache.path_count() == 2 && cache.size() == 1);
+    // Nothing cached before the reset is found after it.
+    auto const misses = cache.stats().misses;
+    JB_CHECK(cache.open_key(root, key_path(2)).get_value_DWORD(L"Index") == 2);
+    JB_CHECK(cache.stats().misses == misses + 1);
+}
+
+JB_TEST(cache_erase_forces_reopen)
+{
+    reg_memory_hive hive;
+    load(hive, 2);
+    memory_key_cache cache;
+    auto const root = cache.add_root(hive.root());
+
+    cache.open_key(root, key_path(0));
+    cache.open_key(root, key_path(1));
+    cache.erase(root, L"software\\KEY0");
+    JB_CHECK(cache.size() == 1);
+    // Erasing what isn't cached changes nothing.
+    cache.erase(root, key_path(5));
+    cache.erase(root, key_path(1), reg_access::read | reg_access::notify);
+    JB_CHECK(cache.size() == 1);
+
+    auto const misses = cache.stats().misses;
+    JB_CHECK(cache.open_key(root, key_path(0)).get_value_DWORD(L"Index") == 0);
+    JB_CHECK(cache.stats().misses == misses + 1);
+    cache.open_key(root, key_path(1));
+    JB_CHECK(cache.stats().misses == misses + 1);
+}
+
+JB_TEST(cache_try_open_missing_key)
+{
+    reg_memory_hive hive;
+    load(hive, 1);
+    memory_key_cache cache;
+    auto const root = cache.add_root(hive.root());
+
+    JB_CHECK(cache.try_open_key(root, L"Software\\Missing") == nullptr);
+    JB_CHECK(cache.size() == 0 && cache.stats().misses == 1);
+    JB_CHECK(cache.try_open_key(root, L"Software\\Missing") == nullptr);
+    JB_CHECK(cache.stats().misses == 2);
+    auto const key = cache.try_open_key(root, key_path(0));
+    JB_CHECK(key && key->get_value_DWORD(L"Index") == 0);
+    JB_CHECK_THROWS(cache.open_key(root, L"Software\\Missing"));
+}
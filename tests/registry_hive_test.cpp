@@ -0,0 +1,401 @@
+﻿#include "test.hpp"
+
+#include "registry_hive.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+// Lays out a regf image: the base block, then one hive bin with the cells. Offsets are relative to
+// the first bin, as in the file.
+class hive_builder final
+{
+public:
+    struct value
+    {
+        std::wstring name;
+        reg_type type;
+        std::vector<uint8_t> data;
+    };
+
+    enum class list_kind { lf, lh, li, ri };
+
+    hive_builder()
+    {
+        image_.resize(base_block_size + bin_header_size);
+        std::memcpy(image_.data(), "regf", 4);
+        std::memcpy(image_.data() + base_block_size, "hbin", 4);
+    }
+
+    // Adds a key cell with its values, subkeys given as key cell offsets, sorted or not as given.
+    uint32_t add_key(std::wstring const & name, std::vector<uint32_t> const & subkeys = {}, std::vector<value> const & values = {}, list_kind kind = list_kind::lh)
+    {
+        uint32_t list = ~uint32_t(0);
+        if (!subkeys.empty())
+            list = kind == list_kind::ri ? add_ri(subkeys) : add_leaf(subkeys, kind);
+        uint32_t value_list = ~uint32_t(0);
+        if (!values.empty())
+        {
+            std::vector<uint32_t> offsets;
+            for (auto const & item : values)
+                offsets.push_back(add_value(item));
+            value_list = reserve(static_cast<uint32_t>(offsets.size() * 4));
+            for (size_t n = 0; n < offsets.size(); ++n)
+                write_payload32(value_list, static_cast<uint32_t>(n * 4), offsets[n]);
+        }
+        auto const offset = reserve(76 + static_cast<uint32_t>(name.size()));
+        std::memcpy(payload(offset), "nk", 2);
+        write16(offset + 4 + 2, 0x0020);
+        write_payload32(offset, 20, static_cast<uint32_t>(subkeys.size()));
+        write_payload32(offset, 28, list);
+        write_payload32(offset, 36, static_cast<uint32_t>(values.size()));
+        write_payload32(offset, 40, value_list);
+        write16(offset + 4 + 72, static_cast<uint16_t>(name.size()));
+        for (size_t n = 0; n < name.size(); ++n)
+            payload(offset)[76 + n] = static_cast<uint8_t>(name[n]);
+        names_[offset] = name;
+        return offset;
+    }
+
+    // Finishes the image with root as the root key.
+    std::vector<uint8_t> build(uint32_t const root)
+    {
+        write32_raw(0x24, root);
+        write32_raw(0x28, static_cast<uint32_t>(image_.size() - base_block_size));
+        return image_;
+    }
+
+    // For corrupting cells after they were added.
+    void write32(uint32_t const offset, uint32_t const value) { write32_raw(base_block_size + offset, value); }
+    void write16(uint32_t const offset, uint16_t const value) { image_[base_block_size + offset] = uint8_t(value); image_[base_block_size + offset + 1] = uint8_t(value >> 8); }
+
+    // The payload of a cell starts 4 bytes after its offset.
+    uint8_t * payload(uint32_t const offset) { return image_.data() + base_block_size + offset + 4; }
+    void write_payload32(uint32_t const offset, uint32_t const at, uint32_t const value) { write32(offset + 4 + at, value); }
+    uint32_t read_payload32(uint32_t const offset, uint32_t const at)
+    {
+        auto const ptr = payload(offset) + at;
+        return uint32_t(ptr[0]) | uint32_t(ptr[1]) << 8 | uint32_t(ptr[2]) << 16 | uint32_t(ptr[3]) << 24;
+    }
+
+private:
+    static size_t const base_block_size = 0x1000;
+    static size_t const bin_header_size = 32;
+
+    void write32_raw(size_t const pos, uint32_t const value)
+    {
+        for (size_t n = 0; n < 4; ++n)
+            image_[pos + n] = static_cast<uint8_t>(value >> (8 * n));
+    }
+
+    // Allocates a cell and returns its offset; the payload follows the 4-byte negative size.
+    uint32_t reserve(uint32_t const payload_size)
+    {
+        auto const size = (payload_size + 4 + 7) & ~uint32_t(7);
+        auto const offset = static_cast<uint32_t>(image_.size() - base_block_size);
+        image_.resize(image_.size() + size);
+        write32_raw(base_block_size + offset, static_cast<uint32_t>(-int32_t(size)));
+        return offset;
+    }
+
+    static uint32_t hash(std::wstring const & name)
+    {
+        uint32_t result = 0;
+        for (auto const ch : name)
+            result = result * 37 + reg_upcase(ch);
+        return result;
+    }
+
+    uint32_t add_leaf(std::vector<uint32_t> const & subkeys, list_kind const kind)
+    {
+        auto const stride = kind == list_kind::li ? 4u : 8u;
+        auto const offset = reserve(4 + static_cast<uint32_t>(subkeys.size()) * stride);
+        payload(offset)[0] = 'l';
+        payload(offset)[1] = kind == list_kind::lf ? 'f' : kind == list_kind::lh ? 'h' : 'i';
+        write16(offset + 4 + 2, static_cast<uint16_t>(subkeys.size()));
+        for (size_t n = 0; n < subkeys.size(); ++n)
+        {
+            write_payload32(offset, 4 + static_cast<uint32_t>(n) * stride, subkeys[n]);
+            if (kind == list_kind::lh)
+                write_payload32(offset, 8 + static_cast<uint32_t>(n) * stride, hash(names_.at(subkeys[n])));
+            else if (kind == list_kind::lf)
+            {
+                uint32_t hint = 0;
+                auto const & name = names_.at(subkeys[n]);
+                for (size_t k = 0; k < std::min<size_t>(4, name.size()); ++k)
+                    hint |= uint32_t(uint8_t(name[k])) << (8 * k);
+                write_payload32(offset, 8 + static_cast<uint32_t>(n) * stride, hint);
+            }
+        }
+        return offset;
+    }
+
+    // Two lh leaves, split in the middle.
+    uint32_t add_ri(std::vector<uint32_t> const & subkeys)
+    {
+        auto const middle = subkeys.begin() + subkeys.size() / 2;
+        uint32_t const leaves[] = { add_leaf({ subkeys.begin(), middle }, list_kind::lh), add_leaf({ middle, subkeys.end() }, list_kind::lh) };
+        auto const offset = reserve(4 + 2 * 4);
+        payload(offset)[0] = 'r';
+        payload(offset)[1] = 'i';
+        write16(offset + 4 + 2, 2);
+        write_payload32(offset, 4, leaves[0]);
+        write_payload32(offset, 8, leaves[1]);
+        return offset;
+    }
+
+    uint32_t add_value(value const & item)
+    {
+        auto const size = static_cast<uint32_t>(item.data.size());
+        uint32_t data_offset = 0;
+        if (size > 4)
+        {
+            data_offset = reserve(size);
+            std::copy(item.data.begin(), item.data.end(), payload(data_offset));
+        }
+        auto const offset = reserve(20 + static_cast<uint32_t>(item.name.size()));
+        std::memcpy(payload(offset), "vk", 2);
+        write16(offset + 4 + 2, static_cast<uint16_t>(item.name.size()));
+        write_payload32(offset, 4, size <= 4 ? size | 0x80000000u : size);
+        if (size <= 4)
+            std::copy(item.data.begin(), item.data.end(), payload(offset) + 8);
+        else
+            write_payload32(offset, 8, data_offset);
+        write_payload32(offset, 12, static_cast<uint32_t>(item.type));
+        write16(offset + 4 + 16, 0x0001);
+        for (size_t n = 0; n < item.name.size(); ++n)
+            payload(offset)[20 + n] = static_cast<uint8_t>(item.name[n]);
+        return offset;
+    }
+
+    std::vector<uint8_t> image_;
+    std::unordered_map<uint32_t, std::wstring> names_;
+};
+
+hive_builder::value sz(std::wstring const & name, std::wstring const & text)
+{
+    std::vector<uint8_t> data;
+    for (auto const ch : text + L'\0')
+    {
+        data.push_back(static_cast<uint8_t>(ch));
+        data.push_back(static_cast<uint8_t>(ch >> 8));
+    }
+    return { name, reg_type::sz, data };
+}
+
+hive_builder::value dword(std::wstring const & name, uint32_t const number)
+{
+    return { name, reg_type::dword, { uint8_t(number), uint8_t(number >> 8), uint8_t(number >> 16), uint8_t(number >> 24) } };
+}
+
+// Sorted names, as the upper-cased names order them.
+std::vector<std::wstring> key_names(size_t const count)
+{
+    std::vector<std::wstring> result;
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto name = std::to_wstring(n);
+        result.push_back(L"Key" + std::wstring(4 - name.size(), L'0') + name);
+    }
+    return result;
+}
+
+// Root with Lh (sorted lh list of many keys with values), Lf, Li (unsorted li) and Ri (ri of two lh
+// leaves) subkeys.
+std::vector<uint8_t> make_hive(hive_builder & builder, size_t const count, std::vector<uint32_t> * const lh_children = nullptr)
+{
+    auto const names = key_names(count);
+    std::vector<uint32_t> children;
+    for (auto const & name : names)
+        children.push_back(builder.add_key(name, {}, { sz(L"Moniker", L"moniker of " + name), dword(L"Index", static_cast<uint32_t>(children.size())) }));
+    if (lh_children)
+        *lh_children = children;
+    auto const lh = builder.add_key(L"Lh", children, {}, hive_builder::list_kind::lh);
+    auto const lf = builder.add_key(L"Lf", { builder.add_key(L"alpha"), builder.add_key(L"Beta"), builder.add_key(L"gamma") }, {}, hive_builder::list_kind::lf);
+    auto const li = builder.add_key(L"Li", { builder.add_key(L"zeta"), builder.add_key(L"Alpha"), builder.add_key(L"mu") }, {}, hive_builder::list_kind::li);
+    auto const ri = builder.add_key(L"Ri", children, {}, hive_builder::list_kind::ri);
+    auto const root = builder.add_key(L"ROOT", { lf, lh, li, ri }, { dword(L"Version", 7) });
+    return builder.build(root);
+}
+
+std::vector<std::wstring> enumerate(reg_hive_key const & key)
+{
+    std::vector<std::wstring> result;
+    for (auto const & name : key.keys())
+        result.emplace_back(name);
+    return result;
+}
+
+}
+
+JB_TEST(open_and_lookup)
+{
+    hive_builder builder;
+    auto const image = make_hive(builder, 300);
+    reg_hive_file hive;
+    hive.attach(image.data(), image.size());
+    auto const root = hive.root();
+    JB_CHECK(root.get_value_DWORD(L"version") == 7);
+    for (auto const list : { L"Lh", L"Ri" })
+        for (auto const & name : key_names(300))
+        {
+            auto const key = root.open_key(std::wstring(list) + L"\\" + name);
+            JB_CHECK(key.get_value_SZ(L"Moniker") == L"moniker of " + name);
+        }
+    JB_CHECK(root.open_key(L"lh\\KEY0123").get_value_DWORD(L"INDEX") == 123);
+    JB_CHECK(root.open_key(L"LF\\BETA"));
+    JB_CHECK(root.open_key(L"Lf\\Alpha"));
+    JB_CHECK(root.open_key(L"Lf\\gamma"));
+    JB_CHECK(root.open_key(L"Li\\ALPHA"));
+    JB_CHECK(root.open_key(L"Li\\Zeta"));
+    for (auto const missing : { L"Lh\\Key", L"Lh\\Key0300", L"Lh\\Key01234", L"Lh\\A", L"Lh\\Zzz", L"Lf\\delta", L"Li\\nu", L"Ri\\Key9999", L"Nope" })
+        JB_CHECK(!root.try_open_key(missing));
+}
+
+JB_TEST(open_from_file)
+{
+    hive_builder builder;
+    auto const image = make_hive(builder, 10);
+    auto const path = std::filesystem::temp_directory_path() / "NetFwTest.test.hive";
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<char const *>(image.data()), static_cast<std::streamsize>(image.size()));
+    {
+        reg_hive_file hive;
+        hive.open(path.wstring().c_str());
+        JB_CHECK(hive.root().open_key(L"Lh\\Key0009").get_value_DWORD(L"Index") == 9);
+    }
+    std::filesystem::remove(path);
+    reg_hive_file hive;
+    JB_CHECK_THROWS(hive.open(path.wstring().c_str()));
+}
+
+JB_TEST(enumeration_in_list_order)
+{
+    hive_builder builder;
+    auto const image = make_hive(builder, 1000);
+    reg_hive_file hive;
+    hive.attach(image.data(), image.size());
+    auto const root = hive.root();
+    JB_CHECK(enumerate(root) == std::vector<std::wstring>({ L"Lf", L"Lh", L"Li", L"Ri" }));
+    JB_CHECK(enumerate(root.open_key(L"Lh")) == key_names(1000));
+    JB_CHECK(enumerate(root.open_key(L"Ri")) == key_names(1000));
+    JB_CHECK(enumerate(root.open_key(L"Li")) == std::vector<std::wstring>({ L"zeta", L"Alpha", L"mu" }));
+    JB_CHECK(root.open_key(L"Lh").get_subkey_values_SZ(L"Moniker", 4).size() == 1000);
+    // Once more through the same handle, from the collected subkeys.
+    auto const lh = root.open_key(L"Lh");
+    JB_CHECK(enumerate(lh) == enumerate(lh));
+}
+
+JB_TEST(malformed_cells_are_bad_db)
+{
+    {
+        // A subkey offset past the end of the hive.
+        hive_builder builder;
+        std::vector<uint32_t> children;
+        make_hive(builder, 10, &children);
+        auto const key = builder.add_key(L"Broken", { children[0], children[1], children[2] }, {}, hive_builder::list_kind::lh);
+        builder.write_payload32(builder.read_payload32(key, 28), 4 + 8, 0x7FFFFF00u);
+        auto const image = builder.build(key);
+        reg_hive_file hive;
+        hive.attach(image.data(), image.size());
+        auto const root = hive.root();
+        std::vector<std::wstring> names;
+        JB_CHECK_THROWS(for (auto const & name : root.keys()) names.emplace_back(name));
+        JB_CHECK(!root.try_open_key(L"Key0009"));
+        JB_CHECK(!root.try_open_key(L"Key0002"));
+    }
+    {
+        // A list count larger than its cell.
+        hive_builder builder;
+        std::vector<uint32_t> children;
+        make_hive(builder, 10, &children);
+        auto const key = builder.add_key(L"Broken", { children[0], children[1] }, {}, hive_builder::list_kind::lh);
+        builder.write16(builder.read_payload32(key, 28) + 4 + 2, 5000);
+        auto const image = builder.build(key);
+        reg_hive_file hive;
+        hive.attach(image.data(), image.size());
+        JB_CHECK_THROWS(enumerate(hive.root()));
+        JB_CHECK(!hive.root().try_open_key(L"Key0000"));
+    }
+    {
+        // A key name longer than its cell.
+        hive_builder builder;
+        auto const key = builder.add_key(L"Child");
+        auto const root = builder.add_key(L"ROOT", { key });
+        builder.write16(key + 4 + 72, 4000);
+        auto const image = builder.build(root);
+        reg_hive_file hive;
+        hive.attach(image.data(), image.size());
+        JB_CHECK(!hive.root().try_open_key(L"Child"));
+        JB_CHECK_THROWS(enumerate(hive.root()));
+    }
+    {
+        // A value data offset past the end.
+        hive_builder builder;
+        auto const root = builder.add_key(L"ROOT", {}, { sz(L"Long", L"long enough to have a data cell") });
+        auto const value = builder.read_payload32(builder.read_payload32(root, 40), 0);
+        builder.write_payload32(value, 8, 0x7FFFFF00u);
+        auto const image = builder.build(root);
+        reg_hive_file hive;
+        hive.attach(image.data(), image.size());
+        JB_CHECK_THROWS(hive.root().get_value_SZ(L"Long"));
+    }
+    {
+        // A value count whose list size wraps around 32 bits.
+        hive_builder builder;
+        auto const root = builder.add_key(L"ROOT", {}, { dword(L"Version", 7) });
+        builder.write_payload32(root, 36, 0x40000001u);
+        auto const image = builder.build(root);
+        reg_hive_file hive;
+        hive.attach(image.data(), image.size());
+        JB_CHECK_THROWS(hive.root().get_value_DWORD(L"Version"));
+        std::vector<std::wstring> names;
+        JB_CHECK_THROWS(for (auto const & name : hive.root().values()) names.emplace_back(name));
+    }
+    {
+        // A subkey count far beyond its list, which must not size the subkey index.
+        hive_builder builder;
+        std::vector<uint32_t> children;
+        make_hive(builder, 10, &children);
+        auto const key = builder.add_key(L"Broken", { children[0], children[1] }, {}, hive_builder::list_kind::lh);
+        builder.write_payload32(key, 20, 0xFFFFFFF0u);
+        auto const image = builder.build(key);
+        reg_hive_file hive;
+        hive.attach(image.data(), image.size());
+        JB_CHECK(hive.root().try_open_key(L"Key0001"));
+        std::vector<std::wstring> names;
+        try
+        {
+            for (auto const & name : hive.root().keys())
+                names.emplace_back(name);
+        }
+        catch (std::runtime_error const &)
+        {
+        }
+        JB_CHECK(names.size() == 2);
+    }
+}
+
+JB_TEST(malformed_files_throw)
+{
+    hive_builder builder;
+    auto image = make_hive(builder, 10);
+    reg_hive_file hive;
+    JB_CHECK_THROWS(hive.attach(image.data(), 100));
+    auto bad_signature = image;
+    bad_signature[0] = 'x';
+    JB_CHECK_THROWS(hive.attach(bad_signature.data(), bad_signature.size()));
+    auto bad_root = image;
+    bad_root[0x24] = 0xF0;
+    bad_root[0x25] = 0xFF;
+    bad_root[0x26] = 0xFF;
+    JB_CHECK_THROWS(hive.attach(bad_root.data(), bad_root.size()));
+}
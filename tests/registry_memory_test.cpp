@@ -0,0 +1,151 @@
+﻿#include "test.hpp"
+
+#include "appcontainer_mapping.hpp"
+#include "registry_memory.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+wchar_t const fixture[] =
+    L"Windows Registry Editor Version 5.00\n"
+    L"\n"
+    L"; Mappings as regedit exports them\n"
+    L"[Software\\Mappings\\S-1-15-2-1]\n"
+    L"\"DisplayName\"=\"Calculator\"\n"
+    L"\"Moniker\"=\"microsoft.windowscalculator_8wekyb3d8bbwe\"\n"
+    L"\"Flags\"=dword:0000002a\n"
+    L"\"Blob\"=hex:01,02,\\\n"
+    L"  03\n"
+    L"\n"
+    L"[Software\\Mappings\\s-1-15-2-3]\n"
+    L"\"Moniker\"=\"contoso.app\"\n"
+    L"\"Description\"=\"Contoso\"\n"
+    L"\n"
+    L"[Software\\Mappings\\S-1-15-2-2]\n"
+    L"\"DisplayName\"=\"Photos\"\n"
+    L"\n"
+    L"[Software\\Ключ]\n"
+    L"@=\"default\"\n";
+
+void load(reg_memory_hive & hive)
+{
+    std::wistringstream in(fixture);
+    hive.load(in);
+    hive.freeze();
+}
+
+}
+
+JB_TEST(lookup_is_case_insensitive)
+{
+    reg_memory_hive hive;
+    load(hive);
+    auto const root = hive.root();
+    auto const key = root.open_key(L"SOFTWARE\\mappings\\s-1-15-2-1");
+    JB_CHECK(key.get_value_SZ(L"displayname") == L"Calculator");
+    JB_CHECK(key.get_value_DWORD(L"FLAGS") == 42);
+    JB_CHECK(root.open_key(L"software\\клЮЧ").get_value_SZ(L"") == L"default");
+    // Paths keep the spelling they were opened with, enumeration the first spelling loaded.
+    JB_CHECK(key.path() == L"SOFTWARE\\mappings\\s-1-15-2-1");
+    JB_CHECK(root.open_key(L"software").get_key_names() == std::vector<std::wstring>({ L"Mappings", L"Ключ" }));
+}
+
+JB_TEST(missing_keys_and_values)
+{
+    reg_memory_hive hive;
+    load(hive);
+    auto const root = hive.root();
+    JB_CHECK(!root.try_open_key(L"Software\\Missing"));
+    JB_CHECK(!root.open_key(L"Software\\Missing", false));
+    JB_CHECK_THROWS(root.open_key(L"Software\\Missing"));
+    auto const key = root.open_key(L"Software\\Mappings\\S-1-15-2-2");
+    JB_CHECK(!key.try_get_value_SZ(L"Moniker"));
+    JB_CHECK_THROWS(key.get_value_SZ(L"Moniker"));
+    // A DWORD read as a string is a type mismatch, not a missing value.
+    JB_CHECK_THROWS(root.open_key(L"Software\\Mappings\\S-1-15-2-1").get_value_SZ(L"Flags"));
+}
+
+JB_TEST(enumeration_is_sorted)
+{
+    reg_memory_hive hive;
+    load(hive);
+    auto const mappings = hive.root().open_key(L"Software\\Mappings");
+    std::vector<std::wstring> names;
+    for (auto const & name : mappings.keys())
+        names.emplace_back(name);
+    JB_CHECK(names == std::vector<std::wstring>({ L"S-1-15-2-1", L"S-1-15-2-2", L"s-1-15-2-3" }));
+    JB_CHECK(mappings.open_key(L"S-1-15-2-1").get_value_names() == std::vector<std::wstring>({ L"Blob", L"DisplayName", L"Flags", L"Moniker" }));
+}
+
+JB_TEST(subkey_values)
+{
+    reg_memory_hive hive;
+    load(hive);
+    auto const values = hive.root().open_key(L"Software\\Mappings").get_subkey_values_SZ(L"Moniker");
+    JB_CHECK(values.size() == 3);
+    JB_CHECK(values.found(0) && values.value(0) == L"microsoft.windowscalculator_8wekyb3d8bbwe");
+    JB_CHECK(!values.found(1));
+    JB_CHECK(values.found(2) && values.name(2) == L"s-1-15-2-3" && values.value(2) == L"contoso.app");
+}
+
+JB_TEST(duplicate_value_replaces)
+{
+    reg_memory_hive hive;
+    auto const key = hive.add_key(L"Software\\Duplicate");
+    hive.add_value_SZ(key, L"Moniker", L"first");
+    hive.add_value_DWORD(key, L"Flags", 1);
+    hive.add_value_SZ(key, L"MONIKER", L"second");
+    hive.add_value_DWORD(hive.add_key(L"Software\\Other"), L"Flags", 2);
+    std::wistringstream in(L"[Software\\Duplicate]\n\"Flags\"=dword:00000003\n");
+    hive.load(in);
+    hive.freeze();
+    JB_CHECK(hive.value_count() == 3);
+    auto const duplicate = hive.root().open_key(L"Software\\Duplicate");
+    JB_CHECK(duplicate.get_value_names() == std::vector<std::wstring>({ L"Flags", L"Moniker" }));
+    JB_CHECK(duplicate.get_value_SZ(L"Moniker") == L"second");
+    JB_CHECK(duplicate.get_value_DWORD(L"Flags") == 3);
+    JB_CHECK(hive.root().open_key(L"Software\\Other").get_value_DWORD(L"Flags") == 2);
+}
+
+JB_TEST(schema_read)
+{
+    reg_memory_hive hive;
+    load(hive);
+    auto const mapping = read_schema<appcontainer_mapping>(hive.root().open_key(L"Software\\Mappings\\S-1-15-2-3"));
+    JB_CHECK(!mapping.display_name);
+    JB_CHECK(mapping.description && *mapping.description == L"Contoso");
+    JB_CHECK(mapping.moniker && *mapping.moniker == L"contoso.app");
+}
+
+JB_TEST(frozen_and_malformed_fixtures)
+{
+    reg_memory_hive hive;
+    load(hive);
+    JB_CHECK_THROWS(hive.add_key(L"Software\\Late"));
+
+    reg_memory_hive unterminated;
+    std::wistringstream key_line(L"[Software\\Broken\n");
+    JB_CHECK_THROWS(unterminated.load(key_line));
+
+    reg_memory_hive orphan;
+    std::wistringstream value_line(L"\"Name\"=\"value\"\n");
+    JB_CHECK_THROWS(orphan.load(value_line));
+}
+
+JB_TEST(ordinal_upper_case)
+{
+    JB_CHECK(reg_upcase(L'a') == L'A');
+    JB_CHECK(reg_upcase(L'Z') == L'Z');
+    JB_CHECK(reg_upcase(0x00FF) == 0x0178);
+    JB_CHECK(reg_upcase(0x0105) == 0x0104);
+    JB_CHECK(reg_upcase(0x0104) == 0x0104);
+    JB_CHECK(reg_upcase(0x03C2) == 0x03A3);
+    JB_CHECK(reg_upcase(0x0447) == 0x0427);
+    JB_CHECK(compare_reg_name(L"Moniker", L"MONIKER") == 0);
+    JB_CHECK(compare_reg_name(L"A", L"b") < 0);
+}
@@ -0,0 +1,82 @@
+﻿#include "test.hpp"
+
+#include "sid_join.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+sid app_container(uint32_t const n)
+{
+    sid result;
+    if (!sid::parse(L"S-1-15-2-" + std::to_wstring(n) + L"-1000-2000-3000-4000-5000-6000", result))
+        throw std::runtime_error("Invalid test SID");
+    return result;
+}
+
+}
+
+JB_TEST(index_finds_first_occurrence)
+{
+    std::vector<sid> const keys = { app_container(1), app_container(2), app_container(1), app_container(3) };
+    sid_index const index(keys.data(), keys.size());
+    JB_CHECK(index.find(app_container(1)) == 0);
+    JB_CHECK(index.find(app_container(2)) == 1);
+    JB_CHECK(index.find(app_container(3)) == 3);
+    JB_CHECK(index.find(app_container(4)) == sid_index::npos);
+    JB_CHECK(index.duplicates() == 1);
+}
+
+JB_TEST(empty_sides)
+{
+    std::vector<sid> const keys = { app_container(1), app_container(2) };
+    auto const left = join_sids(keys.data(), keys.size(), nullptr, 0);
+    JB_CHECK(left.matched.empty() && left.right_only.empty());
+    JB_CHECK((left.left_only == std::vector<uint32_t>{ 0, 1 }));
+    auto const right = join_sids(nullptr, 0, keys.data(), keys.size());
+    JB_CHECK(right.matched.empty() && right.left_only.empty());
+    JB_CHECK((right.right_only == std::vector<uint32_t>{ 0, 1 }));
+}
+
+JB_TEST(join_keeps_order_and_counts_duplicates)
+{
+    std::vector<sid> const left = { app_container(1), app_container(2), app_container(3), app_container(2), app_container(4) };
+    std::vector<sid> const right = { app_container(4), app_container(9), app_container(1), app_container(9), app_container(1) };
+    auto const result = join_sids(left.data(), left.size(), right.data(), right.size());
+    std::vector<std::pair<uint32_t, uint32_t>> const matched = { { 0, 2 }, { 4, 0 } };
+    JB_CHECK(result.matched == matched);
+    JB_CHECK((result.left_only == std::vector<uint32_t>{ 1, 2 }));
+    JB_CHECK((result.right_only == std::vector<uint32_t>{ 1 }));
+    JB_CHECK(result.left_duplicates == 1);
+    JB_CHECK(result.right_duplicates == 2);
+}
+
+JB_TEST(large_join_accounts_for_every_position)
+{
+    // Every third left SID is exempt on the right, which also has SIDs of its own and repeats.
+    std::vector<sid> left, right;
+    for (uint32_t n = 0; n < 100000; ++n)
+    {
+        left.push_back(app_container(n));
+        if (n % 3 == 0)
+            right.push_back(app_container(n));
+    }
+    for (uint32_t n = 0; n < 1000; ++n)
+    {
+        right.push_back(app_container(1000000 + n));
+        right.push_back(app_container(n * 3));
+    }
+    auto const result = join_sids(left.data(), left.size(), right.data(), right.size());
+    JB_CHECK(result.matched.size() == 33334);
+    JB_CHECK(result.left_only.size() == 100000 - 33334);
+    JB_CHECK(result.right_only.size() == 1000);
+    JB_CHECK(result.right_duplicates == 1000);
+    JB_CHECK(result.left_duplicates == 0);
+    for (auto const & item : result.matched)
+        JB_CHECK(left[item.first] == right[item.second]);
+}
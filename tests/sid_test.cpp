@@ -0,0 +1,138 @@
+﻿#include "test.hpp"
+
+#include "sid.hpp"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+std::wstring round_trip(std::wstring_view const & text)
+{
+    sid value;
+    return sid::parse(text, value) ? value.to_string() : L"<invalid>";
+}
+
+// S-1-15-2 app container SIDs as packages get them, seven random sub-authorities.
+std::vector<sid> make_app_containers(size_t const count, uint64_t const seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<sid> result;
+    result.reserve(count);
+    for (size_t n = 0; n < count; ++n)
+    {
+        uint8_t binary[sid::header_size + 8 * sizeof(uint32_t)] = { 1, 8, 0, 0, 0, 0, 0, 15 };
+        uint32_t const sub_authorities[8] = { 2, uint32_t(random()), uint32_t(random()), uint32_t(random()), uint32_t(random()), uint32_t(random()), uint32_t(random()), uint32_t(random()) };
+        for (size_t k = 0; k < 8; ++k)
+            for (size_t b = 0; b < sizeof(uint32_t); ++b)
+                binary[sid::header_size + k * sizeof(uint32_t) + b] = static_cast<uint8_t>(sub_authorities[k] >> (8 * b));
+        result.push_back(sid::from_binary(binary, sizeof binary));
+    }
+    return result;
+}
+
+}
+
+JB_TEST(text_round_trip)
+{
+    JB_CHECK(round_trip(L"S-1-5-18") == L"S-1-5-18");
+    JB_CHECK(round_trip(L"S-1-5") == L"S-1-5");
+    JB_CHECK(round_trip(L"S-1-15-2-1861897761-1695161497-2927542615-642690995-327840285-2659745135-2630312742") == L"S-1-15-2-1861897761-1695161497-2927542615-642690995-327840285-2659745135-2630312742");
+    JB_CHECK(round_trip(L"S-1-0x000000000010-4096") == L"S-1-16-4096");
+    JB_CHECK(round_trip(L"S-1-0x123456789abc-1") == L"S-1-0x123456789abc-1");
+    JB_CHECK(round_trip(L"S-1-5-4294967295") == L"S-1-5-4294967295");
+    JB_CHECK(round_trip(L"S-1-5-1-2-3-4-5-6-7-8-9-10-11-12-13-14-15") == L"S-1-5-1-2-3-4-5-6-7-8-9-10-11-12-13-14-15");
+}
+
+JB_TEST(text_rejects_malformed)
+{
+    for (auto const text : {
+        L"", L"S", L"S-", L"S-1", L"s-1-5-18", L"S-2-5-18", L"S-1--18", L"S-1-5-", L"S-1-5-18-", L"S-1-5-x",
+        L"S-1-5-4294967296", L"S-1-281474976710656-1", L"S-1-5-1-2-3-4-5-6-7-8-9-10-11-12-13-14-15-16" })
+        JB_CHECK(round_trip(text) == L"<invalid>");
+}
+
+JB_TEST(binary_round_trip)
+{
+    uint8_t const binary[] = { 1, 2, 0, 0, 0, 0, 0, 5, 32, 0, 0, 0, 0x20, 0x02, 0, 0 };
+    auto const value = sid::from_binary(binary, sizeof binary);
+    JB_CHECK(value.to_string() == L"S-1-5-32-544");
+    JB_CHECK(value.binary_size() == sizeof binary);
+    JB_CHECK(std::equal(binary, binary + sizeof binary, value.data()));
+    JB_CHECK(value.identifier_authority() == 5 && value.sub_authority_count() == 2 && value.sub_authority(1) == 544);
+
+    sid parsed;
+    JB_CHECK(sid::parse(L"S-1-5-32-544", parsed) && parsed == value);
+
+    sid rejected;
+    JB_CHECK(!sid::parse(binary, sizeof binary - 1, rejected));
+    JB_CHECK(!sid::parse(binary, 7, rejected));
+    uint8_t bad_revision[sizeof binary];
+    std::copy(binary, binary + sizeof binary, bad_revision);
+    bad_revision[0] = 2;
+    JB_CHECK(!sid::parse(bad_revision, sizeof bad_revision, rejected));
+    JB_CHECK_THROWS(sid::from_binary(bad_revision, sizeof bad_revision));
+}
+
+JB_TEST(stream_output)
+{
+    sid value;
+    JB_CHECK(sid::parse(L"S-1-15-3-1024-1", value));
+    std::wostringstream out;
+    out << value;
+    JB_CHECK(out.str() == L"S-1-15-3-1024-1");
+}
+
+JB_TEST(ordering_follows_the_binary_form)
+{
+    // A shorter SID sorts before a longer one with the same prefix; otherwise the bytes decide.
+    std::vector<sid> values;
+    for (auto const text : { L"S-1-5-18", L"S-1-5-32-544", L"S-1-5-32-545", L"S-1-15-2-1", L"S-1-5", L"S-1-16-4096", L"S-1-5-32" })
+    {
+        sid value;
+        JB_CHECK(sid::parse(text, value));
+        values.push_back(value);
+    }
+    auto const random = make_app_containers(1000, 1);
+    values.insert(values.end(), random.begin(), random.end());
+    std::sort(values.begin(), values.end());
+    for (size_t n = 1; n < values.size(); ++n)
+    {
+        auto const & left = values[n - 1];
+        auto const & right = values[n];
+        JB_CHECK(!(right < left));
+        auto const size = std::min(left.binary_size(), right.binary_size());
+        auto const compared = std::lexicographical_compare(left.data(), left.data() + size, right.data(), right.data() + size);
+        JB_CHECK(compared || (std::equal(left.data(), left.data() + size, right.data()) && left.binary_size() <= right.binary_size()));
+    }
+    sid a, b;
+    JB_CHECK(sid::parse(L"S-1-5-32", a) && sid::parse(L"S-1-5-32-544", b));
+    JB_CHECK(a < b && !(b < a) && !(a < a));
+}
+
+JB_TEST(hash_dedupe_matches_string_dedupe)
+{
+    // Every tenth SID repeats an earlier one, as duplicate registrations do.
+    auto values = make_app_containers(200000, 2);
+    for (size_t n = 10; n < values.size(); n += 10)
+        values[n] = values[n / 3];
+    std::unordered_set<sid> by_value(values.begin(), values.end());
+    std::unordered_set<std::wstring> by_text;
+    for (auto const & value : values)
+        by_text.insert(value.to_string());
+    JB_CHECK(by_value.size() == by_text.size());
+    JB_CHECK(by_value.size() == values.size() - values.size() / 10 + 1);
+    for (auto const & value : values)
+        JB_CHECK(by_value.count(value) == 1);
+
+    sid copy;
+    JB_CHECK(sid::parse(values[5].to_string(), copy));
+    JB_CHECK(copy == values[5] && copy.hash() == values[5].hash());
+    JB_CHECK(values[5] != values[6]);
+}
@@ -0,0 +1,166 @@
+﻿#include "test.hpp"
+
+#include "snapshot.hpp"
+
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace jb;
+
+namespace {
+
+sid make_sid(std::wstring const & text)
+{
+    sid result;
+    if (!sid::parse(text, result))
+        throw std::runtime_error("Invalid test SID");
+    return result;
+}
+
+sid app_container(uint32_t const n)
+{
+    return make_sid(L"S-1-15-2-" + std::to_wstring(n) + L"-1-2-3-4-5-6");
+}
+
+snapshot_app_container make_app_container(uint32_t const n)
+{
+    snapshot_app_container result;
+    result.app_container = app_container(n);
+    result.user = make_sid(L"S-1-5-21-1-2-3-1001");
+    result.name = L"package" + std::to_wstring(n) + L"_8wekyb3d8bbwe";
+    result.display_name = L"Package " + std::to_wstring(n);
+    result.capabilities = { { make_sid(L"S-1-15-3-1"), 4 }, { make_sid(L"S-1-15-3-3"), 4 } };
+    result.binaries = { L"C:\\Program Files\\WindowsApps\\" + result.name + L"\\app.exe" };
+    return result;
+}
+
+diagnostic_snapshot make_snapshot()
+{
+    diagnostic_snapshot result;
+    result.present =
+        diagnostic_snapshot::has_elevation_flags | diagnostic_snapshot::has_token_elevation_type | diagnostic_snapshot::has_firewall |
+        diagnostic_snapshot::has_app_containers | diagnostic_snapshot::has_config | diagnostic_snapshot::has_mappings;
+    result.created = 1700000000;
+    result.elevation_flags = 1;
+    result.token_elevation_type = 3;
+    result.firewall[1].inbound = NET_FW_ACTION_ALLOW;
+    // Out of order and with a repeat, which the writer sorts and drops.
+    for (auto const n : { 3u, 1u, 2u, 1u })
+        result.app_containers.push_back(make_app_container(n));
+    result.config = { { app_container(2), 1 } };
+    result.mappings = { { app_container(2), L"Package 2", L"", L"package2_8wekyb3d8bbwe" }, { app_container(1), L"Package 1", L"", L"package1_8wekyb3d8bbwe" } };
+    return result;
+}
+
+}
+
+JB_TEST(round_trip)
+{
+    auto const image = build_snapshot(make_snapshot());
+    snapshot_view view;
+    view.attach(image.data(), image.size());
+    JB_CHECK(view.present() == make_snapshot().present);
+    JB_CHECK(view.created() == 1700000000);
+    JB_CHECK(view.elevation_flags() == 1 && view.token_elevation_type() == 3);
+    JB_CHECK(view.firewall(0).inbound == NET_FW_ACTION_BLOCK);
+    JB_CHECK(view.firewall(1).inbound == NET_FW_ACTION_ALLOW);
+    JB_CHECK(view.firewall(2).outbound == NET_FW_ACTION_ALLOW);
+
+    JB_CHECK(view.app_container_count() == 3);
+    for (size_t n = 1; n < view.app_container_count(); ++n)
+        JB_CHECK(view.app_container_at(n - 1).app_container < view.app_container_at(n).app_container);
+    auto const found = view.find_app_container(app_container(2));
+    JB_CHECK(found < view.app_container_count());
+    auto const item = view.app_container_at(found);
+    JB_CHECK(item.name == L"package2_8wekyb3d8bbwe");
+    JB_CHECK(item.display_name == L"Package 2");
+    JB_CHECK(item.user == make_sid(L"S-1-5-21-1-2-3-1001"));
+    JB_CHECK(item.capability_count == 2 && view.capability(item.first_capability + 1).value == make_sid(L"S-1-15-3-3"));
+    JB_CHECK(item.binary_count == 1 && view.binary(item.first_binary) == L"C:\\Program Files\\WindowsApps\\package2_8wekyb3d8bbwe\\app.exe");
+    JB_CHECK(view.find_app_container(app_container(9)) == view.app_container_count());
+
+    JB_CHECK(view.config_count() == 1 && view.config(0).attributes == 1);
+    JB_CHECK(view.mapping_count() == 2);
+    JB_CHECK(view.mapping_at(0).app_container == app_container(1) && view.mapping_at(0).moniker == L"package1_8wekyb3d8bbwe");
+    // The SIDs and strings are interned.
+    JB_CHECK(view.sid_count() < 3 + 3 + 1 + 2 + 1 + 2);
+}
+
+JB_TEST(file_round_trip)
+{
+    auto const path = std::filesystem::temp_directory_path() / "NetFwTest.test.snapshot";
+    write_snapshot(path, make_snapshot());
+    {
+        snapshot_view view;
+        view.open(path);
+        JB_CHECK(view.app_container_count() == 3);
+        JB_CHECK(view.mapping_count() == 2);
+    }
+    std::filesystem::remove(path);
+
+    snapshot_view view;
+    JB_CHECK_THROWS(view.open(path));
+}
+
+JB_TEST(malformed_images_throw)
+{
+    auto image = build_snapshot(make_snapshot());
+    snapshot_view view;
+    for (auto const size : { size_t(0), size_t(4), size_t(64), image.size() / 2, image.size() - 1 })
+        JB_CHECK_THROWS(view.attach(image.data(), size));
+
+    auto bad_magic = image;
+    bad_magic[0] ^= 0xFF;
+    JB_CHECK_THROWS(view.attach(bad_magic.data(), bad_magic.size()));
+
+    auto bad_version = image;
+    bad_version[4] ^= 0xFF;
+    JB_CHECK_THROWS(view.attach(bad_version.data(), bad_version.size()));
+
+    view.attach(image.data(), image.size());
+    JB_CHECK(view.app_container_count() == 3);
+}
+
+JB_TEST(diff_of_equal_snapshots_is_empty)
+{
+    auto const image = build_snapshot(make_snapshot());
+    snapshot_view from, to;
+    from.attach(image.data(), image.size());
+    to.attach(image.data(), image.size());
+    std::wostringstream out;
+    JB_CHECK(diff_snapshots(from, to, out) == 0);
+    JB_CHECK(out.str().empty());
+}
+
+JB_TEST(diff_reports_each_change)
+{
+    auto before = make_snapshot();
+    auto after = make_snapshot();
+    after.token_elevation_type = 2;
+    after.firewall[2].outbound = NET_FW_ACTION_BLOCK;
+    after.app_containers.erase(after.app_containers.begin());
+    after.app_containers.push_back(make_app_container(4));
+    after.app_containers[0].capabilities[1].attributes = 0;
+    after.app_containers[0].binaries.push_back(L"C:\\extra.exe");
+    after.config.clear();
+    auto const from_image = build_snapshot(before);
+    auto const to_image = build_snapshot(after);
+    snapshot_view from, to;
+    from.attach(from_image.data(), from_image.size());
+    to.attach(to_image.data(), to_image.size());
+    std::wostringstream out;
+    auto const changes = diff_snapshots(from, to, out);
+    std::wstring const expected =
+        L"~ token_elevation_type: 3 -> 2\n"
+        L"~ firewall.public.outbound: allow -> block\n"
+        L"~ app_container S-1-15-2-1-1-2-3-4-5-6: capability S-1-15-3-3: 0x00000004 -> 0x00000000\n"
+        L"+ app_container S-1-15-2-1-1-2-3-4-5-6: binary C:\\extra.exe\n"
+        L"- app_container S-1-15-2-3-1-2-3-4-5-6: package3_8wekyb3d8bbwe\n"
+        L"+ app_container S-1-15-2-4-1-2-3-4-5-6: package4_8wekyb3d8bbwe\n"
+        L"- config S-1-15-2-2-1-2-3-4-5-6\n";
+    JB_CHECK(changes == 7);
+    JB_CHECK(out.str() == expected);
+}
@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+namespace jb {
+
+namespace test {
+
+// Minimal self-registering test cases for the portable parts. A failed check is reported and
+// counted, the case goes on; an exception fails the case and ends it.
+struct test_case final
+{
+    char const * name;
+    void (* run)();
+};
+
+inline std::vector<test_case> & test_cases()
+{
+    static std::vector<test_case> result;
+    return result;
+}
+
+inline size_t & failures()
+{
+    static size_t result = 0;
+    return result;
+}
+
+struct registrar final
+{
+    registrar(char const * const name, void (* const run)())
+    {
+        test_cases().push_back({ name, run });
+    }
+};
+
+inline void check(bool const passed, char const * const expression, char const * const file, int const line)
+{
+    if (passed)
+        return;
+    std::fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+    ++failures();
+}
+
+// Runs every case and returns the process exit code.
+inline int run_all()
+{
+    for (auto const & item : test_cases())
+    {
+        auto const before = failures();
+        try
+        {
+            item.run();
+        }
+        catch (std::exception const & e)
+        {
+            std::fprintf(stderr, "%s: exception: %s\n", item.name, e.what());
+            ++failures();
+        }
+        std::printf("%s: %s\n", item.name, failures() == before ? "passed" : "FAILED");
+    }
+    return failures() ? 1 : 0;
+}
+
+}
+
+}
+
+#define JB_TEST(name) \
+    static void name(); \
+    static ::jb::test::registrar const name##_registrar(#name, name); \
+    static void name()
+
+#define JB_CHECK(expression) ::jb::test::check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
+
+#define JB_CHECK_THROWS(expression) \
+    do \
+    { \
+        bool thrown = false; \
+        try { expression; } catch (std::exception const &) { thrown = true; } \
+        ::jb::test::check(thrown, #expression " throws", __FILE__, __LINE__); \
+    } \
+    while (false)
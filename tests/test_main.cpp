@@ -0,0 +1,6 @@
+﻿#include "test.hpp"
+
+int main()
+{
+    return jb::test::run_all();
+}
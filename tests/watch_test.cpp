@@ -0,0 +1,139 @@
+﻿#include "test.hpp"
+
+#include "change_source.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace jb;
+using std::chrono::milliseconds;
+
+namespace {
+
+// Replays a script of signals: each one comes delay after the previous one was returned and
+// carries the bits it changed, none for a signal like one below the ancestor of a missing key.
+// Closes when the script ends.
+class script_source final : public change_source
+{
+public:
+    struct signal final
+    {
+        milliseconds delay;
+        uint32_t bits;
+    };
+
+    explicit script_source(std::vector<signal> script) : script_(std::move(script)) {}
+
+    size_t signals() const noexcept { return next_; }
+
+private:
+    bool wait_once(milliseconds const timeout, uint32_t & changes) override
+    {
+        if (next_ == script_.size())
+            return false;
+        auto & item = script_[next_];
+        if (item.delay > timeout)
+        {
+            std::this_thread::sleep_for(timeout);
+            item.delay -= timeout;
+            return false;
+        }
+        std::this_thread::sleep_for(item.delay);
+        ++next_;
+        changes = item.bits;
+        return true;
+    }
+
+    std::vector<signal> script_;
+    size_t next_ = 0;
+};
+
+watch_options options(milliseconds const quiet, milliseconds const max_delay)
+{
+    watch_options result;
+    result.quiet = quiet;
+    result.max_delay = max_delay;
+    return result;
+}
+
+milliseconds since(std::chrono::steady_clock::time_point const start)
+{
+    return std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - start);
+}
+
+}
+
+JB_TEST(burst_within_quiet_is_coalesced)
+{
+    script_source source({ { milliseconds(0), 1 }, { milliseconds(5), 2 }, { milliseconds(5), 4 }, { milliseconds(200), 8 } });
+    auto const burst = options(milliseconds(50), milliseconds(1000));
+    JB_CHECK(wait_coalesced(source, change_source::infinite, burst) == 7);
+    JB_CHECK(wait_coalesced(source, change_source::infinite, burst) == 8);
+    JB_CHECK(wait_coalesced(source, change_source::infinite, burst) == 0);
+}
+
+JB_TEST(max_delay_ends_a_steady_burst)
+{
+    std::vector<script_source::signal> script(50, { milliseconds(10), 1 });
+    script.push_back({ milliseconds(10), 2 });
+    script_source source(std::move(script));
+    auto const start = std::chrono::steady_clock::now();
+    JB_CHECK(wait_coalesced(source, change_source::infinite, options(milliseconds(100), milliseconds(100))) == 1);
+    JB_CHECK(since(start) < milliseconds(400));
+    JB_CHECK(source.signals() < 50);
+}
+
+JB_TEST(timeout_without_signal_returns_zero)
+{
+    script_source source({ { milliseconds(500), 1 } });
+    auto const start = std::chrono::steady_clock::now();
+    JB_CHECK(wait_coalesced(source, milliseconds(30), options(milliseconds(50), milliseconds(1000))) == 0);
+    JB_CHECK(since(start) >= milliseconds(30));
+    JB_CHECK(since(start) < milliseconds(400));
+}
+
+JB_TEST(only_changed_parts_are_refreshed)
+{
+    std::vector<uint32_t> const parts = { diagnostic_snapshot::has_mappings, diagnostic_snapshot::has_config, diagnostic_snapshot::has_app_containers };
+    script_source source({ { milliseconds(0), 1 }, { milliseconds(150), 2 }, { milliseconds(5), 4 }, { milliseconds(150), 8 }, { milliseconds(150), 2 } });
+    diagnostic_snapshot model;
+    std::vector<uint32_t> refreshed;
+    std::wostringstream out;
+    auto const refreshes = watch_snapshot(source, parts, model, [&](diagnostic_snapshot &, uint32_t const stale)
+        {
+            refreshed.push_back(stale);
+        }, options(milliseconds(50), milliseconds(1000)), out);
+    JB_CHECK(refreshes == 3);
+    JB_CHECK((refreshed == std::vector<uint32_t>{ diagnostic_snapshot::has_mappings, diagnostic_snapshot::has_config | diagnostic_snapshot::has_app_containers, diagnostic_snapshot::has_config }));
+    JB_CHECK(out.str().find(L"Refresh: ") != std::wstring::npos);
+}
+
+// A signal from the ancestor of a key that is still missing changes no item: neither an infinite
+// wait nor the watch may take it for the source closing.
+JB_TEST(unreportable_signal_is_waited_past)
+{
+    script_source source({ { milliseconds(0), 0 }, { milliseconds(5), 0 }, { milliseconds(5), 2 } });
+    JB_CHECK(source.wait(change_source::infinite) == 2);
+    JB_CHECK(source.signals() == 3);
+
+    script_source timed({ { milliseconds(0), 0 }, { milliseconds(10), 0 }, { milliseconds(10), 0 }, { milliseconds(500), 1 } });
+    auto const start = std::chrono::steady_clock::now();
+    JB_CHECK(timed.wait(milliseconds(40)) == 0);
+    JB_CHECK(since(start) >= milliseconds(40));
+    JB_CHECK(timed.signals() == 3);
+
+    std::vector<uint32_t> const parts = { diagnostic_snapshot::has_mappings };
+    script_source watched({ { milliseconds(0), 0 }, { milliseconds(100), 0 }, { milliseconds(100), 1 } });
+    diagnostic_snapshot model;
+    std::wostringstream out;
+    size_t collects = 0;
+    JB_CHECK(watch_snapshot(watched, parts, model, [&](diagnostic_snapshot &, uint32_t)
+        {
+            ++collects;
+        }, options(milliseconds(20), milliseconds(1000)), out) == 1);
+    JB_CHECK(collects == 1);
+}